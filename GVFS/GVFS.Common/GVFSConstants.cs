@@ -87,6 +87,8 @@ namespace GVFS.Common
         {
             public const string Root = ".gvfs";
             public const string CorruptObjectsName = "CorruptObjects";
+            public const string ModifiedPathsSnapshotName = "ModifiedPathsSnapshot.dat";
+            public const string HookTimingsName = "HookTimings.dat";
 
             public static readonly string LogPath = Path.Combine(DotGVFS.Root, "logs");
             public static readonly string CorruptObjectsPath = Path.Combine(DotGVFS.Root, CorruptObjectsName);
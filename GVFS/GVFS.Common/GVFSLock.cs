@@ -276,6 +276,11 @@ namespace GVFS.Common
             private int numCommitsAndTrees;
             private long commitAndTreeDownloadTimeMs;
 
+            private int numCoalescedObjectDownloads;
+
+            private int numObjectBatches;
+            private long objectBatchDownloadTimeMs;
+
             private int numSizeQueries;
             private long sizeQueryTimeMs;
 
@@ -313,6 +318,21 @@ namespace GVFS.Common
                 }
             }
 
+            public void RecordCoalescedObjectDownload()
+            {
+                Interlocked.Increment(ref this.numCoalescedObjectDownloads);
+            }
+
+            // Objects downloaded by one batched request share its download time, which is recorded once
+            // for the batch rather than added to the blob or commit and tree download times
+            public void RecordObjectBatchDownload(int blobCount, int commitAndTreeCount, long downloadTimeMs)
+            {
+                Interlocked.Add(ref this.numBlobs, blobCount);
+                Interlocked.Add(ref this.numCommitsAndTrees, commitAndTreeCount);
+                Interlocked.Increment(ref this.numObjectBatches);
+                Interlocked.Add(ref this.objectBatchDownloadTimeMs, downloadTimeMs);
+            }
+
             public void RecordSizeQuery(long queryTimeMs)
             {
                 Interlocked.Increment(ref this.numSizeQueries);
@@ -332,6 +352,11 @@ namespace GVFS.Common
                 metadata.Add("CommitsAndTreesDownloaded", this.numCommitsAndTrees);
                 metadata.Add("CommitsAndTreesDownloadTimeMS", this.commitAndTreeDownloadTimeMs);
 
+                metadata.Add("CoalescedObjectDownloads", this.numCoalescedObjectDownloads);
+
+                metadata.Add("ObjectBatchesDownloaded", this.numObjectBatches);
+                metadata.Add("ObjectBatchDownloadTimeMS", this.objectBatchDownloadTimeMs);
+
                 metadata.Add("SizeQueries", this.numSizeQueries);
                 metadata.Add("SizeQueryTimeMS", this.sizeQueryTimeMs);
             }
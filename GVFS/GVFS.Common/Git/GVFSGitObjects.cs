@@ -1,11 +1,14 @@
 ﻿using GVFS.Common.Http;
+using GVFS.Common.NetworkStreams;
 using GVFS.Common.Tracing;
 using System;
 using System.Collections.Concurrent;
 using System.Collections.Generic;
 using System.IO;
+using System.Linq;
 using System.Net;
 using System.Threading;
+using System.Threading.Tasks;
 
 namespace GVFS.Common.Git
 {
@@ -14,12 +17,19 @@ namespace GVFS.Common.Git
         private static readonly TimeSpan NegativeCacheTTL = TimeSpan.FromSeconds(30);
 
         private ConcurrentDictionary<string, DateTime> objectNegativeCache;
-        
+
+        // Downloads started by TryDownloadAndSaveObject(s) that have not completed yet, keyed by
+        // GetInFlightDownloadKey. Requests for an object that is already being downloaded wait for that
+        // download rather than starting their own (e.g. when many git processes ask for the same object at once).
+        private ConcurrentDictionary<string, Lazy<DownloadAndSaveObjectResult>> inFlightDownloads;
+        private long coalescedDownloadCount;
+
         public GVFSGitObjects(GVFSContext context, GitObjectsHttpRequestor objectRequestor)
             : base(context.Tracer, context.Enlistment, objectRequestor, context.FileSystem)
         {
             this.Context = context;
             this.objectNegativeCache = new ConcurrentDictionary<string, DateTime>(StringComparer.OrdinalIgnoreCase);
+            this.inFlightDownloads = new ConcurrentDictionary<string, Lazy<DownloadAndSaveObjectResult>>(StringComparer.OrdinalIgnoreCase);
         }
 
         public enum RequestSource
@@ -30,6 +40,15 @@ namespace GVFS.Common.Git
             NamedPipeMessage,
         }
 
+        /// <summary>
+        /// The number of TryDownloadAndSaveObject calls that waited for a download that was already
+        /// in progress instead of downloading the object themselves.
+        /// </summary>
+        public long CoalescedDownloadCount
+        {
+            get { return Interlocked.Read(ref this.coalescedDownloadCount); }
+        }
+
         protected GVFSContext Context { get; private set; }
 
         public virtual bool TryCopyBlobContentStream(
@@ -91,7 +110,150 @@ namespace GVFS.Common.Git
 
         public DownloadAndSaveObjectResult TryDownloadAndSaveObject(string objectId, RequestSource requestSource)
         {
-            return this.TryDownloadAndSaveObject(objectId, CancellationToken.None, requestSource, retryOnFailure: true);
+            bool coalesced;
+            return this.TryDownloadAndSaveObject(objectId, requestSource, out coalesced);
+        }
+
+        /// <param name="coalesced">
+        /// true if objectId was already being downloaded and this call waited for (and returned the result of)
+        /// that download instead of downloading the object again
+        /// </param>
+        public DownloadAndSaveObjectResult TryDownloadAndSaveObject(string objectId, RequestSource requestSource, out bool coalesced)
+        {
+            Lazy<DownloadAndSaveObjectResult> newDownload = new Lazy<DownloadAndSaveObjectResult>(
+                () => this.TryDownloadAndSaveObject(objectId, CancellationToken.None, requestSource, retryOnFailure: true));
+
+            string key = GetInFlightDownloadKey(objectId, requestSource);
+            Lazy<DownloadAndSaveObjectResult> download = this.inFlightDownloads.GetOrAdd(key, newDownload);
+            if (download != newDownload)
+            {
+                coalesced = true;
+                Interlocked.Increment(ref this.coalescedDownloadCount);
+                return download.Value;
+            }
+
+            coalesced = false;
+            try
+            {
+                return download.Value;
+            }
+            finally
+            {
+                Lazy<DownloadAndSaveObjectResult> unused;
+                this.inFlightDownloads.TryRemove(key, out unused);
+            }
+        }
+
+        public DownloadAndSaveObjectResult[] TryDownloadAndSaveObjects(IReadOnlyList<string> objectIds, RequestSource requestSource)
+        {
+            bool[] coalesced;
+            return this.TryDownloadAndSaveObjects(objectIds, requestSource, out coalesced);
+        }
+
+        /// <summary>
+        /// Download and save multiple objects using a single batched objects request.
+        /// </summary>
+        /// <remarks>
+        /// When the server rejects the batched request because objects in it are missing, the objects that
+        /// were not saved are requested again in smaller batches, down to individual requests, so that
+        /// missing objects are reported (and negatively cached) the same as in TryDownloadAndSaveObject.
+        /// Objects that are already being downloaded are not requested again, their results are those of
+        /// the downloads in progress.
+        /// </remarks>
+        /// <param name="coalesced">
+        /// For each object, true if it was already being downloaded and this call waited for (and returned the
+        /// result of) that download instead of downloading the object again
+        /// </param>
+        /// <returns>The result for each object, in the same order as objectIds</returns>
+        public DownloadAndSaveObjectResult[] TryDownloadAndSaveObjects(IReadOnlyList<string> objectIds, RequestSource requestSource, out bool[] coalesced)
+        {
+            DownloadAndSaveObjectResult[] results = new DownloadAndSaveObjectResult[objectIds.Count];
+            coalesced = new bool[objectIds.Count];
+            if (objectIds.Count == 1)
+            {
+                results[0] = this.TryDownloadAndSaveObject(objectIds[0], requestSource, out coalesced[0]);
+                return results;
+            }
+
+            // Objects this batch downloads are registered as in flight so that single object requests (and other
+            // batches) wait for them, and objects that are already in flight are waited for instead
+            Dictionary<string, TaskCompletionSource<DownloadAndSaveObjectResult>> ownedDownloads =
+                new Dictionary<string, TaskCompletionSource<DownloadAndSaveObjectResult>>(StringComparer.OrdinalIgnoreCase);
+            Dictionary<string, Lazy<DownloadAndSaveObjectResult>> joinedDownloads =
+                new Dictionary<string, Lazy<DownloadAndSaveObjectResult>>(StringComparer.OrdinalIgnoreCase);
+            Dictionary<string, DownloadAndSaveObjectResult> objectResults =
+                new Dictionary<string, DownloadAndSaveObjectResult>(StringComparer.OrdinalIgnoreCase);
+
+            try
+            {
+                for (int i = 0; i < objectIds.Count; ++i)
+                {
+                    string objectId = objectIds[i];
+                    if (objectId == GVFSConstants.AllZeroSha ||
+                        objectResults.ContainsKey(objectId) ||
+                        ownedDownloads.ContainsKey(objectId) ||
+                        joinedDownloads.ContainsKey(objectId))
+                    {
+                        continue;
+                    }
+
+                    if (this.IsInNegativeCache(objectId))
+                    {
+                        objectResults[objectId] = DownloadAndSaveObjectResult.ObjectNotOnServer;
+                        continue;
+                    }
+
+                    TaskCompletionSource<DownloadAndSaveObjectResult> completion = new TaskCompletionSource<DownloadAndSaveObjectResult>();
+                    Lazy<DownloadAndSaveObjectResult> newDownload = new Lazy<DownloadAndSaveObjectResult>(() => completion.Task.Result);
+                    Lazy<DownloadAndSaveObjectResult> download = this.inFlightDownloads.GetOrAdd(GetInFlightDownloadKey(objectId, requestSource), newDownload);
+                    if (download == newDownload)
+                    {
+                        ownedDownloads.Add(objectId, completion);
+                    }
+                    else
+                    {
+                        joinedDownloads.Add(objectId, download);
+                    }
+                }
+
+                if (ownedDownloads.Count > 0)
+                {
+                    this.DownloadAndSaveObjectBatch(ownedDownloads.Keys.ToList(), requestSource, objectResults);
+                }
+            }
+            finally
+            {
+                // Complete this batch's downloads before waiting for anyone else's, so that batches waiting on each
+                // other's objects cannot deadlock
+                foreach (KeyValuePair<string, TaskCompletionSource<DownloadAndSaveObjectResult>> ownedDownload in ownedDownloads)
+                {
+                    DownloadAndSaveObjectResult result;
+                    if (!objectResults.TryGetValue(ownedDownload.Key, out result))
+                    {
+                        result = DownloadAndSaveObjectResult.Error;
+                    }
+
+                    ownedDownload.Value.TrySetResult(result);
+
+                    Lazy<DownloadAndSaveObjectResult> unused;
+                    this.inFlightDownloads.TryRemove(GetInFlightDownloadKey(ownedDownload.Key, requestSource), out unused);
+                }
+            }
+
+            foreach (KeyValuePair<string, Lazy<DownloadAndSaveObjectResult>> joinedDownload in joinedDownloads)
+            {
+                Interlocked.Increment(ref this.coalescedDownloadCount);
+                objectResults[joinedDownload.Key] = joinedDownload.Value.Value;
+            }
+
+            for (int i = 0; i < objectIds.Count; ++i)
+            {
+                DownloadAndSaveObjectResult result;
+                results[i] = objectResults.TryGetValue(objectIds[i], out result) ? result : DownloadAndSaveObjectResult.Error;
+                coalesced[i] = joinedDownloads.ContainsKey(objectIds[i]);
+            }
+
+            return results;
         }
 
         public bool TryGetBlobSizeLocally(string sha, out long length)
@@ -104,6 +266,15 @@ namespace GVFS.Common.Git
             return this.GitObjectRequestor.QueryForFileSizes(objectIds, cancellationToken);
         }
 
+        /// <summary>
+        /// Named pipe requests overwrite any copy of the object already on disk (git only asks for objects it
+        /// could not read), and so they only wait for downloads that do the same.
+        /// </summary>
+        private static string GetInFlightDownloadKey(string objectId, RequestSource requestSource)
+        {
+            return requestSource == RequestSource.NamedPipeMessage ? objectId + ":" + RequestSource.NamedPipeMessage : objectId;
+        }
+
         private DownloadAndSaveObjectResult TryDownloadAndSaveObject(
             string objectId, 
             CancellationToken cancellationToken, 
@@ -115,15 +286,9 @@ namespace GVFS.Common.Git
                 return DownloadAndSaveObjectResult.Error;
             }
 
-            DateTime negativeCacheRequestTime;
-            if (this.objectNegativeCache.TryGetValue(objectId, out negativeCacheRequestTime))
+            if (this.IsInNegativeCache(objectId))
             {
-                if (negativeCacheRequestTime > DateTime.Now.Subtract(NegativeCacheTTL))
-                {
-                    return DownloadAndSaveObjectResult.ObjectNotOnServer;
-                }
-
-                this.objectNegativeCache.TryRemove(objectId, out negativeCacheRequestTime);
+                return DownloadAndSaveObjectResult.ObjectNotOnServer;
             }
 
             // To reduce allocations, reuse the same buffer when writing objects in this batch
@@ -163,5 +328,163 @@ namespace GVFS.Common.Git
 
             return DownloadAndSaveObjectResult.Error;
         }
+
+        private void DownloadAndSaveObjectBatch(
+            List<string> objectIds,
+            RequestSource requestSource,
+            Dictionary<string, DownloadAndSaveObjectResult> objectResults)
+        {
+            if (objectIds.Count == 1)
+            {
+                objectResults[objectIds[0]] = this.TryDownloadAndSaveObject(objectIds[0], CancellationToken.None, requestSource, retryOnFailure: true);
+                return;
+            }
+
+            HashSet<string> objectsToDownload = new HashSet<string>(objectIds, StringComparer.OrdinalIgnoreCase);
+            HashSet<string> savedObjects = new HashSet<string>(StringComparer.OrdinalIgnoreCase);
+
+            // To reduce allocations, reuse the same buffer when writing objects in this batch
+            byte[] bufToCopyWith = new byte[StreamUtil.DefaultCopyBufferSize];
+
+            RetryWrapper<GitObjectsHttpRequestor.GitObjectTaskResult>.InvocationResult output = this.GitObjectRequestor.TryDownloadObjects(
+                objectsToDownload,
+                onSuccess: (tryCount, response) => this.TrySaveBatchedObjects(objectsToDownload, savedObjects, requestSource, response, bufToCopyWith),
+                onFailure: errorArgs =>
+                {
+                    // Missing objects are expected (see TryDownloadLooseObject) and are handled below
+                    GitObjectsHttpException ex = errorArgs.Error as GitObjectsHttpException;
+                    if (ex != null && ex.StatusCode == HttpStatusCode.NotFound)
+                    {
+                        return;
+                    }
+
+                    EventMetadata metadata = new EventMetadata();
+                    metadata.Add("Operation", nameof(this.TryDownloadAndSaveObjects));
+                    metadata.Add("ObjectCount", objectsToDownload.Count);
+                    metadata.Add("AttemptNumber", errorArgs.TryCount);
+                    metadata.Add("WillRetry", errorArgs.WillRetry);
+                    if (errorArgs.Error != null)
+                    {
+                        metadata.Add("Exception", errorArgs.Error.ToString());
+                    }
+
+                    this.Tracer.RelatedWarning(metadata, "TryDownloadAndSaveObjects: Batched objects request failed", Keywords.Network | Keywords.Telemetry);
+                },
+                preferBatchedLooseObjects: true);
+
+            List<string> unsavedObjects = new List<string>();
+            foreach (string objectId in objectIds)
+            {
+                if (savedObjects.Contains(objectId))
+                {
+                    objectResults[objectId] = DownloadAndSaveObjectResult.Success;
+                }
+                else
+                {
+                    unsavedObjects.Add(objectId);
+                }
+            }
+
+            if (unsavedObjects.Count == 0)
+            {
+                return;
+            }
+
+            if (output.Succeeded)
+            {
+                // The server left these objects out of its response, download each by itself to get its individual result
+                foreach (string objectId in unsavedObjects)
+                {
+                    objectResults[objectId] = this.TryDownloadAndSaveObject(objectId, CancellationToken.None, requestSource, retryOnFailure: true);
+                }
+            }
+            else if (output.Result != null && output.Result.HttpStatusCodeResult == HttpStatusCode.NotFound)
+            {
+                // The batched request fails as a whole when any single object is missing from the server. Split the
+                // remaining objects in half rather than requesting each by itself, so that a few missing objects cost
+                // a few requests per missing object instead of one request per object in the batch.
+                int half = unsavedObjects.Count / 2;
+                this.DownloadAndSaveObjectBatch(unsavedObjects.GetRange(0, half), requestSource, objectResults);
+                this.DownloadAndSaveObjectBatch(unsavedObjects.GetRange(half, unsavedObjects.Count - half), requestSource, objectResults);
+            }
+            else
+            {
+                // The request was already retried, smaller requests to a server that cannot be reached (or that
+                // is failing) would fail the same way
+                foreach (string objectId in unsavedObjects)
+                {
+                    objectResults[objectId] = DownloadAndSaveObjectResult.Error;
+                }
+            }
+        }
+
+        private bool IsInNegativeCache(string objectId)
+        {
+            DateTime negativeCacheRequestTime;
+            if (this.objectNegativeCache.TryGetValue(objectId, out negativeCacheRequestTime))
+            {
+                if (negativeCacheRequestTime > DateTime.Now.Subtract(NegativeCacheTTL))
+                {
+                    return true;
+                }
+
+                this.objectNegativeCache.TryRemove(objectId, out negativeCacheRequestTime);
+            }
+
+            return false;
+        }
+
+        private RetryWrapper<GitObjectsHttpRequestor.GitObjectTaskResult>.CallbackResult TrySaveBatchedObjects(
+            HashSet<string> requestedObjects,
+            HashSet<string> savedObjects,
+            RequestSource requestSource,
+            GitEndPointResponseData response,
+            byte[] bufToCopyWith)
+        {
+            // If the request is from git.exe (i.e. NamedPipeMessage) then we should assume that if there is an
+            // object on disk it's corrupt somehow (which is why git is asking for it)
+            bool overwriteExistingObject = requestSource == RequestSource.NamedPipeMessage;
+
+            if (response.ContentType == GitObjectContentType.BatchedLooseObjects)
+            {
+                BatchedLooseObjectDeserializer deserializer = new BatchedLooseObjectDeserializer(
+                    response.Stream,
+                    (stream, sha) =>
+                    {
+                        this.WriteLooseObject(stream, sha, overwriteExistingObject, bufToCopyWith);
+                        savedObjects.Add(sha);
+                    });
+                deserializer.ProcessObjects();
+            }
+            else if (response.ContentType == GitObjectContentType.LooseObject)
+            {
+                if (requestedObjects.Count != 1)
+                {
+                    return new RetryWrapper<GitObjectsHttpRequestor.GitObjectTaskResult>.CallbackResult(new InvalidOperationException("Received loose object when multiple objects were requested."), shouldRetry: false);
+                }
+
+                string sha = requestedObjects.First();
+                this.WriteLooseObject(response.Stream, sha, overwriteExistingObject, bufToCopyWith);
+                savedObjects.Add(sha);
+            }
+            else
+            {
+                GitProcess.Result result = this.TryAddPackFile(response.Stream, unpackObjects: false);
+                if (result.HasErrors)
+                {
+                    return new RetryWrapper<GitObjectsHttpRequestor.GitObjectTaskResult>.CallbackResult(new InvalidOperationException("Could not add pack file: " + result.Errors), shouldRetry: false);
+                }
+
+                foreach (string sha in requestedObjects)
+                {
+                    if (this.Context.Repository.ObjectExists(sha))
+                    {
+                        savedObjects.Add(sha);
+                    }
+                }
+            }
+
+            return new RetryWrapper<GitObjectsHttpRequestor.GitObjectTaskResult>.CallbackResult(new GitObjectsHttpRequestor.GitObjectTaskResult(true));
+        }
     }
 }
\ No newline at end of file
@@ -455,6 +455,25 @@ namespace GVFS.Common.Git
             return !this.GitObjectRequestor.CacheServer.IsNone(this.Enlistment.RepoUrl);
         }
 
+        protected GitProcess.Result TryAddPackFile(Stream contents, bool unpackObjects)
+        {
+            GitProcess.Result result;
+
+            this.fileSystem.CreateDirectory(this.Enlistment.GitPackRoot);
+
+            if (unpackObjects)
+            {
+                result = new GitProcess(this.Enlistment).UnpackObjects(contents);
+            }
+            else
+            {
+                string tempPackPath = this.WriteTempPackFile(contents);
+                return this.IndexTempPackFile(tempPackPath);
+            }
+
+            return result;
+        }
+
         private static string GetRandomPackName(string packRoot)
         {
             string packName = "pack-" + Guid.NewGuid().ToString("N") + ".pack";
@@ -934,25 +953,6 @@ namespace GVFS.Common.Git
             return new RetryWrapper<GitObjectsHttpRequestor.GitObjectTaskResult>.CallbackResult(new GitObjectsHttpRequestor.GitObjectTaskResult(true));
         }
 
-        private GitProcess.Result TryAddPackFile(Stream contents, bool unpackObjects)
-        {
-            GitProcess.Result result;
-
-            this.fileSystem.CreateDirectory(this.Enlistment.GitPackRoot);
-
-            if (unpackObjects)
-            {
-                result = new GitProcess(this.Enlistment).UnpackObjects(contents);
-            }
-            else
-            {
-                string tempPackPath = this.WriteTempPackFile(contents);
-                return this.IndexTempPackFile(tempPackPath);
-            }
-
-            return result;
-        }
-
         private struct LooseObjectToWrite
         {
             public readonly string TempFile;
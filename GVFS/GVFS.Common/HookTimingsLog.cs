@@ -0,0 +1,226 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.IO.MemoryMappedFiles;
+using System.Linq;
+using System.Text;
+using System.Threading;
+
+namespace GVFS.Common
+{
+    /// <summary>
+    /// Reads the hook timings log that GitHooksLoader keeps in the .gvfs folder, a fixed size ring with an
+    /// entry for each of its most recent runs
+    /// </summary>
+    /// <remarks>
+    /// See GitHooksLoader\hooktimings.h for the file format.  GitHooksLoader might be adding entries while the
+    /// log is read, entries that are incomplete or that change while they are read are skipped.
+    /// </remarks>
+    public static class HookTimingsLog
+    {
+        public const uint FormatVersion = 1;
+        public const int HeaderSize = 64;
+        public const int EntrySize = 96;
+        public const int NameSize = 32;
+
+        public const int VersionOffset = 4;
+        public const int CapacityOffset = 8;
+        public const int EntrySizeOffset = 12;
+        public const int EntryCountOffset = 16;
+
+        public const int SequenceOffset = 0;
+        public const int StartTimeOffset = 8;
+        public const int DurationOffset = 16;
+        public const int ExitCodeOffset = 24;
+        public const int FlagsOffset = 28;
+        public const int HookNameOffset = 32;
+        public const int VerbOffset = HookNameOffset + NameSize;
+
+        public const uint InProcessFlag = 0x1;
+
+        public static readonly byte[] Magic = Encoding.ASCII.GetBytes("GVHT");
+
+        public static bool TryReadEntries(string path, out List<Entry> entries, out string error)
+        {
+            entries = null;
+            try
+            {
+                using (FileStream stream = new FileStream(path, FileMode.Open, FileAccess.Read, FileShare.ReadWrite | FileShare.Delete))
+                {
+                    if (stream.Length < HeaderSize)
+                    {
+                        error = "The hook timings log is truncated";
+                        return false;
+                    }
+
+                    using (MemoryMappedFile file = MemoryMappedFile.CreateFromFile(stream, null, 0, MemoryMappedFileAccess.Read, HandleInheritability.None, leaveOpen: true))
+                    using (MemoryMappedViewAccessor accessor = file.CreateViewAccessor(0, stream.Length, MemoryMappedFileAccess.Read))
+                    {
+                        return TryReadEntries(accessor, out entries, out error);
+                    }
+                }
+            }
+            catch (Exception e) when (e is IOException || e is UnauthorizedAccessException)
+            {
+                error = e.Message;
+                return false;
+            }
+        }
+
+        /// <summary>
+        /// Reads the complete entries of the log in accessor, in the order they were written
+        /// </summary>
+        public static bool TryReadEntries(UnmanagedMemoryAccessor accessor, out List<Entry> entries, out string error)
+        {
+            entries = null;
+
+            byte[] magic = new byte[Magic.Length];
+            accessor.ReadArray(0, magic, 0, magic.Length);
+            if (!magic.SequenceEqual(Magic))
+            {
+                error = "The hook timings log has not been written yet or is not a hook timings log";
+                return false;
+            }
+
+            uint version = accessor.ReadUInt32(VersionOffset);
+            if (version != FormatVersion)
+            {
+                error = $"Unsupported hook timings log version {version}, expected {FormatVersion}";
+                return false;
+            }
+
+            uint capacity = accessor.ReadUInt32(CapacityOffset);
+            uint entrySize = accessor.ReadUInt32(EntrySizeOffset);
+            if (entrySize != EntrySize || HeaderSize + ((long)capacity * EntrySize) > accessor.Capacity)
+            {
+                error = $"Invalid hook timings log header (capacity: {capacity}, entry size: {entrySize})";
+                return false;
+            }
+
+            entries = new List<Entry>();
+            byte[] hookName = new byte[NameSize];
+            byte[] verb = new byte[NameSize];
+            for (uint slot = 0; slot < capacity; ++slot)
+            {
+                long offset = HeaderSize + ((long)slot * EntrySize);
+                ulong sequence = accessor.ReadUInt64(offset + SequenceOffset);
+                if (sequence == 0 || (sequence - 1) % capacity != slot)
+                {
+                    continue;
+                }
+
+                Thread.MemoryBarrier();
+                long startTime = accessor.ReadInt64(offset + StartTimeOffset);
+                long duration = accessor.ReadInt64(offset + DurationOffset);
+                int exitCode = accessor.ReadInt32(offset + ExitCodeOffset);
+                uint flags = accessor.ReadUInt32(offset + FlagsOffset);
+                accessor.ReadArray(offset + HookNameOffset, hookName, 0, NameSize);
+                accessor.ReadArray(offset + VerbOffset, verb, 0, NameSize);
+                Thread.MemoryBarrier();
+
+                if (accessor.ReadUInt64(offset + SequenceOffset) != sequence)
+                {
+                    continue;
+                }
+
+                entries.Add(new Entry(
+                    sequence,
+                    DateTimeOffset.FromUnixTimeMilliseconds(startTime / 1000).AddTicks((startTime % 1000) * 10),
+                    TimeSpan.FromTicks(duration * 10),
+                    exitCode,
+                    ReadName(hookName),
+                    ReadName(verb),
+                    (flags & InProcessFlag) != 0));
+            }
+
+            entries.Sort((left, right) => left.Sequence.CompareTo(right.Sequence));
+            error = null;
+            return true;
+        }
+
+        /// <summary>
+        /// Returns the 50th, 95th and 99th percentile durations of the entries for each verb and hook, ordered by verb
+        /// </summary>
+        public static List<LatencySummary> SummarizeByVerb(IEnumerable<Entry> entries)
+        {
+            return entries
+                .GroupBy(entry => new { entry.Verb, entry.HookName })
+                .OrderBy(group => group.Key.Verb, StringComparer.Ordinal)
+                .ThenBy(group => group.Key.HookName, StringComparer.Ordinal)
+                .Select(
+                    group =>
+                    {
+                        List<TimeSpan> durations = group.Select(entry => entry.Duration).OrderBy(duration => duration).ToList();
+                        return new LatencySummary(
+                            group.Key.Verb,
+                            group.Key.HookName,
+                            durations.Count,
+                            Percentile(durations, 50),
+                            Percentile(durations, 95),
+                            Percentile(durations, 99));
+                    })
+                .ToList();
+        }
+
+        /// <summary>
+        /// Nearest-rank percentile of sortedDurations
+        /// </summary>
+        public static TimeSpan Percentile(List<TimeSpan> sortedDurations, int percentile)
+        {
+            int rank = (int)Math.Ceiling(percentile / 100.0 * sortedDurations.Count);
+            return sortedDurations[Math.Max(rank, 1) - 1];
+        }
+
+        private static string ReadName(byte[] name)
+        {
+            int length = Array.IndexOf(name, (byte)0);
+            return Encoding.UTF8.GetString(name, 0, length < 0 ? name.Length : length);
+        }
+
+        public class Entry
+        {
+            public Entry(ulong sequence, DateTimeOffset startTime, TimeSpan duration, int exitCode, string hookName, string verb, bool ranInProcess)
+            {
+                this.Sequence = sequence;
+                this.StartTime = startTime;
+                this.Duration = duration;
+                this.ExitCode = exitCode;
+                this.HookName = hookName;
+                this.Verb = verb;
+                this.RanInProcess = ranInProcess;
+            }
+
+            public ulong Sequence { get; }
+            public DateTimeOffset StartTime { get; }
+            public TimeSpan Duration { get; }
+            public int ExitCode { get; }
+            public string HookName { get; }
+            public string Verb { get; }
+
+            /// <summary>
+            /// GitHooksLoader did the work of GVFS.Hooks itself rather than starting it
+            /// </summary>
+            public bool RanInProcess { get; }
+        }
+
+        public class LatencySummary
+        {
+            public LatencySummary(string verb, string hookName, int count, TimeSpan p50, TimeSpan p95, TimeSpan p99)
+            {
+                this.Verb = verb;
+                this.HookName = hookName;
+                this.Count = count;
+                this.P50 = p50;
+                this.P95 = p95;
+                this.P99 = p99;
+            }
+
+            public string Verb { get; }
+            public string HookName { get; }
+            public int Count { get; }
+            public TimeSpan P50 { get; }
+            public TimeSpan P95 { get; }
+            public TimeSpan P99 { get; }
+        }
+    }
+}
@@ -1,6 +1,7 @@
 ﻿using System;
 using System.Collections.Generic;
 using System.IO;
+using System.Threading;
 using GVFS.Common.FileSystem;
 using GVFS.Common.Tracing;
 
@@ -13,12 +14,26 @@ namespace GVFS.Common
     /// </summary>
     public class ModifiedPathsDatabase : FileBasedCollection
     {
+        private const char GenerationTokenSeparator = '.';
+
         private ConcurrentHashSet<string> modifiedPaths;
 
+        // Every entry in modifiedPaths, in the order that it was added.  An entry's index in the journal
+        // is the generation in which it was added, which lets clients that already have the list (e.g. the
+        // virtual file system hook) ask for only the entries that have been added since.  journalId
+        // identifies this journal in generation tokens, a new journal is built each time GVFS mounts.
+        private List<string> journal;
+        private string journalId;
+
+        private ModifiedPathsSnapshot snapshot;
+        private object snapshotUpdateLock = new object();
+
         protected ModifiedPathsDatabase(ITracer tracer, PhysicalFileSystem fileSystem, string dataFilePath) 
             : base(tracer, fileSystem, dataFilePath, collectionAppendsDirectlyToFile: true)
         {
             this.modifiedPaths = new ConcurrentHashSet<string>(StringComparer.OrdinalIgnoreCase);
+            this.journal = new List<string>();
+            this.journalId = Guid.NewGuid().ToString("N");
         }
 
         public int Count
@@ -26,6 +41,60 @@ namespace GVFS.Common
             get { return this.modifiedPaths.Count; }
         }
 
+        /// <summary>
+        /// Keeps snapshot up to date with the generation of this database, UpdateSnapshot writes the paths to it
+        /// </summary>
+        public void SetSnapshot(ModifiedPathsSnapshot snapshot)
+        {
+            lock (this.journal)
+            {
+                this.snapshot = snapshot;
+            }
+        }
+
+        /// <summary>
+        /// Writes the modified paths to the snapshot if it does not already have all of them
+        /// </summary>
+        public void UpdateSnapshot()
+        {
+            // There is no need for more than one update at a time, paths that are added while an update runs
+            // leave the snapshot stale and are picked up by the next update
+            if (!Monitor.TryEnter(this.snapshotUpdateLock))
+            {
+                return;
+            }
+
+            try
+            {
+                ModifiedPathsSnapshot snapshot;
+                string[] paths;
+                long generation;
+                lock (this.journal)
+                {
+                    snapshot = this.snapshot;
+                    if (snapshot == null || snapshot.Generation == this.journal.Count)
+                    {
+                        return;
+                    }
+
+                    paths = this.journal.ToArray();
+                    generation = this.journal.Count;
+                }
+
+                if (snapshot.TryWrite(paths, generation))
+                {
+                    lock (this.journal)
+                    {
+                        snapshot.TryPublish(generation, this.journal.Count);
+                    }
+                }
+            }
+            finally
+            {
+                Monitor.Exit(this.snapshotUpdateLock);
+            }
+        }
+
         public static bool TryLoadOrCreate(ITracer tracer, string dataDirectory, PhysicalFileSystem fileSystem, out ModifiedPathsDatabase output, out string error)
         {
             ModifiedPathsDatabase temp = new ModifiedPathsDatabase(tracer, fileSystem, dataDirectory);
@@ -33,7 +102,7 @@ namespace GVFS.Common
             if (!temp.TryLoadFromDisk<string, string>(
                 temp.TryParseAddLine,
                 temp.TryParseRemoveLine,
-                (key, value) => temp.modifiedPaths.Add(key),
+                (key, value) => temp.AddEntry(key),
                 out error))
             {
                 temp = null;
@@ -63,6 +132,47 @@ namespace GVFS.Common
             return this.modifiedPaths;
         }
 
+        /// <summary>
+        /// Gets all of the modified paths, along with a token that identifies the generation of the list
+        /// that was returned (for use with TryGetModifiedPathsAddedSince).
+        /// </summary>
+        public IReadOnlyList<string> GetAllModifiedPaths(out string generationToken)
+        {
+            lock (this.journal)
+            {
+                generationToken = this.CreateGenerationToken(this.journal.Count);
+                return this.journal.ToArray();
+            }
+        }
+
+        /// <summary>
+        /// Gets the paths that have been added since the generation identified by generationToken.
+        /// </summary>
+        /// <returns>
+        /// false if generationToken was not returned by this database (e.g. it was returned before GVFS was
+        /// last mounted), in which case the caller must start over with GetAllModifiedPaths
+        /// </returns>
+        public bool TryGetModifiedPathsAddedSince(string generationToken, out IReadOnlyList<string> addedPaths, out string currentGenerationToken)
+        {
+            int generation;
+            if (this.TryParseGenerationToken(generationToken, out generation))
+            {
+                lock (this.journal)
+                {
+                    if (generation <= this.journal.Count)
+                    {
+                        currentGenerationToken = this.CreateGenerationToken(this.journal.Count);
+                        addedPaths = this.journal.GetRange(generation, this.journal.Count - generation);
+                        return true;
+                    }
+                }
+            }
+
+            addedPaths = null;
+            currentGenerationToken = null;
+            return false;
+        }
+
         public bool TryAdd(string path, bool isFolder, out bool isRetryable)
         {
             isRetryable = true;
@@ -71,7 +181,7 @@ namespace GVFS.Common
             {
                 try
                 {
-                    this.WriteAddEntry(entry, () => this.modifiedPaths.Add(entry));
+                    this.WriteAddEntry(entry, () => this.AddEntry(entry));
                 }
                 catch (IOException e)
                 {
@@ -107,6 +217,39 @@ namespace GVFS.Common
             return true;
         }
 
+        private void AddEntry(string entry)
+        {
+            if (this.modifiedPaths.Add(entry))
+            {
+                lock (this.journal)
+                {
+                    this.journal.Add(entry);
+                    this.snapshot?.UpdateCurrentGeneration(this.journal.Count);
+                }
+            }
+        }
+
+        private string CreateGenerationToken(int generation)
+        {
+            return this.journalId + GenerationTokenSeparator + generation;
+        }
+
+        private bool TryParseGenerationToken(string generationToken, out int generation)
+        {
+            generation = 0;
+            if (string.IsNullOrEmpty(generationToken))
+            {
+                return false;
+            }
+
+            string[] parts = generationToken.Split(GenerationTokenSeparator);
+            return
+                parts.Length == 2 &&
+                parts[0] == this.journalId &&
+                int.TryParse(parts[1], out generation) &&
+                generation >= 0;
+        }
+
         private bool TryParseAddLine(string line, out string key, out string value, out string error)
         {
             key = line;
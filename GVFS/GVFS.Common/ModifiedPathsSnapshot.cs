@@ -0,0 +1,223 @@
+﻿using GVFS.Common.FileSystem;
+using GVFS.Common.Tracing;
+using System;
+using System.ComponentModel;
+using System.IO;
+using System.IO.MemoryMappedFiles;
+using System.Runtime.InteropServices;
+using System.Text;
+
+namespace GVFS.Common
+{
+    /// <summary>
+    /// A sorted copy of the modified paths that is kept in the .gvfs folder so that GVFS.VirtualFileSystemHook
+    /// can memory-map it rather than asking GVFS for the list over the pipe.
+    /// </summary>
+    /// <remarks>
+    /// File format (little-endian):
+    ///   "GVMP" (magic), uint32 format version
+    ///   int64 current generation of the modified paths database (updated in place each time a path is added)
+    ///   int64 generation of the database when the paths were written
+    ///   int64 length of the paths in bytes
+    ///   UTF8 paths, each terminated by a NUL, in ordinal order
+    ///
+    /// Readers must only use the paths when the two generations are equal, otherwise the snapshot is stale
+    /// and they should ask GVFS for the list instead.  A new snapshot is written to a temp file and renamed
+    /// over the old one, and the old one is marked as stale first, so readers never see a partial file.
+    ///
+    /// GVFS keeps the published snapshot open for as long as it is mounted, and readers must also check that
+    /// it still is (see PublishedSnapshotShare) so that a snapshot left behind by a crashed mount is not used.
+    /// </remarks>
+    public class ModifiedPathsSnapshot : IDisposable
+    {
+        public const uint FormatVersion = 1;
+
+        private const string EtwArea = nameof(ModifiedPathsSnapshot);
+        private const long StaleGeneration = -1;
+        private const int CurrentGenerationOffset = 8;
+        private const int PathsLengthOffset = 24;
+        private const int HeaderLength = 32;
+        private const int WriteBufferSize = 64 * 1024;
+
+        private static readonly byte[] Magic = Encoding.ASCII.GetBytes("GVMP");
+
+        // On Windows readers check for GVFS's write handle by opening the snapshot without sharing write access,
+        // elsewhere they check for the exclusive flock that .NET takes for FileShare.None
+        private static readonly FileShare PublishedSnapshotShare =
+            RuntimeInformation.IsOSPlatform(OSPlatform.Windows) ? FileShare.ReadWrite | FileShare.Delete : FileShare.None;
+
+        private readonly object snapshotLock = new object();
+        private readonly ITracer tracer;
+        private readonly PhysicalFileSystem fileSystem;
+        private readonly string snapshotPath;
+        private readonly string tempFilePath;
+
+        private MemoryMappedFile snapshotFile;
+        private MemoryMappedViewAccessor header;
+        private bool disposed;
+
+        public ModifiedPathsSnapshot(ITracer tracer, PhysicalFileSystem fileSystem, string snapshotPath)
+        {
+            this.tracer = tracer;
+            this.fileSystem = fileSystem;
+            this.snapshotPath = snapshotPath;
+            this.tempFilePath = snapshotPath + ".tmp";
+            this.Generation = StaleGeneration;
+
+            // A snapshot left behind by a previous mount might not match the modified paths database
+            this.fileSystem.TryDeleteFile(this.snapshotPath);
+        }
+
+        /// <summary>
+        /// The generation of the modified paths in the published snapshot, or -1 if there is no snapshot
+        /// </summary>
+        public long Generation { get; private set; }
+
+        /// <summary>
+        /// Writes paths to a temp file, to be published later by TryPublish.  paths is sorted in place.
+        /// </summary>
+        public bool TryWrite(string[] paths, long generation)
+        {
+            Array.Sort(paths, StringComparer.Ordinal);
+
+            try
+            {
+                using (Stream stream = this.fileSystem.OpenFileStream(this.tempFilePath, FileMode.Create, FileAccess.Write, FileShare.None, callFlushFileBuffers: false))
+                using (BinaryWriter writer = new BinaryWriter(new BufferedStream(stream, WriteBufferSize)))
+                {
+                    writer.Write(Magic);
+                    writer.Write(FormatVersion);
+                    writer.Write(StaleGeneration);
+                    writer.Write(generation);
+                    writer.Write(0L);
+
+                    byte[] pathBuffer = new byte[1024];
+                    long pathsLength = 0;
+                    foreach (string path in paths)
+                    {
+                        int maxByteCount = Encoding.UTF8.GetMaxByteCount(path.Length) + 1;
+                        if (maxByteCount > pathBuffer.Length)
+                        {
+                            pathBuffer = new byte[maxByteCount];
+                        }
+
+                        int byteCount = Encoding.UTF8.GetBytes(path, 0, path.Length, pathBuffer, 0);
+                        pathBuffer[byteCount] = 0;
+                        writer.Write(pathBuffer, 0, byteCount + 1);
+                        pathsLength += byteCount + 1;
+                    }
+
+                    writer.Seek(PathsLengthOffset, SeekOrigin.Begin);
+                    writer.Write(pathsLength);
+                }
+
+                return true;
+            }
+            catch (IOException e)
+            {
+                this.TraceWarning(e, nameof(this.TryWrite));
+                return false;
+            }
+            catch (UnauthorizedAccessException e)
+            {
+                this.TraceWarning(e, nameof(this.TryWrite));
+                return false;
+            }
+        }
+
+        /// <summary>
+        /// Replaces the published snapshot with the one written by TryWrite
+        /// </summary>
+        /// <param name="snapshotGeneration">The generation that was passed to TryWrite</param>
+        /// <param name="currentGeneration">The current generation of the modified paths database</param>
+        public bool TryPublish(long snapshotGeneration, long currentGeneration)
+        {
+            lock (this.snapshotLock)
+            {
+                if (this.disposed)
+                {
+                    return false;
+                }
+
+                this.CloseSnapshot();
+
+                try
+                {
+                    this.fileSystem.MoveAndOverwriteFile(this.tempFilePath, this.snapshotPath);
+
+                    FileStream stream = new FileStream(this.snapshotPath, FileMode.Open, FileAccess.ReadWrite, PublishedSnapshotShare);
+                    this.snapshotFile = MemoryMappedFile.CreateFromFile(stream, null, 0, MemoryMappedFileAccess.ReadWrite, HandleInheritability.None, leaveOpen: false);
+                    this.header = this.snapshotFile.CreateViewAccessor(0, HeaderLength);
+                    this.header.Write(CurrentGenerationOffset, currentGeneration);
+                    this.Generation = snapshotGeneration;
+                    return true;
+                }
+                catch (Exception e) when (e is IOException || e is UnauthorizedAccessException || e is Win32Exception)
+                {
+                    // e.g. on Windows the old snapshot cannot be replaced while the hook has it mapped (and the new one
+                    // cannot be opened while a hook is checking whether it is held), it was marked as stale by
+                    // CloseSnapshot and so the hook will ask GVFS for the list until the next try
+                    this.CloseSnapshot();
+                    this.TraceWarning(e, nameof(this.TryPublish));
+                    return false;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Records that the modified paths database has moved to generation, which makes the published
+        /// snapshot stale if it was taken at an earlier generation
+        /// </summary>
+        public void UpdateCurrentGeneration(long generation)
+        {
+            lock (this.snapshotLock)
+            {
+                this.header?.Write(CurrentGenerationOffset, generation);
+            }
+        }
+
+        public void Dispose()
+        {
+            lock (this.snapshotLock)
+            {
+                if (!this.disposed)
+                {
+                    this.disposed = true;
+                    this.CloseSnapshot();
+
+                    // The hook must not use the snapshot while GVFS is not mounted
+                    this.fileSystem.TryDeleteFile(this.snapshotPath);
+                }
+            }
+        }
+
+        private void CloseSnapshot()
+        {
+            if (this.header != null)
+            {
+                this.header.Write(CurrentGenerationOffset, StaleGeneration);
+                this.header.Dispose();
+                this.header = null;
+            }
+
+            if (this.snapshotFile != null)
+            {
+                this.snapshotFile.Dispose();
+                this.snapshotFile = null;
+            }
+
+            this.Generation = StaleGeneration;
+        }
+
+        private void TraceWarning(Exception e, string method)
+        {
+            if (this.tracer != null)
+            {
+                EventMetadata metadata = new EventMetadata();
+                metadata.Add("Area", EtwArea);
+                metadata.Add("Exception", e.ToString());
+                this.tracer.RelatedWarning(metadata, $"{method}: Failed to update modified paths snapshot");
+            }
+        }
+    }
+}
@@ -25,8 +25,18 @@ namespace GVFS.Common.NamedPipes
                     break;
 
                 case NamedPipeMessages.ModifiedPaths.ListRequest:
-                    string gitAttributes = GVFSConstants.SpecialGitFiles.GitAttributes + "\0";
-                    NamedPipeMessages.ModifiedPaths.Response listResponse = new NamedPipeMessages.ModifiedPaths.Response(NamedPipeMessages.ModifiedPaths.SuccessResult, gitAttributes);
+                    NamedPipeMessages.ModifiedPaths.Response listResponse;
+                    if (new NamedPipeMessages.ModifiedPaths.Request(message).Version == NamedPipeMessages.ModifiedPaths.FullListVersion)
+                    {
+                        string gitAttributes = GVFSConstants.SpecialGitFiles.GitAttributes + "\0";
+                        listResponse = new NamedPipeMessages.ModifiedPaths.Response(NamedPipeMessages.ModifiedPaths.SuccessResult, gitAttributes);
+                    }
+                    else
+                    {
+                        // Clients fall back to the full list (version 1) when incremental lists are not supported
+                        listResponse = new NamedPipeMessages.ModifiedPaths.Response(NamedPipeMessages.ModifiedPaths.InvalidVersion);
+                    }
+
                     connection.TrySendResponse(listResponse.CreateMessage());
                     break;
 
@@ -0,0 +1,111 @@
+﻿using System;
+using System.IO;
+using System.Text;
+
+namespace GVFS.Common.NamedPipes
+{
+    /// <summary>
+    /// Frames sent in both directions on a connection that has been switched to multiplexed
+    /// mode (see NamedPipeMessages.Multiplexing).
+    /// </summary>
+    /// <remarks>
+    /// Each frame is a 4 byte message length and a 4 byte request ID (both little-endian) followed
+    /// by the UTF-8 encoded message (e.g. "DLO|&lt;SHA&gt;", without a trailing newline).
+    /// Responses carry the ID of the request they answer and can be sent in any order.
+    /// </remarks>
+    public static class MultiplexedFrame
+    {
+        public const int HeaderLength = 8;
+        public const int MaxMessageLength = 64 * 1024 * 1024;
+
+        private static readonly Encoding MessageEncoding = new UTF8Encoding(encoderShouldEmitUTF8Identifier: false);
+
+        public static byte[] Create(uint requestId, string message)
+        {
+            int messageLength = MessageEncoding.GetByteCount(message);
+            if (messageLength > MaxMessageLength)
+            {
+                throw new ArgumentException($"Message length ({messageLength}) exceeds the max frame length ({MaxMessageLength})", nameof(message));
+            }
+
+            byte[] frame = new byte[HeaderLength + messageLength];
+            WriteUInt32(frame, 0, (uint)messageLength);
+            WriteUInt32(frame, 4, requestId);
+            MessageEncoding.GetBytes(message, 0, message.Length, frame, HeaderLength);
+            return frame;
+        }
+
+        /// <summary>
+        /// Reads the next frame from stream.
+        /// </summary>
+        /// <returns>false if the stream ended before the start of the next frame</returns>
+        /// <exception cref="IOException">The stream ended in the middle of a frame, or the frame is invalid</exception>
+        public static bool TryRead(Stream stream, out uint requestId, out string message)
+        {
+            requestId = 0;
+            message = null;
+
+            byte[] header = new byte[HeaderLength];
+            int headerBytesRead = ReadFully(stream, header, HeaderLength);
+            if (headerBytesRead == 0)
+            {
+                return false;
+            }
+
+            if (headerBytesRead != HeaderLength)
+            {
+                throw new IOException("Pipe closed in the middle of a frame header");
+            }
+
+            uint messageLength = ReadUInt32(header, 0);
+            if (messageLength > MaxMessageLength)
+            {
+                throw new IOException($"Invalid frame length: {messageLength}");
+            }
+
+            byte[] messageBytes = new byte[messageLength];
+            if (ReadFully(stream, messageBytes, (int)messageLength) != messageLength)
+            {
+                throw new IOException("Pipe closed in the middle of a frame");
+            }
+
+            requestId = ReadUInt32(header, 4);
+            message = MessageEncoding.GetString(messageBytes);
+            return true;
+        }
+
+        private static int ReadFully(Stream stream, byte[] buffer, int count)
+        {
+            int totalBytesRead = 0;
+            while (totalBytesRead < count)
+            {
+                int bytesRead = stream.Read(buffer, totalBytesRead, count - totalBytesRead);
+                if (bytesRead == 0)
+                {
+                    break;
+                }
+
+                totalBytesRead += bytesRead;
+            }
+
+            return totalBytesRead;
+        }
+
+        private static void WriteUInt32(byte[] buffer, int offset, uint value)
+        {
+            buffer[offset] = (byte)value;
+            buffer[offset + 1] = (byte)(value >> 8);
+            buffer[offset + 2] = (byte)(value >> 16);
+            buffer[offset + 3] = (byte)(value >> 24);
+        }
+
+        private static uint ReadUInt32(byte[] buffer, int offset)
+        {
+            return
+                buffer[offset] |
+                ((uint)buffer[offset + 1] << 8) |
+                ((uint)buffer[offset + 2] << 16) |
+                ((uint)buffer[offset + 3] << 24);
+        }
+    }
+}
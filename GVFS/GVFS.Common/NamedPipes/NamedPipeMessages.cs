@@ -65,20 +65,60 @@ namespace GVFS.Common.NamedPipes
             public const string MountFailed = "MountFailed";
         }
 
+        /// <summary>
+        /// Switches a connection to multiplexed mode (see MultiplexedFrame).
+        /// </summary>
+        /// <remarks>
+        /// The request is a regular line-based message, all messages after a SuccessResult
+        /// response are sent as frames.  The client must wait for the response before sending
+        /// its first frame.
+        /// </remarks>
+        public static class Multiplexing
+        {
+            public const string Request = "MUX";
+            public const string CurrentVersion = "1";
+            public const string SuccessResult = "S";
+            public const string InvalidVersion = "InvalidVersion";
+
+            // Sent in place of a response that does not fit in a frame
+            public const string ResponseTooLarge = "ResponseTooLarge";
+        }
+
         public static class ModifiedPaths
         {
             public const string ListRequest = "MPL";
             public const string InvalidVersion = "InvalidVersion";
             public const string SuccessResult = "S";
+            public const char PathTerminator = '\0';
+
+            public const string FullListVersion = "1";
+            public const string IncrementalListVersion = "2";
+
+            // Version 2 responses are "<result>|<generation token>|<paths>", where the result is FullListResult
+            // or AddedPathsResult (the paths added since the generation token in the request)
+            public const string FullListResult = "F";
+            public const string AddedPathsResult = "A";
 
             public class Request
             {
                 public Request(Message message)
                 {
+                    // Version 1: "<version>"
+                    // Version 2: "<version>" or "<version>|<generation token from a previous response>"
                     this.Version = message.Body;
+                    if (message.Body != null)
+                    {
+                        string[] parts = message.Body.Split(new[] { MessageSeparator }, count: 2);
+                        this.Version = parts[0];
+                        if (parts.Length > 1)
+                        {
+                            this.GenerationToken = parts[1];
+                        }
+                    }
                 }
 
                 public string Version { get; }
+                public string GenerationToken { get; }
             }
 
             public class Response
@@ -137,6 +177,65 @@ namespace GVFS.Common.NamedPipes
             }
         }
 
+        public static class DownloadObjects
+        {
+            public const string DownloadRequest = "DLOB";
+            public const string SuccessResult = "S";
+            public const char ObjectIdSeparator = ',';
+
+            // Per-object results, one character per requested SHA (in request order)
+            public const char ObjectDownloaded = 'S';
+            public const char ObjectDownloadFailed = 'F';
+
+            public class Request
+            {
+                public Request(IEnumerable<string> requestShas)
+                {
+                    this.RequestShas = new List<string>(requestShas);
+                }
+
+                public Request(Message message)
+                {
+                    this.RequestShas = string.IsNullOrEmpty(message.Body) ? new string[0] : message.Body.Split(ObjectIdSeparator);
+                }
+
+                public IReadOnlyList<string> RequestShas { get; }
+
+                public Message CreateMessage()
+                {
+                    return new Message(DownloadRequest, string.Join(ObjectIdSeparator.ToString(), this.RequestShas));
+                }
+            }
+
+            public class Response
+            {
+                public Response(string result, string objectResults = null)
+                {
+                    this.Result = result;
+                    this.ObjectResults = objectResults;
+                }
+
+                public Response(Message message)
+                {
+                    this.Result = message.Header;
+                    this.ObjectResults = message.Body;
+                }
+
+                public string Result { get; }
+
+                /// <summary>
+                /// One of ObjectDownloaded or ObjectDownloadFailed for each SHA in the request,
+                /// in the same order as the request.  Only set when Result is SuccessResult.
+                /// </summary>
+                public string ObjectResults { get; }
+
+                public Message CreateMessage()
+                {
+                    return new Message(this.Result, this.ObjectResults);
+                }
+            }
+        }
+
         public static class RunPostFetchJob
         {
             public const string PostFetchJob = "PostFetch";
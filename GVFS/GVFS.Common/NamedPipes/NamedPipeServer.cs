@@ -1,8 +1,12 @@
 ﻿using GVFS.Common.Tracing;
 using System;
+using System.Collections.Generic;
 using System.IO;
 using System.IO.Pipes;
+using System.Runtime.ExceptionServices;
+using System.Text;
 using System.Threading;
+using System.Threading.Tasks;
 
 namespace GVFS.Common.NamedPipes
 {
@@ -63,10 +67,71 @@ namespace GVFS.Common.NamedPipes
                     break;
                 }
 
+                NamedPipeMessages.Message message = NamedPipeMessages.Message.FromString(request);
+                if (message.Header == NamedPipeMessages.Multiplexing.Request)
+                {
+                    if (message.Body != NamedPipeMessages.Multiplexing.CurrentVersion)
+                    {
+                        connection.TrySendResponse(NamedPipeMessages.Multiplexing.InvalidVersion);
+                        continue;
+                    }
+
+                    if (connection.TrySendResponse(NamedPipeMessages.Multiplexing.SuccessResult))
+                    {
+                        HandleMultiplexedConnection(tracer, connection, handleRequest);
+                    }
+
+                    break;
+                }
+
                 handleRequest(tracer, request, connection);
             }
         }
 
+        private static void HandleMultiplexedConnection(ITracer tracer, Connection connection, Action<ITracer, string, Connection> handleRequest)
+        {
+            // Requests are handled concurrently so that a slow request (e.g. an object download)
+            // does not hold up the responses to the requests that were sent after it
+            Exception handlerException = null;
+            using (CountdownEvent outstandingRequests = new CountdownEvent(1))
+            {
+                uint requestId;
+                string frameRequest;
+                while (connection.IsConnected &&
+                    handlerException == null &&
+                    connection.TryReadFrame(out requestId, out frameRequest))
+                {
+                    string request = frameRequest;
+                    Connection requestConnection = connection.CreateRequestConnection(requestId);
+                    outstandingRequests.AddCount();
+                    Task.Run(() =>
+                    {
+                        try
+                        {
+                            handleRequest(tracer, request, requestConnection);
+                        }
+                        catch (Exception e)
+                        {
+                            Interlocked.CompareExchange(ref handlerException, e, null);
+                        }
+                        finally
+                        {
+                            outstandingRequests.Signal();
+                        }
+                    });
+                }
+
+                // The pipe is disposed when this method returns, wait for the requests that are still running
+                outstandingRequests.Signal();
+                outstandingRequests.Wait();
+            }
+
+            if (handlerException != null)
+            {
+                ExceptionDispatchInfo.Capture(handlerException).Throw();
+            }
+        }
+
         private void OpenListeningPipe()
         {
             try
@@ -177,17 +242,35 @@ namespace GVFS.Common.NamedPipes
 
         public class Connection
         {
+            private const int StreamedResponseChunkSize = 64 * 1024;
+            private static readonly Encoding StreamedResponseEncoding = new UTF8Encoding(encoderShouldEmitUTF8Identifier: false);
+
             private NamedPipeServerStream serverStream;
             private StreamReader reader;
             private StreamWriter writer;
             private Func<bool> isStopping;
 
+            // Multiplexed mode only, responses are written as frames tagged with requestId
+            private object frameWriteLock;
+            private uint? requestId;
+
             public Connection(NamedPipeServerStream serverStream, Func<bool> isStopping)
             {
                 this.serverStream = serverStream;
                 this.isStopping = isStopping;
                 this.reader = new StreamReader(this.serverStream);
                 this.writer = new StreamWriter(this.serverStream);
+                this.frameWriteLock = new object();
+            }
+
+            private Connection(Connection multiplexedConnection, uint requestId)
+            {
+                this.serverStream = multiplexedConnection.serverStream;
+                this.isStopping = multiplexedConnection.isStopping;
+                this.reader = multiplexedConnection.reader;
+                this.writer = multiplexedConnection.writer;
+                this.frameWriteLock = multiplexedConnection.frameWriteLock;
+                this.requestId = requestId;
             }
 
             public bool IsConnected
@@ -212,12 +295,65 @@ namespace GVFS.Common.NamedPipes
                 }
             }
 
+            /// <summary>
+            /// Reads the next request frame from a connection that has been switched to multiplexed mode.
+            /// </summary>
+            public bool TryReadFrame(out uint requestId, out string request)
+            {
+                try
+                {
+                    // The client waits for the response to the Multiplexing request before sending
+                    // any frames, and so this.reader has not buffered any frame data
+                    return MultiplexedFrame.TryRead(this.serverStream, out requestId, out request);
+                }
+                catch (IOException)
+                {
+                    requestId = 0;
+                    request = null;
+                    return false;
+                }
+            }
+
+            /// <summary>
+            /// Creates a Connection that sends its responses as frames tagged with requestId.
+            /// </summary>
+            public Connection CreateRequestConnection(uint requestId)
+            {
+                return new Connection(this, requestId);
+            }
+
             public bool TrySendResponse(string message)
             {
                 try
                 {
-                    this.writer.WritePlatformIndependentLine(message);
-                    this.writer.Flush();
+                    if (this.requestId.HasValue)
+                    {
+                        byte[] frame;
+                        bool responseTooLarge = false;
+                        try
+                        {
+                            frame = MultiplexedFrame.Create(this.requestId.Value, message);
+                        }
+                        catch (ArgumentException)
+                        {
+                            // Answer the request rather than leave the client waiting for a response that can never be sent
+                            frame = MultiplexedFrame.Create(this.requestId.Value, NamedPipeMessages.Multiplexing.ResponseTooLarge);
+                            responseTooLarge = true;
+                        }
+
+                        lock (this.frameWriteLock)
+                        {
+                            this.serverStream.Write(frame, 0, frame.Length);
+                            this.serverStream.Flush();
+                        }
+
+                        return !responseTooLarge;
+                    }
+                    else
+                    {
+                        this.writer.WritePlatformIndependentLine(message);
+                        this.writer.Flush();
+                    }
 
                     return true;
                 }
@@ -231,6 +367,48 @@ namespace GVFS.Common.NamedPipes
             {
                 return this.TrySendResponse(message.ToString());
             }
+
+            /// <summary>
+            /// Sends a response whose body is made up of items, each followed by itemTerminator.  The response
+            /// is written to the pipe in chunks as items is enumerated rather than being built up as a single
+            /// string, and so the client can start consuming it before all of the items have been written.
+            /// </summary>
+            public bool TrySendResponse(string header, IEnumerable<string> items, char itemTerminator)
+            {
+                if (this.requestId.HasValue)
+                {
+                    // Frames are length prefixed, and so multiplexed responses can only be sent in one piece
+                    StringBuilder body = new StringBuilder();
+                    foreach (string item in items)
+                    {
+                        body.Append(item).Append(itemTerminator);
+                    }
+
+                    return this.TrySendResponse(new NamedPipeMessages.Message(header, body.ToString()));
+                }
+
+                try
+                {
+                    using (StreamWriter chunkWriter = new StreamWriter(this.serverStream, StreamedResponseEncoding, StreamedResponseChunkSize, leaveOpen: true))
+                    {
+                        // Everything up to and including the separator that precedes the body
+                        chunkWriter.Write(new NamedPipeMessages.Message(header, string.Empty).ToString());
+                        foreach (string item in items)
+                        {
+                            chunkWriter.Write(item);
+                            chunkWriter.Write(itemTerminator);
+                        }
+
+                        chunkWriter.Write('\n');
+                    }
+
+                    return true;
+                }
+                catch (IOException)
+                {
+                    return false;
+                }
+            }
         }
     }
 }
@@ -105,6 +105,9 @@ namespace GVFS.Hooks
 
         private static void CheckForLegalCommands(string[] args)
         {
+            // GitHooksLoader acquires the lock itself for the verbs in LockVerbs (GitHooksLoader\gvfslock.cpp)
+            // without running GVFS.Hooks, verbs checked here must not be in that list (the loader leaves status
+            // to GVFS.Hooks during a merge or revert)
             string command = GetGitCommand(args);
             switch (command)
             {
@@ -391,7 +394,8 @@ namespace GVFS.Hooks
 
             switch (gitCommand)
             {
-                // Keep these alphabetically sorted
+                // Keep these alphabetically sorted, and in sync with NoLockVerbs in GitHooksLoader\gvfslock.cpp
+                // (checked by GitHooksLoaderVerbTests)
                 case "blame":
                 case "branch":
                 case "cat-file":
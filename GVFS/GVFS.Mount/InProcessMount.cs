@@ -22,7 +22,6 @@ namespace GVFS.Mount
         // Tests show that 250 is the max supported pipe name length
         private const int MaxPipeNameLength = 250;
         private const int MutexMaxWaitTimeMS = 500;
-        private const string ModifiedPathsVersion = "1";
 
         private readonly bool showDebugWindow;
 
@@ -144,6 +143,7 @@ namespace GVFS.Mount
                     });
 
                 this.currentState = MountState.Ready;
+                this.fileSystemCallbacks.UpdateModifiedPathsSnapshotInBackground();
 
                 this.unmountEvent.WaitOne();
             }
@@ -249,6 +249,10 @@ namespace GVFS.Mount
                     this.HandleDownloadObjectRequest(message, connection);
                     break;
 
+                case NamedPipeMessages.DownloadObjects.DownloadRequest:
+                    this.HandleDownloadObjectsRequest(message, connection);
+                    break;
+
                 case NamedPipeMessages.ModifiedPaths.ListRequest:
                     this.HandleModifiedPathsListRequest(message, connection);
                     break;
@@ -352,20 +356,58 @@ namespace GVFS.Mount
             }
             else
             {
-                if (request.Version != ModifiedPathsVersion)
+                if (request.Version == NamedPipeMessages.ModifiedPaths.IncrementalListVersion)
+                {
+                    this.SendModifiedPathsSinceGeneration(request.GenerationToken, connection);
+
+                    // The hook only asks for the list when the snapshot is stale, bring it up to date for the next time
+                    this.fileSystemCallbacks.UpdateModifiedPathsSnapshotInBackground();
+                    return;
+                }
+                else if (request.Version != NamedPipeMessages.ModifiedPaths.FullListVersion)
                 {
                     response = new NamedPipeMessages.ModifiedPaths.Response(NamedPipeMessages.ModifiedPaths.InvalidVersion);
                 }
                 else
                 {
-                    string data = string.Join("\0", this.fileSystemCallbacks.GetAllModifiedPaths()) + "\0";
-                    response = new NamedPipeMessages.ModifiedPaths.Response(NamedPipeMessages.ModifiedPaths.SuccessResult, data);
+                    // There can be hundreds of thousands of modified paths, stream them to the client
+                    // rather than building the entire list as a single message
+                    connection.TrySendResponse(
+                        NamedPipeMessages.ModifiedPaths.SuccessResult,
+                        this.fileSystemCallbacks.GetAllModifiedPaths(),
+                        NamedPipeMessages.ModifiedPaths.PathTerminator);
+                    this.fileSystemCallbacks.UpdateModifiedPathsSnapshotInBackground();
+                    return;
                 }
             }
 
             connection.TrySendResponse(response.CreateMessage());
         }
 
+        private void SendModifiedPathsSinceGeneration(string generationToken, NamedPipeServer.Connection connection)
+        {
+            // Clients that already have the list only need the paths that have been added since, the full list
+            // is only sent when the client does not have it yet or its generation token is from a previous mount
+            string result;
+            string currentGenerationToken;
+            IReadOnlyList<string> paths;
+            if (generationToken != null &&
+                this.fileSystemCallbacks.TryGetModifiedPathsAddedSince(generationToken, out paths, out currentGenerationToken))
+            {
+                result = NamedPipeMessages.ModifiedPaths.AddedPathsResult;
+            }
+            else
+            {
+                result = NamedPipeMessages.ModifiedPaths.FullListResult;
+                paths = this.fileSystemCallbacks.GetAllModifiedPaths(out currentGenerationToken);
+            }
+
+            connection.TrySendResponse(
+                new NamedPipeMessages.Message(result, currentGenerationToken).ToString(),
+                paths,
+                NamedPipeMessages.ModifiedPaths.PathTerminator);
+        }
+
         private void HandleDownloadObjectRequest(NamedPipeMessages.Message message, NamedPipeServer.Connection connection)
         {
             NamedPipeMessages.DownloadObject.Response response;
@@ -385,7 +427,8 @@ namespace GVFS.Mount
                 else
                 {
                     Stopwatch downloadTime = Stopwatch.StartNew();
-                    if (this.gitObjects.TryDownloadAndSaveObject(objectSha, GVFSGitObjects.RequestSource.NamedPipeMessage) == GitObjects.DownloadAndSaveObjectResult.Success)
+                    bool coalesced;
+                    if (this.gitObjects.TryDownloadAndSaveObject(objectSha, GVFSGitObjects.RequestSource.NamedPipeMessage, out coalesced) == GitObjects.DownloadAndSaveObjectResult.Success)
                     {
                         response = new NamedPipeMessages.DownloadObject.Response(NamedPipeMessages.DownloadObject.SuccessResult);
                     }
@@ -394,15 +437,96 @@ namespace GVFS.Mount
                         response = new NamedPipeMessages.DownloadObject.Response(NamedPipeMessages.DownloadObject.DownloadFailed);
                     }
 
-                    bool isBlob;
-                    this.context.Repository.TryGetIsBlob(objectSha, out isBlob);
-                    this.context.Repository.GVFSLock.Stats.RecordObjectDownload(isBlob, downloadTime.ElapsedMilliseconds);
+                    if (coalesced)
+                    {
+                        // The object was downloaded (and recorded) by the request that this one waited for
+                        this.context.Repository.GVFSLock.Stats.RecordCoalescedObjectDownload();
+                    }
+                    else
+                    {
+                        bool isBlob;
+                        this.context.Repository.TryGetIsBlob(objectSha, out isBlob);
+                        this.context.Repository.GVFSLock.Stats.RecordObjectDownload(isBlob, downloadTime.ElapsedMilliseconds);
+                    }
                 }
             }
 
             connection.TrySendResponse(response.CreateMessage());
         }
 
+        private void HandleDownloadObjectsRequest(NamedPipeMessages.Message message, NamedPipeServer.Connection connection)
+        {
+            NamedPipeMessages.DownloadObjects.Response response;
+
+            NamedPipeMessages.DownloadObjects.Request request = new NamedPipeMessages.DownloadObjects.Request(message);
+            if (this.currentState != MountState.Ready)
+            {
+                response = new NamedPipeMessages.DownloadObjects.Response(NamedPipeMessages.MountNotReadyResult);
+            }
+            else
+            {
+                List<string> objectShas = new List<string>(request.RequestShas.Count);
+                List<int> objectIndexes = new List<int>(request.RequestShas.Count);
+                char[] objectResults = new char[request.RequestShas.Count];
+                for (int i = 0; i < request.RequestShas.Count; ++i)
+                {
+                    if (SHA1Util.IsValidShaFormat(request.RequestShas[i]))
+                    {
+                        objectShas.Add(request.RequestShas[i]);
+                        objectIndexes.Add(i);
+                    }
+                    else
+                    {
+                        objectResults[i] = NamedPipeMessages.DownloadObjects.ObjectDownloadFailed;
+                    }
+                }
+
+                if (objectShas.Count > 0)
+                {
+                    Stopwatch downloadTime = Stopwatch.StartNew();
+                    bool[] coalesced;
+                    GitObjects.DownloadAndSaveObjectResult[] downloadResults = this.gitObjects.TryDownloadAndSaveObjects(objectShas, GVFSGitObjects.RequestSource.NamedPipeMessage, out coalesced);
+                    downloadTime.Stop();
+
+                    int blobCount = 0;
+                    int commitAndTreeCount = 0;
+                    for (int i = 0; i < downloadResults.Length; ++i)
+                    {
+                        bool downloaded = downloadResults[i] == GitObjects.DownloadAndSaveObjectResult.Success;
+                        objectResults[objectIndexes[i]] = downloaded ? NamedPipeMessages.DownloadObjects.ObjectDownloaded : NamedPipeMessages.DownloadObjects.ObjectDownloadFailed;
+
+                        if (coalesced[i])
+                        {
+                            // The object was downloaded (and recorded) by the request that this one waited for
+                            this.context.Repository.GVFSLock.Stats.RecordCoalescedObjectDownload();
+                        }
+                        else
+                        {
+                            bool isBlob;
+                            this.context.Repository.TryGetIsBlob(objectShas[i], out isBlob);
+                            if (isBlob)
+                            {
+                                ++blobCount;
+                            }
+                            else
+                            {
+                                ++commitAndTreeCount;
+                            }
+                        }
+                    }
+
+                    if (blobCount + commitAndTreeCount > 0)
+                    {
+                        this.context.Repository.GVFSLock.Stats.RecordObjectBatchDownload(blobCount, commitAndTreeCount, downloadTime.ElapsedMilliseconds);
+                    }
+                }
+
+                response = new NamedPipeMessages.DownloadObjects.Response(NamedPipeMessages.DownloadObjects.SuccessResult, new string(objectResults));
+            }
+
+            connection.TrySendResponse(response.CreateMessage());
+        }
+
         private void HandlePostFetchJobRequest(NamedPipeMessages.Message message, NamedPipeServer.Connection connection)
         {
             NamedPipeMessages.RunPostFetchJob.Request request = new NamedPipeMessages.RunPostFetchJob.Request(message);
@@ -0,0 +1,128 @@
+// Measures how long GetGVFSEnlistmentRoot (common.mac.cpp) takes to find the enlistment root when a hook runs
+// 1, 20 and 60 directory levels below it, with the enlistment root cache and without it. Without the cache, TMPDIR
+// points at a folder that does not exist, so every lookup walks up the tree as it does the first time a hook runs
+// in a directory.
+// Only uses portable code, so it also runs on Linux; see Scripts/Mac/RunNativeHookBenchmarks.sh.
+
+#include "stdafx.h"
+#include "../common.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t Depths[] = { 1, 20, 60 };
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1); \
+        } \
+    } while (0)
+
+static void Fail(const char* operation, const std::string& path)
+{
+    fprintf(stderr, "%s failed for %s: %s\n", operation, path.c_str(), strerror(errno));
+    exit(1);
+}
+
+static void MakeDirectory(const std::string& path)
+{
+    if (mkdir(path.c_str(), 0777))
+    {
+        Fail("mkdir", path);
+    }
+}
+
+static void ChangeDirectory(const std::string& path)
+{
+    if (chdir(path.c_str()))
+    {
+        Fail("chdir", path);
+    }
+}
+
+static int RemovePath(const char* path, const struct stat*, int, struct FTW*)
+{
+    return remove(path);
+}
+
+static double MeasureLookups(const std::string& enlistmentRoot, const std::string& tempFolder, size_t lookupCount)
+{
+    CHECK(0 == setenv("TMPDIR", tempFolder.c_str(), 1));
+
+    // The first lookup fills the cache, when there is one
+    CHECK(enlistmentRoot == GetGVFSEnlistmentRoot("EnlistmentRootBenchmark"));
+
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < lookupCount; ++i)
+    {
+        CHECK(enlistmentRoot == GetGVFSEnlistmentRoot("EnlistmentRootBenchmark"));
+    }
+
+    return std::chrono::duration<double>(Clock::now() - start).count() * 1000000 / lookupCount;
+}
+
+int main(int argc, char** argv)
+{
+    size_t lookupCount = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000;
+
+    const char* tempDirectory = getenv("TMPDIR");
+    std::string root = std::string(nullptr != tempDirectory ? tempDirectory : "/tmp") + "/EnlistmentRootBenchmarkXXXXXX";
+    if (nullptr == mkdtemp(&root[0]))
+    {
+        Fail("mkdtemp", root);
+    }
+
+    // The hooks see the working directory with symlinks resolved (e.g. /tmp is /private/tmp on Mac)
+    char resolvedRoot[PATH_MAX];
+    if (nullptr == realpath(root.c_str(), resolvedRoot))
+    {
+        Fail("realpath", root);
+    }
+
+    root = resolvedRoot;
+    std::string enlistmentRoot = root + "/enlistment";
+    std::string cacheTempFolder = root + "/temp";
+    std::string missingTempFolder = root + "/missing";
+    MakeDirectory(enlistmentRoot);
+    MakeDirectory(enlistmentRoot + "/.gvfs");
+    MakeDirectory(cacheTempFolder);
+
+    std::vector<std::string> directories;
+    std::string directory = enlistmentRoot;
+    for (size_t level = 1; level <= Depths[sizeof(Depths) / sizeof(Depths[0]) - 1]; ++level)
+    {
+        directory += "/level" + std::to_string(level);
+        MakeDirectory(directory);
+        directories.push_back(directory);
+    }
+
+    for (size_t depth : Depths)
+    {
+        ChangeDirectory(directories[depth - 1]);
+        double uncachedMicroseconds = MeasureLookups(enlistmentRoot, missingTempFolder, lookupCount);
+        double cachedMicroseconds = MeasureLookups(enlistmentRoot, cacheTempFolder, lookupCount);
+        printf(
+            "%2zu levels deep: without cache %8.2f us/lookup, with cache %6.2f us/lookup\n",
+            depth,
+            uncachedMicroseconds,
+            cachedMicroseconds);
+    }
+
+    ChangeDirectory("/");
+    CHECK(0 == nftw(root.c_str(), RemovePath, 16, FTW_DEPTH | FTW_PHYS));
+    return 0;
+}
@@ -0,0 +1,391 @@
+// Compares the buffered pkt-line reader and writer in packet.cpp with the stdio implementation the hooks used
+// before. A child process plays the read-object hook on a pipe pair while this process plays git, sending
+// "command=get" requests with 1 SHA (read-object version 1) or 100 SHAs (version 2) and waiting for each response.
+// Only uses portable code, so it also runs on Linux; see Scripts/Mac/RunNativeHookBenchmarks.sh.
+
+#include "stdafx.h"
+#include "../packet.h"
+#include "../common.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+#define LARGE_PACKET_MAX 65520
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1); \
+        } \
+    } while (0)
+
+// The stdio implementation from before packet.cpp was buffered, unchanged apart from the namespace
+namespace Legacy
+{
+static void set_packet_header(char *buf, const size_t size)
+{
+	static char hexchar[] = "0123456789abcdef";
+
+#define hex(a) (hexchar[(a) & 15])
+	buf[0] = hex(size >> 12);
+	buf[1] = hex(size >> 8);
+	buf[2] = hex(size >> 4);
+	buf[3] = hex(size);
+#undef hex
+}
+
+const signed char hexval_table[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 00-07 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 08-0f */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 10-17 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 18-1f */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 20-27 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 28-2f */
+	0,  1,  2,  3,  4,  5,  6,  7,		/* 30-37 */
+	8,  9, -1, -1, -1, -1, -1, -1,		/* 38-3f */
+	-1, 10, 11, 12, 13, 14, 15, -1,		/* 40-47 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 48-4f */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 50-57 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 58-5f */
+	-1, 10, 11, 12, 13, 14, 15, -1,		/* 60-67 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 68-67 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 70-77 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 78-7f */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 80-87 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 88-8f */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 90-97 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 98-9f */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* a0-a7 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* a8-af */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* b0-b7 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* b8-bf */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* c0-c7 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* c8-cf */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* d0-d7 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* d8-df */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* e0-e7 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* e8-ef */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* f0-f7 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* f8-ff */
+};
+
+static inline unsigned int hexval(unsigned char c)
+{
+	return hexval_table[c];
+}
+
+static inline int hex2chr(const char *s)
+{
+	int val = hexval(s[0]);
+	return (val < 0) ? val : (val << 4) | hexval(s[1]);
+}
+
+static int packet_length(const char *packetlen)
+{
+	int val = hex2chr(packetlen);
+	return (val < 0) ? val : (val << 8) | hex2chr(packetlen + 2);
+}
+
+static size_t packet_bin_read(void *buf, size_t count, FILE *stream)
+{
+	char packetlen[4];
+	size_t len, ret;
+
+	/* if we timeout waiting for input, exit and git will restart us if needed */
+	size_t bytes_read = fread(packetlen, 1, 4, stream);
+	if (0 == bytes_read)
+	{
+		exit(0);
+	}
+	if (4 != bytes_read)
+	{
+		die(-1, "invalid packet length");
+	}
+
+	len = packet_length(packetlen);
+	if (!len)
+	{
+		return 0;
+	}
+	if (len < 4)
+	{
+		die(-1, "protocol error: bad line length character: %.4s", packetlen);
+	}
+	len -= 4;
+	if (len >= count)
+	{
+		die(-1, "protocol error: bad line length %d", len);
+	}
+	ret = fread(buf, 1, len, stream);
+	if (ret != len)
+	{
+		die(-1, "invalid packet (%d bytes expected; %d bytes read)", len, ret);
+	}
+
+	return len;
+}
+
+size_t packet_txt_read(char *buf, size_t count, FILE *stream = stdin)
+{
+	size_t len;
+
+	len = packet_bin_read(buf, count, stream);
+	if (len && buf[len - 1] == '\n')
+	{
+		len--;
+	}
+
+	buf[len] = 0;
+	return len;
+}
+
+void packet_txt_write(const char *buf, FILE *stream = stdout)
+{
+	char packetlen[4];
+	size_t len, count = strlen(buf);
+
+	set_packet_header(packetlen, count + 5);
+	len = fwrite(packetlen, 1, 4, stream);
+	if (len != 4)
+	{
+		die(-1, "error writing packet length");
+	}
+	len = fwrite(buf, 1, count, stream);
+	if (len != count)
+	{
+		die(-1, "error writing packet");
+	}
+	len = fwrite("\n", 1, 1, stream);
+	if (len != 1)
+	{
+		die(-1, "error writing packet");
+	}
+	fflush(stream);
+}
+
+void packet_flush(FILE *stream = stdout)
+{
+	size_t len;
+
+	len = fwrite("0000", 1, 4, stream);
+	if (len != 4)
+	{
+		die(-1, "error writing flush packet");
+	}
+	fflush(stream);
+}
+}
+
+enum PacketImplementation
+{
+    PacketImplementation_Buffered,
+    PacketImplementation_Legacy,
+};
+
+static std::string StatusLine(const std::string& sha)
+{
+    return "sha1=" + sha + " status=success";
+}
+
+// Answers get commands the way GVFS.ReadObjectHook does when every object is found, until git closes stdin
+static void ServeWithBufferedPackets()
+{
+    const char *packet;
+    size_t len;
+    std::vector<std::string> sha1s;
+    while (1)
+    {
+        packet_txt_read(&packet);
+        sha1s.clear();
+        while ((len = packet_txt_read(&packet)) != 0)
+        {
+            sha1s.push_back(std::string(packet + 5, len - 5));
+        }
+
+        if (sha1s.size() > 1)
+        {
+            for (const std::string& sha1 : sha1s)
+            {
+                packet_txt_write(StatusLine(sha1).c_str());
+            }
+        }
+
+        packet_txt_write("status=success");
+        packet_flush();
+    }
+}
+
+static void ServeWithLegacyPackets()
+{
+    char packet[LARGE_PACKET_MAX];
+    size_t len;
+    std::vector<std::string> sha1s;
+    while (1)
+    {
+        Legacy::packet_txt_read(packet, sizeof(packet));
+        sha1s.clear();
+        while ((len = Legacy::packet_txt_read(packet, sizeof(packet))) != 0)
+        {
+            sha1s.push_back(std::string(packet + 5, len - 5));
+        }
+
+        if (sha1s.size() > 1)
+        {
+            for (const std::string& sha1 : sha1s)
+            {
+                Legacy::packet_txt_write(StatusLine(sha1).c_str());
+            }
+        }
+
+        Legacy::packet_txt_write("status=success");
+        Legacy::packet_flush();
+    }
+}
+
+static void AppendPacket(std::string& buffer, const std::string& line)
+{
+    char header[5];
+    snprintf(header, sizeof(header), "%04x", static_cast<unsigned>(line.size() + 5));
+    buffer += header;
+    buffer += line;
+    buffer += '\n';
+}
+
+static void WriteAll(int fd, const std::string& data)
+{
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t result = write(fd, data.data() + written, data.size() - written);
+        CHECK(result > 0 || (result < 0 && EINTR == errno));
+        if (result > 0)
+        {
+            written += result;
+        }
+    }
+}
+
+static void ReadAll(int fd, std::vector<char>& buffer)
+{
+    size_t bytesRead = 0;
+    while (bytesRead < buffer.size())
+    {
+        ssize_t result = read(fd, buffer.data() + bytesRead, buffer.size() - bytesRead);
+        CHECK(result > 0 || (result < 0 && EINTR == errno));
+        if (result > 0)
+        {
+            bytesRead += result;
+        }
+    }
+}
+
+static double RunGetCommands(PacketImplementation implementation, size_t shasPerCommand, size_t commandCount)
+{
+    std::string request;
+    std::string response;
+    AppendPacket(request, "command=get");
+    for (size_t i = 0; i < shasPerCommand; ++i)
+    {
+        char sha[41];
+        snprintf(sha, sizeof(sha), "%040zx", i + 1);
+        AppendPacket(request, std::string("sha1=") + sha);
+        if (shasPerCommand > 1)
+        {
+            AppendPacket(response, StatusLine(sha));
+        }
+    }
+
+    request += "0000";
+    AppendPacket(response, "status=success");
+    response += "0000";
+
+    int requestPipe[2];
+    int responsePipe[2];
+    CHECK(0 == pipe(requestPipe));
+    CHECK(0 == pipe(responsePipe));
+
+    // Anything left in this process's stdout buffer would be written to the response pipe by the child
+    fflush(stdout);
+    pid_t child = fork();
+    CHECK(child >= 0);
+    if (0 == child)
+    {
+        CHECK(dup2(requestPipe[0], STDIN_FILENO) >= 0);
+        CHECK(dup2(responsePipe[1], STDOUT_FILENO) >= 0);
+        close(requestPipe[0]);
+        close(requestPipe[1]);
+        close(responsePipe[0]);
+        close(responsePipe[1]);
+
+        if (PacketImplementation_Buffered == implementation)
+        {
+            ServeWithBufferedPackets();
+        }
+        else
+        {
+            ServeWithLegacyPackets();
+        }
+
+        _exit(1);
+    }
+
+    close(requestPipe[0]);
+    close(responsePipe[1]);
+
+    std::vector<char> received(response.size());
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < commandCount; ++i)
+    {
+        WriteAll(requestPipe[1], request);
+        ReadAll(responsePipe[0], received);
+        CHECK(0 == memcmp(received.data(), response.data(), response.size()));
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    close(requestPipe[1]);
+    int status;
+    CHECK(child == waitpid(child, &status, 0));
+    CHECK(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+
+    // The hook must not send anything after the last response
+    char extra;
+    CHECK(0 == read(responsePipe[0], &extra, 1));
+    close(responsePipe[0]);
+
+    return seconds;
+}
+
+static void Compare(size_t shasPerCommand, size_t commandCount)
+{
+    double legacySeconds = RunGetCommands(PacketImplementation_Legacy, shasPerCommand, commandCount);
+    double bufferedSeconds = RunGetCommands(PacketImplementation_Buffered, shasPerCommand, commandCount);
+    printf(
+        "%3zu SHAs per get: stdio %8.0f commands/s (%6.2f us), buffered %8.0f commands/s (%6.2f us), %.2fx\n",
+        shasPerCommand,
+        commandCount / legacySeconds,
+        legacySeconds * 1000000 / commandCount,
+        commandCount / bufferedSeconds,
+        bufferedSeconds * 1000000 / commandCount,
+        legacySeconds / bufferedSeconds);
+}
+
+int main(int argc, char** argv)
+{
+    size_t commandCount = argc > 1 ? strtoul(argv[1], nullptr, 10) : 50000;
+
+    Compare(1, commandCount);
+    Compare(100, commandCount / 20);
+    return 0;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
-#ifdef __APPLE__
+#if defined(__APPLE__) || defined(__linux__)
+// Linux is only used to build and run the benchmarks for the portable parts of the hooks
 typedef std::string PATH_STRING;
 typedef int PIPE_HANDLE;
 #elif _WIN32
@@ -37,6 +38,8 @@ inline void die(int err, const char *fmt, ...)
 }
 
 PATH_STRING GetFinalPathName(const PATH_STRING& path);
+PATH_STRING GetGVFSEnlistmentRoot(const char *appName);
+PATH_STRING GetGVFSPipeName(const PATH_STRING& enlistmentRoot);
 PATH_STRING GetGVFSPipeName(const char *appName);
 PIPE_HANDLE CreatePipeToGVFS(const PATH_STRING& pipeName);
 void DisableCRLFTranslationOnStdPipes();
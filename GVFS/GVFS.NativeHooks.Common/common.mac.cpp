@@ -1,15 +1,23 @@
 #include "stdafx.h"
 
-#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <unistd.h>
 
 #include "common.h"
 
-#define MAX_PATH 260
+// Enlistment roots found by earlier hook invocations are cached in a per-user folder, with one
+// file per working directory named after the device and inode of that directory.  Each file
+// holds the path of the working directory and the path of its enlistment root (separated by NUL)
+// and is only used while the working directory path still refers to the same directory and the
+// enlistment root still contains a .gvfs folder.
+#define ENLISTMENT_ROOT_CACHE_FOLDER_PREFIX "gvfs_enlistment_roots_"
+#define DOT_GVFS_RELATIVE_PATH "/.gvfs"
 
 PATH_STRING GetFinalPathName(const PATH_STRING& path)
 {
@@ -17,91 +25,224 @@ PATH_STRING GetFinalPathName(const PATH_STRING& path)
     return path;
 }
 
-PATH_STRING GetGVFSPipeName(const char *appName)
+static bool IsDirectory(const PATH_STRING& path, const char *appName)
 {
-    // The pipe name is built using the path of the GVFS enlistment root.
-    // Start in the current directory and walk up the directory tree
-    // until we find a folder that contains the ".gvfs" folder
-    
-    // TODO 640838: Support paths longer than MAX_PATH
-    char enlistmentRoot[MAX_PATH];
-    if (getcwd(enlistmentRoot, MAX_PATH) == nullptr)
+    struct stat pathStat;
+    if (stat(path.c_str(), &pathStat) != 0)
     {
-        die(ReturnCode::GetCurrentDirectoryFailure, "getcwd failed (%d)\n", errno);
+        if (errno != ENOENT && errno != ENOTDIR)
+        {
+            die(ReturnCode::NotInGVFSEnlistment, "%s failed to stat %s, error: %d\n", appName, path.c_str(), errno);
+        }
+
+        return false;
     }
-    
-    PATH_STRING finalRootPath(GetFinalPathName(enlistmentRoot));
-    size_t resultLength = strlcpy(enlistmentRoot, finalRootPath.c_str(), sizeof(enlistmentRoot));
-    if (resultLength >= sizeof(enlistmentRoot))
+
+    return S_ISDIR(pathStat.st_mode);
+}
+
+static PATH_STRING GetEnlistmentRootCacheFolder()
+{
+    const char *tempFolder = getenv("TMPDIR");
+    if (tempFolder == nullptr || tempFolder[0] == '\0')
     {
-        die(ReturnCode::PipeConnectError,
-            "Could not copy finalRootPath: %ls, insufficient buffer. resultLength: %d, sizeof(enlistmentRoot): %d\n",
-            finalRootPath.c_str(),
-            resultLength,
-            sizeof(enlistmentRoot));
+        tempFolder = "/tmp";
     }
-    
-    size_t enlistmentRootLength = strlen(enlistmentRoot);
-    if ('/' != enlistmentRoot[enlistmentRootLength - 1])
+
+    PATH_STRING cacheFolder(tempFolder);
+    if (cacheFolder.back() != '/')
     {
-        strlcat(enlistmentRoot, "/", sizeof(enlistmentRoot));
-        enlistmentRootLength++;
+        cacheFolder += '/';
     }
-    
-    // Walk up enlistmentRoot looking for a folder named .gvfs
-    char* lastslash = enlistmentRoot + enlistmentRootLength - 1;
-    bool gvfsFound = false;
+
+    return cacheFolder + ENLISTMENT_ROOT_CACHE_FOLDER_PREFIX + std::to_string(getuid());
+}
+
+static bool IsPrivateFolder(const PATH_STRING& path)
+{
+    // The cache decides which pipe the hooks connect to, only trust it if no other user can write to it
+    struct stat folderStat;
+    return
+        lstat(path.c_str(), &folderStat) == 0 &&
+        S_ISDIR(folderStat.st_mode) &&
+        folderStat.st_uid == getuid() &&
+        (folderStat.st_mode & (S_IRWXG | S_IRWXO)) == 0;
+}
+
+static PATH_STRING GetEnlistmentRootCacheFile(const PATH_STRING& cacheFolder, const struct stat& currentDirectoryStat)
+{
+    return
+        cacheFolder + "/" +
+        std::to_string(static_cast<unsigned long long>(currentDirectoryStat.st_dev)) + "_" +
+        std::to_string(static_cast<unsigned long long>(currentDirectoryStat.st_ino));
+}
+
+static bool TryReadCachedEnlistmentRoot(
+    const PATH_STRING& cacheFolder,
+    const struct stat& currentDirectoryStat,
+    const char *appName,
+    /* out */ PATH_STRING& enlistmentRoot)
+{
+    if (!IsPrivateFolder(cacheFolder))
+    {
+        return false;
+    }
+
+    int cacheFile = open(GetEnlistmentRootCacheFile(cacheFolder, currentDirectoryStat).c_str(), O_RDONLY | O_NOFOLLOW);
+    if (cacheFile < 0)
+    {
+        return false;
+    }
+
+    std::string contents;
+    char buffer[4096];
+    ssize_t bytesRead;
+    while ((bytesRead = read(cacheFile, buffer, sizeof(buffer))) > 0)
+    {
+        contents.append(buffer, bytesRead);
+    }
+
+    close(cacheFile);
+    if (bytesRead < 0)
+    {
+        return false;
+    }
+
+    size_t separator = contents.find('\0');
+    if (separator == std::string::npos)
+    {
+        return false;
+    }
+
+    PATH_STRING currentDirectory(contents, 0, separator);
+    PATH_STRING cachedRoot(contents, separator + 1);
+
+    // The root must be the working directory or one of its ancestors
+    if (cachedRoot.empty() ||
+        currentDirectory.compare(0, cachedRoot.length(), cachedRoot) != 0 ||
+        (currentDirectory.length() != cachedRoot.length() && currentDirectory[cachedRoot.length()] != '/'))
+    {
+        return false;
+    }
+
+    // Inodes are reused, make sure the cached working directory path still refers to the current directory
+    struct stat cachedDirectoryStat;
+    if (stat(currentDirectory.c_str(), &cachedDirectoryStat) != 0 ||
+        cachedDirectoryStat.st_dev != currentDirectoryStat.st_dev ||
+        cachedDirectoryStat.st_ino != currentDirectoryStat.st_ino)
+    {
+        return false;
+    }
+
+    if (!IsDirectory(cachedRoot + DOT_GVFS_RELATIVE_PATH, appName))
+    {
+        return false;
+    }
+
+    enlistmentRoot = cachedRoot;
+    return true;
+}
+
+static void TryWriteCachedEnlistmentRoot(
+    const PATH_STRING& cacheFolder,
+    const struct stat& currentDirectoryStat,
+    const PATH_STRING& currentDirectory,
+    const PATH_STRING& enlistmentRoot)
+{
+    // The cache is only an optimization, failing to update it is not an error
+    if (mkdir(cacheFolder.c_str(), S_IRWXU) != 0 && errno != EEXIST)
+    {
+        return;
+    }
+
+    if (!IsPrivateFolder(cacheFolder))
+    {
+        return;
+    }
+
+    std::string contents(currentDirectory);
+    contents += '\0';
+    contents += enlistmentRoot;
+
+    // Write to a temporary file and rename it into place so that readers never see a partial file
+    PATH_STRING cacheFilePath(GetEnlistmentRootCacheFile(cacheFolder, currentDirectoryStat));
+    PATH_STRING tempFilePath(cacheFilePath + "." + std::to_string(getpid()));
+    int tempFile = open(tempFilePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, S_IRUSR | S_IWUSR);
+    if (tempFile < 0)
+    {
+        return;
+    }
+
+    bool success = write(tempFile, contents.c_str(), contents.length()) == static_cast<ssize_t>(contents.length());
+    close(tempFile);
+
+    if (!success || rename(tempFilePath.c_str(), cacheFilePath.c_str()) != 0)
+    {
+        unlink(tempFilePath.c_str());
+    }
+}
+
+PATH_STRING GetGVFSEnlistmentRoot(const char *appName)
+{
+    struct stat currentDirectoryStat;
+    if (stat(".", &currentDirectoryStat) != 0)
+    {
+        die(ReturnCode::GetCurrentDirectoryFailure, "stat of current directory failed (%d)\n", errno);
+    }
+
+    PATH_STRING cacheFolder(GetEnlistmentRootCacheFolder());
+    PATH_STRING enlistmentRoot;
+    if (TryReadCachedEnlistmentRoot(cacheFolder, currentDirectoryStat, appName, enlistmentRoot))
+    {
+        return enlistmentRoot;
+    }
+
+    char *currentDirectoryBuffer = getcwd(nullptr, 0);
+    if (currentDirectoryBuffer == nullptr)
+    {
+        die(ReturnCode::GetCurrentDirectoryFailure, "getcwd failed (%d)\n", errno);
+    }
+
+    PATH_STRING currentDirectory(GetFinalPathName(currentDirectoryBuffer));
+    free(currentDirectoryBuffer);
+
+    while (!currentDirectory.empty() && currentDirectory.back() == '/')
+    {
+        currentDirectory.pop_back();
+    }
+
+    // Start in the current directory and walk up the directory tree
+    // until we find a folder that contains the ".gvfs" folder
+    enlistmentRoot = currentDirectory;
     while (1)
     {
-        *lastslash = '\0';
-        DIR* directory = opendir(enlistmentRoot);
-        if (directory == nullptr)
-        {
-            die(ReturnCode::NotInGVFSEnlistment, "Failed to open directory: %s, error: %d\n", enlistmentRoot, errno);
-        }
-        
-        dirent* dirEntry = readdir(directory);
-        while (!gvfsFound && dirEntry != nullptr)
+        if (enlistmentRoot.empty())
         {
-            if (dirEntry->d_type == DT_DIR && strcmp(dirEntry->d_name, ".gvfs") == 0)
-            {
-                gvfsFound = true;
-            }
-            else
-            {
-                dirEntry = readdir(directory);
-            }
+            die(ReturnCode::NotInGVFSEnlistment, "%s must be run from inside a GVFS enlistment\n", appName);
         }
-        
-        closedir(directory);
-        
-        if (gvfsFound)
+
+        if (IsDirectory(enlistmentRoot + DOT_GVFS_RELATIVE_PATH, appName))
         {
             break;
         }
-        
-        if (errno != 0)
-        {
-            die(ReturnCode::NotInGVFSEnlistment, "readdir failed in directory: %s, error: %i\n", enlistmentRoot, errno);
-        }
-        
-        lastslash--;
-        while ((enlistmentRoot != lastslash) && (*lastslash != '/'))
-        {
-            lastslash--;
-        }
-        
-        if (enlistmentRoot == lastslash)
-        {
-            die(ReturnCode::NotInGVFSEnlistment, "%s must be run from inside a GVFS enlistment\n", appName);
-        }
-        
-        *(lastslash + 1) = 0;
-    };
-    
-    *(lastslash) = 0;
-    
-    return PATH_STRING(enlistmentRoot) + "/.gvfs/GVFS_NetCorePipe";
+
+        enlistmentRoot.resize(enlistmentRoot.find_last_of('/'));
+    }
+
+    TryWriteCachedEnlistmentRoot(cacheFolder, currentDirectoryStat, currentDirectory, enlistmentRoot);
+
+    return enlistmentRoot;
+}
+
+PATH_STRING GetGVFSPipeName(const PATH_STRING& enlistmentRoot)
+{
+    // The pipe name is built using the path of the GVFS enlistment root.
+    return enlistmentRoot + "/.gvfs/GVFS_NetCorePipe";
+}
+
+PATH_STRING GetGVFSPipeName(const char *appName)
+{
+    return GetGVFSPipeName(GetGVFSEnlistmentRoot(appName));
 }
 
 PIPE_HANDLE CreatePipeToGVFS(const PATH_STRING& pipeName)
@@ -116,7 +257,7 @@ PIPE_HANDLE CreatePipeToGVFS(const PATH_STRING& pipeName)
     memset(&socket_address, 0, sizeof(struct sockaddr_un));
     
     socket_address.sun_family = AF_UNIX;
-    size_t resultLength = strlcpy(socket_address.sun_path, pipeName.c_str(), sizeof(socket_address.sun_path));
+    size_t resultLength = snprintf(socket_address.sun_path, sizeof(socket_address.sun_path), "%s", pipeName.c_str());
     
     if (resultLength >= sizeof(socket_address.sun_path))
     {
@@ -26,14 +26,21 @@ PATH_STRING GetFinalPathName(const PATH_STRING& path)
         die(ReturnCode::PathNameError, "Could not open oppen handle to %ls to determine final path name, Error: %d\n", path.c_str(), GetLastError());
     }
 
-    wchar_t finalPathByHandle[MAX_PATH] = { 0 };
-    DWORD finalPathSize = GetFinalPathNameByHandleW(fileHandle, finalPathByHandle, MAX_PATH, FILE_NAME_NORMALIZED);
-    if (finalPathSize == 0)
+    std::wstring finalPath(MAX_PATH, L'\0');
+    DWORD finalPathSize = GetFinalPathNameByHandleW(fileHandle, &finalPath[0], static_cast<DWORD>(finalPath.size()), FILE_NAME_NORMALIZED);
+    if (finalPathSize >= finalPath.size())
+    {
+        // The buffer was too small, finalPathSize is the required size (including the null terminator)
+        finalPath.resize(finalPathSize);
+        finalPathSize = GetFinalPathNameByHandleW(fileHandle, &finalPath[0], static_cast<DWORD>(finalPath.size()), FILE_NAME_NORMALIZED);
+    }
+
+    if (finalPathSize == 0 || finalPathSize >= finalPath.size())
     {
         die(ReturnCode::PathNameError, "Could not get final path name by handle for %ls, Error: %d\n", path.c_str(), GetLastError());
     }
 
-    std::wstring finalPath(finalPathByHandle);
+    finalPath.resize(finalPathSize);
 
     // The remarks section of GetFinalPathNameByHandle mentions the return being prefixed with "\\?\" or "\\?\UNC\"
     // More information the prefixes is here http://msdn.microsoft.com/en-us/library/aa365247(v=VS.85).aspx
@@ -52,74 +59,66 @@ PATH_STRING GetFinalPathName(const PATH_STRING& path)
     return finalPath;
 }
 
-PATH_STRING GetGVFSPipeName(const char *appName)
+PATH_STRING GetGVFSEnlistmentRoot(const char *appName)
 {
-    // The pipe name is built using the path of the GVFS enlistment root.
-    // Start in the current directory and walk up the directory tree
-    // until we find a folder that contains the ".gvfs" folder
-
-    const size_t dotGVFSRelativePathLength = sizeof(L"\\.gvfs") / sizeof(wchar_t);
-
-    // TODO 640838: Support paths longer than MAX_PATH
-    wchar_t enlistmentRoot[MAX_PATH];
-    DWORD currentDirResult = GetCurrentDirectoryW(MAX_PATH - dotGVFSRelativePathLength, enlistmentRoot);
-    if (currentDirResult == 0 || currentDirResult > MAX_PATH - dotGVFSRelativePathLength)
+    DWORD currentDirectoryLength = GetCurrentDirectoryW(0, NULL);
+    if (currentDirectoryLength == 0)
     {
         die(ReturnCode::GetCurrentDirectoryFailure, "GetCurrentDirectory failed (%d)\n", GetLastError());
     }
 
-    PATH_STRING finalRootPath(GetFinalPathName(enlistmentRoot));
-    errno_t copyResult = wcscpy_s(enlistmentRoot, finalRootPath.c_str());
-    if (copyResult != 0)
+    std::wstring currentDirectory(currentDirectoryLength, L'\0');
+    currentDirectoryLength = GetCurrentDirectoryW(currentDirectoryLength, &currentDirectory[0]);
+    if (currentDirectoryLength == 0 || currentDirectoryLength >= currentDirectory.size())
     {
-        die(ReturnCode::PipeConnectError, "Could not copy finalRootPath: %ls. Error: %d\n", finalRootPath.c_str(), copyResult);
+        die(ReturnCode::GetCurrentDirectoryFailure, "GetCurrentDirectory failed (%d)\n", GetLastError());
     }
 
-    size_t enlistmentRootLength = wcslen(enlistmentRoot);
-    if ('\\' != enlistmentRoot[enlistmentRootLength - 1])
+    currentDirectory.resize(currentDirectoryLength);
+
+    PATH_STRING enlistmentRoot(GetFinalPathName(currentDirectory));
+    while (!enlistmentRoot.empty() && enlistmentRoot.back() == L'\\')
     {
-        wcscat_s(enlistmentRoot, L"\\");
-        enlistmentRootLength++;
+        enlistmentRoot.pop_back();
     }
 
-    // Walk up enlistmentRoot looking for a folder named .gvfs
-    wchar_t* lastslash = enlistmentRoot + enlistmentRootLength - 1;
-    WIN32_FIND_DATAW findFileData;
-    HANDLE dotGVFSHandle;
+    // Start in the current directory and walk up the directory tree
+    // until we find a folder that contains the ".gvfs" folder
     while (1)
     {
-        wcscat_s(lastslash, MAX_PATH - (lastslash - enlistmentRoot), L".gvfs");
-        dotGVFSHandle = FindFirstFileW(enlistmentRoot, &findFileData);
-        if (dotGVFSHandle != INVALID_HANDLE_VALUE)
+        PATH_STRING dotGVFSPath(enlistmentRoot + L"\\.gvfs");
+        DWORD attributes = GetFileAttributesW(dotGVFSPath.c_str());
+        if (attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY))
         {
-            FindClose(dotGVFSHandle);
-            if (findFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-            {
-                break;
-            }
-        }
-
-        lastslash--;
-        while ((enlistmentRoot != lastslash) && (*lastslash != '\\'))
-        {
-            lastslash--;
+            break;
         }
 
-        if (enlistmentRoot == lastslash)
+        size_t lastSlash = enlistmentRoot.find_last_of(L'\\');
+        if (lastSlash == std::wstring::npos || lastSlash == 0)
         {
             die(ReturnCode::NotInGVFSEnlistment, "%s must be run from inside a GVFS enlistment\n", appName);
         }
 
-        *(lastslash + 1) = 0;
-    };
+        enlistmentRoot.resize(lastSlash);
+    }
 
-    *(lastslash) = 0;
+    return enlistmentRoot;
+}
 
-    PATH_STRING namedPipe(CharUpperW(enlistmentRoot));
+PATH_STRING GetGVFSPipeName(const PATH_STRING& enlistmentRoot)
+{
+    // The pipe name is built using the path of the GVFS enlistment root.
+    PATH_STRING namedPipe(enlistmentRoot);
+    CharUpperW(&namedPipe[0]);
     std::replace(namedPipe.begin(), namedPipe.end(), L':', L'_');
     return L"\\\\.\\pipe\\GVFS_" + namedPipe;
 }
 
+PATH_STRING GetGVFSPipeName(const char *appName)
+{
+    return GetGVFSPipeName(GetGVFSEnlistmentRoot(appName));
+}
+
 PIPE_HANDLE CreatePipeToGVFS(const PATH_STRING& pipeName)
 {
     PIPE_HANDLE pipeHandle;
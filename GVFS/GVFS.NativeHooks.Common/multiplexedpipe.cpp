@@ -0,0 +1,143 @@
+#include "stdafx.h"
+#include "multiplexedpipe.h"
+
+#define MULTIPLEXING_REQUEST "MUX|1\n"
+#define MULTIPLEXING_SUCCESS_RESULT "S"
+
+// Frame header: 4 byte message length and 4 byte request ID, both little-endian
+#define FRAME_HEADER_LENGTH 8
+#define FRAME_MAX_MESSAGE_LENGTH (64 * 1024 * 1024)
+
+static void WriteUInt32(char* buffer, uint32_t value)
+{
+    buffer[0] = static_cast<char>(value);
+    buffer[1] = static_cast<char>(value >> 8);
+    buffer[2] = static_cast<char>(value >> 16);
+    buffer[3] = static_cast<char>(value >> 24);
+}
+
+static uint32_t ReadUInt32(const char* buffer)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(buffer);
+    return
+        static_cast<uint32_t>(bytes[0]) |
+        (static_cast<uint32_t>(bytes[1]) << 8) |
+        (static_cast<uint32_t>(bytes[2]) << 16) |
+        (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+MultiplexedPipe::MultiplexedPipe(PIPE_HANDLE pipe)
+    : pipe(pipe)
+    , nextRequestId(0)
+{
+}
+
+bool MultiplexedPipe::TryEnable()
+{
+    this->WriteToGVFS(MULTIPLEXING_REQUEST, sizeof(MULTIPLEXING_REQUEST) - 1);
+
+    // GVFS does not send anything else until it has received a request, and so reading
+    // the whole response line cannot consume the start of a frame
+    std::string response;
+    char buffer[64];
+    while (response.empty() || response.back() != '\n')
+    {
+        unsigned long bytesRead = 0;
+        int error = 0;
+        if (!ReadFromPipe(this->pipe, buffer, sizeof(buffer), &bytesRead, &error) || bytesRead == 0)
+        {
+            die(ReturnCode::PipeReadFailed, "Read response from pipe failed (%d)\n", error);
+        }
+
+        response.append(buffer, bytesRead);
+    }
+
+    response.pop_back();
+    return response == MULTIPLEXING_SUCCESS_RESULT;
+}
+
+uint32_t MultiplexedPipe::SendRequest(const std::string& message)
+{
+    if (message.length() > FRAME_MAX_MESSAGE_LENGTH)
+    {
+        die(ReturnCode::PipeWriteFailed, "Request too long (%d bytes)\n", (int)message.length());
+    }
+
+    uint32_t requestId = this->nextRequestId++;
+
+    std::string frame(FRAME_HEADER_LENGTH, '\0');
+    WriteUInt32(&frame[0], static_cast<uint32_t>(message.length()));
+    WriteUInt32(&frame[4], requestId);
+    frame += message;
+
+    this->WriteToGVFS(frame.c_str(), static_cast<unsigned long>(frame.length()));
+    return requestId;
+}
+
+std::string MultiplexedPipe::ReadResponse(uint32_t requestId)
+{
+    while (true)
+    {
+        auto received = this->receivedResponses.find(requestId);
+        if (received != this->receivedResponses.end())
+        {
+            std::string response(std::move(received->second.front()));
+            received->second.pop_front();
+            if (received->second.empty())
+            {
+                this->receivedResponses.erase(received);
+            }
+
+            return response;
+        }
+
+        char header[FRAME_HEADER_LENGTH];
+        this->ReadFromGVFS(header, FRAME_HEADER_LENGTH);
+
+        uint32_t messageLength = ReadUInt32(header);
+        if (messageLength > FRAME_MAX_MESSAGE_LENGTH)
+        {
+            die(ReturnCode::PipeReadFailed, "Invalid response frame length: %u\n", messageLength);
+        }
+
+        std::string message(messageLength, '\0');
+        if (messageLength > 0)
+        {
+            this->ReadFromGVFS(&message[0], messageLength);
+        }
+
+        uint32_t responseId = ReadUInt32(header + 4);
+        if (responseId == requestId)
+        {
+            return message;
+        }
+
+        this->receivedResponses[responseId].push_back(std::move(message));
+    }
+}
+
+void MultiplexedPipe::ReadFromGVFS(char* buffer, unsigned long length)
+{
+    unsigned long totalBytesRead = 0;
+    while (totalBytesRead < length)
+    {
+        unsigned long bytesRead = 0;
+        int error = 0;
+        if (!ReadFromPipe(this->pipe, buffer + totalBytesRead, length - totalBytesRead, &bytesRead, &error) || bytesRead == 0)
+        {
+            die(ReturnCode::PipeReadFailed, "Read response from pipe failed (%d)\n", error);
+        }
+
+        totalBytesRead += bytesRead;
+    }
+}
+
+void MultiplexedPipe::WriteToGVFS(const char* buffer, unsigned long length)
+{
+    unsigned long bytesWritten = 0;
+    int error = 0;
+    if (!WriteToPipe(this->pipe, buffer, length, &bytesWritten, &error) || bytesWritten != length)
+    {
+        die(ReturnCode::PipeWriteFailed, "Failed to write to pipe (%d)\n", error);
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+#include <deque>
+#include <unordered_map>
+#include "common.h"
+
+// Client for a GVFS pipe connection that has been switched to multiplexed mode, where every request
+// and response is a frame tagged with a request ID (see GVFS.Common\NamedPipes\MultiplexedFrame.cs).
+// Any number of requests can be outstanding at once and GVFS can answer them in any order.
+class MultiplexedPipe
+{
+public:
+    explicit MultiplexedPipe(PIPE_HANDLE pipe);
+
+    // Switches the connection to multiplexed mode.  Returns false if GVFS does not support it, in
+    // which case the connection can still be used for line-based requests.
+    bool TryEnable();
+
+    // Sends message (e.g. "DLO|<SHA>") and returns the ID of the request
+    uint32_t SendRequest(const std::string& message);
+
+    // Waits for the next response to requestId.  Responses to other requests that arrive
+    // first are kept until they are asked for.
+    std::string ReadResponse(uint32_t requestId);
+
+private:
+    void ReadFromGVFS(char* buffer, unsigned long length);
+    void WriteToGVFS(const char* buffer, unsigned long length);
+
+    PIPE_HANDLE pipe;
+    uint32_t nextRequestId;
+    std::unordered_map<uint32_t, std::deque<std::string>> receivedResponses;
+};
@@ -0,0 +1,275 @@
+#include "stdafx.h"
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <errno.h>
+#include <unistd.h>
+#endif
+#include <string.h>
+#include "packet.h"
+#include "common.h"
+
+#define LARGE_PACKET_MAX 65520
+#define PACKET_HEADER_LENGTH 4
+
+// The read buffer can always hold a complete packet after the unread data is moved to its
+// start, plus one byte for NUL terminating a payload that does not end with LF
+#define PACKET_READ_BUFFER_LENGTH (2 * LARGE_PACKET_MAX)
+#define PACKET_WRITE_BUFFER_LENGTH LARGE_PACKET_MAX
+
+static char read_buffer[PACKET_READ_BUFFER_LENGTH + 1];
+static size_t read_start;
+static size_t read_end;
+
+// The byte that was replaced with the NUL terminator of the last packet returned by packet_txt_read
+static char *terminator_position;
+static char terminator_replaced_char;
+
+static char write_buffer[PACKET_WRITE_BUFFER_LENGTH];
+static size_t write_length;
+
+static void set_packet_header(char *buf, const size_t size)
+{
+	static char hexchar[] = "0123456789abcdef";
+
+#define hex(a) (hexchar[(a) & 15])
+	buf[0] = hex(size >> 12);
+	buf[1] = hex(size >> 8);
+	buf[2] = hex(size >> 4);
+	buf[3] = hex(size);
+#undef hex
+}
+
+const signed char hexval_table[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 00-07 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 08-0f */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 10-17 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 18-1f */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 20-27 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 28-2f */
+	0,  1,  2,  3,  4,  5,  6,  7,		/* 30-37 */
+	8,  9, -1, -1, -1, -1, -1, -1,		/* 38-3f */
+	-1, 10, 11, 12, 13, 14, 15, -1,		/* 40-47 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 48-4f */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 50-57 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 58-5f */
+	-1, 10, 11, 12, 13, 14, 15, -1,		/* 60-67 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 68-67 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 70-77 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 78-7f */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 80-87 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 88-8f */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 90-97 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* 98-9f */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* a0-a7 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* a8-af */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* b0-b7 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* b8-bf */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* c0-c7 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* c8-cf */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* d0-d7 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* d8-df */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* e0-e7 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* e8-ef */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* f0-f7 */
+	-1, -1, -1, -1, -1, -1, -1, -1,		/* f8-ff */
+};
+
+static inline unsigned int hexval(unsigned char c)
+{
+	return hexval_table[c];
+}
+
+static inline int hex2chr(const char *s)
+{
+	int val = hexval(s[0]);
+	return (val < 0) ? val : (val << 4) | hexval(s[1]);
+}
+
+static int packet_length(const char *packetlen)
+{
+	int val = hex2chr(packetlen);
+	return (val < 0) ? val : (val << 8) | hex2chr(packetlen + 2);
+}
+
+#ifdef _WIN32
+static int read_stdin(char *buf, size_t count)
+{
+	return _read(_fileno(stdin), buf, static_cast<unsigned int>(count));
+}
+
+static int write_stdout(const char *buf, size_t count)
+{
+	return _write(_fileno(stdout), buf, static_cast<unsigned int>(count));
+}
+#else
+static ssize_t read_stdin(char *buf, size_t count)
+{
+	ssize_t ret;
+	do
+	{
+		ret = read(STDIN_FILENO, buf, count);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+
+static ssize_t write_stdout(const char *buf, size_t count)
+{
+	ssize_t ret;
+	do
+	{
+		ret = write(STDOUT_FILENO, buf, count);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+#endif
+
+/* make sure at least "count" unread bytes are in the read buffer, returns false if stdin was closed first */
+static bool fill_read_buffer(size_t count)
+{
+	if (read_start + count > PACKET_READ_BUFFER_LENGTH)
+	{
+		memmove(read_buffer, read_buffer + read_start, read_end - read_start);
+		read_end -= read_start;
+		read_start = 0;
+	}
+
+	while (read_end - read_start < count)
+	{
+		auto bytes_read = read_stdin(read_buffer + read_end, PACKET_READ_BUFFER_LENGTH - read_end);
+		if (bytes_read < 0)
+		{
+			die(-1, "error reading packet (%d)", errno);
+		}
+		if (bytes_read == 0)
+		{
+			return false;
+		}
+
+		read_end += bytes_read;
+	}
+
+	return true;
+}
+
+static size_t packet_bin_read(char **buf)
+{
+	size_t len;
+
+	/* if we timeout waiting for input, exit and git will restart us if needed */
+	if (!fill_read_buffer(PACKET_HEADER_LENGTH))
+	{
+		if (read_start == read_end)
+		{
+			exit(0);
+		}
+
+		die(-1, "invalid packet length");
+	}
+
+	const char *packetlen = read_buffer + read_start;
+	len = packet_length(packetlen);
+	if (!len)
+	{
+		read_start += PACKET_HEADER_LENGTH;
+		return 0;
+	}
+	if (len < PACKET_HEADER_LENGTH || len > LARGE_PACKET_MAX)
+	{
+		die(-1, "protocol error: bad line length character: %.4s", packetlen);
+	}
+	if (!fill_read_buffer(len))
+	{
+		die(-1, "invalid packet (%d bytes expected; %d bytes read)", (int)len, (int)(read_end - read_start));
+	}
+
+	*buf = read_buffer + read_start + PACKET_HEADER_LENGTH;
+	read_start += len;
+	return len - PACKET_HEADER_LENGTH;
+}
+
+size_t packet_txt_read(const char **line)
+{
+	char *buf = NULL;
+	size_t len;
+
+	if (terminator_position)
+	{
+		*terminator_position = terminator_replaced_char;
+		terminator_position = NULL;
+	}
+
+	len = packet_bin_read(&buf);
+	if (!len)
+	{
+		*line = "";
+		return 0;
+	}
+
+	if (buf[len - 1] == '\n')
+	{
+		len--;
+	}
+	else
+	{
+		/* the byte after the payload belongs to the next packet, put it back on the next read */
+		terminator_position = buf + len;
+		terminator_replaced_char = *terminator_position;
+	}
+
+	buf[len] = 0;
+	*line = buf;
+	return len;
+}
+
+static void flush_write_buffer()
+{
+	size_t total_written = 0;
+	while (total_written < write_length)
+	{
+		auto written = write_stdout(write_buffer + total_written, write_length - total_written);
+		if (written <= 0)
+		{
+			die(-1, "error writing packet (%d)", errno);
+		}
+
+		total_written += written;
+	}
+
+	write_length = 0;
+}
+
+void packet_txt_write(const char *buf)
+{
+	size_t count = strlen(buf);
+	size_t len = PACKET_HEADER_LENGTH + count + 1;
+	if (len > LARGE_PACKET_MAX)
+	{
+		die(-1, "protocol error: impossibly long line");
+	}
+
+	if (write_length + len > PACKET_WRITE_BUFFER_LENGTH)
+	{
+		flush_write_buffer();
+	}
+
+	char *packet = write_buffer + write_length;
+	set_packet_header(packet, len);
+	memcpy(packet + PACKET_HEADER_LENGTH, buf, count);
+	packet[len - 1] = '\n';
+	write_length += len;
+}
+
+void packet_flush()
+{
+	if (write_length + PACKET_HEADER_LENGTH > PACKET_WRITE_BUFFER_LENGTH)
+	{
+		flush_write_buffer();
+	}
+
+	memcpy(write_buffer + write_length, "0000", PACKET_HEADER_LENGTH);
+	write_length += PACKET_HEADER_LENGTH;
+	flush_write_buffer();
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <stddef.h>
+
+// Buffered pkt-line reader and writer used by the hooks that talk to git over stdin/stdout
+// (see Git Documentation/technical/protocol-common.txt).
+//
+// Incoming packets are parsed in place from a refillable read buffer.  Outgoing packets are
+// appended to a response buffer that is sent to git with a single write by packet_flush.
+
+// Reads the next packet from stdin and returns its length (0 for a flush packet).
+// *line is set to the NUL terminated payload (without its trailing LF), it points into the
+// read buffer and is only valid until the next call to packet_txt_read.
+// Exits the process when git closes stdin.
+size_t packet_txt_read(const char **line);
+
+// Appends a text packet to the pending response.
+void packet_txt_write(const char *buf);
+
+// Appends a flush packet and sends the pending response to git.
+void packet_flush();
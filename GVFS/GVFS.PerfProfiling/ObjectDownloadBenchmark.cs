@@ -0,0 +1,226 @@
+﻿using GVFS.Common;
+using GVFS.Common.FileSystem;
+using GVFS.Common.Git;
+using GVFS.Common.Http;
+using GVFS.Common.Tracing;
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Linq;
+using System.Net;
+using System.Net.Sockets;
+using System.Text;
+using System.Text.RegularExpressions;
+using System.Threading;
+
+namespace GVFS.PerfProfiling
+{
+    /// <summary>
+    /// Measures how quickly the mount downloads the objects that GVFS.ReadObjectHook asks for, either with one
+    /// request per object (DLO, used for version 1 of the read-object protocol) or with one batched request
+    /// (DLOB, used for version 2). The objects come from a stand-in object server on localhost, so the
+    /// results only include the cost of each request and not the round trip to a real server.
+    /// </summary>
+    public class ObjectDownloadBenchmark : IDisposable
+    {
+        private const int ObjectSize = 1024;
+
+        private static readonly int[] ObjectCounts = { 1, 100, 10000 };
+
+        private readonly string enlistmentRoot;
+        private readonly HttpListener server;
+        private readonly Thread serverThread;
+        private readonly GVFSGitObjects gitObjects;
+        private readonly byte[] objectContents;
+
+        private int requestCount;
+
+        public ObjectDownloadBenchmark(ITracer tracer, string gitBinPath)
+        {
+            this.objectContents = Encoding.ASCII.GetBytes(new string('x', ObjectSize));
+
+            string serverUrl = "http://localhost:" + GetAvailablePort();
+            this.server = new HttpListener();
+            this.server.Prefixes.Add(serverUrl + "/");
+            this.server.Start();
+            this.serverThread = new Thread(this.ServeRequests) { IsBackground = true };
+            this.serverThread.Start();
+
+            this.enlistmentRoot = Path.Combine(Path.GetTempPath(), "GVFS_PerfProfiling_" + Guid.NewGuid().ToString("N"));
+            GVFSEnlistment enlistment = new GVFSEnlistment(this.enlistmentRoot, serverUrl, gitBinPath, gvfsHooksRoot: null);
+            enlistment.InitializeCachePathsFromKey(Path.Combine(this.enlistmentRoot, ".gvfsCache"), "benchmark");
+            Directory.CreateDirectory(enlistment.GitObjectsRoot);
+
+            // The stand-in server does not check credentials, but the requestor still asks git for them
+            GitProcess.Init(enlistment);
+            new GitProcess(enlistment).SetInLocalConfig("credential.helper", "!f() { echo username=benchmark; echo password=benchmark; }; f");
+
+            PhysicalFileSystem fileSystem = new PhysicalFileSystem();
+            GVFSContext context = new GVFSContext(tracer, fileSystem, repository: null, enlistment: enlistment);
+            GitObjectsHttpRequestor objectRequestor = new GitObjectsHttpRequestor(
+                tracer,
+                enlistment,
+                new CacheServerInfo(serverUrl, "StandIn"),
+                new RetryConfig());
+            this.gitObjects = new GVFSGitObjects(context, objectRequestor);
+        }
+
+        public static void Run(ITracer tracer, string gitBinPath)
+        {
+            using (ObjectDownloadBenchmark benchmark = new ObjectDownloadBenchmark(tracer, gitBinPath))
+            {
+                // Get credentials and warm up both download paths before measuring them
+                benchmark.MeasureDownloads(objectCount: 2, report: false);
+
+                foreach (int objectCount in ObjectCounts)
+                {
+                    benchmark.MeasureDownloads(objectCount, report: true);
+                }
+            }
+        }
+
+        public void Dispose()
+        {
+            this.server.Stop();
+            this.serverThread.Join();
+            this.server.Close();
+
+            try
+            {
+                Directory.Delete(this.enlistmentRoot, recursive: true);
+            }
+            catch (IOException)
+            {
+            }
+        }
+
+        private static int GetAvailablePort()
+        {
+            TcpListener listener = new TcpListener(IPAddress.Loopback, 0);
+            listener.Start();
+            int port = ((IPEndPoint)listener.LocalEndpoint).Port;
+            listener.Stop();
+            return port;
+        }
+
+        private static List<string> CreateObjectIds(int count)
+        {
+            Random random = new Random();
+            byte[] bytes = new byte[20];
+            List<string> objectIds = new List<string>(count);
+            for (int i = 0; i < count; ++i)
+            {
+                random.NextBytes(bytes);
+                objectIds.Add(SHA1Util.HexStringFromBytes(bytes));
+            }
+
+            return objectIds;
+        }
+
+        private void MeasureDownloads(int objectCount, bool report)
+        {
+            // Every pass asks for objects that have not been downloaded yet
+            List<string> objectIds = CreateObjectIds(objectCount);
+            int requestsBefore = Volatile.Read(ref this.requestCount);
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            foreach (string objectId in objectIds)
+            {
+                if (this.gitObjects.TryDownloadAndSaveObject(objectId, GVFSGitObjects.RequestSource.NamedPipeMessage) != GitObjects.DownloadAndSaveObjectResult.Success)
+                {
+                    throw new InvalidOperationException("Failed to download " + objectId);
+                }
+            }
+
+            TimeSpan perObjectTime = stopwatch.Elapsed;
+            int perObjectRequests = Volatile.Read(ref this.requestCount) - requestsBefore;
+
+            objectIds = CreateObjectIds(objectCount);
+            requestsBefore = Volatile.Read(ref this.requestCount);
+            stopwatch.Restart();
+            GitObjects.DownloadAndSaveObjectResult[] results = this.gitObjects.TryDownloadAndSaveObjects(objectIds, GVFSGitObjects.RequestSource.NamedPipeMessage);
+            if (results.Any(result => result != GitObjects.DownloadAndSaveObjectResult.Success))
+            {
+                throw new InvalidOperationException("Failed to download a batch of " + objectCount + " objects");
+            }
+
+            TimeSpan batchedTime = stopwatch.Elapsed;
+            int batchedRequests = Volatile.Read(ref this.requestCount) - requestsBefore;
+
+            if (!report)
+            {
+                return;
+            }
+
+            Console.WriteLine(
+                $"{objectCount} objects: one request per object {perObjectTime.TotalMilliseconds:F1} ms ({perObjectRequests} requests, " +
+                $"{objectCount / perObjectTime.TotalSeconds:F0} objects/s), batched {batchedTime.TotalMilliseconds:F1} ms ({batchedRequests} requests, " +
+                $"{objectCount / batchedTime.TotalSeconds:F0} objects/s)");
+        }
+
+        private void ServeRequests()
+        {
+            while (this.server.IsListening)
+            {
+                HttpListenerContext context;
+                try
+                {
+                    context = this.server.GetContext();
+                }
+                catch (HttpListenerException)
+                {
+                    return;
+                }
+                catch (ObjectDisposedException)
+                {
+                    return;
+                }
+
+                Interlocked.Increment(ref this.requestCount);
+                ThreadPool.QueueUserWorkItem(state => this.ServeRequest((HttpListenerContext)state), context);
+            }
+        }
+
+        private void ServeRequest(HttpListenerContext context)
+        {
+            // Answers GET <objects endpoint>/<sha> with a loose object, and POST <objects endpoint> with every
+            // requested object in the batched loose objects format (see BatchedLooseObjectDeserializer)
+            using (HttpListenerResponse response = context.Response)
+            {
+                if (context.Request.HttpMethod == "GET")
+                {
+                    response.ContentType = GVFSConstants.MediaTypes.LooseObjectMediaType;
+                    response.ContentLength64 = this.objectContents.Length;
+                    response.OutputStream.Write(this.objectContents, 0, this.objectContents.Length);
+                    return;
+                }
+
+                string body;
+                using (StreamReader reader = new StreamReader(context.Request.InputStream))
+                {
+                    body = reader.ReadToEnd();
+                }
+
+                MatchCollection objectIds = Regex.Matches(body, "[0-9a-fA-F]{40}");
+                using (MemoryStream batch = new MemoryStream())
+                using (BinaryWriter writer = new BinaryWriter(batch))
+                {
+                    writer.Write(new byte[] { (byte)'G', (byte)'V', (byte)'F', (byte)'S', (byte)' ', 1 });
+                    foreach (Match objectId in objectIds)
+                    {
+                        writer.Write(SHA1Util.BytesFromHexString(objectId.Value));
+                        writer.Write((long)this.objectContents.Length);
+                        writer.Write(this.objectContents);
+                    }
+
+                    writer.Write(new byte[20]);
+                    writer.Flush();
+
+                    response.ContentType = GVFSConstants.MediaTypes.CustomLooseObjectsMediaType;
+                    response.ContentLength64 = batch.Length;
+                    batch.WriteTo(response.OutputStream);
+                }
+            }
+        }
+    }
+}
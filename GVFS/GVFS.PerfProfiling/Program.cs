@@ -1,11 +1,17 @@
 ﻿using GVFS.Common;
+using GVFS.Common.FileSystem;
+using GVFS.Common.NamedPipes;
+using GVFS.Common.Tracing;
 using GVFS.PlatformLoader;
 using GVFS.Virtualization.Projection;
 using System;
 using System.Collections.Generic;
 using System.Diagnostics;
 using System.IO;
+using System.IO.MemoryMappedFiles;
+using System.IO.Pipes;
 using System.Linq;
+using System.Text;
 
 namespace GVFS.PerfProfiling
 {
@@ -17,9 +23,22 @@ namespace GVFS.PerfProfiling
             ValidateIndex = 1 << 0,
             RebuildProjection = 1 << 1,
             ValidateModifiedPaths = 1 << 2,
+            ListModifiedPaths = 1 << 3,
+            ListModifiedPathsRepeatedly = 1 << 4,
+            ListModifiedPathsIncrementally = 1 << 5,
+            CompareModifiedPathsSnapshotToPipe = 1 << 6,
+            DownloadObjects = 1 << 7,
             All = -1,
         }
 
+        private const int SyntheticModifiedPathCount = 1000000;
+        private const int RepeatedModifiedPathsCount = 500000;
+        private const int RepeatedModifiedPathsQueryCount = 20;
+        private const int PathsAddedBetweenModifiedPathsQueries = 5;
+        private const int SnapshotComparisonRuns = 5;
+
+        private static readonly int[] SnapshotComparisonPathCounts = { 10000, 100000, 1000000 };
+
         static void Main(string[] args)
         {
             GVFSPlatformLoader.Initialize();
@@ -40,12 +59,21 @@ namespace GVFS.PerfProfiling
             }
 
             ProfilingEnvironment environment = new ProfilingEnvironment(enlistmentRootPath);
+            List<string> syntheticModifiedPaths = Enumerable.Range(0, SyntheticModifiedPathCount)
+                .Select(i => $"folder{i % 1000}/subfolder{i % 37}/file{i}.txt")
+                .ToList();
+            ModifiedPathsDatabase repeatedModifiedPaths = CreateSyntheticModifiedPathsDatabase(environment.Context.Tracer, RepeatedModifiedPathsCount);
 
             Dictionary<TestsToRun, Action> allTests = new Dictionary<TestsToRun, Action>
             {
                 { TestsToRun.ValidateIndex, () => GitIndexProjection.ReadIndex(environment.Context.Tracer, Path.Combine(environment.Enlistment.WorkingDirectoryRoot, GVFSConstants.DotGit.Index)) },
                 { TestsToRun.RebuildProjection, () => environment.FileSystemCallbacks.GitIndexProjectionProfiler.ForceRebuildProjection() },
                 { TestsToRun.ValidateModifiedPaths, () => environment.FileSystemCallbacks.GitIndexProjectionProfiler.ForceAddMissingModifiedPaths(environment.Context.Tracer) },
+                { TestsToRun.ListModifiedPaths, () => ListModifiedPaths(environment.Context.Tracer, syntheticModifiedPaths) },
+                { TestsToRun.ListModifiedPathsRepeatedly, () => ListModifiedPathsRepeatedly(environment.Context.Tracer, repeatedModifiedPaths, incremental: false) },
+                { TestsToRun.ListModifiedPathsIncrementally, () => ListModifiedPathsRepeatedly(environment.Context.Tracer, repeatedModifiedPaths, incremental: true) },
+                { TestsToRun.CompareModifiedPathsSnapshotToPipe, () => CompareModifiedPathsSnapshotToPipe(environment.Context.Tracer) },
+                { TestsToRun.DownloadObjects, () => ObjectDownloadBenchmark.Run(environment.Context.Tracer, environment.Enlistment.GitBinPath) },
             };
 
             long before = GetMemoryUsage();
@@ -66,6 +94,216 @@ namespace GVFS.PerfProfiling
             Console.Read();
         }
 
+        private static void ListModifiedPaths(ITracer tracer, List<string> modifiedPaths)
+        {
+            // Measures sending a modified paths list to a client that reads it the same way that
+            // GVFS.VirtualFileSystemHook does (in large blocks until the terminating newline)
+            string pipeName = CreatePipeName();
+            using (NamedPipeServer server = NamedPipeServer.StartNewServer(
+                pipeName,
+                tracer,
+                (requestTracer, request, connection) => connection.TrySendResponse(
+                    NamedPipeMessages.ModifiedPaths.SuccessResult,
+                    modifiedPaths,
+                    NamedPipeMessages.ModifiedPaths.PathTerminator)))
+            {
+                string responsePrefix;
+                long responseLength = SendModifiedPathsRequest(pipeName, NamedPipeMessages.ModifiedPaths.FullListVersion, out responsePrefix);
+                Console.WriteLine($"Modified paths response: {FormatByteCount(responseLength)}");
+            }
+        }
+
+        private static void ListModifiedPathsRepeatedly(ITracer tracer, ModifiedPathsDatabase modifiedPaths, bool incremental)
+        {
+            // Measures asking for the modified paths over and over, with a handful of paths added in between, either for
+            // the full list every time or (like GVFS.VirtualFileSystemHook) for the paths added since the previous response
+            string pipeName = CreatePipeName();
+            using (NamedPipeServer server = NamedPipeServer.StartNewServer(
+                pipeName,
+                tracer,
+                (requestTracer, request, connection) => SendModifiedPaths(modifiedPaths, request, connection)))
+            {
+                string generationToken = null;
+                long totalResponseLength = 0;
+                for (int i = 0; i < RepeatedModifiedPathsQueryCount; ++i)
+                {
+                    bool isRetryable;
+                    for (int j = 0; j < PathsAddedBetweenModifiedPathsQueries; ++j)
+                    {
+                        modifiedPaths.TryAdd($"added/{Guid.NewGuid():N}.txt", isFolder: false, isRetryable: out isRetryable);
+                    }
+
+                    string version = incremental ? NamedPipeMessages.ModifiedPaths.IncrementalListVersion : NamedPipeMessages.ModifiedPaths.FullListVersion;
+                    if (generationToken != null)
+                    {
+                        version += "|" + generationToken;
+                    }
+
+                    string responsePrefix;
+                    totalResponseLength += SendModifiedPathsRequest(pipeName, version, out responsePrefix);
+                    if (incremental)
+                    {
+                        generationToken = responsePrefix.Split('|')[1];
+                    }
+                }
+
+                Console.WriteLine($"{RepeatedModifiedPathsQueryCount} modified paths responses: {FormatByteCount(totalResponseLength)}");
+            }
+        }
+
+        private static void CompareModifiedPathsSnapshotToPipe(ITracer tracer)
+        {
+            // Measures getting the full list over the pipe against reading it from the memory-mapped snapshot
+            // that GVFS.VirtualFileSystemHook uses when the snapshot is up to date
+            foreach (int pathCount in SnapshotComparisonPathCounts)
+            {
+                ModifiedPathsDatabase modifiedPaths = CreateSyntheticModifiedPathsDatabase(tracer, pathCount);
+                string snapshotPath = Path.Combine(Path.GetDirectoryName(modifiedPaths.DataFilePath), GVFSConstants.DotGVFS.ModifiedPathsSnapshotName);
+                string pipeName = CreatePipeName();
+                using (ModifiedPathsSnapshot snapshot = new ModifiedPathsSnapshot(tracer, new PhysicalFileSystem(), snapshotPath))
+                using (NamedPipeServer server = NamedPipeServer.StartNewServer(
+                    pipeName,
+                    tracer,
+                    (requestTracer, request, connection) => SendModifiedPaths(modifiedPaths, request, connection)))
+                {
+                    modifiedPaths.SetSnapshot(snapshot);
+
+                    Stopwatch stopwatch = Stopwatch.StartNew();
+                    modifiedPaths.UpdateSnapshot();
+                    TimeSpan writeTime = stopwatch.Elapsed;
+
+                    string responsePrefix;
+                    TimeSpan pipeTime = MedianTime(() => SendModifiedPathsRequest(pipeName, NamedPipeMessages.ModifiedPaths.FullListVersion, out responsePrefix));
+                    TimeSpan snapshotTime = MedianTime(() => ReadModifiedPathsSnapshot(snapshotPath));
+
+                    Console.WriteLine(
+                        $"{pathCount} modified paths: pipe {pipeTime.TotalMilliseconds} ms, snapshot {snapshotTime.TotalMilliseconds} ms " +
+                        $"(snapshot written in {writeTime.TotalMilliseconds} ms)");
+
+                    modifiedPaths.SetSnapshot(null);
+                }
+
+                modifiedPaths.Dispose();
+            }
+        }
+
+        private static long ReadModifiedPathsSnapshot(string snapshotPath)
+        {
+            // Reads the snapshot the same way as GVFS.VirtualFileSystemHook (see ModifiedPathsSnapshot for the format)
+            const int CurrentGenerationOffset = 8;
+            const int SnapshotGenerationOffset = 16;
+            const int PathsLengthOffset = 24;
+            const int HeaderLength = 32;
+
+            using (FileStream stream = new FileStream(snapshotPath, FileMode.Open, FileAccess.Read, FileShare.ReadWrite | FileShare.Delete))
+            using (MemoryMappedFile snapshotFile = MemoryMappedFile.CreateFromFile(stream, null, 0, MemoryMappedFileAccess.Read, HandleInheritability.None, leaveOpen: true))
+            using (MemoryMappedViewAccessor header = snapshotFile.CreateViewAccessor(0, HeaderLength, MemoryMappedFileAccess.Read))
+            {
+                long pathsLength = header.ReadInt64(PathsLengthOffset);
+                if (header.ReadInt64(CurrentGenerationOffset) != header.ReadInt64(SnapshotGenerationOffset))
+                {
+                    throw new InvalidOperationException("Modified paths snapshot is stale");
+                }
+
+                using (MemoryMappedViewStream paths = snapshotFile.CreateViewStream(HeaderLength, pathsLength, MemoryMappedFileAccess.Read))
+                {
+                    paths.CopyTo(Stream.Null, 64 * 1024);
+                }
+
+                return pathsLength;
+            }
+        }
+
+        private static TimeSpan MedianTime(Action action)
+        {
+            List<TimeSpan> times = new List<TimeSpan>();
+            for (int i = 0; i < SnapshotComparisonRuns; ++i)
+            {
+                Stopwatch stopwatch = Stopwatch.StartNew();
+                action();
+                times.Add(stopwatch.Elapsed);
+            }
+
+            times.Sort();
+            return times[times.Count / 2];
+        }
+
+        private static void SendModifiedPaths(ModifiedPathsDatabase modifiedPaths, string request, NamedPipeServer.Connection connection)
+        {
+            // Responds the same way as InProcessMount.HandleModifiedPathsListRequest
+            NamedPipeMessages.ModifiedPaths.Request modifiedPathsRequest = new NamedPipeMessages.ModifiedPaths.Request(NamedPipeMessages.Message.FromString(request));
+            if (modifiedPathsRequest.Version == NamedPipeMessages.ModifiedPaths.FullListVersion)
+            {
+                connection.TrySendResponse(NamedPipeMessages.ModifiedPaths.SuccessResult, modifiedPaths.GetAllModifiedPaths(), NamedPipeMessages.ModifiedPaths.PathTerminator);
+                return;
+            }
+
+            string result = NamedPipeMessages.ModifiedPaths.AddedPathsResult;
+            string generationToken;
+            IReadOnlyList<string> paths;
+            if (!modifiedPaths.TryGetModifiedPathsAddedSince(modifiedPathsRequest.GenerationToken, out paths, out generationToken))
+            {
+                result = NamedPipeMessages.ModifiedPaths.FullListResult;
+                paths = modifiedPaths.GetAllModifiedPaths(out generationToken);
+            }
+
+            connection.TrySendResponse(new NamedPipeMessages.Message(result, generationToken).ToString(), paths, NamedPipeMessages.ModifiedPaths.PathTerminator);
+        }
+
+        private static long SendModifiedPathsRequest(string pipeName, string version, out string responsePrefix)
+        {
+            using (NamedPipeClientStream pipe = new NamedPipeClientStream(pipeName))
+            {
+                pipe.Connect();
+
+                byte[] request = Encoding.UTF8.GetBytes(new NamedPipeMessages.Message(NamedPipeMessages.ModifiedPaths.ListRequest, version).ToString() + "\n");
+                pipe.Write(request, 0, request.Length);
+                pipe.Flush();
+
+                // Read the response in large blocks until the terminating newline, like GVFS.VirtualFileSystemHook
+                byte[] buffer = new byte[64 * 1024];
+                long totalBytesRead = 0;
+                int bytesRead;
+                responsePrefix = null;
+                while ((bytesRead = pipe.Read(buffer, 0, buffer.Length)) > 0)
+                {
+                    if (responsePrefix == null)
+                    {
+                        responsePrefix = Encoding.UTF8.GetString(buffer, 0, Math.Min(bytesRead, 128));
+                    }
+
+                    totalBytesRead += bytesRead;
+                    if (buffer[bytesRead - 1] == '\n')
+                    {
+                        break;
+                    }
+                }
+
+                return totalBytesRead;
+            }
+        }
+
+        private static ModifiedPathsDatabase CreateSyntheticModifiedPathsDatabase(ITracer tracer, int pathCount)
+        {
+            string dataFilePath = Path.Combine(Path.GetTempPath(), CreatePipeName(), "ModifiedPaths.dat");
+            Directory.CreateDirectory(Path.GetDirectoryName(dataFilePath));
+            File.WriteAllText(dataFilePath, string.Concat(Enumerable.Range(0, pathCount).Select(i => $"A folder{i % 1000}/subfolder{i % 37}/file{i}.txt\r\n")));
+
+            ModifiedPathsDatabase modifiedPaths;
+            string error;
+            if (!ModifiedPathsDatabase.TryLoadOrCreate(tracer, dataFilePath, new PhysicalFileSystem(), out modifiedPaths, out error))
+            {
+                throw new InvalidOperationException("Failed to load synthetic modified paths: " + error);
+            }
+
+            return modifiedPaths;
+        }
+
+        private static string CreatePipeName()
+        {
+            return "GVFS_PerfProfiling_" + Guid.NewGuid().ToString("N");
+        }
+
         private static bool IsOn(TestsToRun value, TestsToRun flag)
         {
             return flag == (value & flag);
@@ -44,6 +44,12 @@ namespace GVFS.Platform.Mac
                 case Result.EPathNotFound:
                     return FSResult.FileOrPathNotFound;
 
+                case Result.EDirectoryNotEmpty:
+                    return FSResult.DirectoryNotEmpty;
+
+                case Result.EVirtualizationInvalidOperation:
+                    return FSResult.VirtualizationInvalidOperation;
+
                 default:
                     return FSResult.IOError;
             }
@@ -178,56 +184,30 @@ namespace GVFS.Platform.Mac
                     return Result.EIOError;
                 }
 
-                try
-                {
-                    if (!this.GitObjects.TryCopyBlobContentStream(
+                // The blob may have to be downloaded, so hydrate the file on a file and network worker thread rather than
+                // holding up PrjFSLib's thread. PrjFSLib keeps fileHandle open until the command is completed.
+                FileOrNetworkRequest getFileStreamHandler = new FileOrNetworkRequest(
+                    (blobSizesConnection) => this.GetFileStreamAsyncHandler(
+                        commandId,
                         sha,
-                        CancellationToken.None,
-                        GVFSGitObjects.RequestSource.FileStreamCallback,
-                        (stream, blobLength) =>
-                        {
-                            // TODO(Mac): Find a better solution than reading from the stream one byte at at time
-                            byte[] buffer = new byte[4096];
-                            uint bufferIndex = 0;
-                            int nextByte = stream.ReadByte();
-                            while (nextByte != -1)
-                            {
-                                while (bufferIndex < buffer.Length && nextByte != -1)
-                                {
-                                    buffer[bufferIndex] = (byte)nextByte;
-                                    nextByte = stream.ReadByte();
-                                    ++bufferIndex;
-                                }
-
-                                Result result = this.virtualizationInstance.WriteFileContents(
-                                    fileHandle,
-                                    buffer,
-                                    bufferIndex);
-                                if (result != Result.Success)
-                                {
-                                    activity.RelatedError(metadata, $"{nameof(this.virtualizationInstance.WriteFileContents)} failed, error: " + result.ToString("X") + "(" + result.ToString("G") + ")");
-                                    throw new GetFileStreamException(result);
-                                }
-
-                                if (bufferIndex == buffer.Length)
-                                {
-                                    bufferIndex = 0;
-                                }
-                            }
-                        }))
-                    {
-                        activity.RelatedError(metadata, $"{nameof(this.OnGetFileStream)}: TryCopyBlobContentStream failed");
+                        fileHandle,
+                        metadata,
+                        activity),
+                    () => activity.Dispose());
 
-                        // TODO: Is this the correct Result to return?
-                        return Result.EFileNotFound;
-                    }
-                }
-                catch (GetFileStreamException e)
+                Exception e;
+                if (!this.TryScheduleFileOrNetworkRequest(getFileStreamHandler, out e))
                 {
-                    return e.Result;
+                    metadata.Add("Exception", e?.ToString());
+                    metadata.Add(TracingConstants.MessageKey.WarningMessage, nameof(this.OnGetFileStream) + ": Failed to schedule async handler");
+                    activity.RelatedEvent(EventLevel.Warning, nameof(this.OnGetFileStream) + "_FailedToScheduleAsyncHandler", metadata);
+                    activity.Dispose();
+
+                    // TODO: Is this the correct Result to return?
+                    return Result.EIOError;
                 }
 
-                return Result.Success;
+                return Result.Pending;
             }
             catch (Exception e)
             {
@@ -241,6 +221,70 @@ namespace GVFS.Platform.Mac
             return Result.EIOError;
         }
 
+        private void GetFileStreamAsyncHandler(
+            ulong commandId,
+            string sha,
+            IntPtr fileHandle,
+            EventMetadata requestMetadata,
+            ITracer activity)
+        {
+            Result result = Result.Success;
+            try
+            {
+                if (!this.GitObjects.TryCopyBlobContentStream(
+                    sha,
+                    CancellationToken.None,
+                    GVFSGitObjects.RequestSource.FileStreamCallback,
+                    (stream, blobLength) =>
+                    {
+                        // TODO(Mac): Find a better solution than reading from the stream one byte at at time
+                        byte[] buffer = new byte[4096];
+                        uint bufferIndex = 0;
+                        int nextByte = stream.ReadByte();
+                        while (nextByte != -1)
+                        {
+                            while (bufferIndex < buffer.Length && nextByte != -1)
+                            {
+                                buffer[bufferIndex] = (byte)nextByte;
+                                nextByte = stream.ReadByte();
+                                ++bufferIndex;
+                            }
+
+                            Result writeResult = this.virtualizationInstance.WriteFileContents(
+                                fileHandle,
+                                buffer,
+                                bufferIndex);
+                            if (writeResult != Result.Success)
+                            {
+                                activity.RelatedError(requestMetadata, $"{nameof(this.virtualizationInstance.WriteFileContents)} failed, error: " + writeResult.ToString("X") + "(" + writeResult.ToString("G") + ")");
+                                throw new GetFileStreamException(writeResult);
+                            }
+
+                            if (bufferIndex == buffer.Length)
+                            {
+                                bufferIndex = 0;
+                            }
+                        }
+                    }))
+                {
+                    activity.RelatedError(requestMetadata, $"{nameof(this.GetFileStreamAsyncHandler)}: TryCopyBlobContentStream failed");
+
+                    // TODO: Is this the correct Result to return?
+                    result = Result.EFileNotFound;
+                }
+            }
+            catch (GetFileStreamException e)
+            {
+                result = e.Result;
+            }
+
+            Result completeResult = this.virtualizationInstance.CompleteCommand(commandId, result);
+            if (completeResult != Result.Success)
+            {
+                activity.RelatedError(requestMetadata, $"{nameof(this.virtualizationInstance.CompleteCommand)} failed, error: " + completeResult.ToString("X") + "(" + completeResult.ToString("G") + ")");
+            }
+        }
+
         private void OnFileModified(string relativePath)
         {
             try
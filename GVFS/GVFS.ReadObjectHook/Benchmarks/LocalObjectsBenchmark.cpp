@@ -0,0 +1,261 @@
+// Measures how quickly the read-object hook finds objects on disk (see localobjects.h): looking up SHAs in a
+// synthetic version 2 pack index with 10M objects (by default), both SHAs that are in the pack and SHAs that
+// are not, and SHAs of loose objects. Every lookup also checks for a loose object first, as the hook does.
+// Only uses portable code, so it also runs on Linux; see Scripts/Mac/RunNativeHookBenchmarks.sh.
+
+#include "../stdafx.h"
+#include "../localobjects.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef std::array<unsigned char, 20> ObjectId;
+typedef std::chrono::steady_clock Clock;
+
+static const size_t LookupCount = 1000000;
+static const size_t LooseObjectCount = 10000;
+
+// The start of an empty zlib stream, which is all the hook checks for
+static const unsigned char LooseObjectContents[] = { 0x78, 0x01, 0x03, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1); \
+        } \
+    } while (0)
+
+static void Fail(const char* operation, const std::string& path)
+{
+    fprintf(stderr, "%s failed for %s: %s\n", operation, path.c_str(), strerror(errno));
+    exit(1);
+}
+
+static double SecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void PrintResult(const char* name, size_t lookups, double seconds)
+{
+    printf("  %-28s %9.0f lookups/s  %7.3f us/lookup\n", name, lookups / seconds, seconds * 1000000 / lookups);
+}
+
+static std::string ToHex(const ObjectId& id)
+{
+    static const char Digits[] = "0123456789abcdef";
+    std::string hex(40, '0');
+    for (size_t i = 0; i < id.size(); ++i)
+    {
+        hex[i * 2] = Digits[id[i] >> 4];
+        hex[i * 2 + 1] = Digits[id[i] & 0x0f];
+    }
+
+    return hex;
+}
+
+static ObjectId RandomId(std::mt19937_64& random)
+{
+    ObjectId id;
+    for (size_t i = 0; i < id.size(); i += 4)
+    {
+        uint32_t value = static_cast<uint32_t>(random());
+        memcpy(&id[i], &value, 4);
+    }
+
+    return id;
+}
+
+static void WriteBigEndianUInt32(FILE* file, uint32_t value)
+{
+    unsigned char bytes[] =
+    {
+        static_cast<unsigned char>(value >> 24),
+        static_cast<unsigned char>(value >> 16),
+        static_cast<unsigned char>(value >> 8),
+        static_cast<unsigned char>(value),
+    };
+
+    CHECK(1 == fwrite(bytes, sizeof(bytes), 1, file));
+}
+
+static void WritePackIndex(const std::string& path, const std::vector<ObjectId>& ids)
+{
+    // Version 2 layout: signature, version, fanout, SHAs, CRC32s, 4 byte offsets, pack checksum, index checksum.
+    // The hook only reads the fanout and the SHAs, so the rest is written as zeros.
+    FILE* file = fopen(path.c_str(), "wb");
+    if (nullptr == file)
+    {
+        Fail("fopen", path);
+    }
+
+    static const unsigned char Header[] = { 0xff, 't', 'O', 'c', 0, 0, 0, 2 };
+    CHECK(1 == fwrite(Header, sizeof(Header), 1, file));
+
+    size_t objectIndex = 0;
+    for (unsigned firstByte = 0; firstByte < 256; ++firstByte)
+    {
+        while (objectIndex < ids.size() && ids[objectIndex][0] <= firstByte)
+        {
+            ++objectIndex;
+        }
+
+        WriteBigEndianUInt32(file, static_cast<uint32_t>(objectIndex));
+    }
+
+    for (const ObjectId& id : ids)
+    {
+        CHECK(1 == fwrite(id.data(), id.size(), 1, file));
+    }
+
+    std::vector<unsigned char> zeros(ids.size() * 8 + 40);
+    CHECK(1 == fwrite(zeros.data(), zeros.size(), 1, file));
+
+    if (fclose(file))
+    {
+        Fail("fclose", path);
+    }
+}
+
+static void WriteFile(const std::string& path, const void* contents, size_t length)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (nullptr == file)
+    {
+        Fail("fopen", path);
+    }
+
+    CHECK(length == fwrite(contents, 1, length, file));
+    if (fclose(file))
+    {
+        Fail("fclose", path);
+    }
+}
+
+static void MakeDirectory(const std::string& path)
+{
+    if (mkdir(path.c_str(), 0777) && EEXIST != errno)
+    {
+        Fail("mkdir", path);
+    }
+}
+
+static void LookUp(const char* name, const std::vector<std::string>& shas, bool expectFound)
+{
+    Clock::time_point start = Clock::now();
+    for (const std::string& sha : shas)
+    {
+        CHECK(expectFound == LocalObjectExists(sha.c_str()));
+    }
+
+    PrintResult(name, shas.size(), SecondsSince(start));
+}
+
+int main(int argc, char** argv)
+{
+    size_t objectCount = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000000;
+    CHECK(objectCount >= LookupCount);
+
+    const char* tempDirectory = getenv("TMPDIR");
+    std::string root = std::string(nullptr != tempDirectory ? tempDirectory : "/tmp") + "/LocalObjectsBenchmarkXXXXXX";
+    if (nullptr == mkdtemp(&root[0]))
+    {
+        Fail("mkdtemp", root);
+    }
+
+    std::string objectsRoot = root + "/src/.git/objects";
+    MakeDirectory(root + "/src");
+    MakeDirectory(root + "/src/.git");
+    MakeDirectory(objectsRoot);
+    MakeDirectory(objectsRoot + "/pack");
+
+    std::mt19937_64 random(1);
+    std::vector<ObjectId> packedIds(objectCount);
+    for (ObjectId& id : packedIds)
+    {
+        id = RandomId(random);
+    }
+
+    std::sort(packedIds.begin(), packedIds.end());
+    packedIds.erase(std::unique(packedIds.begin(), packedIds.end()), packedIds.end());
+
+    Clock::time_point start = Clock::now();
+    std::string packPath = objectsRoot + "/pack/pack-benchmark";
+    WritePackIndex(packPath + ".idx", packedIds);
+    WriteFile(packPath + ".pack", "PACK", 4);
+    printf("%zu packed objects, index written in %.2f s\n", packedIds.size(), SecondsSince(start));
+
+    // Each SHA is only answered locally once per process, so every lookup asks for a different one
+    std::vector<std::string> packedShas;
+    size_t stride = packedIds.size() / LookupCount;
+    for (size_t i = 0; i < LookupCount; ++i)
+    {
+        packedShas.push_back(ToHex(packedIds[i * stride]));
+    }
+
+    std::shuffle(packedShas.begin(), packedShas.end(), random);
+
+    std::vector<std::string> missingShas;
+    while (missingShas.size() < LookupCount)
+    {
+        ObjectId id = RandomId(random);
+        if (!std::binary_search(packedIds.begin(), packedIds.end(), id))
+        {
+            missingShas.push_back(ToHex(id));
+        }
+    }
+
+    std::vector<std::string> looseShas;
+    for (size_t i = 0; i < LooseObjectCount; ++i)
+    {
+        std::string sha = ToHex(RandomId(random));
+        std::string directory = objectsRoot + "/" + sha.substr(0, 2);
+        MakeDirectory(directory);
+        WriteFile(directory + "/" + sha.substr(2), LooseObjectContents, sizeof(LooseObjectContents));
+        looseShas.push_back(sha);
+    }
+
+    InitializeLocalObjects(root);
+
+    // The first lookup maps the index
+    start = Clock::now();
+    CHECK(LocalObjectExists(packedShas.back().c_str()));
+    printf("  first lookup (maps the index) %.3f ms\n", SecondsSince(start) * 1000);
+    packedShas.pop_back();
+
+    LookUp("packed objects", packedShas, true);
+    LookUp("missing objects", missingShas, false);
+    LookUp("loose objects", looseShas, true);
+
+    // A second request for an object means git could not read it, so it must go to GVFS
+    CHECK(!LocalObjectExists(packedShas.front().c_str()));
+    CHECK(!LocalObjectExists(looseShas.front().c_str()));
+
+    for (const std::string& sha : looseShas)
+    {
+        std::string directory = objectsRoot + "/" + sha.substr(0, 2);
+        unlink((directory + "/" + sha.substr(2)).c_str());
+        rmdir(directory.c_str());
+    }
+
+    unlink((packPath + ".idx").c_str());
+    unlink((packPath + ".pack").c_str());
+    rmdir((objectsRoot + "/pack").c_str());
+    rmdir(objectsRoot.c_str());
+    rmdir((root + "/src/.git").c_str());
+    rmdir((root + "/src").c_str());
+    rmdir(root.c_str());
+    return 0;
+}
@@ -0,0 +1,497 @@
+// Load driver for the read-object hook's connection to GVFS. It runs the hook (built from main.cpp, passed as the
+// first argument) in a temporary enlistment and plays git, sending version 2 "get" commands with 1, 100 and 1000
+// SHAs that are not on disk. A stand-in GVFS listens on the enlistment's pipe and answers DLO and DLOB requests,
+// taking DownloadLatency plus DownloadTimePerObject to "download" each request. It runs once with multiplexed
+// connections (MUX|1) and once answering UnknownRequest to MUX|1, so the hook has to fall back to line mode, and
+// reports how long each get takes and how many requests the hook had in flight at once.
+// Only uses portable code, so it also runs on Linux; see Scripts/Mac/RunNativeHookBenchmarks.sh.
+
+#include "../stdafx.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+static const std::chrono::microseconds DownloadLatency(1000);
+static const std::chrono::microseconds DownloadTimePerObject(20);
+static const size_t ShaCounts[] = { 1, 100, 1000 };
+static const size_t GetCommandCount = 20;
+
+#define SHA1_LENGTH 40
+#define FRAME_HEADER_LENGTH 8
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1); \
+        } \
+    } while (0)
+
+static void Fail(const char* operation, const std::string& path)
+{
+    fprintf(stderr, "%s failed for %s: %s\n", operation, path.c_str(), strerror(errno));
+    exit(1);
+}
+
+static void MakeDirectory(const std::string& path)
+{
+    if (mkdir(path.c_str(), 0777))
+    {
+        Fail("mkdir", path);
+    }
+}
+
+static int RemovePath(const char* path, const struct stat*, int, struct FTW*)
+{
+    return remove(path);
+}
+
+static void WriteAll(int fd, const std::string& data)
+{
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t result = write(fd, data.data() + written, data.size() - written);
+        CHECK(result > 0 || (result < 0 && EINTR == errno));
+        if (result > 0)
+        {
+            written += result;
+        }
+    }
+}
+
+// Returns false if fd is closed before the first byte
+static bool ReadAll(int fd, char* buffer, size_t length)
+{
+    size_t bytesRead = 0;
+    while (bytesRead < length)
+    {
+        ssize_t result = read(fd, buffer + bytesRead, length - bytesRead);
+        CHECK(result >= 0 || EINTR == errno);
+        if (0 == result)
+        {
+            CHECK(0 == bytesRead);
+            return false;
+        }
+
+        if (result > 0)
+        {
+            bytesRead += result;
+        }
+    }
+
+    return true;
+}
+
+static void WriteUInt32(char* buffer, uint32_t value)
+{
+    buffer[0] = static_cast<char>(value);
+    buffer[1] = static_cast<char>(value >> 8);
+    buffer[2] = static_cast<char>(value >> 16);
+    buffer[3] = static_cast<char>(value >> 24);
+}
+
+static uint32_t ReadUInt32(const char* buffer)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(buffer);
+    return
+        static_cast<uint32_t>(bytes[0]) |
+        (static_cast<uint32_t>(bytes[1]) << 8) |
+        (static_cast<uint32_t>(bytes[2]) << 16) |
+        (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+// Stand-in for the GVFS mount, serving the single connection the hook opens
+class StandInGVFS
+{
+public:
+    StandInGVFS(const std::string& pipeName, bool supportsMultiplexing)
+        : pipeName(pipeName)
+        , supportsMultiplexing(supportsMultiplexing)
+        , requestsInFlight(0)
+        , maxRequestsInFlight(0)
+        , requestCount(0)
+    {
+        this->listenSocket = socket(PF_UNIX, SOCK_STREAM, 0);
+        CHECK(this->listenSocket >= 0);
+
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        CHECK(pipeName.length() < sizeof(address.sun_path));
+        memcpy(address.sun_path, pipeName.c_str(), pipeName.length() + 1);
+        if (bind(this->listenSocket, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) || listen(this->listenSocket, 1))
+        {
+            Fail("bind", pipeName);
+        }
+
+        this->serverThread = std::thread(&StandInGVFS::Serve, this);
+    }
+
+    ~StandInGVFS()
+    {
+        this->serverThread.join();
+        close(this->listenSocket);
+        unlink(this->pipeName.c_str());
+    }
+
+    int MaxRequestsInFlight() const { return this->maxRequestsInFlight; }
+    int RequestCount() const { return this->requestCount; }
+
+private:
+    static std::string Download(const std::string& request)
+    {
+        size_t separator = request.find('|');
+        std::string header = request.substr(0, separator);
+        std::string body = std::string::npos == separator ? std::string() : request.substr(separator + 1);
+        if ("DLO" == header)
+        {
+            CHECK(SHA1_LENGTH == body.length());
+            std::this_thread::sleep_for(DownloadLatency + DownloadTimePerObject);
+            return "S";
+        }
+
+        if ("DLOB" == header)
+        {
+            size_t objectCount = (body.length() + 1) / (SHA1_LENGTH + 1);
+            CHECK(objectCount * (SHA1_LENGTH + 1) == body.length() + 1);
+            std::this_thread::sleep_for(DownloadLatency + DownloadTimePerObject * objectCount);
+            return "S|" + std::string(objectCount, 'S');
+        }
+
+        return "UnknownRequest";
+    }
+
+    std::string HandleRequest(const std::string& request)
+    {
+        ++this->requestCount;
+        int inFlight = ++this->requestsInFlight;
+        int maxInFlight = this->maxRequestsInFlight;
+        while (inFlight > maxInFlight && !this->maxRequestsInFlight.compare_exchange_weak(maxInFlight, inFlight))
+        {
+        }
+
+        std::string response = Download(request);
+        --this->requestsInFlight;
+        return response;
+    }
+
+    void Serve()
+    {
+        int connection = accept(this->listenSocket, nullptr, nullptr);
+        CHECK(connection >= 0);
+
+        // Line-based requests until the hook asks for (and gets) a multiplexed connection
+        std::string received;
+        char buffer[4096];
+        bool multiplexed = false;
+        while (!multiplexed)
+        {
+            size_t lineEnd = received.find('\n');
+            if (std::string::npos == lineEnd)
+            {
+                ssize_t bytesRead = read(connection, buffer, sizeof(buffer));
+                CHECK(bytesRead >= 0);
+                if (0 == bytesRead)
+                {
+                    close(connection);
+                    return;
+                }
+
+                received.append(buffer, bytesRead);
+                continue;
+            }
+
+            std::string request = received.substr(0, lineEnd);
+            received.erase(0, lineEnd + 1);
+            if ("MUX|1" == request)
+            {
+                multiplexed = this->supportsMultiplexing;
+                WriteAll(connection, multiplexed ? "S\n" : "UnknownRequest\n");
+                continue;
+            }
+
+            WriteAll(connection, this->HandleRequest(request) + "\n");
+        }
+
+        // GVFS does not send anything after "S" until it gets a request, so nothing is left in received
+        CHECK(received.empty());
+
+        std::mutex writeLock;
+        std::vector<std::thread> handlers;
+        char header[FRAME_HEADER_LENGTH];
+        while (ReadAll(connection, header, sizeof(header)))
+        {
+            std::string request(ReadUInt32(header), '\0');
+            CHECK(ReadAll(connection, &request[0], request.length()));
+            uint32_t requestId = ReadUInt32(header + 4);
+
+            handlers.emplace_back([this, connection, requestId, request, &writeLock]()
+            {
+                std::string response = this->HandleRequest(request);
+                std::string frame(FRAME_HEADER_LENGTH, '\0');
+                WriteUInt32(&frame[0], static_cast<uint32_t>(response.length()));
+                WriteUInt32(&frame[4], requestId);
+                frame += response;
+
+                std::lock_guard<std::mutex> lock(writeLock);
+                WriteAll(connection, frame);
+            });
+        }
+
+        for (std::thread& handler : handlers)
+        {
+            handler.join();
+        }
+
+        close(connection);
+    }
+
+    std::string pipeName;
+    bool supportsMultiplexing;
+    int listenSocket;
+    std::thread serverThread;
+    std::atomic<int> requestsInFlight;
+    std::atomic<int> maxRequestsInFlight;
+    std::atomic<int> requestCount;
+};
+
+// Plays git's side of the read-object protocol
+class ReadObjectHook
+{
+public:
+    ReadObjectHook(const std::string& hookPath, const std::string& workingDirectory)
+    {
+        int toHook[2];
+        int fromHook[2];
+        CHECK(0 == pipe(toHook));
+        CHECK(0 == pipe(fromHook));
+
+        fflush(stdout);
+        this->pid = fork();
+        CHECK(this->pid >= 0);
+        if (0 == this->pid)
+        {
+            if (chdir(workingDirectory.c_str()) ||
+                dup2(toHook[0], STDIN_FILENO) < 0 ||
+                dup2(fromHook[1], STDOUT_FILENO) < 0)
+            {
+                _exit(1);
+            }
+
+            close(toHook[0]);
+            close(toHook[1]);
+            close(fromHook[0]);
+            close(fromHook[1]);
+            execl(hookPath.c_str(), hookPath.c_str(), static_cast<char*>(nullptr));
+            _exit(127);
+        }
+
+        close(toHook[0]);
+        close(fromHook[1]);
+        this->input = toHook[1];
+        this->output = fromHook[0];
+
+        this->WritePackets({ "git-read-object-client", "version=2" });
+        this->ExpectPackets({ "git-read-object-server", "version=2" });
+        this->WritePackets({ "capability=get" });
+        this->ExpectPackets({ "capability=get" });
+    }
+
+    ~ReadObjectHook()
+    {
+        // The hook exits when git closes its stdin
+        close(this->input);
+        int status;
+        CHECK(this->pid == waitpid(this->pid, &status, 0));
+        CHECK(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+        close(this->output);
+    }
+
+    void Get(const std::vector<std::string>& sha1s)
+    {
+        std::vector<std::string> request = { "command=get" };
+        std::vector<std::string> expectedResponse;
+        for (const std::string& sha1 : sha1s)
+        {
+            request.push_back("sha1=" + sha1);
+            expectedResponse.push_back("sha1=" + sha1 + " status=success");
+        }
+
+        expectedResponse.push_back("status=success");
+        this->WritePackets(request);
+        this->ExpectPackets(expectedResponse);
+    }
+
+private:
+    void WritePackets(const std::vector<std::string>& lines)
+    {
+        std::string packets;
+        for (const std::string& line : lines)
+        {
+            char header[5];
+            snprintf(header, sizeof(header), "%04x", static_cast<unsigned>(line.length() + 5));
+            packets += header + line + "\n";
+        }
+
+        packets += "0000";
+        WriteAll(this->input, packets);
+    }
+
+    void ExpectPackets(const std::vector<std::string>& lines)
+    {
+        for (const std::string& line : lines)
+        {
+            CHECK(line == this->ReadPacket());
+        }
+
+        CHECK(this->ReadPacket().empty());
+    }
+
+    // Returns an empty string for a flush packet
+    std::string ReadPacket()
+    {
+        char header[5] = {};
+        CHECK(ReadAll(this->output, header, 4));
+        size_t length = strtoul(header, nullptr, 16);
+        if (0 == length)
+        {
+            return std::string();
+        }
+
+        CHECK(length > 4);
+        std::string line(length - 4, '\0');
+        CHECK(ReadAll(this->output, &line[0], line.length()));
+        if ('\n' == line.back())
+        {
+            line.pop_back();
+        }
+
+        return line;
+    }
+
+    pid_t pid;
+    int input;
+    int output;
+};
+
+static double MeasureGets(
+    const std::string& hookPath,
+    const std::string& enlistmentRoot,
+    bool supportsMultiplexing,
+    size_t shaCount,
+    size_t& nextSha,
+    /* out */ int& maxRequestsInFlight)
+{
+    StandInGVFS gvfs(enlistmentRoot + "/.gvfs/GVFS_NetCorePipe", supportsMultiplexing);
+    Clock::duration elapsed = Clock::duration::zero();
+    {
+        ReadObjectHook hook(hookPath, enlistmentRoot + "/src");
+        for (size_t i = 0; i < GetCommandCount; ++i)
+        {
+            // Every SHA is new so that the hook has to ask GVFS for all of them
+            std::vector<std::string> sha1s;
+            for (size_t j = 0; j < shaCount; ++j)
+            {
+                char sha1[SHA1_LENGTH + 1];
+                snprintf(sha1, sizeof(sha1), "%040zx", ++nextSha);
+                sha1s.push_back(sha1);
+            }
+
+            Clock::time_point start = Clock::now();
+            hook.Get(sha1s);
+            elapsed += Clock::now() - start;
+        }
+    }
+
+    maxRequestsInFlight = gvfs.MaxRequestsInFlight();
+    return std::chrono::duration<double, std::milli>(elapsed).count() / GetCommandCount;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <path to the read-object hook>\n", argv[0]);
+        return 1;
+    }
+
+    char hookPath[PATH_MAX];
+    if (nullptr == realpath(argv[1], hookPath))
+    {
+        Fail("realpath", argv[1]);
+    }
+
+    const char* tempDirectory = getenv("TMPDIR");
+    std::string root = std::string(nullptr != tempDirectory ? tempDirectory : "/tmp") + "/MuxBenchmarkXXXXXX";
+    if (nullptr == mkdtemp(&root[0]))
+    {
+        Fail("mkdtemp", root);
+    }
+
+    // The hook finds the enlistment from its working directory, which has symlinks resolved
+    char resolvedRoot[PATH_MAX];
+    if (nullptr == realpath(root.c_str(), resolvedRoot))
+    {
+        Fail("realpath", root);
+    }
+
+    root = resolvedRoot;
+    std::string enlistmentRoot = root + "/enlistment";
+    MakeDirectory(enlistmentRoot);
+    MakeDirectory(enlistmentRoot + "/.gvfs");
+    MakeDirectory(enlistmentRoot + "/src");
+    MakeDirectory(enlistmentRoot + "/src/.git");
+    MakeDirectory(enlistmentRoot + "/src/.git/objects");
+
+    // Keep the hook's enlistment root cache out of the real temp folder
+    CHECK(0 == setenv("TMPDIR", root.c_str(), 1));
+    signal(SIGPIPE, SIG_IGN);
+
+    size_t nextSha = 0;
+    for (size_t shaCount : ShaCounts)
+    {
+        int lineModeInFlight;
+        int multiplexedInFlight;
+        double lineModeMilliseconds = MeasureGets(hookPath, enlistmentRoot, false, shaCount, nextSha, lineModeInFlight);
+        double multiplexedMilliseconds = MeasureGets(hookPath, enlistmentRoot, true, shaCount, nextSha, multiplexedInFlight);
+
+        // Without multiplexing the hook must wait for each response before sending another request
+        CHECK(1 == lineModeInFlight);
+
+        // With it, the hook splits the SHAs into DLOB requests of 100 and sends them all at once
+        CHECK(shaCount <= 100 || multiplexedInFlight > 1);
+
+        printf(
+            "%4zu SHAs per get: line mode %7.2f ms (max %d in flight), multiplexed %7.2f ms (max %d in flight)\n",
+            shaCount,
+            lineModeMilliseconds,
+            lineModeInFlight,
+            multiplexedMilliseconds,
+            multiplexedInFlight);
+    }
+
+    CHECK(0 == nftw(root.c_str(), RemovePath, 16, FTW_DEPTH | FTW_PHYS));
+    return 0;
+}
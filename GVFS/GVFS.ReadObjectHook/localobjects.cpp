@@ -0,0 +1,618 @@
+#include "stdafx.h"
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "localobjects.h"
+
+#ifdef _WIN32
+#define PATH_LITERAL(s) L##s
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define PATH_LITERAL(s) s
+#endif
+
+#define SHA1_LENGTH 40
+#define SHA1_BYTE_LENGTH 20
+
+// Pack index format (see Git Documentation/technical/pack-format.txt)
+//   v1: 256 entry fanout table, then a <4 byte offset, 20 byte SHA> entry per object
+//   v2: "\377tOc", 4 byte version, 256 entry fanout table, then a 20 byte SHA per object
+#define PACK_INDEX_FANOUT_LENGTH (256 * 4)
+#define PACK_INDEX_V1_ENTRY_LENGTH (4 + SHA1_BYTE_LENGTH)
+#define PACK_INDEX_V2_HEADER_LENGTH 8
+static const unsigned char PackIndexV2Signature[] = { 0xff, 't', 'O', 'c' };
+
+struct MappedFile
+{
+    const unsigned char* data;
+    size_t length;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+};
+
+struct PackIndex
+{
+    PATH_STRING name;
+    MappedFile file;
+    const unsigned char* fanout;
+    const unsigned char* shas;
+    size_t shaStride;
+};
+
+struct ObjectDirectory
+{
+    PATH_STRING root;
+    PATH_STRING packDirectory;
+    bool packsLoaded;
+    uint64_t packDirectoryModifiedTime;
+    std::vector<PackIndex> packIndexes;
+};
+
+static std::vector<ObjectDirectory> s_objectDirectories;
+
+// SHAs that have already been reported as present in this session. Git asking for one of them again means
+// it could not read the object, so it has to go to GVFS, which overwrites corrupt objects.
+static std::unordered_set<std::string> s_objectsFoundLocally;
+
+#ifdef _WIN32
+
+static const PATH_STRING PathSeparator(L"\\");
+
+static bool TryGetFileAttributes(const PATH_STRING& path, WIN32_FILE_ATTRIBUTE_DATA* attributes)
+{
+    return GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, attributes) != FALSE;
+}
+
+static bool TryGetModifiedTime(const PATH_STRING& path, uint64_t* modifiedTime)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!TryGetFileAttributes(path, &attributes))
+    {
+        return false;
+    }
+
+    *modifiedTime = (static_cast<uint64_t>(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+    return true;
+}
+
+static bool IsNonEmptyFile(const PATH_STRING& path)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    return
+        TryGetFileAttributes(path, &attributes) &&
+        !(attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+        (attributes.nFileSizeHigh != 0 || attributes.nFileSizeLow != 0);
+}
+
+static bool TryMapFile(const PATH_STRING& path, MappedFile* file)
+{
+    // FILE_SHARE_DELETE allows GVFS to clean up pack files while they are mapped
+    HANDLE fileHandle = CreateFileW(
+        path.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL);
+
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+    {
+        CloseHandle(fileHandle);
+        return false;
+    }
+
+    file->mapping = CreateFileMappingW(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(fileHandle);
+    if (file->mapping == NULL)
+    {
+        return false;
+    }
+
+    file->data = static_cast<const unsigned char*>(MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0));
+    if (file->data == nullptr)
+    {
+        CloseHandle(file->mapping);
+        return false;
+    }
+
+    file->length = static_cast<size_t>(fileSize.QuadPart);
+    return true;
+}
+
+static void UnmapFile(MappedFile* file)
+{
+    UnmapViewOfFile(file->data);
+    CloseHandle(file->mapping);
+    file->data = nullptr;
+    file->mapping = NULL;
+}
+
+static void ListPackIndexNames(const PATH_STRING& packDirectory, std::vector<PATH_STRING>& names)
+{
+    WIN32_FIND_DATAW findFileData;
+    HANDLE findHandle = FindFirstFileW((packDirectory + L"\\*.idx").c_str(), &findFileData);
+    if (findHandle == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    do
+    {
+        if (!(findFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+        {
+            names.push_back(findFileData.cFileName);
+        }
+    } while (FindNextFileW(findHandle, &findFileData));
+
+    FindClose(findHandle);
+}
+
+static FILE* OpenFileForRead(const PATH_STRING& path)
+{
+    return _wfopen(path.c_str(), L"rb");
+}
+
+static PATH_STRING ToPathString(const std::string& utf8Path)
+{
+    int length = MultiByteToWideChar(CP_UTF8, 0, utf8Path.c_str(), static_cast<int>(utf8Path.size()), nullptr, 0);
+    if (length <= 0)
+    {
+        return PATH_STRING();
+    }
+
+    PATH_STRING path(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, utf8Path.c_str(), static_cast<int>(utf8Path.size()), &path[0], length);
+    return path;
+}
+
+static bool IsAbsolutePath(const PATH_STRING& path)
+{
+    return
+        (path.size() >= 2 && path[1] == L':') ||
+        (path.size() >= 1 && (path[0] == L'\\' || path[0] == L'/'));
+}
+
+#else
+
+static const PATH_STRING PathSeparator("/");
+
+static bool TryGetModifiedTime(const PATH_STRING& path, uint64_t* modifiedTime)
+{
+    struct stat fileStat;
+    if (stat(path.c_str(), &fileStat) != 0)
+    {
+        return false;
+    }
+
+#ifdef __APPLE__
+    *modifiedTime = static_cast<uint64_t>(fileStat.st_mtimespec.tv_sec) * 1000000000 + fileStat.st_mtimespec.tv_nsec;
+#else
+    *modifiedTime = static_cast<uint64_t>(fileStat.st_mtim.tv_sec) * 1000000000 + fileStat.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+static bool IsNonEmptyFile(const PATH_STRING& path)
+{
+    struct stat fileStat;
+    return
+        stat(path.c_str(), &fileStat) == 0 &&
+        S_ISREG(fileStat.st_mode) &&
+        fileStat.st_size > 0;
+}
+
+static bool TryMapFile(const PATH_STRING& path, MappedFile* file)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    file->data = static_cast<const unsigned char*>(data);
+    file->length = fileStat.st_size;
+    return true;
+}
+
+static void UnmapFile(MappedFile* file)
+{
+    munmap(const_cast<unsigned char*>(file->data), file->length);
+    file->data = nullptr;
+    file->length = 0;
+}
+
+static void ListPackIndexNames(const PATH_STRING& packDirectory, std::vector<PATH_STRING>& names)
+{
+    DIR* directory = opendir(packDirectory.c_str());
+    if (directory == nullptr)
+    {
+        return;
+    }
+
+    const size_t idxExtensionLength = 4;
+    dirent* dirEntry;
+    while ((dirEntry = readdir(directory)) != nullptr)
+    {
+        size_t nameLength = strlen(dirEntry->d_name);
+        if (nameLength > idxExtensionLength && strcmp(dirEntry->d_name + nameLength - idxExtensionLength, ".idx") == 0)
+        {
+            names.push_back(dirEntry->d_name);
+        }
+    }
+
+    closedir(directory);
+}
+
+static FILE* OpenFileForRead(const PATH_STRING& path)
+{
+    return fopen(path.c_str(), "rb");
+}
+
+static PATH_STRING ToPathString(const std::string& utf8Path)
+{
+    return utf8Path;
+}
+
+static bool IsAbsolutePath(const PATH_STRING& path)
+{
+    return !path.empty() && path[0] == '/';
+}
+
+#endif
+
+static uint32_t ReadBigEndianUInt32(const unsigned char* data)
+{
+    return
+        (static_cast<uint32_t>(data[0]) << 24) |
+        (static_cast<uint32_t>(data[1]) << 16) |
+        (static_cast<uint32_t>(data[2]) << 8) |
+        static_cast<uint32_t>(data[3]);
+}
+
+static bool TryParseSHA(const char* sha1, unsigned char* shaBytes)
+{
+    for (int i = 0; i < SHA1_BYTE_LENGTH; ++i)
+    {
+        int value = 0;
+        for (int j = 0; j < 2; ++j)
+        {
+            char c = sha1[i * 2 + j];
+            value <<= 4;
+            if (c >= '0' && c <= '9')
+            {
+                value |= c - '0';
+            }
+            else if (c >= 'a' && c <= 'f')
+            {
+                value |= c - 'a' + 10;
+            }
+            else if (c >= 'A' && c <= 'F')
+            {
+                value |= c - 'A' + 10;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        shaBytes[i] = static_cast<unsigned char>(value);
+    }
+
+    return sha1[SHA1_LENGTH] == '\0';
+}
+
+static bool HasValidZlibHeader(const PATH_STRING& looseObjectPath)
+{
+    // Loose objects are zlib streams: CM must be 8 (deflate), CINFO at most 7, and the first two bytes
+    // read as a big endian number must be a multiple of 31. This rejects empty, truncated to nothing and
+    // overwritten objects without having to inflate them.
+    FILE* file = OpenFileForRead(looseObjectPath);
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    unsigned char header[2];
+    size_t bytesRead = fread(header, 1, sizeof(header), file);
+    fclose(file);
+
+    return
+        bytesRead == sizeof(header) &&
+        (header[0] & 0x0f) == 8 &&
+        (header[0] >> 4) <= 7 &&
+        ((static_cast<unsigned int>(header[0]) << 8) | header[1]) % 31 == 0;
+}
+
+static bool TryLoadPackIndex(const PATH_STRING& packDirectory, const PATH_STRING& name, PackIndex* packIndex)
+{
+    // Only trust indexes whose pack has already been moved into place
+    PATH_STRING indexPath(packDirectory + PathSeparator + name);
+    PATH_STRING packPath(indexPath.substr(0, indexPath.size() - 4) + PATH_LITERAL(".pack"));
+    if (!IsNonEmptyFile(packPath) || !TryMapFile(indexPath, &packIndex->file))
+    {
+        return false;
+    }
+
+    const unsigned char* data = packIndex->file.data;
+    size_t length = packIndex->file.length;
+    size_t headerLength;
+    if (length >= PACK_INDEX_V2_HEADER_LENGTH && memcmp(data, PackIndexV2Signature, sizeof(PackIndexV2Signature)) == 0)
+    {
+        if (ReadBigEndianUInt32(data + sizeof(PackIndexV2Signature)) != 2)
+        {
+            UnmapFile(&packIndex->file);
+            return false;
+        }
+
+        headerLength = PACK_INDEX_V2_HEADER_LENGTH;
+        packIndex->fanout = data + headerLength;
+        packIndex->shas = packIndex->fanout + PACK_INDEX_FANOUT_LENGTH;
+        packIndex->shaStride = SHA1_BYTE_LENGTH;
+    }
+    else
+    {
+        headerLength = 0;
+        packIndex->fanout = data;
+        packIndex->shas = packIndex->fanout + PACK_INDEX_FANOUT_LENGTH + 4;
+        packIndex->shaStride = PACK_INDEX_V1_ENTRY_LENGTH;
+    }
+
+    if (length < headerLength + PACK_INDEX_FANOUT_LENGTH)
+    {
+        UnmapFile(&packIndex->file);
+        return false;
+    }
+
+    uint32_t objectCount = ReadBigEndianUInt32(packIndex->fanout + PACK_INDEX_FANOUT_LENGTH - 4);
+    if (length < headerLength + PACK_INDEX_FANOUT_LENGTH + static_cast<uint64_t>(objectCount) * packIndex->shaStride)
+    {
+        UnmapFile(&packIndex->file);
+        return false;
+    }
+
+    packIndex->name = name;
+    return true;
+}
+
+static bool PackIndexContains(const PackIndex& packIndex, const unsigned char* shaBytes)
+{
+    // The fanout table holds, for each possible first byte, the number of objects whose
+    // first byte is less than or equal to it.  That gives the range to binary search.
+    uint32_t objectCount = ReadBigEndianUInt32(packIndex.fanout + PACK_INDEX_FANOUT_LENGTH - 4);
+    uint32_t low = shaBytes[0] == 0 ? 0 : ReadBigEndianUInt32(packIndex.fanout + (shaBytes[0] - 1) * 4);
+    uint32_t high = ReadBigEndianUInt32(packIndex.fanout + shaBytes[0] * 4);
+    if (high > objectCount)
+    {
+        high = objectCount;
+    }
+
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        int result = memcmp(packIndex.shas + static_cast<size_t>(middle) * packIndex.shaStride, shaBytes, SHA1_BYTE_LENGTH);
+        if (result == 0)
+        {
+            return true;
+        }
+        else if (result < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return false;
+}
+
+static void RefreshPackIndexes(ObjectDirectory& objectDirectory)
+{
+    // Read the modified time before listing the directory so that any change made while
+    // listing is picked up by the next refresh
+    uint64_t modifiedTime = 0;
+    bool packDirectoryExists = TryGetModifiedTime(objectDirectory.packDirectory, &modifiedTime);
+    if (objectDirectory.packsLoaded && packDirectoryExists && modifiedTime == objectDirectory.packDirectoryModifiedTime)
+    {
+        return;
+    }
+
+    std::vector<PATH_STRING> names;
+    if (packDirectoryExists)
+    {
+        ListPackIndexNames(objectDirectory.packDirectory, names);
+    }
+
+    std::vector<PackIndex> previousIndexes;
+    previousIndexes.swap(objectDirectory.packIndexes);
+
+    for (const PATH_STRING& name : names)
+    {
+        bool alreadyLoaded = false;
+        for (PackIndex& previousIndex : previousIndexes)
+        {
+            if (previousIndex.file.data != nullptr && previousIndex.name == name)
+            {
+                objectDirectory.packIndexes.push_back(std::move(previousIndex));
+                previousIndex.file.data = nullptr;
+                alreadyLoaded = true;
+                break;
+            }
+        }
+
+        if (!alreadyLoaded)
+        {
+            PackIndex packIndex;
+            if (TryLoadPackIndex(objectDirectory.packDirectory, name, &packIndex))
+            {
+                objectDirectory.packIndexes.push_back(std::move(packIndex));
+            }
+        }
+    }
+
+    // Unmap the indexes of any packs that have been deleted
+    for (PackIndex& previousIndex : previousIndexes)
+    {
+        if (previousIndex.file.data != nullptr)
+        {
+            UnmapFile(&previousIndex.file);
+        }
+    }
+
+    objectDirectory.packsLoaded = packDirectoryExists;
+    objectDirectory.packDirectoryModifiedTime = modifiedTime;
+}
+
+static void AddObjectDirectory(const PATH_STRING& root)
+{
+    for (const ObjectDirectory& objectDirectory : s_objectDirectories)
+    {
+        if (objectDirectory.root == root)
+        {
+            return;
+        }
+    }
+
+    ObjectDirectory objectDirectory;
+    objectDirectory.root = root;
+    objectDirectory.packDirectory = root + PathSeparator + PATH_LITERAL("pack");
+    objectDirectory.packsLoaded = false;
+    objectDirectory.packDirectoryModifiedTime = 0;
+    s_objectDirectories.push_back(std::move(objectDirectory));
+}
+
+void InitializeLocalObjects(const PATH_STRING& enlistmentRoot)
+{
+    PATH_STRING localObjectsRoot(
+        enlistmentRoot + PathSeparator + PATH_LITERAL("src") + PathSeparator + PATH_LITERAL(".git") + PathSeparator + PATH_LITERAL("objects"));
+    AddObjectDirectory(localObjectsRoot);
+
+    // GVFS lists the shared git objects root in the alternates file, one path per line
+    FILE* alternatesFile = OpenFileForRead(
+        localObjectsRoot + PathSeparator + PATH_LITERAL("info") + PathSeparator + PATH_LITERAL("alternates"));
+    if (alternatesFile == nullptr)
+    {
+        return;
+    }
+
+    std::string alternates;
+    char buffer[1024];
+    size_t bytesRead;
+    while ((bytesRead = fread(buffer, 1, sizeof(buffer), alternatesFile)) > 0)
+    {
+        alternates.append(buffer, bytesRead);
+    }
+
+    fclose(alternatesFile);
+
+    size_t lineStart = 0;
+    while (lineStart < alternates.size())
+    {
+        size_t lineEnd = alternates.find('\n', lineStart);
+        if (lineEnd == std::string::npos)
+        {
+            lineEnd = alternates.size();
+        }
+
+        std::string line(alternates, lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+
+        if (line.size() >= 2 && line.front() == '"' && line.back() == '"')
+        {
+            line = line.substr(1, line.size() - 2);
+        }
+
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        PATH_STRING alternateRoot(ToPathString(line));
+        if (!IsAbsolutePath(alternateRoot))
+        {
+            alternateRoot = localObjectsRoot + PathSeparator + alternateRoot;
+        }
+
+        AddObjectDirectory(alternateRoot);
+    }
+}
+
+bool LocalObjectExists(const char *sha1)
+{
+    unsigned char shaBytes[SHA1_BYTE_LENGTH];
+    if (!TryParseSHA(sha1, shaBytes))
+    {
+        return false;
+    }
+
+    std::string shaString(sha1, SHA1_LENGTH);
+    if (s_objectsFoundLocally.find(shaString) != s_objectsFoundLocally.end())
+    {
+        return false;
+    }
+
+    PATH_STRING sha(ToPathString(shaString));
+    PATH_STRING looseObjectPath(sha.substr(0, 2) + PathSeparator + sha.substr(2));
+    for (ObjectDirectory& objectDirectory : s_objectDirectories)
+    {
+        // Git only asks for objects it could not read, ignore loose objects that do not start with a
+        // zlib header as they are corrupt and need to be downloaded again
+        bool found = HasValidZlibHeader(objectDirectory.root + PathSeparator + looseObjectPath);
+        if (!found)
+        {
+            RefreshPackIndexes(objectDirectory);
+            for (const PackIndex& packIndex : objectDirectory.packIndexes)
+            {
+                if (PackIndexContains(packIndex, shaBytes))
+                {
+                    found = true;
+                    break;
+                }
+            }
+        }
+
+        if (found)
+        {
+            s_objectsFoundLocally.insert(shaString);
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "common.h"
+
+// Checks the enlistment's object directories (the local .git/objects folder and the git
+// objects roots listed in its alternates file) for objects that are already on disk,
+// so that requests for them can be answered without contacting GVFS.
+//
+// Pack indexes are memory-mapped the first time they are needed and are only re-scanned
+// when the pack directory they live in changes.
+//
+// Each SHA is only answered locally once per hook process: if git asks for it again it could
+// not read the object on disk, and GVFS has to download it and overwrite the corrupt copy.
+
+void InitializeLocalObjects(const PATH_STRING& enlistmentRoot);
+bool LocalObjectExists(const char *sha1);
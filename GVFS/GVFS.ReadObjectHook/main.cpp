@@ -6,14 +6,25 @@
 //
 // Git and read-object negotiate an interface and capabilities then git issues a "get" command for the missing SHA.
 // See Git Documentation/Technical/read-object-protocol.txt for details.
+//
+// With version=2 a single "get" command can contain any number of "sha1=" lines (terminated by a flush packet).
+// GVFS.ReadObjectHook downloads all of them with one request to GVFS and replies with a
+// "sha1=<SHA> status=<success|error>" line for each requested SHA followed by an overall "status=" line.
+// Objects that are already in one of the enlistment's object directories (e.g. because another git process
+// asked GVFS for them first) are reported as successfully downloaded without contacting GVFS.
 // GVFS.ReadObjectHook decides which GVFS instance to connect to based on its path.
 // It then connects to GVFS and asks GVFS to download the requested object (to the .git\objects folder).
 
 #include "stdafx.h"
-#include "packet.h"
+#include <algorithm>
+#include <memory>
+#include <string.h>
+#include <vector>
+#include "packet.h"
 #include "common.h"
+#include "localobjects.h"
+#include "multiplexedpipe.h"
 
-#define MAX_PACKET_LENGTH 512
 #define SHA1_LENGTH 40
 #define DLO_REQUEST_LENGTH (4 + SHA1_LENGTH + 1)
 
@@ -22,6 +33,25 @@
 // "F\n" -> Failure
 #define DLO_RESPONSE_LENGTH 2
 
+// Batched request format:  "DLOB|<SHA>,<SHA>,...,<SHA>\n"
+// Expected batched response:
+// "S|<one 'S' (success) or 'F' (failure) per requested SHA>\n"
+// "UnknownRequest\n" -> GVFS does not support batched downloads
+#define DLOB_REQUEST_HEADER "DLOB|"
+#define DLOB_SUCCESS_HEADER "S|"
+#define DLOB_UNKNOWN_REQUEST "UnknownRequest"
+#define DLOB_OBJECT_DOWNLOADED 'S'
+
+// When GVFS supports multiplexed connections (see multiplexedpipe.h) the same requests and responses are sent
+// as frames, without the trailing newline.  The SHAs of a version 2 "get" command are then split into several
+// DLOB requests that are all sent before reading any response, so that GVFS downloads them concurrently.
+// Every version of GVFS that supports multiplexed connections also supports DLOB.
+#define DLO_REQUEST_HEADER "DLO|"
+#define DLO_SUCCESS_RESULT "S"
+#define DLOB_MULTIPLEXED_BATCH_SIZE 100
+
+#define PIPE_READ_BUFFER_LENGTH 4096
+
 enum ReadObjectHookErrorReturnCode
 {
     ErrorReadObjectProtocol = ReturnCode::LastError + 1,
@@ -75,42 +105,189 @@ int DownloadSHA(PIPE_HANDLE pipeHandle, const char *sha1)
     return *response == 'S' ? ReturnCode::Success : ReturnCode::FailureToDownload;
 }
 
+int DownloadSHA(MultiplexedPipe& multiplexedPipe, const std::string& sha1)
+{
+    uint32_t requestId = multiplexedPipe.SendRequest(DLO_REQUEST_HEADER + sha1);
+    return multiplexedPipe.ReadResponse(requestId) == DLO_SUCCESS_RESULT ? ReturnCode::Success : ReturnCode::FailureToDownload;
+}
+
+std::string ReadResponseLine(PIPE_HANDLE pipeHandle)
+{
+    std::string response;
+    char buffer[PIPE_READ_BUFFER_LENGTH];
+    unsigned long bytesRead;
+    int error = 0;
+    bool success;
+    do
+    {
+        bytesRead = 0;
+        success = ReadFromPipe(
+            pipeHandle,
+            buffer,
+            sizeof(buffer),
+            &bytesRead,
+            &error);
+        response.append(buffer, bytesRead);
+    } while (success && bytesRead > 0 && (response.empty() || response.back() != '\n'));
+
+    if (!success || response.empty() || response.back() != '\n')
+    {
+        die(ReturnCode::PipeReadFailed, "Read response from pipe failed (%d)\n", error);
+    }
+
+    response.pop_back();
+    return response;
+}
+
+std::string CreateBatchedDownloadRequest(const std::vector<std::string>& sha1s, size_t first, size_t count)
+{
+    // Construct batched download request message
+    // Format:  "DLOB|<40 character SHA>,<40 character SHA>,..."
+    std::string request(DLOB_REQUEST_HEADER);
+    request.reserve(request.size() + count * (SHA1_LENGTH + 1) + 1);
+    for (size_t i = first; i < first + count; ++i)
+    {
+        if (i > first)
+        {
+            request += ',';
+        }
+
+        request += sha1s[i];
+    }
+
+    return request;
+}
+
+void ReadBatchedDownloadResults(
+    const std::string& response,
+    size_t first,
+    size_t count,
+    /* out */ std::vector<int>& results)
+{
+    const size_t successHeaderLength = sizeof(DLOB_SUCCESS_HEADER) - 1;
+    if (response.compare(0, successHeaderLength, DLOB_SUCCESS_HEADER) != 0)
+    {
+        // GVFS could not process the request (e.g. the mount is not ready), every SHA failed
+        return;
+    }
+
+    if (response.size() - successHeaderLength != count)
+    {
+        die(ReturnCode::PipeReadFailed, "Invalid batched download response, expected %d results: %s\n", (int)count, response.c_str());
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (response[successHeaderLength + i] == DLOB_OBJECT_DOWNLOADED)
+        {
+            results[first + i] = ReturnCode::Success;
+        }
+    }
+}
+
+void DownloadSHAs(PIPE_HANDLE pipeHandle, const std::vector<std::string>& sha1s, /* out */ std::vector<int>& results)
+{
+    results.assign(sha1s.size(), ReturnCode::FailureToDownload);
+
+    std::string request = CreateBatchedDownloadRequest(sha1s, 0, sha1s.size());
+    request += '\n';
+
+    unsigned long bytesWritten;
+    int error = 0;
+    bool success = WriteToPipe(
+        pipeHandle,
+        request.c_str(),
+        static_cast<unsigned long>(request.size()),
+        &bytesWritten,
+        &error);
+
+    if (!success || bytesWritten != request.size())
+    {
+        die(ReturnCode::PipeWriteFailed, "Failed to write to pipe (%d)\n", error);
+    }
+
+    std::string response = ReadResponseLine(pipeHandle);
+    if (response == DLOB_UNKNOWN_REQUEST)
+    {
+        // GVFS predates batched downloads, fall back to requesting each SHA on its own
+        for (size_t i = 0; i < sha1s.size(); ++i)
+        {
+            results[i] = DownloadSHA(pipeHandle, sha1s[i].c_str());
+        }
+
+        return;
+    }
+
+    ReadBatchedDownloadResults(response, 0, sha1s.size(), results);
+}
+
+void DownloadSHAs(MultiplexedPipe& multiplexedPipe, const std::vector<std::string>& sha1s, /* out */ std::vector<int>& results)
+{
+    results.assign(sha1s.size(), ReturnCode::FailureToDownload);
+
+    std::vector<uint32_t> requestIds;
+    for (size_t first = 0; first < sha1s.size(); first += DLOB_MULTIPLEXED_BATCH_SIZE)
+    {
+        size_t count = std::min<size_t>(DLOB_MULTIPLEXED_BATCH_SIZE, sha1s.size() - first);
+        requestIds.push_back(multiplexedPipe.SendRequest(CreateBatchedDownloadRequest(sha1s, first, count)));
+    }
+
+    for (size_t batch = 0; batch < requestIds.size(); ++batch)
+    {
+        size_t first = batch * DLOB_MULTIPLEXED_BATCH_SIZE;
+        size_t count = std::min<size_t>(DLOB_MULTIPLEXED_BATCH_SIZE, sha1s.size() - first);
+        ReadBatchedDownloadResults(multiplexedPipe.ReadResponse(requestIds[batch]), first, count, results);
+    }
+}
+
 int main(int, char *argv[])
 {
-    char packet_buffer[MAX_PACKET_LENGTH];
+    const char *packet;
     size_t len;
     int err;
 
     DisableCRLFTranslationOnStdPipes();
 
-    packet_txt_read(packet_buffer, sizeof(packet_buffer));
-    if (strcmp(packet_buffer, "git-read-object-client"))
+    packet_txt_read(&packet);
+    if (strcmp(packet, "git-read-object-client"))
     {
         die(ReadObjectHookErrorReturnCode::ErrorReadObjectProtocol, "Bad welcome message\n");
     }
 
-    packet_txt_read(packet_buffer, sizeof(packet_buffer));
-    if (strcmp(packet_buffer, "version=1"))
+    // Git lists every version it supports, use the highest one we also support
+    int version = 0;
+    while (packet_txt_read(&packet))
     {
-        die(ReadObjectHookErrorReturnCode::ErrorReadObjectProtocol, "Bad version\n");
+        if (!strcmp(packet, "version=1"))
+        {
+            version = version > 1 ? version : 1;
+        }
+        else if (!strcmp(packet, "version=2"))
+        {
+            version = 2;
+        }
+        else if (strncmp(packet, "version=", 8))
+        {
+            die(ReadObjectHookErrorReturnCode::ErrorReadObjectProtocol, "Bad version end\n");
+        }
     }
 
-    if (packet_txt_read(packet_buffer, sizeof(packet_buffer)))
+    if (version == 0)
     {
-        die(ReadObjectHookErrorReturnCode::ErrorReadObjectProtocol, "Bad version end\n");
+        die(ReadObjectHookErrorReturnCode::ErrorReadObjectProtocol, "Bad version\n");
     }
 
     packet_txt_write("git-read-object-server");
-    packet_txt_write("version=1");
+    packet_txt_write(version == 2 ? "version=2" : "version=1");
     packet_flush();
 
-    packet_txt_read(packet_buffer, sizeof(packet_buffer));
-    if (strcmp(packet_buffer, "capability=get"))
+    packet_txt_read(&packet);
+    if (strcmp(packet, "capability=get"))
     {
         die(ReadObjectHookErrorReturnCode::ErrorReadObjectProtocol, "Bad capability\n");
     }
 
-    if (packet_txt_read(packet_buffer, sizeof(packet_buffer)))
+    if (packet_txt_read(&packet))
     {
         die(ReadObjectHookErrorReturnCode::ErrorReadObjectProtocol, "Bad capability end\n");
     }
@@ -118,30 +295,115 @@ int main(int, char *argv[])
     packet_txt_write("capability=get");
     packet_flush();
 
-    PATH_STRING pipeName(GetGVFSPipeName(argv[0]));
+    PATH_STRING enlistmentRoot(GetGVFSEnlistmentRoot(argv[0]));
+    PATH_STRING pipeName(GetGVFSPipeName(enlistmentRoot));
+    InitializeLocalObjects(enlistmentRoot);
 
-    PIPE_HANDLE pipeHandle = CreatePipeToGVFS(pipeName);
+    // The pipe is only opened the first time git asks for an object that is not on disk
+    PIPE_HANDLE pipeHandle = 0;
+    bool pipeConnected = false;
+
+    // Only set when GVFS supports multiplexed connections, otherwise requests are sent on pipeHandle one at a time
+    std::unique_ptr<MultiplexedPipe> multiplexedPipe;
+
+    std::vector<std::string> sha1s;
+    std::vector<int> results;
+    std::vector<std::string> missingSha1s;
+    std::vector<int> missingResults;
+    std::string statusLine;
 
     while (1)
     {
-        packet_txt_read(packet_buffer, sizeof(packet_buffer));
-        if (strcmp(packet_buffer, "command=get"))
+        packet_txt_read(&packet);
+        if (strcmp(packet, "command=get"))
         {
             die(ReadObjectHookErrorReturnCode::ErrorReadObjectProtocol, "Bad command\n");
         }
 
-        len = packet_txt_read(packet_buffer, sizeof(packet_buffer));
-        if ((len != SHA1_LENGTH + 5) || strncmp(packet_buffer, "sha1=", 5))
+        sha1s.clear();
+        while ((len = packet_txt_read(&packet)) != 0)
         {
-            die(ReadObjectHookErrorReturnCode::ErrorReadObjectProtocol, "Bad sha1 in get command\n");
+            if ((len != SHA1_LENGTH + 5) || strncmp(packet, "sha1=", 5))
+            {
+                die(ReadObjectHookErrorReturnCode::ErrorReadObjectProtocol, "Bad sha1 in get command\n");
+            }
+
+            sha1s.push_back(std::string(packet + 5, SHA1_LENGTH));
         }
 
-        if (packet_txt_read(packet_buffer, sizeof(packet_buffer)))
+        if (sha1s.empty() || (version == 1 && sha1s.size() != 1))
         {
             die(ReadObjectHookErrorReturnCode::ErrorReadObjectProtocol, "Bad command end\n");
         }
 
-        err = DownloadSHA(pipeHandle, packet_buffer + 5);
+        results.assign(sha1s.size(), ReturnCode::Success);
+        missingSha1s.clear();
+        for (size_t i = 0; i < sha1s.size(); ++i)
+        {
+            if (!LocalObjectExists(sha1s[i].c_str()))
+            {
+                missingSha1s.push_back(sha1s[i]);
+            }
+        }
+
+        if (!missingSha1s.empty())
+        {
+            if (!pipeConnected)
+            {
+                pipeHandle = CreatePipeToGVFS(pipeName);
+                pipeConnected = true;
+
+                multiplexedPipe.reset(new MultiplexedPipe(pipeHandle));
+                if (!multiplexedPipe->TryEnable())
+                {
+                    multiplexedPipe.reset();
+                }
+            }
+
+            if (version == 1)
+            {
+                results[0] = multiplexedPipe ? DownloadSHA(*multiplexedPipe, sha1s[0]) : DownloadSHA(pipeHandle, sha1s[0].c_str());
+            }
+            else
+            {
+                if (multiplexedPipe)
+                {
+                    DownloadSHAs(*multiplexedPipe, missingSha1s, missingResults);
+                }
+                else
+                {
+                    DownloadSHAs(pipeHandle, missingSha1s, missingResults);
+                }
+
+                for (size_t i = 0, missingIndex = 0; i < sha1s.size() && missingIndex < missingSha1s.size(); ++i)
+                {
+                    if (sha1s[i] == missingSha1s[missingIndex])
+                    {
+                        results[i] = missingResults[missingIndex];
+                        ++missingIndex;
+                    }
+                }
+            }
+        }
+
+        if (version == 1)
+        {
+            err = results[0];
+        }
+        else
+        {
+            err = ReturnCode::Success;
+            for (size_t i = 0; i < sha1s.size(); ++i)
+            {
+                statusLine = "sha1=" + sha1s[i] + (results[i] ? " status=error" : " status=success");
+                packet_txt_write(statusLine.c_str());
+                if (results[i])
+                {
+                    err = results[i];
+                }
+            }
+        }
+
         packet_txt_write(err ? "status=error" : "status=success");
         packet_flush();
     }
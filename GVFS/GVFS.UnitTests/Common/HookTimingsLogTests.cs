@@ -0,0 +1,165 @@
+﻿using GVFS.Common;
+using GVFS.Tests.Should;
+using NUnit.Framework;
+using System;
+using System.Collections.Generic;
+using System.IO.MemoryMappedFiles;
+using System.Linq;
+using System.Text;
+
+namespace GVFS.UnitTests.Common
+{
+    [TestFixture]
+    public class HookTimingsLogTests
+    {
+        private const uint Capacity = 4;
+
+        [TestCase]
+        public void ReadsCompleteEntriesInTheOrderTheyWereWritten()
+        {
+            using (MemoryMappedFile log = CreateLog(entryCount: 6))
+            using (MemoryMappedViewAccessor accessor = log.CreateViewAccessor())
+            {
+                // Entries 5 and 6 have replaced entries 1 and 2, and entry 4 is still being written
+                WriteEntry(accessor, sequence: 3, durationMs: 30, verb: "status");
+                WriteEntry(accessor, sequence: 4, durationMs: 40, verb: "commit");
+                WriteEntry(accessor, sequence: 5, durationMs: 50, verb: "checkout", ranInProcess: true);
+                WriteEntry(accessor, sequence: 6, durationMs: 60, verb: "add");
+                accessor.Write(HookTimingsLog.HeaderSize + (3 * HookTimingsLog.EntrySize), 0UL);
+
+                List<HookTimingsLog.Entry> entries;
+                string error;
+                HookTimingsLog.TryReadEntries(accessor, out entries, out error).ShouldBeTrue(error);
+
+                entries.Select(entry => entry.Sequence).ShouldMatchInOrder(new[] { 3UL, 5UL, 6UL });
+                entries[0].Verb.ShouldEqual("status");
+                entries[0].HookName.ShouldEqual("pre-command");
+                entries[0].Duration.ShouldEqual(TimeSpan.FromMilliseconds(30));
+                entries[0].StartTime.ShouldEqual(DateTimeOffset.FromUnixTimeSeconds(1500000000).AddMilliseconds(3));
+                entries[0].RanInProcess.ShouldBeFalse();
+                entries[1].RanInProcess.ShouldBeTrue();
+                entries[2].ExitCode.ShouldEqual(1);
+            }
+        }
+
+        [TestCase]
+        public void SkipsEntriesWrittenToTheWrongSlot()
+        {
+            using (MemoryMappedFile log = CreateLog(entryCount: 1))
+            using (MemoryMappedViewAccessor accessor = log.CreateViewAccessor())
+            {
+                WriteEntry(accessor, sequence: 1, durationMs: 10, verb: "status");
+                accessor.Write(HookTimingsLog.HeaderSize + HookTimingsLog.EntrySize, 1UL);
+
+                List<HookTimingsLog.Entry> entries;
+                string error;
+                HookTimingsLog.TryReadEntries(accessor, out entries, out error).ShouldBeTrue(error);
+                entries.Count.ShouldEqual(1);
+            }
+        }
+
+        [TestCase]
+        public void FailsForUninitializedLog()
+        {
+            using (MemoryMappedFile log = MemoryMappedFile.CreateNew(null, HookTimingsLog.HeaderSize + (Capacity * HookTimingsLog.EntrySize)))
+            using (MemoryMappedViewAccessor accessor = log.CreateViewAccessor())
+            {
+                List<HookTimingsLog.Entry> entries;
+                string error;
+                HookTimingsLog.TryReadEntries(accessor, out entries, out error).ShouldBeFalse();
+                entries.ShouldBeNull();
+            }
+        }
+
+        [TestCase]
+        public void FailsForUnknownVersion()
+        {
+            using (MemoryMappedFile log = CreateLog(entryCount: 0))
+            using (MemoryMappedViewAccessor accessor = log.CreateViewAccessor())
+            {
+                accessor.Write(HookTimingsLog.VersionOffset, HookTimingsLog.FormatVersion + 1);
+
+                List<HookTimingsLog.Entry> entries;
+                string error;
+                HookTimingsLog.TryReadEntries(accessor, out entries, out error).ShouldBeFalse();
+            }
+        }
+
+        [TestCase]
+        public void FailsWhenCapacityDoesNotFit()
+        {
+            using (MemoryMappedFile log = CreateLog(entryCount: 0))
+            using (MemoryMappedViewAccessor accessor = log.CreateViewAccessor())
+            {
+                accessor.Write(HookTimingsLog.CapacityOffset, uint.MaxValue);
+
+                List<HookTimingsLog.Entry> entries;
+                string error;
+                HookTimingsLog.TryReadEntries(accessor, out entries, out error).ShouldBeFalse();
+            }
+        }
+
+        [TestCase]
+        public void SummarizesPercentilesPerVerbAndHook()
+        {
+            List<HookTimingsLog.Entry> entries = new List<HookTimingsLog.Entry>();
+            for (int i = 1; i <= 100; ++i)
+            {
+                entries.Add(CreateEntry("status", "pre-command", TimeSpan.FromMilliseconds(101 - i)));
+            }
+
+            entries.Add(CreateEntry("commit", "post-command", TimeSpan.FromMilliseconds(7)));
+            entries.Add(CreateEntry("commit", "pre-command", TimeSpan.FromMilliseconds(3)));
+
+            List<HookTimingsLog.LatencySummary> summaries = HookTimingsLog.SummarizeByVerb(entries);
+            summaries.Select(summary => summary.Verb + " " + summary.HookName).ShouldMatchInOrder(new[] { "commit post-command", "commit pre-command", "status pre-command" });
+
+            summaries[0].Count.ShouldEqual(1);
+            summaries[0].P50.ShouldEqual(TimeSpan.FromMilliseconds(7));
+            summaries[0].P99.ShouldEqual(TimeSpan.FromMilliseconds(7));
+
+            summaries[2].Count.ShouldEqual(100);
+            summaries[2].P50.ShouldEqual(TimeSpan.FromMilliseconds(50));
+            summaries[2].P95.ShouldEqual(TimeSpan.FromMilliseconds(95));
+            summaries[2].P99.ShouldEqual(TimeSpan.FromMilliseconds(99));
+        }
+
+        private static HookTimingsLog.Entry CreateEntry(string verb, string hookName, TimeSpan duration)
+        {
+            return new HookTimingsLog.Entry(1, DateTimeOffset.UtcNow, duration, 0, hookName, verb, ranInProcess: false);
+        }
+
+        private static MemoryMappedFile CreateLog(ulong entryCount)
+        {
+            MemoryMappedFile log = MemoryMappedFile.CreateNew(null, HookTimingsLog.HeaderSize + (Capacity * HookTimingsLog.EntrySize));
+            using (MemoryMappedViewAccessor accessor = log.CreateViewAccessor())
+            {
+                accessor.WriteArray(0, HookTimingsLog.Magic, 0, HookTimingsLog.Magic.Length);
+                accessor.Write(HookTimingsLog.VersionOffset, HookTimingsLog.FormatVersion);
+                accessor.Write(HookTimingsLog.CapacityOffset, Capacity);
+                accessor.Write(HookTimingsLog.EntrySizeOffset, (uint)HookTimingsLog.EntrySize);
+                accessor.Write(HookTimingsLog.EntryCountOffset, entryCount);
+            }
+
+            return log;
+        }
+
+        private static void WriteEntry(MemoryMappedViewAccessor accessor, ulong sequence, int durationMs, string verb, bool ranInProcess = false)
+        {
+            long offset = HookTimingsLog.HeaderSize + ((long)((sequence - 1) % Capacity) * HookTimingsLog.EntrySize);
+            accessor.Write(offset + HookTimingsLog.SequenceOffset, sequence);
+            accessor.Write(offset + HookTimingsLog.StartTimeOffset, (1500000000L * 1000000) + ((long)sequence * 1000));
+            accessor.Write(offset + HookTimingsLog.DurationOffset, durationMs * 1000L);
+            accessor.Write(offset + HookTimingsLog.ExitCodeOffset, sequence == 6 ? 1 : 0);
+            accessor.Write(offset + HookTimingsLog.FlagsOffset, ranInProcess ? HookTimingsLog.InProcessFlag : 0);
+
+            byte[] hookName = new byte[HookTimingsLog.NameSize];
+            Encoding.UTF8.GetBytes("pre-command", 0, "pre-command".Length, hookName, 0);
+            accessor.WriteArray(offset + HookTimingsLog.HookNameOffset, hookName, 0, hookName.Length);
+
+            byte[] verbName = new byte[HookTimingsLog.NameSize];
+            Encoding.UTF8.GetBytes(verb, 0, verb.Length, verbName, 0);
+            accessor.WriteArray(offset + HookTimingsLog.VerbOffset, verbName, 0, verbName.Length);
+        }
+    }
+}
@@ -4,6 +4,7 @@ using GVFS.UnitTests.Mock;
 using GVFS.UnitTests.Mock.FileSystem;
 using NUnit.Framework;
 using System;
+using System.Collections.Generic;
 using System.IO;
 
 namespace GVFS.UnitTests.Common
@@ -74,6 +75,52 @@ A dir1/dir2/file3.txt
             TestAddingPath(pathToAdd: Path.Combine("dir", "subdir"), pathInList: Path.Combine("dir", "subdir") + Path.DirectorySeparatorChar, isFolder: true);
         }
 
+        [TestCase]
+        public void GenerationTokensReturnOnlyAddedPaths()
+        {
+            ModifiedPathsDatabase mpd = CreateModifiedPathsDatabase(ExistingEntries);
+
+            string firstToken;
+            mpd.GetAllModifiedPaths(out firstToken).Count.ShouldEqual(3);
+
+            bool isRetryable;
+            mpd.TryAdd("new1.txt", isFolder: false, isRetryable: out isRetryable).ShouldBeTrue();
+            mpd.TryAdd("file.txt", isFolder: false, isRetryable: out isRetryable).ShouldBeTrue();
+            mpd.TryAdd("newDir", isFolder: true, isRetryable: out isRetryable).ShouldBeTrue();
+
+            IReadOnlyList<string> addedPaths;
+            string secondToken;
+            mpd.TryGetModifiedPathsAddedSince(firstToken, out addedPaths, out secondToken).ShouldBeTrue();
+            addedPaths.ShouldMatchInOrder(new[] { "new1.txt", "newDir/" });
+            secondToken.ShouldNotEqual(firstToken);
+
+            string thirdToken;
+            mpd.TryGetModifiedPathsAddedSince(secondToken, out addedPaths, out thirdToken).ShouldBeTrue();
+            addedPaths.ShouldBeEmpty();
+            thirdToken.ShouldEqual(secondToken);
+
+            string fullListToken;
+            mpd.GetAllModifiedPaths(out fullListToken).Count.ShouldEqual(5);
+            fullListToken.ShouldEqual(secondToken);
+        }
+
+        [TestCase]
+        public void GenerationTokensFromOtherDatabasesAreRejected()
+        {
+            ModifiedPathsDatabase mpd = CreateModifiedPathsDatabase(ExistingEntries);
+            ModifiedPathsDatabase remountedMpd = CreateModifiedPathsDatabase(ExistingEntries);
+
+            string token;
+            mpd.GetAllModifiedPaths(out token);
+
+            IReadOnlyList<string> addedPaths;
+            string currentToken;
+            remountedMpd.TryGetModifiedPathsAddedSince(token, out addedPaths, out currentToken).ShouldBeFalse();
+            mpd.TryGetModifiedPathsAddedSince(null, out addedPaths, out currentToken).ShouldBeFalse();
+            mpd.TryGetModifiedPathsAddedSince("NotAToken", out addedPaths, out currentToken).ShouldBeFalse();
+            mpd.TryGetModifiedPathsAddedSince(token.Replace(".3", ".4"), out addedPaths, out currentToken).ShouldBeFalse();
+        }
+
         private static void TestAddingPath(string path, bool isFolder = false)
         {
             TestAddingPath(path, path, isFolder);
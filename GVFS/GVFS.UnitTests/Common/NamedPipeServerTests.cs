@@ -0,0 +1,263 @@
+﻿using GVFS.Common.NamedPipes;
+using GVFS.Common.Tracing;
+using GVFS.Tests.Should;
+using GVFS.UnitTests.Mock.Common;
+using NUnit.Framework;
+using System;
+using System.Collections.Generic;
+using System.IO.Pipes;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace GVFS.UnitTests.Common
+{
+    [TestFixture]
+    public class NamedPipeServerTests
+    {
+        private const string EchoRequest = "Echo";
+        private const string WaitRequest = "Wait";
+        private const string ReleaseRequest = "Release";
+        private const string ListRequest = "List";
+        private const string OversizeRequest = "Oversize";
+        private const string SuccessResult = "S";
+
+        private static readonly TimeSpan ResponseTimeout = TimeSpan.FromSeconds(30);
+
+        private ManualResetEventSlim releaseWaitingRequest;
+        private ManualResetEventSlim oversizeRequestHandled;
+        private bool oversizeResponseSent;
+
+        [SetUp]
+        public void SetUp()
+        {
+            this.releaseWaitingRequest = new ManualResetEventSlim(initialState: false);
+            this.oversizeRequestHandled = new ManualResetEventSlim(initialState: false);
+            this.oversizeResponseSent = true;
+        }
+
+        [TearDown]
+        public void TearDown()
+        {
+            this.releaseWaitingRequest.Dispose();
+            this.oversizeRequestHandled.Dispose();
+        }
+
+        [TestCase]
+        public void LineBasedRequestsAreStillSupported()
+        {
+            string pipeName = CreatePipeName();
+            using (NamedPipeServer server = NamedPipeServer.StartNewServer(pipeName, new MockTracer(), this.HandleRequest))
+            using (NamedPipeClient client = new NamedPipeClient(pipeName))
+            {
+                client.Connect().ShouldBeTrue();
+
+                client.SendRequest(new NamedPipeMessages.Message(EchoRequest, "line"));
+                client.ReadRawResponse().ShouldEqual(SuccessResult + "|line");
+
+                client.SendRequest(new NamedPipeMessages.Message(NamedPipeMessages.Multiplexing.Request, "0"));
+                client.ReadRawResponse().ShouldEqual(NamedPipeMessages.Multiplexing.InvalidVersion);
+
+                client.SendRequest(new NamedPipeMessages.Message(EchoRequest, "still line based"));
+                client.ReadRawResponse().ShouldEqual(SuccessResult + "|still line based");
+            }
+        }
+
+        [TestCase]
+        public void MultiplexedRequestsCanBeAnsweredOutOfOrder()
+        {
+            string pipeName = CreatePipeName();
+            using (NamedPipeServer server = NamedPipeServer.StartNewServer(pipeName, new MockTracer(), this.HandleRequest))
+            using (NamedPipeClientStream pipe = ConnectMultiplexedClient(pipeName))
+            {
+                // The first request is not answered until the second one has been handled
+                SendFrame(pipe, 1, new NamedPipeMessages.Message(WaitRequest, "first"));
+                SendFrame(pipe, 2, new NamedPipeMessages.Message(ReleaseRequest, "second"));
+
+                uint requestId;
+                string response;
+                MultiplexedFrame.TryRead(pipe, out requestId, out response).ShouldBeTrue();
+                requestId.ShouldEqual(2u);
+                response.ShouldEqual(SuccessResult + "|second");
+
+                MultiplexedFrame.TryRead(pipe, out requestId, out response).ShouldBeTrue();
+                requestId.ShouldEqual(1u);
+                response.ShouldEqual(SuccessResult + "|first");
+            }
+        }
+
+        [TestCase]
+        public void MultiplexedConnectionsHandleManyConcurrentClients()
+        {
+            const int ClientCount = 16;
+            const int RequestsPerClient = 250;
+
+            string pipeName = CreatePipeName();
+            using (NamedPipeServer server = NamedPipeServer.StartNewServer(pipeName, new MockTracer(), this.HandleRequest))
+            {
+                // The clients block on pipe reads, run them on their own threads so they don't starve the
+                // thread pool that the server uses to handle the requests
+                Task[] clients = Enumerable.Range(0, ClientCount)
+                    .Select(clientNumber => Task.Factory.StartNew(
+                        () => RunEchoClient(pipeName, clientNumber, RequestsPerClient),
+                        TaskCreationOptions.LongRunning))
+                    .ToArray();
+
+                Task.WaitAll(clients, ResponseTimeout).ShouldBeTrue("Clients did not receive all of their responses");
+            }
+        }
+
+        [TestCase]
+        public void StreamedResponsesMatchSingleMessageResponses()
+        {
+            // Enough items that the response is written in several chunks
+            const int ItemCount = 20000;
+            string expectedResponse = new NamedPipeMessages.Message(SuccessResult, string.Join("\0", CreateListItems(ItemCount)) + "\0").ToString();
+
+            string pipeName = CreatePipeName();
+            using (NamedPipeServer server = NamedPipeServer.StartNewServer(pipeName, new MockTracer(), this.HandleRequest))
+            {
+                using (NamedPipeClient client = new NamedPipeClient(pipeName))
+                {
+                    client.Connect().ShouldBeTrue();
+
+                    client.SendRequest(new NamedPipeMessages.Message(ListRequest, ItemCount.ToString()));
+                    client.ReadRawResponse().ShouldEqual(expectedResponse);
+
+                    client.SendRequest(new NamedPipeMessages.Message(EchoRequest, "after list"));
+                    client.ReadRawResponse().ShouldEqual(SuccessResult + "|after list");
+                }
+
+                using (NamedPipeClientStream pipe = ConnectMultiplexedClient(pipeName))
+                {
+                    SendFrame(pipe, 1, new NamedPipeMessages.Message(ListRequest, ItemCount.ToString()));
+
+                    uint requestId;
+                    string response;
+                    MultiplexedFrame.TryRead(pipe, out requestId, out response).ShouldBeTrue();
+                    requestId.ShouldEqual(1u);
+                    response.ShouldEqual(expectedResponse);
+                }
+            }
+        }
+
+        [TestCase]
+        public void MultiplexedResponsesTooLargeForAFrameFailTheRequestOnly()
+        {
+            string pipeName = CreatePipeName();
+            using (NamedPipeServer server = NamedPipeServer.StartNewServer(pipeName, new MockTracer(), this.HandleRequest))
+            using (NamedPipeClientStream pipe = ConnectMultiplexedClient(pipeName))
+            {
+                SendFrame(pipe, 1, new NamedPipeMessages.Message(OversizeRequest, string.Empty));
+
+                uint requestId;
+                string response;
+                MultiplexedFrame.TryRead(pipe, out requestId, out response).ShouldBeTrue();
+                requestId.ShouldEqual(1u);
+                response.ShouldEqual(NamedPipeMessages.Multiplexing.ResponseTooLarge);
+                this.oversizeRequestHandled.Wait(ResponseTimeout).ShouldBeTrue();
+                this.oversizeResponseSent.ShouldBeFalse();
+
+                // The connection is still usable
+                SendFrame(pipe, 2, new NamedPipeMessages.Message(EchoRequest, "after oversize"));
+                MultiplexedFrame.TryRead(pipe, out requestId, out response).ShouldBeTrue();
+                requestId.ShouldEqual(2u);
+                response.ShouldEqual(SuccessResult + "|after oversize");
+            }
+        }
+
+        private static IEnumerable<string> CreateListItems(int count)
+        {
+            return Enumerable.Range(0, count).Select(i => $"folder{i % 100}/file{i}.txt");
+        }
+
+        private static string CreatePipeName()
+        {
+            return "GVFS_UnitTests_" + Guid.NewGuid().ToString("N");
+        }
+
+        private static NamedPipeClientStream ConnectMultiplexedClient(string pipeName)
+        {
+            NamedPipeClientStream pipe = new NamedPipeClientStream(pipeName);
+            pipe.Connect((int)ResponseTimeout.TotalMilliseconds);
+
+            NamedPipeMessages.Message request = new NamedPipeMessages.Message(NamedPipeMessages.Multiplexing.Request, NamedPipeMessages.Multiplexing.CurrentVersion);
+            byte[] requestBytes = Encoding.UTF8.GetBytes(request.ToString() + "\n");
+            pipe.Write(requestBytes, 0, requestBytes.Length);
+            pipe.Flush();
+
+            // Read the response one byte at a time so that nothing after the newline is consumed
+            StringBuilder response = new StringBuilder();
+            int nextByte;
+            while ((nextByte = pipe.ReadByte()) != '\n')
+            {
+                nextByte.ShouldNotEqual(-1, "Pipe closed before multiplexing was enabled");
+                response.Append((char)nextByte);
+            }
+
+            response.ToString().ShouldEqual(NamedPipeMessages.Multiplexing.SuccessResult);
+            return pipe;
+        }
+
+        private static void SendFrame(NamedPipeClientStream pipe, uint requestId, NamedPipeMessages.Message message)
+        {
+            byte[] frame = MultiplexedFrame.Create(requestId, message.ToString());
+            pipe.Write(frame, 0, frame.Length);
+            pipe.Flush();
+        }
+
+        private static void RunEchoClient(string pipeName, int clientNumber, int requestCount)
+        {
+            using (NamedPipeClientStream pipe = ConnectMultiplexedClient(pipeName))
+            {
+                // Keep every request outstanding before reading any of the responses
+                for (uint requestId = 0; requestId < requestCount; ++requestId)
+                {
+                    SendFrame(pipe, requestId, new NamedPipeMessages.Message(EchoRequest, $"{clientNumber}:{requestId}"));
+                }
+
+                HashSet<uint> answeredRequests = new HashSet<uint>();
+                for (int i = 0; i < requestCount; ++i)
+                {
+                    uint requestId;
+                    string response;
+                    MultiplexedFrame.TryRead(pipe, out requestId, out response).ShouldBeTrue();
+                    answeredRequests.Add(requestId).ShouldBeTrue($"Request {requestId} was answered more than once");
+                    response.ShouldEqual($"{SuccessResult}|{clientNumber}:{requestId}");
+                }
+
+                answeredRequests.Count.ShouldEqual(requestCount);
+            }
+        }
+
+        private void HandleRequest(ITracer tracer, string request, NamedPipeServer.Connection connection)
+        {
+            NamedPipeMessages.Message message = NamedPipeMessages.Message.FromString(request);
+            if (message.Header == ListRequest)
+            {
+                connection.TrySendResponse(SuccessResult, CreateListItems(int.Parse(message.Body)), '\0');
+                return;
+            }
+
+            if (message.Header == OversizeRequest)
+            {
+                this.oversizeResponseSent = connection.TrySendResponse(new string('x', MultiplexedFrame.MaxMessageLength + 1));
+                this.oversizeRequestHandled.Set();
+                return;
+            }
+
+            if (message.Header == WaitRequest)
+            {
+                this.releaseWaitingRequest.Wait(ResponseTimeout);
+            }
+
+            connection.TrySendResponse(new NamedPipeMessages.Message(SuccessResult, message.Body));
+
+            if (message.Header == ReleaseRequest)
+            {
+                this.releaseWaitingRequest.Set();
+            }
+        }
+    }
+}
@@ -9,11 +9,14 @@ using GVFS.UnitTests.Mock.FileSystem;
 using GVFS.UnitTests.Mock.Git;
 using NUnit.Framework;
 using System;
+using System.Collections.Concurrent;
 using System.Collections.Generic;
 using System.IO;
+using System.Linq;
 using System.Net;
 using System.Reflection;
 using System.Threading;
+using System.Threading.Tasks;
 
 namespace GVFS.UnitTests.Git
 {
@@ -113,6 +116,221 @@ namespace GVFS.UnitTests.Git
                 gitObjects => gitObjects.TryDownloadCommit("object0"));
         }
 
+        [TestCase]
+        public void DownloadsMultipleObjectsWithBatchedRequest()
+        {
+            const string Sha1 = "1111111111111111111111111111111111111111";
+            const string Sha2 = "2222222222222222222222222222222222222222";
+            const string Sha3 = "3333333333333333333333333333333333333333";
+
+            List<string> requestedObjects = new List<string>();
+            GVFSGitObjects dut = this.CreateTestableGVFSGitObjectsForBatchedDownloads(
+                sha =>
+                {
+                    requestedObjects.Add(sha);
+                    return sha + "Contents";
+                });
+
+            GitObjects.DownloadAndSaveObjectResult[] results = dut.TryDownloadAndSaveObjects(new[] { Sha1, Sha2, Sha3 }, GVFSGitObjects.RequestSource.FileStreamCallback);
+
+            results.ShouldMatchInOrder(new[]
+            {
+                GitObjects.DownloadAndSaveObjectResult.Success,
+                GitObjects.DownloadAndSaveObjectResult.Success,
+                GitObjects.DownloadAndSaveObjectResult.Success
+            });
+
+            // All three objects should have been resolved by the single batched request
+            requestedObjects.ShouldMatchInOrder(new[] { Sha1, Sha2, Sha3 });
+        }
+
+        [TestCase]
+        public void ReportsPerObjectResultsWhenBatchedRequestFails()
+        {
+            const string Sha1 = "1111111111111111111111111111111111111111";
+            const string MissingSha = "2222222222222222222222222222222222222222";
+
+            MockBatchHttpGitObjects httpObjects;
+            GVFSGitObjects dut = this.CreateTestableGVFSGitObjectsForBatchedDownloads(sha => sha == MissingSha ? null : sha + "Contents", out httpObjects);
+            httpObjects.RejectBatchesWithMissingObjects = true;
+
+            GitObjects.DownloadAndSaveObjectResult[] results = dut.TryDownloadAndSaveObjects(
+                new[] { Sha1, MissingSha, GVFSConstants.AllZeroSha },
+                GVFSGitObjects.RequestSource.FileStreamCallback);
+
+            results[0].ShouldEqual(GitObjects.DownloadAndSaveObjectResult.Success);
+            results[1].ShouldEqual(GitObjects.DownloadAndSaveObjectResult.ObjectNotOnServer);
+            results[2].ShouldEqual(GitObjects.DownloadAndSaveObjectResult.Error);
+
+            // The missing object should now be in the negative cache
+            dut.TryDownloadAndSaveObjects(new[] { Sha1, MissingSha }, GVFSGitObjects.RequestSource.FileStreamCallback)[1]
+                .ShouldEqual(GitObjects.DownloadAndSaveObjectResult.ObjectNotOnServer);
+        }
+
+        [TestCase]
+        public void RetriesRejectedBatchedRequestsWithSmallerBatches()
+        {
+            const int ObjectCount = 64;
+            string[] objectIds = Enumerable.Range(1, ObjectCount).Select(i => i.ToString("x40")).ToArray();
+            string missingSha = objectIds[ObjectCount / 3];
+
+            MockBatchHttpGitObjects httpObjects;
+            GVFSGitObjects dut = this.CreateTestableGVFSGitObjectsForBatchedDownloads(sha => sha == missingSha ? null : sha + "Contents", out httpObjects);
+            httpObjects.RejectBatchesWithMissingObjects = true;
+
+            GitObjects.DownloadAndSaveObjectResult[] results = dut.TryDownloadAndSaveObjects(objectIds, GVFSGitObjects.RequestSource.FileStreamCallback);
+
+            for (int i = 0; i < ObjectCount; ++i)
+            {
+                results[i].ShouldEqual(objectIds[i] == missingSha ? GitObjects.DownloadAndSaveObjectResult.ObjectNotOnServer : GitObjects.DownloadAndSaveObjectResult.Success);
+            }
+
+            // Halving the rejected batches isolates the missing object with two batched requests per level
+            httpObjects.BatchRequestCount.ShouldBeAtMost(2 * (int)Math.Log(ObjectCount, 2));
+        }
+
+        [TestCase]
+        public void ReportsWhichObjectsInABatchWereCoalesced()
+        {
+            const string Sha1 = "1111111111111111111111111111111111111111";
+            const string Sha2 = "2222222222222222222222222222222222222222";
+
+            ManualResetEventSlim downloadStarted = new ManualResetEventSlim(initialState: false);
+            GVFSGitObjects dut = null;
+
+            // Hold the single object download open until the batch has joined it
+            dut = this.CreateTestableGVFSGitObjectsForBatchedDownloads(
+                sha =>
+                {
+                    if (sha == Sha2)
+                    {
+                        downloadStarted.Set();
+                        SpinWait.SpinUntil(() => dut.CoalescedDownloadCount >= 1, TimeSpan.FromSeconds(30));
+                    }
+
+                    return sha + "Contents";
+                });
+
+            Task<GitObjects.DownloadAndSaveObjectResult> download = Task.Factory.StartNew(
+                () => dut.TryDownloadAndSaveObject(Sha2, GVFSGitObjects.RequestSource.FileStreamCallback),
+                TaskCreationOptions.LongRunning);
+
+            downloadStarted.Wait(TimeSpan.FromSeconds(30)).ShouldBeTrue("Download did not start");
+
+            bool[] coalesced;
+            dut.TryDownloadAndSaveObjects(new[] { Sha1, Sha2 }, GVFSGitObjects.RequestSource.FileStreamCallback, out coalesced)
+                .ShouldNotContain(result => result != GitObjects.DownloadAndSaveObjectResult.Success);
+            coalesced.ShouldMatchInOrder(new[] { false, true });
+
+            download.Wait(TimeSpan.FromSeconds(30)).ShouldBeTrue("Download did not complete");
+        }
+
+        [TestCase]
+        public void ConcurrentDownloadsOfTheSameObjectAreCoalesced()
+        {
+            const int ObjectCount = 10;
+            const int RequestCount = 500;
+
+            string[] objectIds = Enumerable.Range(1, ObjectCount).Select(i => i.ToString("x40")).ToArray();
+            ConcurrentDictionary<string, int> fetchCounts = new ConcurrentDictionary<string, int>(StringComparer.OrdinalIgnoreCase);
+            GVFSGitObjects dut = null;
+
+            // Hold every fetch open until all of the other requests have joined an in-flight download,
+            // so that a request can only trigger a second fetch if coalescing is broken
+            dut = this.CreateTestableGVFSGitObjectsForBatchedDownloads(
+                sha =>
+                {
+                    fetchCounts.AddOrUpdate(sha, 1, (key, count) => count + 1);
+                    SpinWait.SpinUntil(() => dut.CoalescedDownloadCount >= RequestCount - ObjectCount, TimeSpan.FromSeconds(30));
+                    return sha + "Contents";
+                });
+
+            Task<GitObjects.DownloadAndSaveObjectResult>[] requests = Enumerable.Range(0, RequestCount)
+                .Select(i => Task.Factory.StartNew(
+                    () => dut.TryDownloadAndSaveObject(objectIds[i % ObjectCount], GVFSGitObjects.RequestSource.FileStreamCallback),
+                    TaskCreationOptions.LongRunning))
+                .ToArray();
+
+            Task.WaitAll(requests, TimeSpan.FromMinutes(1)).ShouldBeTrue("Requests did not complete");
+            requests.ShouldNotContain(request => request.Result != GitObjects.DownloadAndSaveObjectResult.Success);
+
+            fetchCounts.Count.ShouldEqual(ObjectCount);
+            fetchCounts.Values.Sum().ShouldEqual(ObjectCount);
+            dut.CoalescedDownloadCount.ShouldEqual(RequestCount - ObjectCount);
+        }
+
+        [TestCase]
+        public void SingleObjectRequestsJoinBatchedDownloads()
+        {
+            const string Sha1 = "1111111111111111111111111111111111111111";
+            const string Sha2 = "2222222222222222222222222222222222222222";
+
+            ConcurrentDictionary<string, int> fetchCounts = new ConcurrentDictionary<string, int>(StringComparer.OrdinalIgnoreCase);
+            ManualResetEventSlim batchStarted = new ManualResetEventSlim(initialState: false);
+            GVFSGitObjects dut = null;
+
+            // Hold the batch open until the single object request has joined it
+            dut = this.CreateTestableGVFSGitObjectsForBatchedDownloads(
+                sha =>
+                {
+                    fetchCounts.AddOrUpdate(sha, 1, (key, count) => count + 1);
+                    batchStarted.Set();
+                    SpinWait.SpinUntil(() => dut.CoalescedDownloadCount >= 1, TimeSpan.FromSeconds(30));
+                    return sha + "Contents";
+                });
+
+            Task<GitObjects.DownloadAndSaveObjectResult[]> batch = Task.Factory.StartNew(
+                () => dut.TryDownloadAndSaveObjects(new[] { Sha1, Sha2 }, GVFSGitObjects.RequestSource.FileStreamCallback),
+                TaskCreationOptions.LongRunning);
+
+            batchStarted.Wait(TimeSpan.FromSeconds(30)).ShouldBeTrue("Batch did not start");
+
+            bool coalesced;
+            dut.TryDownloadAndSaveObject(Sha2, GVFSGitObjects.RequestSource.FileStreamCallback, out coalesced)
+                .ShouldEqual(GitObjects.DownloadAndSaveObjectResult.Success);
+            coalesced.ShouldBeTrue();
+
+            batch.Wait(TimeSpan.FromSeconds(30)).ShouldBeTrue("Batch did not complete");
+            batch.Result.ShouldNotContain(result => result != GitObjects.DownloadAndSaveObjectResult.Success);
+            fetchCounts[Sha2].ShouldEqual(1);
+        }
+
+        [TestCase]
+        public void NamedPipeRequestsDoNotJoinDownloadsThatKeepExistingObjects()
+        {
+            const string Sha = "1111111111111111111111111111111111111111";
+
+            // Hold the first download open until the named pipe request has started its own, and give
+            // the two downloads different results so that a coalesced request would be detected
+            int fetchCount = 0;
+            GVFSGitObjects dut = this.CreateTestableGVFSGitObjectsForBatchedDownloads(
+                sha =>
+                {
+                    if (Interlocked.Increment(ref fetchCount) == 1)
+                    {
+                        SpinWait.SpinUntil(() => Volatile.Read(ref fetchCount) >= 2, TimeSpan.FromSeconds(30));
+                        return sha + "Contents";
+                    }
+
+                    return null;
+                });
+
+            Task<GitObjects.DownloadAndSaveObjectResult> callbackRequest = Task.Factory.StartNew(
+                () => dut.TryDownloadAndSaveObject(Sha, GVFSGitObjects.RequestSource.FileStreamCallback),
+                TaskCreationOptions.LongRunning);
+
+            SpinWait.SpinUntil(() => Volatile.Read(ref fetchCount) >= 1, TimeSpan.FromSeconds(30)).ShouldBeTrue("Download did not start");
+
+            bool coalesced;
+            dut.TryDownloadAndSaveObject(Sha, GVFSGitObjects.RequestSource.NamedPipeMessage, out coalesced)
+                .ShouldEqual(GitObjects.DownloadAndSaveObjectResult.ObjectNotOnServer);
+            coalesced.ShouldBeFalse();
+
+            callbackRequest.Wait(TimeSpan.FromSeconds(30)).ShouldBeTrue("Download did not complete");
+            callbackRequest.Result.ShouldEqual(GitObjects.DownloadAndSaveObjectResult.Success);
+            fetchCount.ShouldEqual(2);
+        }
+
         private void AssertRetryableExceptionOnDownload(
             MemoryStream inputStream,
             string mediaType,
@@ -147,6 +365,28 @@ namespace GVFS.UnitTests.Git
             return dut;
         }
 
+        private GVFSGitObjects CreateTestableGVFSGitObjectsForBatchedDownloads(Func<string, string> objectResolver)
+        {
+            MockBatchHttpGitObjects httpObjects;
+            return this.CreateTestableGVFSGitObjectsForBatchedDownloads(objectResolver, out httpObjects);
+        }
+
+        private GVFSGitObjects CreateTestableGVFSGitObjectsForBatchedDownloads(Func<string, string> objectResolver, out MockBatchHttpGitObjects httpObjects)
+        {
+            MockFileSystemWithCallbacks fileSystem = new MockFileSystemWithCallbacks();
+            fileSystem.OnFileExists = () => true;
+            fileSystem.OnOpenFileStream = (path, mode, access) => new MemoryStream();
+
+            MockTracer tracer = new MockTracer();
+            GVFSEnlistment enlistment = new GVFSEnlistment(TestEnlistmentRoot, "https://fakeRepoUrl", "fakeGitBinPath", gvfsHooksRoot: null);
+            enlistment.InitializeCachePathsFromKey(TestLocalCacheRoot, TestObjecRoot);
+            GitRepo repo = new GitRepo(tracer, enlistment, fileSystem, () => new MockLibGit2Repo(tracer));
+
+            GVFSContext context = new GVFSContext(tracer, fileSystem, repo, enlistment);
+            httpObjects = new MockBatchHttpGitObjects(tracer, enlistment, objectResolver);
+            return new GVFSGitObjects(context, httpObjects);
+        }
+
         private string GetDataPath(string fileName)
         {
             string workingDirectory = Path.GetDirectoryName(Assembly.GetExecutingAssembly().Location);
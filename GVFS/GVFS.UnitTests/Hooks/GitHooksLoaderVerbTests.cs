@@ -0,0 +1,110 @@
+﻿using GVFS.Tests.Should;
+using NUnit.Framework;
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Reflection;
+using System.Text.RegularExpressions;
+
+namespace GVFS.UnitTests.Hooks
+{
+    /// <summary>
+    /// GitHooksLoader handles the verbs in NoLockVerbs and LockVerbs (GitHooksLoader\gvfslock.cpp) itself,
+    /// without running GVFS.Hooks, so those lists have to agree with what GVFS.Hooks\Program.cs does for
+    /// each verb.  Both source files are copied to the Data folder by GVFS.UnitTests.csproj.
+    /// </summary>
+    [TestFixture]
+    public class GitHooksLoaderVerbTests
+    {
+        private List<string> noLockVerbs;
+        private List<string> lockVerbs;
+        private List<string> gvfsHooksNoLockVerbs;
+        private List<string> gvfsHooksCheckedVerbs;
+        private List<string> gvfsHooksPreCommandVerbs;
+
+        [SetUp]
+        public void ReadVerbLists()
+        {
+            string gvfsLockSource = File.ReadAllText(GetDataPath(Path.Combine("GitHooksLoader", "gvfslock.cpp")));
+            this.noLockVerbs = GetNativeVerbs(gvfsLockSource, "NoLockVerbs");
+            this.lockVerbs = GetNativeVerbs(gvfsLockSource, "LockVerbs");
+
+            string gvfsHooksSource = File.ReadAllText(GetDataPath(Path.Combine("GVFS.Hooks", "Program.cs")));
+            this.gvfsHooksNoLockVerbs = GetCaseLabels(gvfsHooksSource, "private static bool ShouldLock(");
+            this.gvfsHooksCheckedVerbs = GetCaseLabels(gvfsHooksSource, "private static void CheckForLegalCommands(");
+            this.gvfsHooksPreCommandVerbs = GetCaseLabels(gvfsHooksSource, "private static void RunPreCommands(");
+
+            this.noLockVerbs.ShouldBeNonEmpty();
+            this.lockVerbs.ShouldBeNonEmpty();
+            this.gvfsHooksNoLockVerbs.ShouldBeNonEmpty();
+            this.gvfsHooksCheckedVerbs.ShouldBeNonEmpty();
+            this.gvfsHooksPreCommandVerbs.ShouldBeNonEmpty();
+        }
+
+        [TestCase]
+        public void NoLockVerbsMatchVerbsGVFSHooksDoesNotLockFor()
+        {
+            // Except the verbs that GVFS.Hooks runs a pre-command for (fetch)
+            this.noLockVerbs.ShouldMatchInOrder(this.gvfsHooksNoLockVerbs.Except(this.gvfsHooksPreCommandVerbs));
+        }
+
+        [TestCase]
+        public void NoLockVerbsAreNotCheckedByGVFSHooks()
+        {
+            this.noLockVerbs.Intersect(this.gvfsHooksCheckedVerbs).ShouldBeEmpty();
+            this.noLockVerbs.Intersect(this.gvfsHooksPreCommandVerbs).ShouldBeEmpty();
+        }
+
+        [TestCase]
+        public void LockVerbsAreLockedByGVFSHooks()
+        {
+            this.lockVerbs.Intersect(this.gvfsHooksNoLockVerbs).ShouldBeEmpty();
+        }
+
+        [TestCase]
+        public void LockVerbsAreNotCheckedByGVFSHooks()
+        {
+            // GitHooksLoader leaves status to GVFS.Hooks when GVFS.Hooks checks it (during a merge or revert)
+            this.lockVerbs.Intersect(this.gvfsHooksCheckedVerbs).Except(new[] { "status" }).ShouldBeEmpty();
+            this.lockVerbs.Intersect(this.gvfsHooksPreCommandVerbs).ShouldBeEmpty();
+        }
+
+        [TestCase]
+        public void LockVerbsAreSorted()
+        {
+            this.lockVerbs.ShouldMatchInOrder(this.lockVerbs.OrderBy(verb => verb, StringComparer.Ordinal));
+        }
+
+        private static List<string> GetNativeVerbs(string source, string listName)
+        {
+            Match list = Regex.Match(source, @"\b" + listName + @"\[\]\s*=\s*\{(?<verbs>[^}]*)\}");
+            list.Success.ShouldBeTrue(listName + " not found");
+
+            return Regex.Matches(list.Groups["verbs"].Value, @"HOOK_TEXT\(""(?<verb>[^""]+)""\)")
+                .Cast<Match>()
+                .Select(verb => verb.Groups["verb"].Value)
+                .ToList();
+        }
+
+        private static List<string> GetCaseLabels(string source, string methodSignature)
+        {
+            int methodStart = source.IndexOf(methodSignature, StringComparison.Ordinal);
+            methodStart.ShouldNotEqual(-1, methodSignature + " not found");
+
+            int methodEnd = source.IndexOf("private static ", methodStart + methodSignature.Length, StringComparison.Ordinal);
+            string method = methodEnd < 0 ? source.Substring(methodStart) : source.Substring(methodStart, methodEnd - methodStart);
+
+            return Regex.Matches(method, @"case ""(?<verb>[^""]+)"":")
+                .Cast<Match>()
+                .Select(verb => verb.Groups["verb"].Value)
+                .ToList();
+        }
+
+        private static string GetDataPath(string fileName)
+        {
+            string workingDirectory = Path.GetDirectoryName(Assembly.GetExecutingAssembly().Location);
+            return Path.Combine(workingDirectory, "Data", fileName);
+        }
+    }
+}
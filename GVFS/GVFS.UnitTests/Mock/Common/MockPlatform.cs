@@ -47,7 +47,12 @@ namespace GVFS.UnitTests.Mock.Common
 
         public override NamedPipeServerStream CreatePipeByName(string pipeName)
         {
-            throw new NotSupportedException();
+            return new NamedPipeServerStream(
+                pipeName,
+                PipeDirection.InOut,
+                NamedPipeServerStream.MaxAllowedServerInstances,
+                PipeTransmissionMode.Byte,
+                PipeOptions.WriteThrough | PipeOptions.Asynchronous);
         }
 
         public override InProcEventListener CreateTelemetryListenerIfEnabled(string providerName)
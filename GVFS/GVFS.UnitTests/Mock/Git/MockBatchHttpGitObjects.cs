@@ -6,6 +6,7 @@ using GVFS.Tests.Should;
 using System;
 using System.Collections.Generic;
 using System.IO;
+using System.Linq;
 using System.Net;
 using System.Text;
 using System.Threading;
@@ -15,6 +16,7 @@ namespace GVFS.UnitTests.Mock.Git
     public class MockBatchHttpGitObjects : GitObjectsHttpRequestor
     {
         private Func<string, string> objectResolver;
+        private int batchRequestCount;
 
         public MockBatchHttpGitObjects(ITracer tracer, Enlistment enlistment, Func<string, string> objectResolver)
             : base(tracer, enlistment, new MockCacheServerInfo(), new RetryConfig())
@@ -22,6 +24,15 @@ namespace GVFS.UnitTests.Mock.Git
             this.objectResolver = objectResolver;
         }
 
+        // When set, batched requests for any object that objectResolver does not resolve fail with
+        // NotFound (as the server does), rather than leaving the object out of the response
+        public bool RejectBatchesWithMissingObjects { get; set; }
+
+        public int BatchRequestCount
+        {
+            get { return Volatile.Read(ref this.batchRequestCount); }
+        }
+
         public override List<GitObjectSize> QueryForFileSizes(IEnumerable<string> objectIds, CancellationToken cancellationToken)
         {
             throw new NotImplementedException();
@@ -32,6 +43,31 @@ namespace GVFS.UnitTests.Mock.Git
             throw new NotImplementedException();
         }
         
+        public override RetryWrapper<GitObjectTaskResult>.InvocationResult TryDownloadLooseObject(
+            string objectId,
+            bool retryOnFailure,
+            CancellationToken cancellationToken,
+            string requestSource,
+            Func<int, GitEndPointResponseData, RetryWrapper<GitObjectTaskResult>.CallbackResult> onSuccess)
+        {
+            string contents = this.objectResolver(objectId);
+            if (string.IsNullOrEmpty(contents))
+            {
+                return new RetryWrapper<GitObjectTaskResult>.InvocationResult(1, false, new GitObjectTaskResult(HttpStatusCode.NotFound));
+            }
+
+            using (GitEndPointResponseData response = new GitEndPointResponseData(
+                HttpStatusCode.OK,
+                GVFSConstants.MediaTypes.LooseObjectMediaType,
+                new ReusableMemoryStream(contents),
+                message: null,
+                onResponseDisposed: null))
+            {
+                RetryWrapper<GitObjectTaskResult>.CallbackResult result = onSuccess(1, response);
+                return new RetryWrapper<GitObjectTaskResult>.InvocationResult(1, true, result.Result);
+            }
+        }
+
         public override RetryWrapper<GitObjectTaskResult>.InvocationResult TryDownloadObjects(
             Func<IEnumerable<string>> objectIdGenerator,
             Func<int, GitEndPointResponseData, RetryWrapper<GitObjectTaskResult>.CallbackResult> onSuccess,
@@ -47,6 +83,12 @@ namespace GVFS.UnitTests.Mock.Git
             Action<RetryWrapper<GitObjectTaskResult>.ErrorEventArgs> onFailure,
             bool preferBatchedLooseObjects)
         {
+            Interlocked.Increment(ref this.batchRequestCount);
+            if (this.RejectBatchesWithMissingObjects && objectIds.Any(objectId => string.IsNullOrEmpty(this.objectResolver(objectId))))
+            {
+                return new RetryWrapper<GitObjectTaskResult>.InvocationResult(1, false, new GitObjectTaskResult(HttpStatusCode.NotFound));
+            }
+
             return this.StreamObjects(objectIds, onSuccess, onFailure);
         }
 
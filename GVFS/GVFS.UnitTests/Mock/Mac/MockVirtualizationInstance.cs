@@ -15,6 +15,7 @@ namespace GVFS.UnitTests.Mock.Mac
         {
             this.commandCompleted = new AutoResetEvent(false);
             this.CreatedPlaceholders = new ConcurrentDictionary<string, ushort>();
+            this.CompletedCommands = new ConcurrentDictionary<ulong, Result>();
             this.WriteFileReturnResult = Result.Success;
         }
 
@@ -27,6 +28,7 @@ namespace GVFS.UnitTests.Mock.Mac
         public UpdateFailureCause DeleteFileUpdateFailureCause { get; set; }
 
         public ConcurrentDictionary<string, ushort> CreatedPlaceholders { get; private set; }
+        public ConcurrentDictionary<ulong, Result> CompletedCommands { get; private set; }
 
         public override EnumerateDirectoryCallback OnEnumerateDirectory { get; set; }
         public override GetFileStreamCallback OnGetFileStream { get; set; }
@@ -95,6 +97,11 @@ namespace GVFS.UnitTests.Mock.Mac
             ulong commandId,
             Result result)
         {
+            if (!this.CompletedCommands.TryAdd(commandId, result))
+            {
+                return Result.EInvalidArgs;
+            }
+
             this.CompletionResult = result;
             this.commandCompleted.Set();
             return Result.Success;
@@ -106,6 +113,11 @@ namespace GVFS.UnitTests.Mock.Mac
             return this.CompletionResult;
         }
 
+        public bool WaitForCompletedCommands(int commandCount, TimeSpan timeout)
+        {
+            return SpinWait.SpinUntil(() => this.CompletedCommands.Count >= commandCount, timeout);
+        }
+
         public override Result ConvertDirectoryToPlaceholder(
             string relativeDirectoryPath)
         {
@@ -29,6 +29,8 @@ namespace GVFS.UnitTests.Platform.Mac
             { Result.Success, FSResult.Ok },
             { Result.EFileNotFound, FSResult.FileOrPathNotFound },
             { Result.EPathNotFound, FSResult.FileOrPathNotFound },
+            { Result.EDirectoryNotEmpty, FSResult.DirectoryNotEmpty },
+            { Result.EVirtualizationInvalidOperation, FSResult.VirtualizationInvalidOperation },
         };
 
         [TestCase]
@@ -254,7 +256,7 @@ namespace GVFS.UnitTests.Platform.Mac
         }
 
         [TestCase]
-        public void OnGetFileStreamReturnsSuccessWhenFileStreamAvailable()
+        public void OnGetFileStreamReturnsPendingAndCompletesWithSuccessWhenFileStreamAvailable()
         {
             using (MockBackgroundFileSystemTaskRunner backgroundTaskRunner = new MockBackgroundFileSystemTaskRunner())
             using (MockVirtualizationInstance mockVirtualization = new MockVirtualizationInstance())
@@ -287,8 +289,9 @@ namespace GVFS.UnitTests.Platform.Mac
                     contentId: contentId,
                     triggeringProcessId: 2,
                     triggeringProcessName: "UnitTest",
-                    fileHandle: IntPtr.Zero).ShouldEqual(Result.Success);
+                    fileHandle: IntPtr.Zero).ShouldEqual(Result.Pending);
 
+                mockVirtualization.WaitForCompletionStatus().ShouldEqual(Result.Success);
                 mockVirtualization.BytesWritten.ShouldEqual(fileLength);
 
                 fileSystemCallbacks.Stop();
@@ -296,7 +299,56 @@ namespace GVFS.UnitTests.Platform.Mac
         }
 
         [TestCase]
-        public void OnGetFileStreamReturnsErrorWhenWriteFileContentsFails()
+        public void OnGetFileStreamCompletesManyHydrationsFromWorkerThreads()
+        {
+            const int HydrationCount = 5000;
+
+            using (MockBackgroundFileSystemTaskRunner backgroundTaskRunner = new MockBackgroundFileSystemTaskRunner())
+            using (MockVirtualizationInstance mockVirtualization = new MockVirtualizationInstance())
+            using (MockGitIndexProjection gitIndexProjection = new MockGitIndexProjection(new[] { "test.txt" }))
+            using (MacFileSystemVirtualizer virtualizer = new MacFileSystemVirtualizer(this.Repo.Context, this.Repo.GitObjects, mockVirtualization))
+            using (FileSystemCallbacks fileSystemCallbacks = new FileSystemCallbacks(
+                this.Repo.Context,
+                this.Repo.GitObjects,
+                RepoMetadata.Instance,
+                new MockBlobSizes(),
+                gitIndexProjection,
+                backgroundFileSystemTaskRunner: backgroundTaskRunner,
+                fileSystemVirtualizer: virtualizer))
+            {
+                string error;
+                fileSystemCallbacks.TryStart(out error).ShouldEqual(true);
+
+                byte[] contentId = FileSystemVirtualizer.ConvertShaToContentId("0123456789012345678901234567890123456789");
+                byte[] placeholderVersion = FileSystemVirtualizer.GetPlaceholderVersionId();
+
+                MockGVFSGitObjects mockGVFSGitObjects = this.Repo.GitObjects as MockGVFSGitObjects;
+                mockGVFSGitObjects.FileLength = 100;
+                mockVirtualization.WriteFileReturnResult = Result.Success;
+
+                // Every callback returns before its hydration is done, the file and network worker threads complete them
+                for (ulong commandId = 1; commandId <= HydrationCount; ++commandId)
+                {
+                    mockVirtualization.OnGetFileStream(
+                        commandId,
+                        relativePath: "test" + commandId + ".txt",
+                        providerId: placeholderVersion,
+                        contentId: contentId,
+                        triggeringProcessId: 2,
+                        triggeringProcessName: "UnitTest",
+                        fileHandle: IntPtr.Zero).ShouldEqual(Result.Pending);
+                }
+
+                mockVirtualization.WaitForCompletedCommands(HydrationCount, TimeSpan.FromMinutes(1)).ShouldBeTrue("Not all hydrations were completed");
+                mockVirtualization.CompletedCommands.Count.ShouldEqual(HydrationCount);
+                mockVirtualization.CompletedCommands.Values.ShouldNotContain(result => result != Result.Success);
+
+                fileSystemCallbacks.Stop();
+            }
+        }
+
+        [TestCase]
+        public void OnGetFileStreamCompletesWithErrorWhenWriteFileContentsFails()
         {
             using (MockBackgroundFileSystemTaskRunner backgroundTaskRunner = new MockBackgroundFileSystemTaskRunner())
             using (MockVirtualizationInstance mockVirtualization = new MockVirtualizationInstance())
@@ -329,7 +381,9 @@ namespace GVFS.UnitTests.Platform.Mac
                     contentId: contentId,
                     triggeringProcessId: 2,
                     triggeringProcessName: "UnitTest",
-                    fileHandle: IntPtr.Zero).ShouldEqual(Result.EIOError);
+                    fileHandle: IntPtr.Zero).ShouldEqual(Result.Pending);
+
+                mockVirtualization.WaitForCompletionStatus().ShouldEqual(Result.EIOError);
 
                 fileSystemCallbacks.Stop();
             }
@@ -1,11 +1,143 @@
 #include "stdafx.h"
 #include "common.h"
+#include "modifiedpathscache.h"
+#include "modifiedpathssnapshot.h"
+
+// Version 2 modified paths requests:  "MPL|2\n" or "MPL|2|<generation token from a previous response>\n"
+// Expected response:
+// "F|<generation token>|<NUL terminated paths>\n" -> The full list
+// "A|<generation token>|<NUL terminated paths>\n" -> The paths added since the generation token in the request
+// "InvalidVersion\n" -> GVFS predates version 2, fall back to version 1
+//
+// Version 1 modified paths request:  "MPL|1\n"
+// Expected response:
+// "S|<NUL terminated paths>\n"
+#define MPL_REQUEST "MPL|"
+#define MPL_VERSION "1"
+#define MPL_INCREMENTAL_VERSION "2"
+#define MPL_SUCCESS_RESULT "S"
+#define MPL_FULL_LIST_RESULT 'F'
+#define MPL_ADDED_PATHS_RESULT 'A'
+#define MPL_INVALID_VERSION "InvalidVersion"
+#define MPL_RESPONSE_SEPARATOR '|'
+#define MPL_READ_BUFFER_LENGTH (64 * 1024)
 
 enum VirtualFileSystemErrorReturnCode
 {
 	ErrorVirtualFileSystemProtocol = ReturnCode::LastError + 1,
 };
 
+// The modified paths list can contain hundreds of thousands of paths, and GVFS writes it to the pipe
+// in chunks as it is generated.  It is moved to stdout in large blocks, and without going through the
+// stdout buffer, so that git can start reading it as soon as possible.
+static char s_responseBuffer[MPL_READ_BUFFER_LENGTH];
+static unsigned long s_responseOffset = 0;
+static unsigned long s_responseLength = 0;
+
+static void SendRequest(PIPE_HANDLE pipeHandle, const std::string& request)
+{
+    unsigned long bytesWritten;
+    int error = 0;
+    bool success = WriteToPipe(
+        pipeHandle,
+        request.c_str(),
+        static_cast<unsigned long>(request.size()),
+        &bytesWritten,
+        &error);
+
+    if (!success || bytesWritten != request.size())
+    {
+        die(ReturnCode::PipeWriteFailed, "Failed to write to pipe (%d)\n", error);
+    }
+}
+
+static void FillResponseBuffer(PIPE_HANDLE pipeHandle)
+{
+    unsigned long bytesRead = 0;
+    int error = 0;
+    if (!ReadFromPipe(pipeHandle, s_responseBuffer, sizeof(s_responseBuffer), &bytesRead, &error))
+    {
+        die(ReturnCode::PipeReadFailed, "Read response from pipe failed (%d)\n", error);
+    }
+
+    if (bytesRead == 0)
+    {
+        die(ReturnCode::PipeReadFailed, "Pipe closed before the modified paths list was complete\n");
+    }
+
+    s_responseOffset = 0;
+    s_responseLength = bytesRead;
+}
+
+// Reads the first fieldCount '|' terminated fields of the response (e.g. "S|") into header (without the
+// final '|').  Returns false if the response is a single line without that many fields (e.g. "MountNotReady"),
+// in which case header is the entire response.
+static bool TryReadResponseHeader(PIPE_HANDLE pipeHandle, int fieldCount, /* out */ std::string& header)
+{
+    header.clear();
+    int fieldsRead = 0;
+    while (1)
+    {
+        if (s_responseOffset == s_responseLength)
+        {
+            FillResponseBuffer(pipeHandle);
+        }
+
+        char nextChar = s_responseBuffer[s_responseOffset++];
+        if (nextChar == '\n')
+        {
+            return false;
+        }
+
+        if (nextChar == MPL_RESPONSE_SEPARATOR && ++fieldsRead == fieldCount)
+        {
+            return true;
+        }
+
+        header += nextChar;
+    }
+}
+
+static void WriteToStdout(const char *data, size_t length)
+{
+    if (length > 0 && fwrite(data, 1, length, stdout) != length)
+    {
+        die(VirtualFileSystemErrorReturnCode::ErrorVirtualFileSystemProtocol, "Failed to write modified paths to stdout\n");
+    }
+}
+
+// Copies the rest of the response (the NUL terminated paths) to stdout, and also appends the paths
+// to receivedPaths when it is not null
+static void CopyModifiedPathsToStdout(PIPE_HANDLE pipeHandle, std::string* receivedPaths)
+{
+    bool finishedReading = false;
+    do
+    {
+        if (s_responseOffset == s_responseLength)
+        {
+            FillResponseBuffer(pipeHandle);
+        }
+
+        const char *paths = s_responseBuffer + s_responseOffset;
+        unsigned long pathsLength = s_responseLength - s_responseOffset;
+        s_responseOffset = s_responseLength;
+
+        // Every path is terminated by a NUL, and so a newline can only be the end of the response
+        // when it is the last byte read
+        if (paths[pathsLength - 1] == '\n')
+        {
+            finishedReading = true;
+            pathsLength -= 1;
+        }
+
+        WriteToStdout(paths, pathsLength);
+        if (receivedPaths != nullptr)
+        {
+            receivedPaths->append(paths, pathsLength);
+        }
+    } while (!finishedReading);
+}
+
 int main(int argc, char *argv[])
 {
     if (argc != 2)
@@ -19,76 +151,83 @@ int main(int argc, char *argv[])
     }
 
     DisableCRLFTranslationOnStdPipes();
+    setvbuf(stdout, nullptr, _IONBF, 0);
 
-    PATH_STRING pipeName(GetGVFSPipeName(argv[0]));
-    PIPE_HANDLE pipeHandle = CreatePipeToGVFS(pipeName);
+    PATH_STRING enlistmentRoot(GetGVFSEnlistmentRoot(argv[0]));
 
-    // Construct projection request message
-    unsigned long bytesWritten;
-    unsigned long messageLength = 6;
-    int error = 0;
-    bool success = WriteToPipe(
-        pipeHandle,
-        "MPL|1\n",
-        messageLength,
-        &bytesWritten,
-        &error);
+    // Use the snapshot that GVFS keeps in the .gvfs folder when it is up to date, there is then no need
+    // to wait for GVFS to handle a request at all
+    const char *snapshotPaths;
+    size_t snapshotPathsLength;
+    if (TryMapModifiedPathsSnapshot(enlistmentRoot, &snapshotPaths, &snapshotPathsLength))
+    {
+        WriteToStdout(snapshotPaths, snapshotPathsLength);
+        return 0;
+    }
+
+    PIPE_HANDLE pipeHandle = CreatePipeToGVFS(GetGVFSPipeName(enlistmentRoot));
+
+    // Git needs the full list every time, but usually only a handful of paths have been added since the
+    // last time the hook ran.  Ask GVFS for only those, and combine them with the list from the last run.
+    std::string cachedGenerationToken;
+    std::string cachedPaths;
+    bool haveCachedPaths = TryReadModifiedPathsCache(enlistmentRoot, cachedGenerationToken, cachedPaths);
 
-    if (!success || bytesWritten != messageLength)
+    std::string request(MPL_REQUEST MPL_INCREMENTAL_VERSION);
+    if (haveCachedPaths)
     {
-        die(ReturnCode::PipeWriteFailed, "Failed to write to pipe (%d)\n", error);
+        request += MPL_RESPONSE_SEPARATOR;
+        request += cachedGenerationToken;
     }
 
-    char message[1024];
-    unsigned long bytesRead;
-    int lastError;
-    bool finishedReading = false;
-    bool firstRead = true;
-    do
+    request += '\n';
+    SendRequest(pipeHandle, request);
+
+    std::string header;
+    if (!TryReadResponseHeader(pipeHandle, 2, header))
     {
-        char *pMessage = &message[0];
-
-        success = ReadFromPipe(
-            pipeHandle,
-            message,
-            sizeof(message),
-            &bytesRead,
-            &lastError);
-
-        if (!success)
+        if (header != MPL_INVALID_VERSION)
         {
-            break;
+            die(ReturnCode::PipeReadFailed, "Read response from pipe failed (%s)\n", header.c_str());
         }
-        
-        messageLength = bytesRead;
 
-        if (firstRead)
+        // GVFS predates incremental modified paths lists, fall back to requesting the full list
+        SendRequest(pipeHandle, MPL_REQUEST MPL_VERSION "\n");
+        if (!TryReadResponseHeader(pipeHandle, 1, header) || header != MPL_SUCCESS_RESULT)
         {
-            firstRead = false;
-            if (message[0] != 'S')
-            {
-                die(ReturnCode::PipeReadFailed, "Read response from pipe failed (%s)\n", message);
-            }
-
-            pMessage += 2;
-            messageLength -= 2;
+            die(ReturnCode::PipeReadFailed, "Read response from pipe failed (%s)\n", header.c_str());
         }
 
-        if (*(pMessage + messageLength - 1) == '\n')
-        {
-            finishedReading = true;
-            messageLength -= 1;
-        }
-
-        fwrite(pMessage, 1, messageLength, stdout);
+        CopyModifiedPathsToStdout(pipeHandle, nullptr);
+        return 0;
+    }
 
-    } while (success && !finishedReading);
+    // header is "<result>|<generation token>"
+    if (header.size() < 3 || header[1] != MPL_RESPONSE_SEPARATOR)
+    {
+        die(ReturnCode::PipeReadFailed, "Invalid modified paths response (%s)\n", header.c_str());
+    }
 
-    if (!success)
+    std::string generationToken(header, 2);
+    std::string receivedPaths;
+    if (header[0] == MPL_ADDED_PATHS_RESULT && haveCachedPaths)
     {
-        die(ReturnCode::PipeReadFailed, "Read response from pipe failed (%d)\n", lastError);
+        WriteToStdout(cachedPaths.data(), cachedPaths.size());
+        CopyModifiedPathsToStdout(pipeHandle, &receivedPaths);
+        if (generationToken != cachedGenerationToken)
+        {
+            WriteModifiedPathsCache(enlistmentRoot, generationToken, cachedPaths + receivedPaths);
+        }
+    }
+    else if (header[0] == MPL_FULL_LIST_RESULT)
+    {
+        CopyModifiedPathsToStdout(pipeHandle, &receivedPaths);
+        WriteModifiedPathsCache(enlistmentRoot, generationToken, receivedPaths);
+    }
+    else
+    {
+        die(ReturnCode::PipeReadFailed, "Invalid modified paths response (%s)\n", header.c_str());
     }
 
     return 0;
 }
-
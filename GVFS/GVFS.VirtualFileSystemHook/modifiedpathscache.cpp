@@ -0,0 +1,216 @@
+#include "stdafx.h"
+#include "modifiedpathscache.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Cache file format: "<generation token>\n" followed by the NUL terminated paths
+#define GENERATION_TOKEN_TERMINATOR '\n'
+
+#ifdef _WIN32
+
+static PATH_STRING GetCacheFilePath(const PATH_STRING& enlistmentRoot)
+{
+    return enlistmentRoot + L"\\.gvfs\\ModifiedPathsHookCache.dat";
+}
+
+static PATH_STRING GetTempFilePath(const PATH_STRING& cacheFilePath)
+{
+    return cacheFilePath + L"." + std::to_wstring(GetCurrentProcessId());
+}
+
+static bool TryReadFile(const PATH_STRING& path, std::string& contents)
+{
+    HANDLE fileHandle = CreateFileW(
+        path.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL,
+        OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN,
+        NULL);
+
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    bool success = GetFileSizeEx(fileHandle, &fileSize) != FALSE && fileSize.HighPart == 0;
+    if (success)
+    {
+        contents.resize(fileSize.LowPart);
+        DWORD totalBytesRead = 0;
+        while (success && totalBytesRead < fileSize.LowPart)
+        {
+            DWORD bytesRead;
+            success =
+                ReadFile(fileHandle, &contents[totalBytesRead], fileSize.LowPart - totalBytesRead, &bytesRead, NULL) != FALSE &&
+                bytesRead > 0;
+            totalBytesRead += bytesRead;
+        }
+    }
+
+    CloseHandle(fileHandle);
+    return success;
+}
+
+static bool TryWriteFile(const PATH_STRING& path, const std::string& contents)
+{
+    HANDLE fileHandle = CreateFileW(
+        path.c_str(),
+        GENERIC_WRITE,
+        0,
+        NULL,
+        CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL);
+
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    DWORD bytesWritten;
+    bool success =
+        WriteFile(fileHandle, contents.data(), static_cast<DWORD>(contents.size()), &bytesWritten, NULL) != FALSE &&
+        bytesWritten == contents.size();
+
+    CloseHandle(fileHandle);
+    return success;
+}
+
+static bool TryReplaceFile(const PATH_STRING& sourcePath, const PATH_STRING& destinationPath)
+{
+    return MoveFileExW(sourcePath.c_str(), destinationPath.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+}
+
+static void DeleteFileIfExists(const PATH_STRING& path)
+{
+    DeleteFileW(path.c_str());
+}
+
+#else
+
+static PATH_STRING GetCacheFilePath(const PATH_STRING& enlistmentRoot)
+{
+    return enlistmentRoot + "/.gvfs/ModifiedPathsHookCache.dat";
+}
+
+static PATH_STRING GetTempFilePath(const PATH_STRING& cacheFilePath)
+{
+    return cacheFilePath + "." + std::to_string(getpid());
+}
+
+static bool TryReadFile(const PATH_STRING& path, std::string& contents)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat fileStat;
+    bool success = fstat(fd, &fileStat) == 0;
+    if (success)
+    {
+        contents.resize(fileStat.st_size);
+        size_t totalBytesRead = 0;
+        while (success && totalBytesRead < contents.size())
+        {
+            ssize_t bytesRead = read(fd, &contents[totalBytesRead], contents.size() - totalBytesRead);
+            success = bytesRead > 0 || (bytesRead < 0 && errno == EINTR);
+            totalBytesRead += bytesRead > 0 ? bytesRead : 0;
+        }
+    }
+
+    close(fd);
+    return success;
+}
+
+static bool TryWriteFile(const PATH_STRING& path, const std::string& contents)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    bool success = true;
+    size_t totalBytesWritten = 0;
+    while (success && totalBytesWritten < contents.size())
+    {
+        ssize_t bytesWritten = write(fd, contents.data() + totalBytesWritten, contents.size() - totalBytesWritten);
+        success = bytesWritten > 0 || (bytesWritten < 0 && errno == EINTR);
+        totalBytesWritten += bytesWritten > 0 ? bytesWritten : 0;
+    }
+
+    close(fd);
+    return success;
+}
+
+static bool TryReplaceFile(const PATH_STRING& sourcePath, const PATH_STRING& destinationPath)
+{
+    return rename(sourcePath.c_str(), destinationPath.c_str()) == 0;
+}
+
+static void DeleteFileIfExists(const PATH_STRING& path)
+{
+    unlink(path.c_str());
+}
+
+#endif
+
+bool TryReadModifiedPathsCache(
+    const PATH_STRING& enlistmentRoot,
+    /* out */ std::string& generationToken,
+    /* out */ std::string& modifiedPaths)
+{
+    std::string contents;
+    if (!TryReadFile(GetCacheFilePath(enlistmentRoot), contents))
+    {
+        return false;
+    }
+
+    size_t tokenLength = contents.find(GENERATION_TOKEN_TERMINATOR);
+    if (tokenLength == std::string::npos || tokenLength == 0)
+    {
+        return false;
+    }
+
+    // Every path is NUL terminated, anything else means the file was not written by WriteModifiedPathsCache
+    if (contents.size() > tokenLength + 1 && contents.back() != '\0')
+    {
+        return false;
+    }
+
+    generationToken.assign(contents, 0, tokenLength);
+    modifiedPaths.assign(contents, tokenLength + 1, std::string::npos);
+    return true;
+}
+
+void WriteModifiedPathsCache(
+    const PATH_STRING& enlistmentRoot,
+    const std::string& generationToken,
+    const std::string& modifiedPaths)
+{
+    std::string contents;
+    contents.reserve(generationToken.size() + 1 + modifiedPaths.size());
+    contents += generationToken;
+    contents += GENERATION_TOKEN_TERMINATOR;
+    contents += modifiedPaths;
+
+    // Other git processes can be running the hook at the same time, write to a temporary file and move it
+    // into place so that they never see a partial file
+    PATH_STRING cacheFilePath(GetCacheFilePath(enlistmentRoot));
+    PATH_STRING tempFilePath(GetTempFilePath(cacheFilePath));
+    if (!TryWriteFile(tempFilePath, contents) || !TryReplaceFile(tempFilePath, cacheFilePath))
+    {
+        DeleteFileIfExists(tempFilePath);
+    }
+}
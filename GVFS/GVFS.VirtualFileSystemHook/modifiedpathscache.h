@@ -0,0 +1,18 @@
+#pragma once
+#include "common.h"
+
+// Keeps a copy of the last modified paths list that GVFS sent to the hook, along with the generation
+// token that GVFS returned with it, in the enlistment's .gvfs folder.  Later invocations of the hook
+// send the token to GVFS and only receive the paths that have been added since.
+//
+// The cache is only an optimization, failing to read or write it is not an error.
+
+bool TryReadModifiedPathsCache(
+    const PATH_STRING& enlistmentRoot,
+    /* out */ std::string& generationToken,
+    /* out */ std::string& modifiedPaths);
+
+void WriteModifiedPathsCache(
+    const PATH_STRING& enlistmentRoot,
+    const std::string& generationToken,
+    const std::string& modifiedPaths);
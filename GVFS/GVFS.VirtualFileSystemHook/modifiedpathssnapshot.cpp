@@ -0,0 +1,173 @@
+#include "stdafx.h"
+#include "modifiedpathssnapshot.h"
+#include <stdint.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Snapshot header (little-endian):
+//   "GVMP", uint32 format version
+//   int64 current generation, int64 snapshot generation, int64 length of the paths
+#define SNAPSHOT_MAGIC "GVMP"
+#define SNAPSHOT_MAGIC_LENGTH 4
+#define SNAPSHOT_FORMAT_VERSION 1
+#define SNAPSHOT_HEADER_LENGTH 32
+
+struct SnapshotHeader
+{
+    char magic[SNAPSHOT_MAGIC_LENGTH];
+    uint32_t formatVersion;
+
+    // Updated in place by GVFS whenever a path is added
+    volatile int64_t currentGeneration;
+    int64_t snapshotGeneration;
+    int64_t pathsLength;
+};
+
+static_assert(sizeof(SnapshotHeader) == SNAPSHOT_HEADER_LENGTH, "SnapshotHeader must match the snapshot file format");
+
+#ifdef _WIN32
+
+// GVFS keeps a write handle open to the snapshot while it is mounted, and so opening the snapshot without
+// sharing write access only succeeds if GVFS has exited (or crashed) since it published the snapshot
+static bool IsSnapshotHeldByGVFS(const PATH_STRING& snapshotPath)
+{
+    HANDLE probeHandle = CreateFileW(
+        snapshotPath.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_DELETE,
+        NULL,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL);
+
+    if (probeHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(probeHandle);
+        return false;
+    }
+
+    return GetLastError() == ERROR_SHARING_VIOLATION;
+}
+
+static const void* MapSnapshotFile(const PATH_STRING& enlistmentRoot, /* out */ size_t* fileSize)
+{
+    PATH_STRING snapshotPath = enlistmentRoot + L"\\.gvfs\\ModifiedPathsSnapshot.dat";
+    if (!IsSnapshotHeldByGVFS(snapshotPath))
+    {
+        return nullptr;
+    }
+
+    HANDLE fileHandle = CreateFileW(
+        snapshotPath.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL);
+
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        return nullptr;
+    }
+
+    const void* view = nullptr;
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(fileHandle, &size) && size.QuadPart >= SNAPSHOT_HEADER_LENGTH)
+    {
+        HANDLE mappingHandle = CreateFileMappingW(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mappingHandle != NULL)
+        {
+            view = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+            *fileSize = static_cast<size_t>(size.QuadPart);
+
+            // The view keeps the mapping alive
+            CloseHandle(mappingHandle);
+        }
+    }
+
+    CloseHandle(fileHandle);
+    return view;
+}
+
+#else
+
+// GVFS holds an exclusive flock on the snapshot while it is mounted (it is how .NET implements FileShare.None),
+// and so a shared lock can only be taken if GVFS has exited (or crashed) since it published the snapshot
+static bool IsSnapshotHeldByGVFS(int fd)
+{
+    if (flock(fd, LOCK_SH | LOCK_NB) == 0)
+    {
+        flock(fd, LOCK_UN);
+        return false;
+    }
+
+    return errno == EWOULDBLOCK;
+}
+
+static const void* MapSnapshotFile(const PATH_STRING& enlistmentRoot, /* out */ size_t* fileSize)
+{
+    int fd = open((enlistmentRoot + "/.gvfs/ModifiedPathsSnapshot.dat").c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    const void* view = nullptr;
+    struct stat fileStat;
+    if (IsSnapshotHeldByGVFS(fd) && fstat(fd, &fileStat) == 0 && fileStat.st_size >= SNAPSHOT_HEADER_LENGTH)
+    {
+        void* mapping = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            view = mapping;
+            *fileSize = static_cast<size_t>(fileStat.st_size);
+        }
+    }
+
+    // The mapping keeps the file alive
+    close(fd);
+    return view;
+}
+
+#endif
+
+bool TryMapModifiedPathsSnapshot(
+    const PATH_STRING& enlistmentRoot,
+    /* out */ const char** modifiedPaths,
+    /* out */ size_t* modifiedPathsLength)
+{
+    size_t fileSize = 0;
+    const void* view = MapSnapshotFile(enlistmentRoot, &fileSize);
+    if (view == nullptr)
+    {
+        return false;
+    }
+
+    const SnapshotHeader* header = static_cast<const SnapshotHeader*>(view);
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LENGTH) != 0 ||
+        header->formatVersion != SNAPSHOT_FORMAT_VERSION ||
+        header->pathsLength < 0 ||
+        static_cast<uint64_t>(header->pathsLength) > fileSize - SNAPSHOT_HEADER_LENGTH)
+    {
+        return false;
+    }
+
+    // GVFS sets the current generation to -1 before it replaces or deletes the snapshot
+    if (header->snapshotGeneration < 0 || header->currentGeneration != header->snapshotGeneration)
+    {
+        return false;
+    }
+
+    *modifiedPaths = static_cast<const char*>(view) + SNAPSHOT_HEADER_LENGTH;
+    *modifiedPathsLength = static_cast<size_t>(header->pathsLength);
+    return true;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "common.h"
+
+// GVFS keeps a sorted copy of the modified paths in the enlistment's .gvfs folder (see ModifiedPathsSnapshot.cs),
+// along with the generation of the modified paths that it was taken at and the current generation.  When the
+// two generations match the hook can write the paths straight from the mapped file to stdout, without
+// waiting for GVFS to handle a request.
+//
+// Returns false if there is no snapshot, it is stale, or the GVFS that published it is no longer running, in which
+// case the hook must ask GVFS for the list.
+// The file stays mapped until the hook exits.
+
+bool TryMapModifiedPathsSnapshot(
+    const PATH_STRING& enlistmentRoot,
+    /* out */ const char** modifiedPaths,
+    /* out */ size_t* modifiedPathsLength);
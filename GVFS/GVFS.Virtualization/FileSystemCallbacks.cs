@@ -13,6 +13,7 @@ using System.Collections.Generic;
 using System.IO;
 using System.Linq;
 using System.Threading;
+using System.Threading.Tasks;
 
 namespace GVFS.Virtualization
 {
@@ -33,6 +34,7 @@ namespace GVFS.Virtualization
         private GVFSContext context;
         private GVFSGitObjects gitObjects;
         private ModifiedPathsDatabase modifiedPaths;
+        private ModifiedPathsSnapshot modifiedPathsSnapshot;
         private ConcurrentDictionary<string, PlaceHolderCreateCounter> placeHolderCreationCount;
         private BackgroundFileSystemTaskRunner backgroundFileSystemTaskRunner;
         private FileSystemVirtualizer fileSystemVirtualizer;
@@ -183,6 +185,12 @@ namespace GVFS.Virtualization
 
             this.backgroundFileSystemTaskRunner.Start();
 
+            this.modifiedPathsSnapshot = new ModifiedPathsSnapshot(
+                this.context.Tracer,
+                this.context.FileSystem,
+                Path.Combine(this.context.Enlistment.DotGVFSRoot, GVFSConstants.DotGVFS.ModifiedPathsSnapshotName));
+            this.modifiedPaths.SetSnapshot(this.modifiedPathsSnapshot);
+
             this.IsMounted = true;
             return true;
         }
@@ -202,6 +210,14 @@ namespace GVFS.Virtualization
             this.GitIndexProjection.Shutdown();
             this.BlobSizes.Shutdown();
             this.fileSystemVirtualizer.Stop();
+
+            if (this.modifiedPathsSnapshot != null)
+            {
+                this.modifiedPaths.SetSnapshot(null);
+                this.modifiedPathsSnapshot.Dispose();
+                this.modifiedPathsSnapshot = null;
+            }
+
             this.IsMounted = false;
         }
 
@@ -225,6 +241,12 @@ namespace GVFS.Virtualization
                 this.GitIndexProjection = null;
             }
 
+            if (this.modifiedPathsSnapshot != null)
+            {
+                this.modifiedPathsSnapshot.Dispose();
+                this.modifiedPathsSnapshot = null;
+            }
+
             if (this.modifiedPaths != null)
             {
                 this.modifiedPaths.Dispose();
@@ -331,6 +353,28 @@ namespace GVFS.Virtualization
             return this.modifiedPaths.GetAllModifiedPaths();
         }
 
+        /// <summary>
+        /// Brings the modified paths snapshot in the .gvfs folder up to date on a background thread
+        /// </summary>
+        public void UpdateModifiedPathsSnapshotInBackground()
+        {
+            ModifiedPathsDatabase modifiedPaths = this.modifiedPaths;
+            if (modifiedPaths != null)
+            {
+                Task.Run(() => modifiedPaths.UpdateSnapshot());
+            }
+        }
+
+        public IReadOnlyList<string> GetAllModifiedPaths(out string generationToken)
+        {
+            return this.modifiedPaths.GetAllModifiedPaths(out generationToken);
+        }
+
+        public bool TryGetModifiedPathsAddedSince(string generationToken, out IReadOnlyList<string> addedPaths, out string currentGenerationToken)
+        {
+            return this.modifiedPaths.TryGetModifiedPathsAddedSince(generationToken, out addedPaths, out currentGenerationToken);
+        }
+
         public virtual void OnIndexFileChange()
         {
             string lockedGitCommand = this.context.Repository.GVFSLock.GetLockedGitCommand();
@@ -1,5 +1,6 @@
 ﻿using CommandLine;
 using GVFS.Common;
+using System.Collections.Generic;
 using System.IO;
 using System.Linq;
 
@@ -24,6 +25,13 @@ namespace GVFS.CommandLine
             HelpText = "The type of log file to display on the console")]
         public string LogType { get; set; }
 
+        [Option(
+            "hook-timings",
+            Required = false,
+            Default = false,
+            HelpText = "Show the latency of the git hooks for each git verb, from the most recent git commands")]
+        public bool HookTimings { get; set; }
+
         protected override string VerbName
         {
             get { return LogVerbName; }
@@ -33,7 +41,10 @@ namespace GVFS.CommandLine
         {
             this.ValidatePathParameter(this.EnlistmentRootPathParameter);
 
-            this.Output.WriteLine("Most recent log files:");
+            if (!this.HookTimings)
+            {
+                this.Output.WriteLine("Most recent log files:");
+            }
 
             string errorMessage;
             string enlistmentRoot;
@@ -44,6 +55,12 @@ namespace GVFS.CommandLine
                     this.EnlistmentRootPathParameter);
             }
 
+            if (this.HookTimings)
+            {
+                this.DisplayHookTimings(enlistmentRoot);
+                return;
+            }
+
             string gvfsLogsRoot = Path.Combine(
                 enlistmentRoot,
                 GVFSConstants.DotGVFS.LogPath);
@@ -106,6 +123,45 @@ namespace GVFS.CommandLine
             return "gvfs_" + logFileType + "_*.log";
         }
 
+        private void DisplayHookTimings(string enlistmentRoot)
+        {
+            string hookTimingsPath = Path.Combine(enlistmentRoot, GVFSConstants.DotGVFS.Root, GVFSConstants.DotGVFS.HookTimingsName);
+            if (!File.Exists(hookTimingsPath))
+            {
+                this.ReportErrorAndExit("No hook timings found");
+            }
+
+            List<HookTimingsLog.Entry> entries;
+            string error;
+            if (!HookTimingsLog.TryReadEntries(hookTimingsPath, out entries, out error))
+            {
+                this.ReportErrorAndExit("Failed to read hook timings: " + error);
+            }
+
+            if (entries.Count == 0)
+            {
+                this.ReportErrorAndExit("No hook timings found");
+            }
+
+            this.Output.WriteLine(
+                "Hook latency in milliseconds, from {0} hooks run since {1}:",
+                entries.Count,
+                entries[0].StartTime.LocalDateTime);
+
+            this.Output.WriteLine("  {0,-20} {1,-14} {2,7} {3,9} {4,9} {5,9}", "Verb", "Hook", "Count", "p50", "p95", "p99");
+            foreach (HookTimingsLog.LatencySummary summary in HookTimingsLog.SummarizeByVerb(entries))
+            {
+                this.Output.WriteLine(
+                    "  {0,-20} {1,-14} {2,7} {3,9:F1} {4,9:F1} {5,9:F1}",
+                    summary.Verb,
+                    summary.HookName,
+                    summary.Count,
+                    summary.P50.TotalMilliseconds,
+                    summary.P95.TotalMilliseconds,
+                    summary.P99.TotalMilliseconds);
+            }
+        }
+
         private void DisplayMostRecent(string logFolder, string logFileType)
         {
             string logFile = FindNewestFileInFolder(logFolder, logFileType);
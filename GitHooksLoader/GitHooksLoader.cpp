@@ -1,153 +1,303 @@
 // GitHooksLoader.cpp : Defines the entry point for the console application.
 //
+// The loader runs every application listed in <loader name>.hooks, one per line. By default each
+// application runs on its own, after every application listed before it has exited. Lines that start
+// with "[independent]" mark applications that do not depend on each other: consecutive independent
+// applications are started together, and the next ordered application waits for all of them.
+//
+//     # Comment
+//     [independent] first-linter.exe
+//     [independent] second-linter.exe
+//     GVFS.Hooks.exe
+//
+// If any application fails, the exit code of the first one that failed (in manifest order) is returned
+// and no later applications are started.
+//
+// For common git verbs the loader does the work of GVFS.Hooks itself rather than starting it (see
+// gvfslock.h), set GITHOOKSLOADER_DISABLE_FASTPATH to always start it.
+//
+// Each run is recorded in the enlistment's hook timings log (see hooktimings.h).
 
 #include "stdafx.h"
+#include <chrono>
 #include <fstream>
 #include <string>
+#include <vector>
+#include "gvfslock.h"
+#include "hooklauncher.h"
+#include "hooktimings.h"
 
-int ExecuteHook(const std::wstring &applicationName, wchar_t *hookName, int argc, WCHAR *argv[]);
+#define INDEPENDENT_HOOK_ANNOTATION HOOK_TEXT("[independent]")
 
-int wmain(int argc, WCHAR *argv[])
+typedef std::chrono::steady_clock Clock;
+
+struct Hook
 {
-	LARGE_INTEGER tickFrequency = { 0 };
-	LARGE_INTEGER startTime = { 0 }, endTime = { 0 };
-    bool perfTraceEnabled = false;
+    HOOK_STRING application;
+    bool independent;
+    Clock::time_point startTime;
+    Clock::time_point endTime;
+    int exitCode;
+    bool ranInProcess;
+};
 
-    size_t requiredCount = 0;
-    if (getenv_s(&requiredCount, NULL, 0, "GITHOOKSLOADER_PERFTRACE") != 0)
+static double ElapsedMilliseconds(Clock::time_point startTime, Clock::time_point endTime)
+{
+    return std::chrono::duration<double, std::milli>(endTime - startTime).count();
+}
+
+static int64_t MicrosecondsSinceUnixEpoch()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static std::vector<Hook> ReadHooksManifest(const HOOK_STRING& manifestPath)
+{
+    const HOOK_STRING independentAnnotation(INDEPENDENT_HOOK_ANNOTATION);
+    std::vector<Hook> hooks;
+    std::basic_ifstream<HOOK_CHAR> hooksList(manifestPath);
+    for (HOOK_STRING hookApplication; std::getline(hooksList, hookApplication); )
     {
-        requiredCount = 0;
+        if (!hookApplication.empty() && hookApplication.back() == '\r')
+        {
+            hookApplication.pop_back();
+        }
+
+        // Skip comments and empty lines.
+        if (hookApplication.empty() || hookApplication.at(0) == '#')
+        {
+            continue;
+        }
+
+        Hook hook;
+        hook.independent = hookApplication.compare(0, independentAnnotation.length(), independentAnnotation) == 0;
+        if (hook.independent)
+        {
+            hookApplication.erase(0, independentAnnotation.length());
+            hookApplication.erase(0, hookApplication.find_first_not_of(HOOK_TEXT(" \t")));
+            if (hookApplication.empty())
+            {
+                continue;
+            }
+        }
+
+        hook.application = hookApplication;
+        hook.exitCode = 0;
+        hook.ranInProcess = false;
+        hooks.push_back(hook);
     }
 
-    if (requiredCount != 0)
+    return hooks;
+}
+
+// Runs hooks[first] up to (but not including) hooks[last] concurrently, and returns the exit code of
+// the first of them that failed
+static int RunHooksConcurrently(
+    std::vector<Hook>& hooks,
+    size_t first,
+    size_t last,
+    const HOOK_STRING& hookName,
+    const std::vector<HOOK_STRING>& args,
+    bool fastPathEnabled)
+{
+    std::vector<HOOK_PROCESS> runningProcesses;
+    std::vector<size_t> runningHooks;
+    for (size_t i = first; i < last; ++i)
     {
-        // Only enable tracing if we have access to a high res perf counter.
-        if (QueryPerformanceFrequency(&tickFrequency) != 0)
+        hooks[i].startTime = Clock::now();
+        if (fastPathEnabled &&
+            IsGVFSHooksApplication(hooks[i].application) &&
+            TryRunGVFSHooksInProcess(hookName, args, &hooks[i].exitCode))
         {
-            perfTraceEnabled = true;
+            hooks[i].endTime = Clock::now();
+            hooks[i].ranInProcess = true;
+            continue;
         }
+
+        runningProcesses.push_back(StartHook(hooks[i].application, hookName, args));
+        runningHooks.push_back(i);
     }
 
-    if (argc < 2)
+    while (!runningProcesses.empty())
     {
-        fwprintf(stderr, L"Usage: %s <git verb> [<other arguments>]\n", argv[0]);
-        exit(1);
+        int exitCode;
+        size_t exited = WaitForAnyHook(runningProcesses, &exitCode);
+        Hook& hook = hooks[runningHooks[exited]];
+        hook.endTime = Clock::now();
+        hook.exitCode = exitCode;
+
+        runningProcesses.erase(runningProcesses.begin() + exited);
+        runningHooks.erase(runningHooks.begin() + exited);
     }
 
-    wchar_t hookName[_MAX_FNAME];
-    errno_t err = _wsplitpath_s(argv[0], NULL, 0, NULL, 0, hookName, _MAX_FNAME, NULL, 0);
-    if (err != 0)
+    // Hooks can finish in any order, use manifest order so that the result does not depend on timing
+    for (size_t i = first; i < last; ++i)
     {
-        fwprintf(stderr, L"Error splitting the path. Error code %d.\n", err);
-        exit(2);
+        if (hooks[i].exitCode != 0)
+        {
+            return hooks[i].exitCode;
+        }
     }
-    
-    std::wstring executingLoader = std::wstring(argv[0]);
-    size_t exePartStart = executingLoader.rfind(L".exe");
 
-    if (exePartStart != std::wstring::npos)
+    return 0;
+}
+
+static int RunHooks(
+    const HOOK_STRING& executingLoader,
+    const HOOK_STRING& hookName,
+    const std::vector<HOOK_STRING>& args,
+    bool perfTraceEnabled,
+    bool fastPathEnabled)
+{
+    std::vector<Hook> hooks = ReadHooksManifest(executingLoader + HOOK_TEXT(".hooks"));
+    if (hooks.empty())
     {
-        executingLoader.resize(exePartStart);
+        HOOK_FPRINTF(stderr, HOOK_TEXT("No hooks found to execute\n"));
+        exit(5);
     }
 
-    std::wifstream hooksList(executingLoader + L".hooks");
-    int numHooksExecuted = 0;
-    for (std::wstring hookApplication; std::getline(hooksList, hookApplication); )
+    int64_t startTimeSinceUnixEpoch = MicrosecondsSinceUnixEpoch();
+    Clock::time_point startTime = Clock::now();
+
+    // The critical path is the longest running hook of each group of hooks that ran together, it is
+    // the wall-clock time that the loader would take if starting and waiting on hooks took no time
+    double criticalPathTime = 0;
+    HOOK_STRING criticalPath;
+
+    int exitCode = 0;
+    size_t first = 0;
+    while (first < hooks.size() && exitCode == 0)
     {
-        // Skip comments and empty lines.
-        if (hookApplication.empty() || hookApplication.at(0) == '#')
+        size_t last = first + 1;
+        if (hooks[first].independent)
         {
-            continue;
+            while (last < hooks.size() && hooks[last].independent)
+            {
+                ++last;
+            }
         }
 
-        numHooksExecuted++;
+        exitCode = RunHooksConcurrently(hooks, first, last, hookName, args, fastPathEnabled);
 
         if (perfTraceEnabled)
         {
-            QueryPerformanceCounter(&startTime);
-        }
+            size_t longest = first;
+            for (size_t i = first; i < last; ++i)
+            {
+                double elapsedTime = ElapsedMilliseconds(hooks[i].startTime, hooks[i].endTime);
+                HOOK_FPRINTF(
+                    stdout,
+                    HOOK_TEXT("%s: %s%s = %.2f milliseconds\n"),
+                    executingLoader.c_str(),
+                    hooks[i].application.c_str(),
+                    hooks[i].ranInProcess ? HOOK_TEXT(" (in process)") : HOOK_TEXT(""),
+                    elapsedTime);
+                if (elapsedTime > ElapsedMilliseconds(hooks[longest].startTime, hooks[longest].endTime))
+                {
+                    longest = i;
+                }
+            }
 
-        int hookExitCode = ExecuteHook(hookApplication, hookName, argc, argv);
-        if (0 != hookExitCode)
-        {
-            return hookExitCode;
+            criticalPathTime += ElapsedMilliseconds(hooks[longest].startTime, hooks[longest].endTime);
+            criticalPath += (criticalPath.empty() ? HOOK_TEXT("") : HOOK_TEXT(" -> ")) + hooks[longest].application;
         }
 
-        if (perfTraceEnabled)
+        first = last;
+    }
+
+    Clock::time_point endTime = Clock::now();
+    uint32_t timingFlags = 0;
+    for (const Hook& hook : hooks)
+    {
+        if (hook.ranInProcess)
         {
-            double elapsedTime;
-            QueryPerformanceCounter(&endTime);
-            elapsedTime = (endTime.QuadPart - startTime.QuadPart) * 1000.0 / tickFrequency.QuadPart;
-            fwprintf(stdout, L"%s: %s = %.2f milliseconds\n", executingLoader.c_str(), hookApplication.c_str(), elapsedTime);
+            timingFlags |= HOOK_TIMING_FLAG_IN_PROCESS;
         }
     }
 
-    if (0 == numHooksExecuted)
+    RecordHookTiming(
+        hookName,
+        args[0],
+        startTimeSinceUnixEpoch,
+        std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count(),
+        exitCode,
+        timingFlags);
+
+    if (perfTraceEnabled)
     {
-        fwprintf(stderr, L"No hooks found to execute\n");
-        exit(5);
+        HOOK_FPRINTF(
+            stdout,
+            HOOK_TEXT("%s: wall clock = %.2f milliseconds, critical path = %.2f milliseconds (%s)\n"),
+            executingLoader.c_str(),
+            ElapsedMilliseconds(startTime, endTime),
+            criticalPathTime,
+            criticalPath.c_str());
     }
 
-    return 0;
+    return exitCode;
+}
+
+#ifdef _WIN32
+
+static bool IsEnvironmentVariableSet(const char* name)
+{
+    size_t requiredCount = 0;
+    if (getenv_s(&requiredCount, NULL, 0, name) != 0)
+    {
+        requiredCount = 0;
+    }
+
+    return requiredCount != 0;
 }
 
-int ExecuteHook(const std::wstring &applicationName, wchar_t *hookName, int argc, WCHAR *argv[])
+int wmain(int argc, WCHAR *argv[])
 {
-    wchar_t expandedPath[MAX_PATH + 1];
-    DWORD length = ExpandEnvironmentStrings(applicationName.c_str(), expandedPath, MAX_PATH);
-    if (length == 0 || length > MAX_PATH)
+    bool perfTraceEnabled = IsEnvironmentVariableSet("GITHOOKSLOADER_PERFTRACE");
+    bool fastPathEnabled = !IsEnvironmentVariableSet("GITHOOKSLOADER_DISABLE_FASTPATH");
+
+    if (argc < 2)
     {
-        fwprintf(stderr, L"Unable to expand '%s'", applicationName.c_str());
-        exit(6);
+        fwprintf(stderr, L"Usage: %s <git verb> [<other arguments>]\n", argv[0]);
+        exit(1);
     }
-    
-    std::wstring commandLine = std::wstring(expandedPath) + L" " + hookName;
-    for (int x = 1; x < argc; x++)
+
+    wchar_t hookName[_MAX_FNAME];
+    errno_t err = _wsplitpath_s(argv[0], NULL, 0, NULL, 0, hookName, _MAX_FNAME, NULL, 0);
+    if (err != 0)
     {
-        commandLine += L" " + std::wstring(argv[x]);
+        fwprintf(stderr, L"Error splitting the path. Error code %d.\n", err);
+        exit(2);
     }
-    
-    // Start the child process. 
-    STARTUPINFO si;
-    PROCESS_INFORMATION pi;
-    ZeroMemory(&si, sizeof(si));
-    si.cb = sizeof(si);
-    si.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
-    si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
-    si.dwFlags = STARTF_USESTDHANDLES;
-
-    ZeroMemory(&pi, sizeof(pi));
-    if (!CreateProcess(
-        NULL,           // Application name
-        const_cast<LPWSTR>(commandLine.c_str()),
-        NULL,           // Process handle not inheritable
-        NULL,           // Thread handle not inheritable
-        TRUE,           // Set handle inheritance to TRUE
-        CREATE_NO_WINDOW, // Process creation flags
-        NULL,           // Use parent's environment block
-        NULL,           // Use parent's starting directory 
-        &si,            // Pointer to STARTUPINFO structure
-        &pi)            // Pointer to PROCESS_INFORMATION structure
-        )
+
+    std::wstring executingLoader = std::wstring(argv[0]);
+    size_t exePartStart = executingLoader.rfind(L".exe");
+
+    if (exePartStart != std::wstring::npos)
     {
-        fwprintf(stderr, L"Could not execute '%s'. CreateProcess error (%d).\n", applicationName.c_str(), GetLastError());
-        exit(3);
+        executingLoader.resize(exePartStart);
     }
 
-    // Wait until child process exits.
-    WaitForSingleObject(pi.hProcess, INFINITE);
+    return RunHooks(executingLoader, hookName, std::vector<std::wstring>(argv + 1, argv + argc), perfTraceEnabled, fastPathEnabled);
+}
+
+#else
 
-    // Get process exit code to pass along
-    DWORD exitCode;
-    if (!GetExitCodeProcess(pi.hProcess, &exitCode))
+int main(int argc, char *argv[])
+{
+    bool perfTraceEnabled = getenv("GITHOOKSLOADER_PERFTRACE") != nullptr;
+    bool fastPathEnabled = getenv("GITHOOKSLOADER_DISABLE_FASTPATH") == nullptr;
+
+    if (argc < 2)
     {
-        fwprintf(stderr, L"GetExitCodeProcess failed (%d).\n", GetLastError());
-        exit(4);
+        fprintf(stderr, "Usage: %s <git verb> [<other arguments>]\n", argv[0]);
+        exit(1);
     }
 
-    // Close process and thread handles. 
-    CloseHandle(pi.hProcess);
-    CloseHandle(pi.hThread);
+    std::string executingLoader(argv[0]);
+    size_t fileNameStart = executingLoader.rfind('/');
+    std::string hookName(executingLoader, fileNameStart == std::string::npos ? 0 : fileNameStart + 1);
+
+    return RunHooks(executingLoader, hookName, std::vector<std::string>(argv + 1, argv + argc), perfTraceEnabled, fastPathEnabled);
+}
 
-    return (int)exitCode;
-}
\ No newline at end of file
+#endif
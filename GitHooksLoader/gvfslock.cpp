@@ -0,0 +1,520 @@
+#include "stdafx.h"
+#include "gvfslock.h"
+#include "gvfspipe.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <ctype.h>
+#include <mutex>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#define GVFS_HOOKS_EXECUTABLE_NAME HOOK_TEXT("gvfs.hooks.exe")
+#else
+#define GVFS_HOOKS_EXECUTABLE_NAME HOOK_TEXT("gvfs.hooks")
+#endif
+
+#define PRE_COMMAND_HOOK HOOK_TEXT("pre-command")
+#define POST_COMMAND_HOOK HOOK_TEXT("post-command")
+#define GIT_PID_ARG HOOK_TEXT("--git-pid=")
+
+// The values below match GVFS.Hooks and NamedPipeMessages (LockNamedPipeMessages.cs)
+#define ACQUIRE_LOCK_REQUEST "AcquireLock"
+#define RELEASE_LOCK_REQUEST "ReleaseLock"
+#define LOCK_ACQUIRED_RESULT "LockAcquired"
+#define LOCK_AVAILABLE_RESULT "LockAvailable"
+#define MESSAGE_SEPARATOR '|'
+#define RELEASE_LOCK_SECTION_SEPARATOR '<'
+#define MAX_REPORTED_FILE_NAMES 100
+#define POST_COMMAND_SPINNER_DELAY_MS 500
+
+// Verbs that GVFS.Hooks does not take the lock for (see Program.ShouldLock), except fetch, which
+// GVFS.Hooks runs 'gvfs prefetch --commits' for.  Keep these alphabetically sorted.  GitHooksLoaderVerbTests
+// (GVFS.UnitTests) checks this list and LockVerbs against GVFS.Hooks.
+static const HOOK_CHAR* const NoLockVerbs[] =
+{
+    HOOK_TEXT("blame"),
+    HOOK_TEXT("branch"),
+    HOOK_TEXT("cat-file"),
+    HOOK_TEXT("check-attr"),
+    HOOK_TEXT("commit-graph"),
+    HOOK_TEXT("config"),
+    HOOK_TEXT("credential"),
+    HOOK_TEXT("diff"),
+    HOOK_TEXT("diff-files"),
+    HOOK_TEXT("diff-index"),
+    HOOK_TEXT("diff-tree"),
+    HOOK_TEXT("difftool"),
+    HOOK_TEXT("for-each-ref"),
+    HOOK_TEXT("help"),
+    HOOK_TEXT("hash-object"),
+    HOOK_TEXT("index-pack"),
+    HOOK_TEXT("log"),
+    HOOK_TEXT("ls-files"),
+    HOOK_TEXT("ls-tree"),
+    HOOK_TEXT("merge-base"),
+    HOOK_TEXT("midx"),
+    HOOK_TEXT("name-rev"),
+    HOOK_TEXT("push"),
+    HOOK_TEXT("remote"),
+    HOOK_TEXT("rev-list"),
+    HOOK_TEXT("rev-parse"),
+    HOOK_TEXT("show"),
+    HOOK_TEXT("show-ref"),
+    HOOK_TEXT("symbolic-ref"),
+    HOOK_TEXT("tag"),
+    HOOK_TEXT("unpack-objects"),
+    HOOK_TEXT("update-ref"),
+    HOOK_TEXT("version"),
+    HOOK_TEXT("web--browse"),
+};
+
+// Verbs that take the lock and that GVFS.Hooks checks nothing else for (status is only checked during a
+// merge or revert, see TryRunGVFSHooksInProcess).  Verbs that are in neither list, including aliases that
+// GVFS.Hooks looks up in the git config, are left to GVFS.Hooks.  Keep these alphabetically sorted.
+static const HOOK_CHAR* const LockVerbs[] =
+{
+    HOOK_TEXT("add"),
+    HOOK_TEXT("am"),
+    HOOK_TEXT("apply"),
+    HOOK_TEXT("checkout"),
+    HOOK_TEXT("checkout-index"),
+    HOOK_TEXT("cherry-pick"),
+    HOOK_TEXT("clean"),
+    HOOK_TEXT("commit"),
+    HOOK_TEXT("merge"),
+    HOOK_TEXT("mv"),
+    HOOK_TEXT("read-tree"),
+    HOOK_TEXT("rebase"),
+    HOOK_TEXT("reset"),
+    HOOK_TEXT("restore"),
+    HOOK_TEXT("revert"),
+    HOOK_TEXT("rm"),
+    HOOK_TEXT("stash"),
+    HOOK_TEXT("status"),
+    HOOK_TEXT("switch"),
+    HOOK_TEXT("write-tree"),
+};
+
+struct ReleaseLockData
+{
+    int failedToUpdateCount;
+    int failedToDeleteCount;
+    std::vector<std::string> failedToUpdateFileList;
+    std::vector<std::string> failedToDeleteFileList;
+};
+
+static HOOK_STRING ToLower(HOOK_STRING text)
+{
+    for (HOOK_CHAR& c : text)
+    {
+        if (c >= 'A' && c <= 'Z')
+        {
+            c = c - 'A' + 'a';
+        }
+    }
+
+    return text;
+}
+
+template <size_t Count>
+static bool IsVerbInList(const HOOK_STRING& verb, const HOOK_CHAR* const (&verbs)[Count])
+{
+    for (const HOOK_CHAR* listedVerb : verbs)
+    {
+        if (verb == listedVerb)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static HOOK_STRING GetGitVerb(const std::vector<HOOK_STRING>& args)
+{
+    HOOK_STRING verb = ToLower(args[0]);
+    if (verb.compare(0, 4, HOOK_TEXT("git-")) == 0)
+    {
+        verb.erase(0, 4);
+    }
+
+    return verb;
+}
+
+static bool ContainsArg(const std::vector<HOOK_STRING>& args, const HOOK_STRING& expectedArg)
+{
+    return std::find(args.begin(), args.end(), expectedArg) != args.end();
+}
+
+static bool ContainsArgIgnoreCase(const std::vector<HOOK_STRING>& args, const HOOK_STRING& expectedLowercaseArg)
+{
+    for (const HOOK_STRING& arg : args)
+    {
+        if (ToLower(arg) == expectedLowercaseArg)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static std::string GetEnvironmentValue(const char* name)
+{
+#ifdef _WIN32
+    char* value = nullptr;
+    size_t length;
+    if (_dupenv_s(&value, &length, name) != 0 || value == nullptr)
+    {
+        return std::string();
+    }
+
+    std::string result(value);
+    free(value);
+    return result;
+#else
+    const char* value = getenv(name);
+    return value == nullptr ? std::string() : std::string(value);
+#endif
+}
+
+static bool IsGitEnvVarDisabled(const char* name)
+{
+    std::string value = GetEnvironmentValue(name);
+    std::transform(value.begin(), value.end(), value.begin(), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+    return value == "false" || value == "no" || value == "off" || value == "0";
+}
+
+static bool TryGetGitPid(const std::vector<HOOK_STRING>& args, /* out */ int* pid)
+{
+    const HOOK_STRING gitPidArg(GIT_PID_ARG);
+    for (const HOOK_STRING& arg : args)
+    {
+        if (arg.compare(0, gitPidArg.length(), gitPidArg) == 0)
+        {
+            std::string value = ToUTF8(arg.substr(gitPidArg.length()));
+            char* end;
+            long parsedPid = strtol(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0' || parsedPid <= 0 || parsedPid > INT32_MAX)
+            {
+                return false;
+            }
+
+            *pid = static_cast<int>(parsedPid);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static std::string CreateLockRequest(const char* header, int pid, bool checkAvailabilityOnly, const std::vector<HOOK_STRING>& args)
+{
+    // The command as GVFS.Hooks reports it ("git " followed by the arguments other than --git-pid)
+    const HOOK_STRING gitPidArg(GIT_PID_ARG);
+    HOOK_STRING command(HOOK_TEXT("git"));
+    for (const HOOK_STRING& arg : args)
+    {
+        if (arg.compare(0, gitPidArg.length(), gitPidArg) != 0)
+        {
+            command += HOOK_TEXT(" ") + arg;
+        }
+    }
+
+    // Format: header|pid|isElevated|checkAvailabilityOnly|commandLength|command (see LockData.ToMessage)
+    return
+        std::string(header) + MESSAGE_SEPARATOR +
+        std::to_string(pid) + MESSAGE_SEPARATOR +
+        (IsElevated() ? "True" : "False") + MESSAGE_SEPARATOR +
+        (checkAvailabilityOnly ? "True" : "False") + MESSAGE_SEPARATOR +
+        std::to_string(GetUTF16Length(command)) + MESSAGE_SEPARATOR +
+        ToUTF8(command);
+}
+
+static std::vector<std::string> Split(const std::string& text, char separator)
+{
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (true)
+    {
+        size_t end = text.find(separator, start);
+        parts.push_back(text.substr(start, end == std::string::npos ? std::string::npos : end - start));
+        if (end == std::string::npos)
+        {
+            return parts;
+        }
+
+        start = end + 1;
+    }
+}
+
+static bool TryParseInt(const std::string& text, /* out */ int* value)
+{
+    char* end;
+    long parsedValue = strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || parsedValue < 0 || parsedValue > INT32_MAX)
+    {
+        return false;
+    }
+
+    *value = static_cast<int>(parsedValue);
+    return true;
+}
+
+// Format: FailedUpdateCount<FailedDeleteCount<FailedUpdateList<FailedDeleteList (see ReleaseLockData.FromBody)
+static bool TryParseReleaseLockData(const std::string& body, /* out */ ReleaseLockData* data)
+{
+    data->failedToUpdateCount = 0;
+    data->failedToDeleteCount = 0;
+    if (body.empty())
+    {
+        return true;
+    }
+
+    std::vector<std::string> sections = Split(body, RELEASE_LOCK_SECTION_SEPARATOR);
+    if (sections.size() != 4 ||
+        !TryParseInt(sections[0], &data->failedToUpdateCount) ||
+        !TryParseInt(sections[1], &data->failedToDeleteCount))
+    {
+        return false;
+    }
+
+    for (const std::string& path : Split(sections[2], MESSAGE_SEPARATOR))
+    {
+        if (!path.empty())
+        {
+            data->failedToUpdateFileList.push_back(path);
+        }
+    }
+
+    for (const std::string& path : Split(sections[3], MESSAGE_SEPARATOR))
+    {
+        if (!path.empty())
+        {
+            data->failedToDeleteFileList.push_back(path);
+        }
+    }
+
+    return true;
+}
+
+static void PrintUpdatePlaceholderFailures(std::vector<std::string> fileList, const char* failedOperation, const char* recoveryCommand)
+{
+    if (fileList.empty())
+    {
+        return;
+    }
+
+    std::sort(
+        fileList.begin(),
+        fileList.end(),
+        [](const std::string& left, const std::string& right)
+        {
+            return std::lexicographical_compare(
+                left.begin(),
+                left.end(),
+                right.begin(),
+                right.end(),
+                [](char l, char r) { return toupper(static_cast<unsigned char>(l)) < toupper(static_cast<unsigned char>(r)); });
+        });
+
+    printf("\nGVFS was unable to %s the following files. To recover, close all handles to the files and run these commands:", failedOperation);
+    for (const std::string& file : fileList)
+    {
+        printf("\n    %s%s", recoveryCommand, file.c_str());
+    }
+
+    printf("\n");
+}
+
+// Reads GVFS's response, and shows message with a spinner if that takes longer than initialDelayMs
+// (like ConsoleHelper.ShowStatusWhileRunning does for GVFS.Hooks)
+static bool ReadLineShowingStatus(GVFS_PIPE pipe, /* out */ std::string* response, const char* message, int initialDelayMs)
+{
+    std::mutex mutex;
+    std::condition_variable doneChanged;
+    bool done = false;
+    bool messageWritten = false;
+
+    std::thread spinnerThread(
+        [&]()
+        {
+            static const char waiting[] = { '-', '\\', '|', '/' };
+
+            std::unique_lock<std::mutex> lock(mutex);
+            if (doneChanged.wait_for(lock, std::chrono::milliseconds(initialDelayMs), [&]() { return done; }))
+            {
+                return;
+            }
+
+            for (int retries = 0; !done; ++retries)
+            {
+                printf("\r%s...%c", message, waiting[(retries / 2) % sizeof(waiting)]);
+                fflush(stdout);
+                messageWritten = true;
+                doneChanged.wait_for(lock, std::chrono::milliseconds(100), [&]() { return done; });
+            }
+
+            // Clear out any trailing waiting character
+            printf("\r%s...", message);
+        });
+
+    bool success = ReadLineFromGVFS(pipe, response);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+
+    doneChanged.notify_one();
+    spinnerThread.join();
+
+    if (messageWritten)
+    {
+        printf("Succeeded\n");
+    }
+
+    return success;
+}
+
+static bool TryAcquireGVFSLock(GVFS_PIPE pipe, int pid, bool checkAvailabilityOnly, const std::vector<HOOK_STRING>& args)
+{
+    std::string response;
+    if (!WriteLineToGVFS(pipe, CreateLockRequest(ACQUIRE_LOCK_REQUEST, pid, checkAvailabilityOnly, args)) ||
+        !ReadLineFromGVFS(pipe, &response))
+    {
+        return false;
+    }
+
+    std::string result = response.substr(0, response.find(MESSAGE_SEPARATOR));
+    return result == (checkAvailabilityOnly ? LOCK_AVAILABLE_RESULT : LOCK_ACQUIRED_RESULT);
+}
+
+static bool TryReleaseGVFSLock(GVFS_PIPE pipe, int pid, const std::vector<HOOK_STRING>& args, /* out */ int* exitCode)
+{
+    if (!WriteLineToGVFS(pipe, CreateLockRequest(RELEASE_LOCK_REQUEST, pid, false, args)))
+    {
+        return false;
+    }
+
+    // The request has been sent and cannot be repeated by GVFS.Hooks, from here on errors are reported
+    // as GVFS.Hooks would report them
+    std::string response;
+    bool showStatus = GetEnvironmentValue("GVFS_UNATTENDED") != "1" && !IsConsoleOutputRedirectedToFile();
+    bool responseRead = showStatus ?
+        ReadLineShowingStatus(pipe, &response, "Waiting for GVFS to parse index and update placeholder files", POST_COMMAND_SPINNER_DELAY_MS) :
+        ReadLineFromGVFS(pipe, &response);
+
+    if (!responseRead)
+    {
+        printf("Unable to initialize Git command.\nEnsure that GVFS is running.\n");
+        *exitCode = 1;
+        return true;
+    }
+
+    size_t separator = response.find(MESSAGE_SEPARATOR);
+    ReleaseLockData data;
+    if (!TryParseReleaseLockData(separator == std::string::npos ? std::string() : response.substr(separator + 1), &data))
+    {
+        printf("\nError communicating with GVFS: Run 'git status' to check the status of your repo\n");
+    }
+    else if (data.failedToUpdateCount + data.failedToDeleteCount > MAX_REPORTED_FILE_NAMES)
+    {
+        printf(
+            "\nGVFS failed to update %d files, run 'git status' to check the status of files in the repo\n",
+            data.failedToUpdateCount + data.failedToDeleteCount);
+    }
+    else
+    {
+        PrintUpdatePlaceholderFailures(data.failedToDeleteFileList, "delete", "git clean -f ");
+        PrintUpdatePlaceholderFailures(data.failedToUpdateFileList, "update", "git checkout -- ");
+    }
+
+    *exitCode = 0;
+    return true;
+}
+
+bool IsGVFSHooksApplication(const HOOK_STRING& application)
+{
+    size_t fileNameStart = application.find_last_of(HOOK_TEXT("\\/"));
+    HOOK_STRING fileName = fileNameStart == HOOK_STRING::npos ? application : application.substr(fileNameStart + 1);
+    return ToLower(fileName) == GVFS_HOOKS_EXECUTABLE_NAME;
+}
+
+bool TryRunGVFSHooksInProcess(const HOOK_STRING& hookName, const std::vector<HOOK_STRING>& args, /* out */ int* exitCode)
+{
+    HOOK_STRING hookType = ToLower(hookName);
+    bool isPreCommand = hookType == PRE_COMMAND_HOOK;
+    if (args.empty() || (!isPreCommand && hookType != POST_COMMAND_HOOK))
+    {
+        return false;
+    }
+
+    HOOK_STRING verb = GetGitVerb(args);
+    if (IsVerbInList(verb, NoLockVerbs) ||
+        (verb == HOOK_TEXT("reset") && ContainsArg(args, HOOK_TEXT("--soft"))))
+    {
+        *exitCode = 0;
+        return true;
+    }
+
+    if (!IsVerbInList(verb, LockVerbs))
+    {
+        return false;
+    }
+
+    // Status only checks whether the lock is available when it will not take the index lock itself
+    bool checkAvailabilityOnly =
+        verb == HOOK_TEXT("status") &&
+        (ContainsArgIgnoreCase(args, HOOK_TEXT("--no-lock-index")) || IsGitEnvVarDisabled("GIT_OPTIONAL_LOCKS"));
+
+    if (!isPreCommand && checkAvailabilityOnly)
+    {
+        *exitCode = 0;
+        return true;
+    }
+
+    HOOK_STRING enlistmentRoot;
+    int pid = 0;
+    if (!TryGetGVFSEnlistmentRoot(&enlistmentRoot) ||
+        !TryGetGitPid(args, &pid) ||
+        !IsProcessActive(pid))
+    {
+        return false;
+    }
+
+    // During a merge or revert GVFS.Hooks checks that status was run with rename detection disabled
+    if (isPreCommand && verb == HOOK_TEXT("status"))
+    {
+        HOOK_STRING dotGitPath = enlistmentRoot + HOOK_PATH_SEPARATOR + HOOK_TEXT("src") + HOOK_PATH_SEPARATOR + HOOK_TEXT(".git") + HOOK_PATH_SEPARATOR;
+        if (FileExists(dotGitPath + HOOK_TEXT("MERGE_HEAD")) || FileExists(dotGitPath + HOOK_TEXT("REVERT_HEAD")))
+        {
+            return false;
+        }
+    }
+
+    GVFS_PIPE pipe = ConnectToGVFS(enlistmentRoot);
+    if (pipe == INVALID_GVFS_PIPE)
+    {
+        return false;
+    }
+
+    bool handled;
+    if (isPreCommand)
+    {
+        handled = TryAcquireGVFSLock(pipe, pid, checkAvailabilityOnly, args);
+        *exitCode = 0;
+    }
+    else
+    {
+        handled = TryReleaseGVFSLock(pipe, pid, args, exitCode);
+    }
+
+    CloseGVFSPipe(pipe);
+    return handled;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vector>
+#include "hooklauncher.h"
+
+// GVFS.Hooks, which GVFS lists in the pre-command and post-command manifests, acquires the GVFS lock before
+// git commands and releases it afterwards.  Starting a managed process costs far more than the lock request
+// itself, so for the common git verbs that need nothing else from GVFS.Hooks the loader sends the
+// AcquireLock and ReleaseLock requests over the mount's pipe itself.
+
+// Returns true if application (a line of a .hooks manifest) is GVFS.Hooks with no extra arguments
+bool IsGVFSHooksApplication(const HOOK_STRING& application);
+
+// Does what GVFS.Hooks would do for hookName and args, and returns false if GVFS.Hooks must be run instead.
+// That is the case for verbs that need more than the lock (e.g. commands that GVFS does not support, or
+// fetch, which runs a prefetch), and whenever GVFS does not grant the lock right away so that GVFS.Hooks
+// can wait for it and report errors as it always has.
+bool TryRunGVFSHooksInProcess(const HOOK_STRING& hookName, const std::vector<HOOK_STRING>& args, /* out */ int* exitCode);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include "hooklauncher.h"
+
+// Platform specific helpers for the parts of the loader that talk to GVFS (see gvfslock.h and hooktimings.h).
+// None of them exit the loader on failure, callers fall back to running GVFS.Hooks so that it can report
+// the error.
+
+#ifdef _WIN32
+typedef HANDLE GVFS_PIPE;
+#define INVALID_GVFS_PIPE INVALID_HANDLE_VALUE
+#define HOOK_PATH_SEPARATOR HOOK_TEXT("\\")
+#else
+typedef int GVFS_PIPE;
+#define INVALID_GVFS_PIPE (-1)
+#define HOOK_PATH_SEPARATOR HOOK_TEXT("/")
+#endif
+
+// Finds the folder containing .gvfs by walking up from the normalized current directory, the same
+// way that GVFS.Hooks does so that both use the same pipe
+bool TryGetGVFSEnlistmentRoot(/* out */ HOOK_STRING* enlistmentRoot);
+
+// Returns INVALID_GVFS_PIPE if the enlistment is not mounted
+GVFS_PIPE ConnectToGVFS(const HOOK_STRING& enlistmentRoot);
+void CloseGVFSPipe(GVFS_PIPE pipe);
+
+// Messages are UTF-8 lines terminated by '\n', the terminator is added by WriteLineToGVFS and
+// removed by ReadLineFromGVFS
+bool WriteLineToGVFS(GVFS_PIPE pipe, const std::string& message);
+bool ReadLineFromGVFS(GVFS_PIPE pipe, /* out */ std::string* message);
+
+bool FileExists(const HOOK_STRING& path);
+bool IsProcessActive(int processId);
+bool IsElevated();
+bool IsConsoleOutputRedirectedToFile();
+
+std::string ToUTF8(const HOOK_STRING& text);
+
+// Lock requests include the length of the command as measured by GVFS (in UTF-16 code units)
+size_t GetUTF16Length(const HOOK_STRING& text);
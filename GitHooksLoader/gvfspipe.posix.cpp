@@ -0,0 +1,212 @@
+#include "stdafx.h"
+#include "gvfspipe.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// A write after GVFS has closed its end of the pipe must fail with EPIPE rather than kill the loader (and the
+// git command waiting on it) with SIGPIPE.  macOS has no MSG_NOSIGNAL, ConnectToGVFS sets SO_NOSIGPIPE instead.
+#ifdef MSG_NOSIGNAL
+static const int SendFlags = MSG_NOSIGNAL;
+#else
+static const int SendFlags = 0;
+#endif
+
+static bool IsDirectory(const std::string& path)
+{
+    struct stat pathStat;
+    return stat(path.c_str(), &pathStat) == 0 && S_ISDIR(pathStat.st_mode);
+}
+
+static bool FindGVFSEnlistmentRoot(/* out */ std::string* enlistmentRoot)
+{
+    char currentDirectory[PATH_MAX];
+    if (realpath(".", currentDirectory) == nullptr)
+    {
+        return false;
+    }
+
+    std::string root(currentDirectory);
+    while (!root.empty() && root.back() == '/')
+    {
+        root.pop_back();
+    }
+
+    while (!IsDirectory(root + "/.gvfs"))
+    {
+        if (root.empty())
+        {
+            return false;
+        }
+
+        root.resize(root.find_last_of('/'));
+    }
+
+    *enlistmentRoot = root;
+    return true;
+}
+
+bool TryGetGVFSEnlistmentRoot(/* out */ std::string* enlistmentRoot)
+{
+    // The current directory does not change while the loader runs, so the root is only looked up once
+    static bool lookedUp = false;
+    static bool found = false;
+    static std::string root;
+    if (!lookedUp)
+    {
+        found = FindGVFSEnlistmentRoot(&root);
+        lookedUp = true;
+    }
+
+    if (found)
+    {
+        *enlistmentRoot = root;
+    }
+
+    return found;
+}
+
+GVFS_PIPE ConnectToGVFS(const std::string& enlistmentRoot)
+{
+    // Matches MacPlatform.GetNamedPipeNameImplementation
+    std::string pipeName(enlistmentRoot + "/.gvfs/GVFS_NetCorePipe");
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (pipeName.length() >= sizeof(address.sun_path))
+    {
+        return INVALID_GVFS_PIPE;
+    }
+
+    memcpy(address.sun_path, pipeName.c_str(), pipeName.length());
+
+    int pipe = socket(PF_UNIX, SOCK_STREAM, 0);
+    if (pipe < 0)
+    {
+        return INVALID_GVFS_PIPE;
+    }
+
+#ifdef SO_NOSIGPIPE
+    int noSigPipe = 1;
+    if (setsockopt(pipe, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe)) != 0)
+    {
+        close(pipe);
+        return INVALID_GVFS_PIPE;
+    }
+#endif
+
+    if (connect(pipe, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        close(pipe);
+        return INVALID_GVFS_PIPE;
+    }
+
+    return pipe;
+}
+
+void CloseGVFSPipe(GVFS_PIPE pipe)
+{
+    close(pipe);
+}
+
+bool WriteLineToGVFS(GVFS_PIPE pipe, const std::string& message)
+{
+    std::string line(message + "\n");
+    size_t bytesWritten = 0;
+    while (bytesWritten < line.length())
+    {
+        ssize_t result = send(pipe, line.c_str() + bytesWritten, line.length() - bytesWritten, SendFlags);
+        if (result < 0 && errno != EINTR)
+        {
+            return false;
+        }
+
+        bytesWritten += result < 0 ? 0 : result;
+    }
+
+    return true;
+}
+
+bool ReadLineFromGVFS(GVFS_PIPE pipe, /* out */ std::string* message)
+{
+    message->clear();
+
+    char buffer[4096];
+    while (true)
+    {
+        ssize_t bytesRead = recv(pipe, buffer, sizeof(buffer), 0);
+        if (bytesRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (bytesRead <= 0)
+        {
+            return false;
+        }
+
+        message->append(buffer, bytesRead);
+        size_t terminator = message->find('\n');
+        if (terminator != std::string::npos)
+        {
+            message->resize(terminator);
+            if (!message->empty() && message->back() == '\r')
+            {
+                message->pop_back();
+            }
+
+            return true;
+        }
+    }
+}
+
+bool FileExists(const std::string& path)
+{
+    struct stat pathStat;
+    return stat(path.c_str(), &pathStat) == 0;
+}
+
+bool IsProcessActive(int processId)
+{
+    return kill(processId, 0) == 0 || errno == EPERM;
+}
+
+bool IsElevated()
+{
+    // Matches MacPlatform.IsElevatedImplementation
+    return false;
+}
+
+bool IsConsoleOutputRedirectedToFile()
+{
+    struct stat outputStat;
+    return fstat(STDOUT_FILENO, &outputStat) == 0 && S_ISREG(outputStat.st_mode);
+}
+
+std::string ToUTF8(const std::string& text)
+{
+    return text;
+}
+
+size_t GetUTF16Length(const std::string& text)
+{
+    size_t length = 0;
+    for (unsigned char c : text)
+    {
+        // Count each UTF-8 lead byte, characters outside the BMP (4 byte sequences) take two UTF-16 code units
+        if ((c & 0xC0) != 0x80)
+        {
+            length += c >= 0xF0 ? 2 : 1;
+        }
+    }
+
+    return length;
+}
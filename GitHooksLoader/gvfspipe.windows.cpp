@@ -0,0 +1,251 @@
+#include "stdafx.h"
+#include "gvfspipe.h"
+
+#include <algorithm>
+
+#define PIPE_CONNECT_TIMEOUT_MS 3000
+
+static bool TryGetFinalPathName(const std::wstring& path, /* out */ std::wstring* finalPath)
+{
+    // FILE_FLAG_BACKUP_SEMANTICS is required to open a handle to a directory
+    HANDLE fileHandle = CreateFileW(
+        path.c_str(),
+        FILE_READ_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL,
+        OPEN_EXISTING,
+        FILE_FLAG_BACKUP_SEMANTICS,
+        NULL);
+
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    std::wstring result(MAX_PATH, L'\0');
+    DWORD resultSize = GetFinalPathNameByHandleW(fileHandle, &result[0], static_cast<DWORD>(result.size()), FILE_NAME_NORMALIZED);
+    if (resultSize >= result.size())
+    {
+        // The buffer was too small, resultSize is the required size (including the null terminator)
+        result.resize(resultSize);
+        resultSize = GetFinalPathNameByHandleW(fileHandle, &result[0], static_cast<DWORD>(result.size()), FILE_NAME_NORMALIZED);
+    }
+
+    CloseHandle(fileHandle);
+    if (resultSize == 0 || resultSize >= result.size())
+    {
+        return false;
+    }
+
+    result.resize(resultSize);
+
+    const std::wstring pathPrefix(L"\\\\?\\");
+    const std::wstring uncPrefix(L"\\\\?\\UNC\\");
+    if (result.compare(0, uncPrefix.length(), uncPrefix) == 0)
+    {
+        result = L"\\\\" + result.substr(uncPrefix.length());
+    }
+    else if (result.compare(0, pathPrefix.length(), pathPrefix) == 0)
+    {
+        result = result.substr(pathPrefix.length());
+    }
+
+    *finalPath = result;
+    return true;
+}
+
+static bool IsDirectory(const std::wstring& path)
+{
+    DWORD attributes = GetFileAttributesW(path.c_str());
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+static bool FindGVFSEnlistmentRoot(/* out */ std::wstring* enlistmentRoot)
+{
+    DWORD currentDirectoryLength = GetCurrentDirectoryW(0, NULL);
+    if (currentDirectoryLength == 0)
+    {
+        return false;
+    }
+
+    std::wstring currentDirectory(currentDirectoryLength, L'\0');
+    currentDirectoryLength = GetCurrentDirectoryW(currentDirectoryLength, &currentDirectory[0]);
+    if (currentDirectoryLength == 0 || currentDirectoryLength >= currentDirectory.size())
+    {
+        return false;
+    }
+
+    currentDirectory.resize(currentDirectoryLength);
+
+    std::wstring root;
+    if (!TryGetFinalPathName(currentDirectory, &root))
+    {
+        return false;
+    }
+
+    while (!root.empty() && root.back() == L'\\')
+    {
+        root.pop_back();
+    }
+
+    while (!IsDirectory(root + L"\\.gvfs"))
+    {
+        size_t lastSlash = root.find_last_of(L'\\');
+        if (lastSlash == std::wstring::npos || lastSlash == 0)
+        {
+            return false;
+        }
+
+        root.resize(lastSlash);
+    }
+
+    *enlistmentRoot = root;
+    return true;
+}
+
+bool TryGetGVFSEnlistmentRoot(/* out */ std::wstring* enlistmentRoot)
+{
+    // The current directory does not change while the loader runs, so the root is only looked up once
+    static bool lookedUp = false;
+    static bool found = false;
+    static std::wstring root;
+    if (!lookedUp)
+    {
+        found = FindGVFSEnlistmentRoot(&root);
+        lookedUp = true;
+    }
+
+    if (found)
+    {
+        *enlistmentRoot = root;
+    }
+
+    return found;
+}
+
+GVFS_PIPE ConnectToGVFS(const std::wstring& enlistmentRoot)
+{
+    // Matches WindowsPlatform.GetNamedPipeNameImplementation
+    std::wstring pipeName(enlistmentRoot);
+    CharUpperW(&pipeName[0]);
+    std::replace(pipeName.begin(), pipeName.end(), L':', L'_');
+    pipeName = L"\\\\.\\pipe\\GVFS_" + pipeName;
+
+    while (true)
+    {
+        HANDLE pipe = CreateFileW(pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+        if (pipe != INVALID_HANDLE_VALUE)
+        {
+            return pipe;
+        }
+
+        if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipeW(pipeName.c_str(), PIPE_CONNECT_TIMEOUT_MS))
+        {
+            return INVALID_GVFS_PIPE;
+        }
+    }
+}
+
+void CloseGVFSPipe(GVFS_PIPE pipe)
+{
+    CloseHandle(pipe);
+}
+
+bool WriteLineToGVFS(GVFS_PIPE pipe, const std::string& message)
+{
+    std::string line(message + "\n");
+    DWORD bytesWritten;
+    return
+        WriteFile(pipe, line.c_str(), static_cast<DWORD>(line.length()), &bytesWritten, NULL) &&
+        bytesWritten == line.length();
+}
+
+bool ReadLineFromGVFS(GVFS_PIPE pipe, /* out */ std::string* message)
+{
+    message->clear();
+
+    char buffer[4096];
+    while (true)
+    {
+        DWORD bytesRead;
+        if (!ReadFile(pipe, buffer, sizeof(buffer), &bytesRead, NULL) && GetLastError() != ERROR_MORE_DATA)
+        {
+            return false;
+        }
+
+        if (bytesRead == 0)
+        {
+            return false;
+        }
+
+        message->append(buffer, bytesRead);
+        size_t terminator = message->find('\n');
+        if (terminator != std::string::npos)
+        {
+            message->resize(terminator);
+            if (!message->empty() && message->back() == '\r')
+            {
+                message->pop_back();
+            }
+
+            return true;
+        }
+    }
+}
+
+bool FileExists(const std::wstring& path)
+{
+    return GetFileAttributesW(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+}
+
+bool IsProcessActive(int processId)
+{
+    HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId);
+    if (process == NULL)
+    {
+        return false;
+    }
+
+    DWORD exitCode;
+    bool isActive = GetExitCodeProcess(process, &exitCode) && exitCode == STILL_ACTIVE;
+    CloseHandle(process);
+    return isActive;
+}
+
+bool IsElevated()
+{
+    HANDLE token;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token))
+    {
+        return false;
+    }
+
+    TOKEN_ELEVATION elevation;
+    DWORD size;
+    bool isElevated = GetTokenInformation(token, TokenElevation, &elevation, sizeof(elevation), &size) && elevation.TokenIsElevated;
+    CloseHandle(token);
+    return isElevated;
+}
+
+bool IsConsoleOutputRedirectedToFile()
+{
+    return GetFileType(GetStdHandle(STD_OUTPUT_HANDLE)) == FILE_TYPE_DISK;
+}
+
+std::string ToUTF8(const std::wstring& text)
+{
+    if (text.empty())
+    {
+        return std::string();
+    }
+
+    int length = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.length()), NULL, 0, NULL, NULL);
+    std::string result(length, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.length()), &result[0], length, NULL, NULL);
+    return result;
+}
+
+size_t GetUTF16Length(const std::wstring& text)
+{
+    return text.length();
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+typedef std::wstring HOOK_STRING;
+typedef wchar_t HOOK_CHAR;
+typedef HANDLE HOOK_PROCESS;
+#define HOOK_TEXT(text) L##text
+#define HOOK_FPRINTF fwprintf
+#else
+#include <sys/types.h>
+typedef std::string HOOK_STRING;
+typedef char HOOK_CHAR;
+typedef pid_t HOOK_PROCESS;
+#define HOOK_TEXT(text) text
+#define HOOK_FPRINTF fprintf
+#endif
+
+// Starts the application from a line of the .hooks manifest, passing it the hook name and the
+// loader's arguments.  Exits the loader if the application cannot be started.
+//
+// On Windows the application is a command line and can contain %VARIABLE% references (CreateProcess),
+// elsewhere it is a shell command line and can contain $VARIABLE references (posix_spawn of /bin/sh).
+HOOK_PROCESS StartHook(const HOOK_STRING& application, const HOOK_STRING& hookName, const std::vector<HOOK_STRING>& args);
+
+// Waits until one of processes exits, and returns its index in processes along with its exit code.
+// The process is cleaned up and must not be waited on again.
+size_t WaitForAnyHook(const std::vector<HOOK_PROCESS>& processes, /* out */ int* exitCode);
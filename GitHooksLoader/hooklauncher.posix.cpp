@@ -0,0 +1,78 @@
+#include "stdafx.h"
+#include "hooklauncher.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+HOOK_PROCESS StartHook(const HOOK_STRING& application, const HOOK_STRING& hookName, const std::vector<HOOK_STRING>& args)
+{
+    // Run the application through the shell (which expands any variables in it) with the hook name and
+    // arguments as positional parameters, and exec it so that the shell does not stay around
+    std::string script = "exec " + application + " \"$@\"";
+
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>("sh"));
+    argv.push_back(const_cast<char*>("-c"));
+    argv.push_back(const_cast<char*>(script.c_str()));
+    argv.push_back(const_cast<char*>("sh"));
+    argv.push_back(const_cast<char*>(hookName.c_str()));
+    for (const std::string& arg : args)
+    {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+
+    argv.push_back(nullptr);
+
+    // Like CreateProcess with STARTF_USESTDHANDLES on Windows, hooks share stdout and stderr with
+    // the loader but do not get its stdin
+    posix_spawn_file_actions_t fileActions;
+    posix_spawn_file_actions_init(&fileActions);
+    posix_spawn_file_actions_addopen(&fileActions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+
+    pid_t pid;
+    int error = posix_spawn(&pid, "/bin/sh", &fileActions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&fileActions);
+    if (error != 0)
+    {
+        fprintf(stderr, "Could not execute '%s'. posix_spawn error (%d).\n", application.c_str(), error);
+        exit(3);
+    }
+
+    return pid;
+}
+
+size_t WaitForAnyHook(const std::vector<HOOK_PROCESS>& processes, /* out */ int* exitCode)
+{
+    while (1)
+    {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            fprintf(stderr, "waitpid failed (%d).\n", errno);
+            exit(4);
+        }
+
+        for (size_t i = 0; i < processes.size(); ++i)
+        {
+            if (processes[i] == pid)
+            {
+                // Report hooks that were killed by a signal the same way that the shell does
+                *exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+                return i;
+            }
+        }
+    }
+}
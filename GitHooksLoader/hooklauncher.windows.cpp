@@ -0,0 +1,93 @@
+#include "stdafx.h"
+#include "hooklauncher.h"
+
+HOOK_PROCESS StartHook(const HOOK_STRING& application, const HOOK_STRING& hookName, const std::vector<HOOK_STRING>& args)
+{
+    wchar_t expandedPath[MAX_PATH + 1];
+    DWORD length = ExpandEnvironmentStrings(application.c_str(), expandedPath, MAX_PATH);
+    if (length == 0 || length > MAX_PATH)
+    {
+        fwprintf(stderr, L"Unable to expand '%s'", application.c_str());
+        exit(6);
+    }
+
+    std::wstring commandLine = std::wstring(expandedPath) + L" " + hookName;
+    for (const std::wstring& arg : args)
+    {
+        commandLine += L" " + arg;
+    }
+
+    // Start the child process. 
+    STARTUPINFO si;
+    PROCESS_INFORMATION pi;
+    ZeroMemory(&si, sizeof(si));
+    si.cb = sizeof(si);
+    si.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+    si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+    si.dwFlags = STARTF_USESTDHANDLES;
+
+    ZeroMemory(&pi, sizeof(pi));
+    if (!CreateProcess(
+        NULL,           // Application name
+        const_cast<LPWSTR>(commandLine.c_str()),
+        NULL,           // Process handle not inheritable
+        NULL,           // Thread handle not inheritable
+        TRUE,           // Set handle inheritance to TRUE
+        CREATE_NO_WINDOW, // Process creation flags
+        NULL,           // Use parent's environment block
+        NULL,           // Use parent's starting directory 
+        &si,            // Pointer to STARTUPINFO structure
+        &pi)            // Pointer to PROCESS_INFORMATION structure
+        )
+    {
+        fwprintf(stderr, L"Could not execute '%s'. CreateProcess error (%d).\n", application.c_str(), GetLastError());
+        exit(3);
+    }
+
+    CloseHandle(pi.hThread);
+    return pi.hProcess;
+}
+
+size_t WaitForAnyHook(const std::vector<HOOK_PROCESS>& processes, /* out */ int* exitCode)
+{
+    // WaitForMultipleObjects can only wait on MAXIMUM_WAIT_OBJECTS handles at a time, when there are more
+    // processes than that wait on them in batches (with a short timeout) until one of them exits
+    DWORD timeout = processes.size() <= MAXIMUM_WAIT_OBJECTS ? INFINITE : 10;
+    size_t exitedIndex = processes.size();
+    while (exitedIndex == processes.size())
+    {
+        for (size_t batchStart = 0; batchStart < processes.size(); batchStart += MAXIMUM_WAIT_OBJECTS)
+        {
+            size_t batchSize = min(processes.size() - batchStart, static_cast<size_t>(MAXIMUM_WAIT_OBJECTS));
+            DWORD result = WaitForMultipleObjects(
+                static_cast<DWORD>(batchSize),
+                &processes[batchStart],
+                FALSE,
+                timeout);
+
+            if (result < WAIT_OBJECT_0 + batchSize)
+            {
+                exitedIndex = batchStart + (result - WAIT_OBJECT_0);
+                break;
+            }
+            else if (result != WAIT_TIMEOUT)
+            {
+                fwprintf(stderr, L"WaitForMultipleObjects failed (%d).\n", GetLastError());
+                exit(4);
+            }
+        }
+    }
+
+    // Get process exit code to pass along
+    HOOK_PROCESS process = processes[exitedIndex];
+    DWORD processExitCode;
+    if (!GetExitCodeProcess(process, &processExitCode))
+    {
+        fwprintf(stderr, L"GetExitCodeProcess failed (%d).\n", GetLastError());
+        exit(4);
+    }
+
+    CloseHandle(process);
+    *exitCode = static_cast<int>(processExitCode);
+    return exitedIndex;
+}
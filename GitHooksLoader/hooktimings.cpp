@@ -0,0 +1,87 @@
+#include "stdafx.h"
+#include "hooktimings.h"
+#include "gvfspipe.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+
+static void CopyName(const HOOK_STRING& name, char (&destination)[HOOK_TIMINGS_NAME_SIZE])
+{
+    std::string utf8Name = ToUTF8(name);
+    for (char& c : utf8Name)
+    {
+        if (c >= 'A' && c <= 'Z')
+        {
+            c = c - 'A' + 'a';
+        }
+    }
+
+    // Always leave room for a NUL so that readers can treat names as strings
+    memset(destination, 0, sizeof(destination));
+    memcpy(destination, utf8Name.c_str(), std::min(utf8Name.length(), sizeof(destination) - 1));
+}
+
+void RecordHookTiming(
+    const HOOK_STRING& hookName,
+    const HOOK_STRING& verb,
+    int64_t startTime,
+    int64_t duration,
+    int exitCode,
+    uint32_t flags)
+{
+    HOOK_STRING enlistmentRoot;
+    if (!TryGetGVFSEnlistmentRoot(&enlistmentRoot))
+    {
+        return;
+    }
+
+    const size_t fileSize = HOOK_TIMINGS_HEADER_SIZE + HOOK_TIMINGS_CAPACITY * sizeof(HookTimingEntry);
+    HOOK_STRING path =
+        enlistmentRoot + HOOK_PATH_SEPARATOR + HOOK_TEXT(".gvfs") + HOOK_PATH_SEPARATOR + HOOK_TIMINGS_FILE_NAME;
+    char* view = static_cast<char*>(MapHookTimingsFile(path, fileSize));
+    if (view == nullptr)
+    {
+        return;
+    }
+
+    HookTimingsHeader* header = reinterpret_cast<HookTimingsHeader*>(view);
+    if (memcmp(header->magic, "\0\0\0\0", sizeof(header->magic)) == 0)
+    {
+        // A new file.  Loaders that race to initialize it write the same values, and the magic (which shares
+        // its 8 bytes with the version) is written last so that nobody uses the file before the header is valid.
+        header->capacity = HOOK_TIMINGS_CAPACITY;
+        header->entrySize = sizeof(HookTimingEntry);
+
+        HookTimingsHeader initializedHeader = {};
+        memcpy(initializedHeader.magic, HOOK_TIMINGS_MAGIC, sizeof(initializedHeader.magic));
+        initializedHeader.version = HOOK_TIMINGS_VERSION;
+        uint64_t magicAndVersion;
+        memcpy(&magicAndVersion, &initializedHeader, sizeof(magicAndVersion));
+        PublishHookTimings(reinterpret_cast<uint64_t*>(header), magicAndVersion);
+    }
+
+    // Leave files written in another format (or by another version of the loader) alone
+    if (memcmp(header->magic, HOOK_TIMINGS_MAGIC, sizeof(header->magic)) == 0 &&
+        header->version == HOOK_TIMINGS_VERSION &&
+        header->capacity == HOOK_TIMINGS_CAPACITY &&
+        header->entrySize == sizeof(HookTimingEntry))
+    {
+        uint64_t sequence = InterlockedIncrementHookTimings(&header->entryCount);
+        HookTimingEntry* entry = reinterpret_cast<HookTimingEntry*>(view + HOOK_TIMINGS_HEADER_SIZE) + (sequence - 1) % HOOK_TIMINGS_CAPACITY;
+
+        // Readers must not see any of the new fields while the sequence still has its old value
+        PublishHookTimings(&entry->sequence, 0);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        entry->startTime = startTime;
+        entry->duration = duration;
+        entry->exitCode = exitCode;
+        entry->flags = flags;
+        CopyName(hookName, entry->hookName);
+        CopyName(verb, entry->verb);
+        PublishHookTimings(&entry->sequence, sequence);
+    }
+
+    UnmapHookTimingsFile(view, fileSize);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hooklauncher.h"
+
+// Every run of the loader in a GVFS enlistment is recorded in .gvfs/HookTimings.dat, a fixed size ring of
+// the most recent runs that the loader memory-maps to add an entry ('gvfs log --hook-timings' reports the
+// latency per git verb, see HookTimingsLog.cs).
+//
+// File format (little-endian):
+//   HookTimingsHeader, padded to HOOK_TIMINGS_HEADER_SIZE bytes
+//   HOOK_TIMINGS_CAPACITY HookTimingEntry slots, entry n (counting from 1) is written to slot (n - 1) % capacity
+//
+// The sequence of an entry is 0 while it is being written and n once it is complete, readers must skip
+// entries whose sequence is 0 or changes while they read them.
+
+#define HOOK_TIMINGS_FILE_NAME HOOK_TEXT("HookTimings.dat")
+#define HOOK_TIMINGS_MAGIC "GVHT"
+#define HOOK_TIMINGS_VERSION 1
+#define HOOK_TIMINGS_CAPACITY 4096
+#define HOOK_TIMINGS_HEADER_SIZE 64
+#define HOOK_TIMINGS_NAME_SIZE 32
+
+// GVFS.Hooks did not have to be started (see gvfslock.h)
+#define HOOK_TIMING_FLAG_IN_PROCESS 0x1
+
+struct HookTimingsHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t entrySize;
+    uint64_t entryCount;
+};
+
+struct HookTimingEntry
+{
+    uint64_t sequence;
+    int64_t startTime;   // Microseconds since the Unix epoch (UTC)
+    int64_t duration;    // Microseconds
+    int32_t exitCode;
+    uint32_t flags;
+
+    // UTF-8, truncated if needed and padded with NULs
+    char hookName[HOOK_TIMINGS_NAME_SIZE];
+    char verb[HOOK_TIMINGS_NAME_SIZE];
+};
+
+static_assert(sizeof(HookTimingsHeader) <= HOOK_TIMINGS_HEADER_SIZE, "HookTimingsHeader must fit in HOOK_TIMINGS_HEADER_SIZE");
+static_assert(sizeof(HookTimingEntry) == 96, "HookTimingEntry is part of the file format");
+
+// Adds a run of the loader to the timings file of the current enlistment.  The log is informational
+// only, so any failure (e.g. not being in an enlistment) is ignored.
+void RecordHookTiming(
+    const HOOK_STRING& hookName,
+    const HOOK_STRING& verb,
+    int64_t startTime,
+    int64_t duration,
+    int exitCode,
+    uint32_t flags);
+
+// Implemented per platform (hooktimings.windows.cpp, hooktimings.posix.cpp)
+
+// Maps the first size bytes of path for reading and writing, creating the file or growing it (with zeros)
+// if needed.  Returns nullptr on failure.
+void* MapHookTimingsFile(const HOOK_STRING& path, size_t size);
+void UnmapHookTimingsFile(void* view, size_t size);
+
+// Atomically increments value and returns the incremented value
+uint64_t InterlockedIncrementHookTimings(uint64_t* value);
+
+// Stores newValue with release semantics, so that readers that see it also see every earlier write
+void PublishHookTimings(uint64_t* value, uint64_t newValue);
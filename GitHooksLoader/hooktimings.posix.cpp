@@ -0,0 +1,45 @@
+#include "stdafx.h"
+#include "hooktimings.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void* MapHookTimingsFile(const std::string& path, size_t size)
+{
+    // Only the enlistment's owner runs git (and so the loader) in it
+    int file = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (file < 0)
+    {
+        return nullptr;
+    }
+
+    // Only ever grow the file, another loader might be using it
+    struct stat fileStat;
+    if (fstat(file, &fileStat) != 0 ||
+        (static_cast<size_t>(fileStat.st_size) < size && ftruncate(file, size) != 0))
+    {
+        close(file);
+        return nullptr;
+    }
+
+    void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    close(file);
+    return view == MAP_FAILED ? nullptr : view;
+}
+
+void UnmapHookTimingsFile(void* view, size_t size)
+{
+    munmap(view, size);
+}
+
+uint64_t InterlockedIncrementHookTimings(uint64_t* value)
+{
+    return __atomic_add_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+void PublishHookTimings(uint64_t* value, uint64_t newValue)
+{
+    __atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+}
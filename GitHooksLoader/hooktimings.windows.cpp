@@ -0,0 +1,49 @@
+#include "stdafx.h"
+#include "hooktimings.h"
+
+void* MapHookTimingsFile(const std::wstring& path, size_t size)
+{
+    HANDLE file = CreateFileW(
+        path.c_str(),
+        GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL,
+        OPEN_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return nullptr;
+    }
+
+    // CreateFileMapping grows the file (with zeros) if it is smaller than the mapping
+    ULARGE_INTEGER mappingSize;
+    mappingSize.QuadPart = size;
+    HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READWRITE, mappingSize.HighPart, mappingSize.LowPart, NULL);
+    CloseHandle(file);
+    if (mapping == NULL)
+    {
+        return nullptr;
+    }
+
+    // The view keeps the mapping (and the file) open until it is unmapped
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, size);
+    CloseHandle(mapping);
+    return view;
+}
+
+void UnmapHookTimingsFile(void* view, size_t /* size */)
+{
+    UnmapViewOfFile(view);
+}
+
+uint64_t InterlockedIncrementHookTimings(uint64_t* value)
+{
+    return static_cast<uint64_t>(InterlockedIncrement64(reinterpret_cast<volatile LONG64*>(value)));
+}
+
+void PublishHookTimings(uint64_t* value, uint64_t newValue)
+{
+    InterlockedExchange64(reinterpret_cast<volatile LONG64*>(value), static_cast<LONG64>(newValue));
+}
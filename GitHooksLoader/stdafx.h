@@ -5,7 +5,10 @@
 
 #pragma once
 
+#ifdef _WIN32
 #include "targetver.h"
 #include <Windows.h>
+#endif
+
 #include <stdio.h>
 
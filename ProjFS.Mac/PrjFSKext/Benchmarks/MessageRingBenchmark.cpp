@@ -0,0 +1,408 @@
+// Checks and benchmarks MessageRing, which carries messages from the kext's kauth threads to the provider, in user
+// space. A small ring is stress tested with producers writing records of varying sizes that wrap around it and fill
+// it, while the consumer checks every record arrives once, intact and in each producer's order. Then throughput is
+// measured with 1 to 64 producers sending kauth sized messages, reserving space lock free, and serialized by a mutex
+// as they were around IOSharedDataQueue::enqueue.
+// Only uses portable code, so it also runs on Linux; see Scripts/RunBenchmarks.sh.
+
+#include "MessageRing.h"
+#include "Message.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1); \
+        } \
+    } while (0)
+
+// Stands in for the mach notification the kext sends through its data queue
+struct Notification
+{
+    std::mutex mutex;
+    std::condition_variable signalled;
+    bool isSignalled = false;
+
+    void Signal()
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->isSignalled = true;
+        this->signalled.notify_one();
+    }
+
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->signalled.wait(lock, [this] { return this->isSignalled; });
+        this->isSignalled = false;
+    }
+};
+
+struct StressRecord
+{
+    uint32_t producer;
+    uint32_t sequence;
+
+    // Followed by GetPayloadSize(sequence) bytes
+};
+
+static uint32_t GetPayloadSize(uint32_t sequence)
+{
+    return sequence * 7 % 300;
+}
+
+static uint8_t GetPayloadByte(uint32_t producer, uint32_t sequence, uint32_t index)
+{
+    return static_cast<uint8_t>(producer * 31 + sequence + index);
+}
+
+static std::vector<uint8_t> AllocateRing(uint32_t capacity)
+{
+    // Ring memory is 8 byte aligned, as page aligned shared memory is
+    return std::vector<uint8_t>(MessageRing_GetMemorySize(capacity) + 8);
+}
+
+static MessageRingHeader* InitRing(std::vector<uint8_t>& memory, uint32_t capacity)
+{
+    uintptr_t address = (reinterpret_cast<uintptr_t>(memory.data()) + 7) & ~static_cast<uintptr_t>(7);
+    return MessageRing_Init(reinterpret_cast<void*>(address), capacity);
+}
+
+static void CheckSingleThreaded()
+{
+    const uint32_t capacity = 256;
+    std::vector<uint8_t> memory = AllocateRing(capacity);
+    MessageRingHeader* ring = InitRing(memory, capacity);
+    MessageRingProducer ringProducer;
+    MessageRing_InitProducer(&ringProducer, capacity);
+
+    std::vector<uint32_t> drained;
+    auto recordValue = [&drained](const void* data, uint32_t dataSize)
+    {
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+        CHECK(dataSize >= sizeof(value));
+        drained.push_back(value);
+    };
+
+    // Too large for the ring
+    uint64_t position;
+    CHECK(nullptr == MessageRing_Reserve(ring, &ringProducer, capacity / 2, &position));
+
+    // The consumer starts out waiting, so only the first commit notifies
+    uint32_t value = 1;
+    void* data = MessageRing_Reserve(ring, &ringProducer, 20, &position);
+    CHECK(nullptr != data);
+    memcpy(data, &value, sizeof(value));
+    CHECK(MessageRing_Commit(ring, &ringProducer, position, 20));
+
+    value = 2;
+    data = MessageRing_Reserve(ring, &ringProducer, 20, &position);
+    memcpy(data, &value, sizeof(value));
+    CHECK(!MessageRing_Commit(ring, &ringProducer, position, 20));
+
+    // An uncommitted record holds up the ones after it
+    uint64_t uncommittedPosition;
+    data = MessageRing_Reserve(ring, &ringProducer, 4, &uncommittedPosition);
+    value = 3;
+    memcpy(data, &value, sizeof(value));
+    data = MessageRing_Reserve(ring, &ringProducer, 4, &position);
+    value = 4;
+    memcpy(data, &value, sizeof(value));
+    MessageRing_Commit(ring, &ringProducer, position, 4);
+
+    CHECK(2 == MessageRing_Drain(ring, 10, recordValue));
+    CHECK(drained == std::vector<uint32_t>({ 1, 2 }));
+    CHECK(0 == MessageRing_Drain(ring, 10, recordValue));
+
+    MessageRing_Commit(ring, &ringProducer, uncommittedPosition, 4);
+    CHECK(!MessageRing_PrepareToWait(ring));
+    CHECK(1 == MessageRing_Drain(ring, 1, recordValue));
+    CHECK(1 == MessageRing_Drain(ring, 10, recordValue));
+    CHECK(drained == std::vector<uint32_t>({ 1, 2, 3, 4 }));
+    CHECK(MessageRing_PrepareToWait(ring));
+
+    // 96 bytes have been used, so two 64 byte records fit before the end of the ring and the third goes at its
+    // start, after padding. The ring is then full.
+    drained.clear();
+    for (value = 10; value < 13; ++value)
+    {
+        data = MessageRing_Reserve(ring, &ringProducer, 56, &position);
+        CHECK(nullptr != data);
+        memcpy(data, &value, sizeof(value));
+        CHECK(MessageRing_Commit(ring, &ringProducer, position, 56) == (10 == value));
+    }
+
+    CHECK(MessageRing_GetRecords(ring) + sizeof(MessageRingRecordHeader) == data);
+    CHECK(nullptr == MessageRing_Reserve(ring, &ringProducer, 56, &position));
+    CHECK(3 == MessageRing_Drain(ring, 10, recordValue));
+    CHECK(drained == std::vector<uint32_t>({ 10, 11, 12 }));
+    CHECK(ring->consumedPosition == ringProducer.reservedPosition);
+
+    // Records that fill the whole ring are drained once each
+    drained.clear();
+    for (value = 20; value < 24; ++value)
+    {
+        data = MessageRing_Reserve(ring, &ringProducer, 56, &position);
+        CHECK(nullptr != data);
+        memcpy(data, &value, sizeof(value));
+        MessageRing_Commit(ring, &ringProducer, position, 56);
+    }
+
+    CHECK(nullptr == MessageRing_Reserve(ring, &ringProducer, 0, &position));
+    CHECK(4 == MessageRing_Drain(ring, 10, recordValue));
+    CHECK(drained == std::vector<uint32_t>({ 20, 21, 22, 23 }));
+    CHECK(ring->consumedPosition == ringProducer.reservedPosition);
+
+    // Whatever the consumer stores in consumedPosition, records are only written within the ring. One ahead of
+    // the producers makes the ring look empty, and one more than a ring's length behind makes it look full.
+    uint64_t consumedPosition = ring->consumedPosition;
+    ring->consumedPosition = UINT64_MAX;
+    for (value = 30; value < 34; ++value)
+    {
+        data = MessageRing_Reserve(ring, &ringProducer, 56, &position);
+        CHECK(nullptr != data);
+        CHECK(static_cast<uint8_t*>(data) >= MessageRing_GetRecords(ring));
+        CHECK(static_cast<uint8_t*>(data) + 56 <= MessageRing_GetRecords(ring) + capacity);
+        MessageRing_Commit(ring, &ringProducer, position, 56);
+    }
+
+    ring->consumedPosition = 0;
+    CHECK(nullptr == MessageRing_Reserve(ring, &ringProducer, 0, &position));
+    ring->consumedPosition = consumedPosition;
+    CHECK(4 == MessageRing_Drain(ring, 10, recordValue));
+    CHECK(ring->consumedPosition == ringProducer.reservedPosition);
+
+    printf("MessageRing checks passed\n");
+}
+
+static void StressTest(uint32_t producerCount, uint32_t recordsPerProducer)
+{
+    const uint32_t capacity = 4096;
+    std::vector<uint8_t> memory = AllocateRing(capacity);
+    MessageRingHeader* ring = InitRing(memory, capacity);
+    MessageRingProducer ringProducer;
+    MessageRing_InitProducer(&ringProducer, capacity);
+    Notification notification;
+    std::atomic<uint64_t> fullCount(0);
+
+    std::vector<std::thread> producers;
+    for (uint32_t producer = 0; producer < producerCount; ++producer)
+    {
+        producers.emplace_back(
+            [&, producer]()
+            {
+                for (uint32_t sequence = 0; sequence < recordsPerProducer; ++sequence)
+                {
+                    uint32_t payloadSize = GetPayloadSize(sequence);
+                    uint64_t position;
+                    uint8_t* data;
+                    while (nullptr == (data = static_cast<uint8_t*>(MessageRing_Reserve(ring, &ringProducer, sizeof(StressRecord) + payloadSize, &position))))
+                    {
+                        ++fullCount;
+                        std::this_thread::yield();
+                    }
+
+                    StressRecord record = { producer, sequence };
+                    memcpy(data, &record, sizeof(record));
+                    for (uint32_t i = 0; i < payloadSize; ++i)
+                    {
+                        data[sizeof(record) + i] = GetPayloadByte(producer, sequence, i);
+                    }
+
+                    if (MessageRing_Commit(ring, &ringProducer, position, sizeof(StressRecord) + payloadSize))
+                    {
+                        notification.Signal();
+                    }
+                }
+            });
+    }
+
+    std::vector<uint32_t> nextSequences(producerCount, 0);
+    uint64_t remaining = static_cast<uint64_t>(producerCount) * recordsPerProducer;
+    uint64_t batchCount = 0;
+    auto checkRecord = [&](const void* data, uint32_t dataSize)
+    {
+        StressRecord record;
+        CHECK(dataSize >= sizeof(record));
+        memcpy(&record, data, sizeof(record));
+        CHECK(record.producer < producerCount);
+        CHECK(record.sequence == nextSequences[record.producer]);
+        CHECK(dataSize == sizeof(record) + GetPayloadSize(record.sequence));
+
+        const uint8_t* payload = static_cast<const uint8_t*>(data) + sizeof(record);
+        for (uint32_t i = 0; i < dataSize - sizeof(record); ++i)
+        {
+            CHECK(payload[i] == GetPayloadByte(record.producer, record.sequence, i));
+        }
+
+        ++nextSequences[record.producer];
+        --remaining;
+    };
+
+    while (0 != remaining)
+    {
+        if (0 != MessageRing_Drain(ring, 16, checkRecord))
+        {
+            ++batchCount;
+        }
+        else if (MessageRing_PrepareToWait(ring))
+        {
+            notification.Wait();
+        }
+    }
+
+    for (std::thread& producer : producers)
+    {
+        producer.join();
+    }
+
+    CHECK(0 == MessageRing_Drain(ring, 16, checkRecord));
+    CHECK(ring->consumedPosition == ringProducer.reservedPosition);
+    for (uint32_t nextSequence : nextSequences)
+    {
+        CHECK(recordsPerProducer == nextSequence);
+    }
+
+    printf(
+        "stress     %2u producers  %8llu records in %7llu batches, ring full %llu times\n",
+        producerCount,
+        static_cast<unsigned long long>(producerCount) * recordsPerProducer,
+        static_cast<unsigned long long>(batchCount),
+        static_cast<unsigned long long>(fullCount.load()));
+}
+
+// Messages with a typical relative path, sent by producerCount threads at once through a ring the size of the
+// kext's. Returns messages per second.
+static double BenchmarkThroughput(uint32_t producerCount, bool serialized, uint32_t messageCount)
+{
+    const uint32_t capacity = 128 * 1024;
+    const char path[] = "src/Components/Networking/Sockets/ConnectionPool.cpp";
+    std::vector<uint8_t> memory = AllocateRing(capacity);
+    MessageRingHeader* ring = InitRing(memory, capacity);
+    MessageRingProducer ringProducer;
+    MessageRing_InitProducer(&ringProducer, capacity);
+    Notification notification;
+    std::mutex writerMutex;
+
+    uint32_t messagesPerProducer = messageCount / producerCount;
+    std::vector<std::thread> producers;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint32_t producer = 0; producer < producerCount; ++producer)
+    {
+        producers.emplace_back(
+            [&, producer]()
+            {
+                MessageHeader header = {};
+                header.messageType = MessageType_KtoU_HydrateFile;
+                header.pathSizeBytes = sizeof(path);
+                uint32_t messageSize = sizeof(header) + sizeof(path);
+                for (uint32_t i = 0; i < messagesPerProducer; ++i)
+                {
+                    header.messageId = static_cast<uint64_t>(producer) * messagesPerProducer + i + 1;
+
+                    std::unique_lock<std::mutex> lock(writerMutex, std::defer_lock);
+                    uint64_t position;
+                    uint8_t* messageMemory;
+                    while (true)
+                    {
+                        if (serialized)
+                        {
+                            lock.lock();
+                        }
+
+                        messageMemory = static_cast<uint8_t*>(MessageRing_Reserve(ring, &ringProducer, messageSize, &position));
+                        if (nullptr != messageMemory)
+                        {
+                            break;
+                        }
+
+                        if (serialized)
+                        {
+                            lock.unlock();
+                        }
+
+                        std::this_thread::yield();
+                    }
+
+                    memcpy(messageMemory, &header, sizeof(header));
+                    memcpy(messageMemory + sizeof(header), path, sizeof(path));
+                    bool notify = MessageRing_Commit(ring, &ringProducer, position, messageSize);
+                    if (serialized)
+                    {
+                        lock.unlock();
+                    }
+
+                    if (notify)
+                    {
+                        notification.Signal();
+                    }
+                }
+            });
+    }
+
+    uint64_t remaining = static_cast<uint64_t>(messagesPerProducer) * producerCount;
+    uint64_t messageIdSum = 0;
+    auto readMessage = [&](const void* data, uint32_t)
+    {
+        // Parsed in place, as PrjFSLib does before it decides whether to copy the message
+        const MessageHeader* header = static_cast<const MessageHeader*>(data);
+        messageIdSum += header->messageId;
+        --remaining;
+    };
+
+    while (0 != remaining)
+    {
+        if (0 == MessageRing_Drain(ring, 64, readMessage) && MessageRing_PrepareToWait(ring))
+        {
+            notification.Wait();
+        }
+    }
+
+    for (std::thread& producer : producers)
+    {
+        producer.join();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t sentCount = static_cast<uint64_t>(messagesPerProducer) * producerCount;
+    CHECK(messageIdSum == sentCount * (sentCount + 1) / 2);
+    return sentCount / seconds;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t messageCount = argc > 1 ? static_cast<uint32_t>(strtoul(argv[1], nullptr, 10)) : 2000000;
+
+    CheckSingleThreaded();
+
+    const uint32_t producerCounts[] = { 1, 2, 4, 8, 16, 32, 64 };
+    for (uint32_t producerCount : producerCounts)
+    {
+        StressTest(producerCount, 200000 / producerCount);
+    }
+
+    for (uint32_t producerCount : producerCounts)
+    {
+        double serialized = BenchmarkThroughput(producerCount, true, messageCount);
+        double lockFree = BenchmarkThroughput(producerCount, false, messageCount);
+        printf(
+            "throughput %2u producers  mutex %10.0f messages/s  lock free %10.0f messages/s\n",
+            producerCount,
+            serialized,
+            lockFree);
+    }
+
+    return 0;
+}
@@ -0,0 +1,295 @@
+// Checks and benchmarks OutstandingMessages_DeliverResponses, which KauthHandler uses to wake the threads waiting
+// for the provider's responses, in user space. Kernel threads sleeping on their OutstandingMessage are simulated by
+// threads waiting on a condition variable, and wakeup() by notifying it.
+// Only uses portable code, so it also runs on Linux; see Scripts/RunBenchmarks.sh.
+
+#include "../PrjFSKext/OutstandingMessages.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1); \
+        } \
+    } while (0)
+
+static void InitMessage(OutstandingMessage* message, uint64_t messageId)
+{
+    *message = OutstandingMessage();
+    message->request.messageId = messageId;
+    message->response = MessageType_Invalid;
+    message->receivedResponse = false;
+}
+
+static void CheckDeliverResponses()
+{
+    OutstandingMessage messages[64];
+    OutstandingMessage_Head outstandingMessages = LIST_HEAD_INITIALIZER(OutstandingMessage_Head);
+    for (uint64_t i = 0; i < 64; ++i)
+    {
+        InitMessage(&messages[i], i + 1);
+        LIST_INSERT_HEAD(&outstandingMessages, &messages[i], _list_privates);
+    }
+
+    std::vector<uint64_t> woken;
+    auto recordWakeup = [&woken](OutstandingMessage* message) { woken.push_back(message->request.messageId); };
+
+    // Sorted batch
+    const uint64_t sortedIds[] = { 3, 5, 64 };
+    CHECK(3 == OutstandingMessages_DeliverResponses(&outstandingMessages, sortedIds, 3, MessageType_Response_Success, recordWakeup));
+    std::sort(woken.begin(), woken.end());
+    CHECK(woken == std::vector<uint64_t>({ 3, 5, 64 }));
+    CHECK(messages[2].receivedResponse && MessageType_Response_Success == messages[2].response);
+    CHECK(messages[63].receivedResponse && MessageType_Response_Success == messages[63].response);
+    CHECK(!messages[3].receivedResponse);
+
+    // Batch with one ID that is not outstanding
+    woken.clear();
+    const uint64_t partlyOutstandingIds[] = { 2, 10, 40, 1000 };
+    CHECK(3 == OutstandingMessages_DeliverResponses(&outstandingMessages, partlyOutstandingIds, 4, MessageType_Response_Fail, recordWakeup));
+    std::sort(woken.begin(), woken.end());
+    CHECK(woken == std::vector<uint64_t>({ 2, 10, 40 }));
+    CHECK(messages[1].receivedResponse && MessageType_Response_Fail == messages[1].response);
+    CHECK(messages[39].receivedResponse && MessageType_Response_Fail == messages[39].response);
+
+    // Single ID, as sent by KauthHandler_HandleKernelMessageResponse
+    woken.clear();
+    uint64_t singleId = 33;
+    CHECK(1 == OutstandingMessages_DeliverResponses(&outstandingMessages, &singleId, 1, MessageType_Response_Success, recordWakeup));
+    CHECK(woken == std::vector<uint64_t>({ 33 }));
+
+    // No outstanding message matches
+    woken.clear();
+    const uint64_t unknownIds[] = { 65, 66 };
+    CHECK(0 == OutstandingMessages_DeliverResponses(&outstandingMessages, unknownIds, 2, MessageType_Response_Success, recordWakeup));
+    CHECK(woken.empty());
+
+    // Empty list
+    OutstandingMessage_Head emptyList = LIST_HEAD_INITIALIZER(OutstandingMessage_Head);
+    CHECK(0 == OutstandingMessages_DeliverResponses(&emptyList, sortedIds, 3, MessageType_Response_Success, recordWakeup));
+
+    // Batches that are not strictly ascending are rejected before they get this far
+    const uint64_t unsortedIds[] = { 40, 2, 1000, 10 };
+    const uint64_t repeatedIds[] = { 2, 10, 10, 40 };
+    CHECK(OutstandingMessages_IsValidResponseBatch(sortedIds, 3));
+    CHECK(OutstandingMessages_IsValidResponseBatch(&singleId, 1));
+    CHECK(!OutstandingMessages_IsValidResponseBatch(unsortedIds, 4));
+    CHECK(!OutstandingMessages_IsValidResponseBatch(repeatedIds, 4));
+
+    printf("OutstandingMessages_DeliverResponses checks passed\n");
+}
+
+// Time to respond to a group of coalesced requests while other requests are outstanding, one ID per call as
+// before, or with the whole group in one call
+static void BenchmarkListWalk(uint32_t outstandingCount, uint32_t groupSize)
+{
+    std::vector<OutstandingMessage> messages(outstandingCount);
+    OutstandingMessage_Head outstandingMessages = LIST_HEAD_INITIALIZER(OutstandingMessage_Head);
+    for (uint32_t i = 0; i < outstandingCount; ++i)
+    {
+        InitMessage(&messages[i], i + 1);
+        LIST_INSERT_HEAD(&outstandingMessages, &messages[i], _list_privates);
+    }
+
+    // The group is the oldest requests, which are at the end of the list
+    std::vector<uint64_t> group;
+    for (uint32_t i = 0; i < groupSize; ++i)
+    {
+        group.push_back(i + 1);
+    }
+
+    std::mutex listMutex;
+    uint64_t wakeups = 0;
+    auto countWakeup = [&wakeups](OutstandingMessage*) { ++wakeups; };
+    const uint32_t iterations = 20000;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint32_t iteration = 0; iteration < iterations; ++iteration)
+    {
+        for (uint64_t messageId : group)
+        {
+            std::lock_guard<std::mutex> lock(listMutex);
+            OutstandingMessages_DeliverResponses(&outstandingMessages, &messageId, 1, MessageType_Response_Success, countWakeup);
+        }
+    }
+
+    double singleSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (uint32_t iteration = 0; iteration < iterations; ++iteration)
+    {
+        std::lock_guard<std::mutex> lock(listMutex);
+        OutstandingMessages_DeliverResponses(&outstandingMessages, group.data(), groupSize, MessageType_Response_Success, countWakeup);
+    }
+
+    double batchSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    CHECK(wakeups == 2ULL * iterations * groupSize);
+    printf(
+        "list walk  %4u outstanding  %3u coalesced  one per call %9.1f ns/group  batched %9.1f ns/group\n",
+        outstandingCount,
+        groupSize,
+        singleSeconds * 1e9 / iterations,
+        batchSeconds * 1e9 / iterations);
+}
+
+// Simulated kauth threads that each send a request and sleep until it is responded to, and a provider thread that
+// responds to all the requests it has received, one ID per call or all of them in one call
+static void BenchmarkSimulatedWaiters(unsigned waiterCount, bool batched)
+{
+    const unsigned requestsPerWaiter = 2000;
+
+    std::mutex listMutex;
+    OutstandingMessage_Head outstandingMessages = LIST_HEAD_INITIALIZER(OutstandingMessage_Head);
+    std::vector<std::condition_variable> sleepChannels(waiterCount);
+
+    // Stands in for the kernel message queue
+    std::mutex queueMutex;
+    std::condition_variable queueNotEmpty;
+    std::deque<uint64_t> queue;
+    bool allRequestsSent = false;
+
+    auto wakeupWaiter = [&sleepChannels, waiterCount](OutstandingMessage* message)
+    {
+        sleepChannels[(message->request.messageId - 1) % waiterCount].notify_one();
+    };
+
+    std::vector<std::thread> waiters;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned waiterIndex = 0; waiterIndex < waiterCount; ++waiterIndex)
+    {
+        waiters.emplace_back(
+            [&, waiterIndex]()
+            {
+                for (unsigned request = 0; request < requestsPerWaiter; ++request)
+                {
+                    OutstandingMessage message;
+                    uint64_t messageId = static_cast<uint64_t>(request) * waiterCount + waiterIndex + 1;
+                    InitMessage(&message, messageId);
+
+                    std::unique_lock<std::mutex> listLock(listMutex);
+                    LIST_INSERT_HEAD(&outstandingMessages, &message, _list_privates);
+
+                    {
+                        std::lock_guard<std::mutex> queueLock(queueMutex);
+                        queue.push_back(messageId);
+                        queueNotEmpty.notify_one();
+                    }
+
+                    sleepChannels[waiterIndex].wait(listLock, [&message] { return message.receivedResponse; });
+                    CHECK(((messageId % 2 == 0) ? MessageType_Response_Success : MessageType_Response_Fail) == message.response);
+                    LIST_REMOVE(&message, _list_privates);
+                }
+            });
+    }
+
+    std::thread provider(
+        [&]()
+        {
+            std::vector<uint64_t> received;
+            std::vector<uint64_t> successIds;
+            std::vector<uint64_t> failIds;
+            uint64_t responseCount = 0;
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> queueLock(queueMutex);
+                    queueNotEmpty.wait(queueLock, [&] { return !queue.empty() || allRequestsSent; });
+                    if (queue.empty())
+                    {
+                        break;
+                    }
+
+                    received.assign(queue.begin(), queue.end());
+                    queue.clear();
+                }
+
+                // As PrjFSLib does before it sends a batch
+                std::sort(received.begin(), received.end());
+
+                successIds.clear();
+                failIds.clear();
+                for (uint64_t messageId : received)
+                {
+                    (messageId % 2 == 0 ? successIds : failIds).push_back(messageId);
+                }
+
+                if (batched)
+                {
+                    std::lock_guard<std::mutex> listLock(listMutex);
+                    responseCount += OutstandingMessages_DeliverResponses(&outstandingMessages, successIds.data(), static_cast<uint32_t>(successIds.size()), MessageType_Response_Success, wakeupWaiter);
+                    responseCount += OutstandingMessages_DeliverResponses(&outstandingMessages, failIds.data(), static_cast<uint32_t>(failIds.size()), MessageType_Response_Fail, wakeupWaiter);
+                }
+                else
+                {
+                    for (uint64_t messageId : received)
+                    {
+                        std::lock_guard<std::mutex> listLock(listMutex);
+                        MessageType responseType = (messageId % 2 == 0) ? MessageType_Response_Success : MessageType_Response_Fail;
+                        responseCount += OutstandingMessages_DeliverResponses(&outstandingMessages, &messageId, 1, responseType, wakeupWaiter);
+                    }
+                }
+            }
+
+            CHECK(responseCount == static_cast<uint64_t>(waiterCount) * requestsPerWaiter);
+        });
+
+    for (std::thread& waiter : waiters)
+    {
+        waiter.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> queueLock(queueMutex);
+        allRequestsSent = true;
+        queueNotEmpty.notify_one();
+    }
+
+    provider.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    CHECK(LIST_EMPTY(&outstandingMessages));
+    printf(
+        "simulated  %3u waiters  %-12s %8.1f ns/response\n",
+        waiterCount,
+        batched ? "batched" : "one per call",
+        seconds * 1e9 / (static_cast<double>(waiterCount) * requestsPerWaiter));
+}
+
+int main()
+{
+    CheckDeliverResponses();
+
+    const uint32_t outstandingCounts[] = { 16, 256, 1024 };
+    const uint32_t groupSizes[] = { 2, 8, 64 };
+    for (uint32_t outstandingCount : outstandingCounts)
+    {
+        for (uint32_t groupSize : groupSizes)
+        {
+            if (groupSize <= outstandingCount)
+            {
+                BenchmarkListWalk(outstandingCount, groupSize);
+            }
+        }
+    }
+
+    const unsigned waiterCounts[] = { 1, 8, 64 };
+    for (unsigned waiterCount : waiterCounts)
+    {
+        BenchmarkSimulatedWaiters(waiterCount, false);
+        BenchmarkSimulatedWaiters(waiterCount, true);
+    }
+
+    return 0;
+}
@@ -12,6 +12,7 @@
 #include "Message.h"
 #include "Locks.hpp"
 #include "PrjFSProviderUserClient.hpp"
+#include "OutstandingMessages.hpp"
 
 // Function prototypes
 static int HandleVnodeOperation(
@@ -70,22 +71,11 @@ static bool ShouldHandleEvent(
     int* kauthResult);
 
 
-// Structs
-typedef struct OutstandingMessage
-{
-    MessageHeader request;
-    MessageType response;
-    bool    receivedResponse;
-    
-    LIST_ENTRY(OutstandingMessage) _list_privates;
-    
-} OutstandingMessage;
-
 // State
 static kauth_listener_t s_vnodeListener = nullptr;
 static kauth_listener_t s_fileopListener = nullptr;
 
-static LIST_HEAD(OutstandingMessage_Head, OutstandingMessage) s_outstandingMessages = LIST_HEAD_INITIALIZER(OutstandingMessage_Head);
+static OutstandingMessage_Head s_outstandingMessages = LIST_HEAD_INITIALIZER(OutstandingMessage_Head);
 static Mutex s_outstandingMessagesMutex = {};
 static volatile int s_nextMessageId;
 
@@ -181,6 +171,11 @@ kern_return_t KauthHandler_Cleanup()
 }
 
 void KauthHandler_HandleKernelMessageResponse(uint64_t messageId, MessageType responseType)
+{
+    KauthHandler_HandleKernelMessageResponses(&messageId, 1, responseType);
+}
+
+void KauthHandler_HandleKernelMessageResponses(const uint64_t* messageIds, uint32_t messageIdCount, MessageType responseType)
 {
     switch (responseType)
     {
@@ -189,20 +184,12 @@ void KauthHandler_HandleKernelMessageResponse(uint64_t messageId, MessageType re
         {
             Mutex_Acquire(s_outstandingMessagesMutex);
             {
-                OutstandingMessage* outstandingMessage;
-                LIST_FOREACH(outstandingMessage, &s_outstandingMessages, _list_privates)
-                {
-                    if (outstandingMessage->request.messageId == messageId)
-                    {
-                        // Save the response for the blocked thread.
-                        outstandingMessage->response = responseType;
-                        outstandingMessage->receivedResponse = true;
-                        
-                        wakeup(outstandingMessage);
-                        
-                        break;
-                    }
-                }
+                OutstandingMessages_DeliverResponses(
+                    &s_outstandingMessages,
+                    messageIds,
+                    messageIdCount,
+                    responseType,
+                    [](OutstandingMessage* outstandingMessage) { wakeup(outstandingMessage); });
             }
             Mutex_Release(s_outstandingMessagesMutex);
         }
@@ -594,7 +581,7 @@ static bool TrySendRequestAndWaitForResponse(
     while (!message.receivedResponse &&
            !s_isShuttingDown)
     {
-        Sleep(5, &message);
+        Sleep(ProviderMessageTimeoutSeconds, &message);
     }
     
     if (s_isShuttingDown)
@@ -3,9 +3,16 @@
 
 #include "Message.h"
 
+// How long a kauth thread waits on the provider at a time: for its response, before checking whether the kext is
+// shutting down, and for space to send its message in, before giving up on it
+static const uint32_t ProviderMessageTimeoutSeconds = 5;
+
 kern_return_t KauthHandler_Init();
 kern_return_t KauthHandler_Cleanup();
 
 void KauthHandler_HandleKernelMessageResponse(uint64_t messageId, MessageType responseType);
 
+// Responds to several messages with the same response, waking all of their threads under one lock acquisition
+void KauthHandler_HandleKernelMessageResponses(const uint64_t* messageIds, uint32_t messageIdCount, MessageType responseType);
+
 #endif /* KauthHandler_h */
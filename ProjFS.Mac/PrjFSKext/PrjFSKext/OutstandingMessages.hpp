@@ -0,0 +1,93 @@
+#pragma once
+
+// Only depends on sys/queue.h and Message.h, so that the response delivery logic can also be built and
+// exercised in user space; see PrjFSKext/Benchmarks.
+
+#include <sys/queue.h>
+#include "Message.h"
+
+// A request sent to the provider whose thread is waiting for the response
+typedef struct OutstandingMessage
+{
+    MessageHeader request;
+    MessageType response;
+    bool    receivedResponse;
+    
+    LIST_ENTRY(OutstandingMessage) _list_privates;
+    
+} OutstandingMessage;
+
+LIST_HEAD(OutstandingMessage_Head, OutstandingMessage);
+
+// Returns true if messageIds are in strictly ascending order, which providers must ensure for the batches they send
+// (they sort and de-duplicate them first) so that they can be searched by bisection while the list is locked.
+// Checked before taking the lock, and batches that fail it are rejected.
+inline bool OutstandingMessages_IsValidResponseBatch(const uint64_t* messageIds, uint32_t messageIdCount)
+{
+    for (uint32_t i = 1; i < messageIdCount; ++i)
+    {
+        if (messageIds[i] <= messageIds[i - 1])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Returns true if messageId is in messageIds, which must be sorted
+inline bool OutstandingMessages_ContainsMessageId(const uint64_t* messageIds, uint32_t messageIdCount, uint64_t messageId)
+{
+    uint32_t low = 0;
+    uint32_t high = messageIdCount;
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (messageIds[middle] < messageId)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return low < messageIdCount && messageIds[low] == messageId;
+}
+
+// Saves responseType as the response of each message in outstandingMessages whose ID is in messageIds, and calls
+// wakeup(message) for it so that its thread sees the response. messageIds must pass
+// OutstandingMessages_IsValidResponseBatch. The list is walked once however many IDs there are, and the caller must
+// hold the lock that protects it. Returns the number of messages that were woken.
+template <typename TWakeup>
+uint32_t OutstandingMessages_DeliverResponses(
+    OutstandingMessage_Head* outstandingMessages,
+    const uint64_t* messageIds,
+    uint32_t messageIdCount,
+    MessageType responseType,
+    TWakeup wakeup)
+{
+    uint32_t wokenCount = 0;
+    OutstandingMessage* outstandingMessage;
+    LIST_FOREACH(outstandingMessage, outstandingMessages, _list_privates)
+    {
+        if (OutstandingMessages_ContainsMessageId(messageIds, messageIdCount, outstandingMessage->request.messageId))
+        {
+            // Save the response for the blocked thread.
+            outstandingMessage->response = responseType;
+            outstandingMessage->receivedResponse = true;
+
+            wakeup(outstandingMessage);
+
+            ++wokenCount;
+            if (wokenCount == messageIdCount)
+            {
+                // IDs in a batch are unique, so every message has been found
+                break;
+            }
+        }
+    }
+
+    return wokenCount;
+}
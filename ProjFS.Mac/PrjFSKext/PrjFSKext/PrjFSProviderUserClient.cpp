@@ -1,18 +1,28 @@
 #include "PrjFSProviderUserClient.hpp"
 #include "PrjFSCommon.h"
 #include "../public/PrjFSProviderClientShared.h"
+#include "../public/MessageRing.h"
 #include "Message.h"
 #include "KauthHandler.hpp"
+#include "KextLog.hpp"
+#include "OutstandingMessages.hpp"
 #include "VirtualizationRoots.hpp"
 
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/IOLib.h>
 #include <IOKit/IOSharedDataQueue.h>
+#include <kern/clock.h>
 #include <sys/proc.h>
 
 OSDefineMetaClassAndStructors(PrjFSProviderUserClient, IOUserClient);
 
 // Amount of memory to set aside for kernel -> userspace messages.
 // Should be chosen to comfortably hold "enough" Message structs and associated path strings.
-static const uint32_t ProviderMessageQueueCapacityBytes = 100 * 1024;
+// Must be a power of two.
+static const uint32_t ProviderMessageRingCapacityBytes = 128 * 1024;
+
+// The data queue only carries wakeups, of which there is at most one per wait by the provider
+static const uint32_t ProviderMessageQueueCapacityBytes = 4 * 1024;
 
 
 static const IOExternalMethodDispatch ProviderUserClientDispatch[] =
@@ -29,6 +39,14 @@ static const IOExternalMethodDispatch ProviderUserClientDispatch[] =
             .checkScalarOutputCount =   0,
             .checkStructureOutputSize = 0
         },
+    [ProviderSelector_KernelMessageResponses] =
+        {
+            .function =                 &PrjFSProviderUserClient::kernelMessageResponses,
+            .checkScalarInputCount =    1, // response type
+            .checkStructureInputSize =  kIOUCVariableStructureSize, // array of message ids
+            .checkScalarOutputCount =   0,
+            .checkStructureOutputSize = 0
+        },
 };
 
 bool PrjFSProviderUserClient::initWithTask(
@@ -63,6 +81,18 @@ bool PrjFSProviderUserClient::initWithTask(
         goto CleanupAndFail;
     }
     
+    this->messageRingMemory = IOBufferMemoryDescriptor::withOptions(
+        kIODirectionInOut | kIOMemoryKernelUserShared,
+        MessageRing_GetMemorySize(ProviderMessageRingCapacityBytes),
+        PAGE_SIZE);
+    if (nullptr == this->messageRingMemory)
+    {
+        goto CleanupAndFail;
+    }
+    
+    this->messageRing = MessageRing_Init(this->messageRingMemory->getBytesNoCopy(), ProviderMessageRingCapacityBytes);
+    MessageRing_InitProducer(&this->messageRingProducer, ProviderMessageRingCapacityBytes);
+    
     return true;
     
 CleanupAndFail:
@@ -71,6 +101,7 @@ CleanupAndFail:
         Mutex_FreeMemory(&this->dataQueueWriterMutex);
     }
     
+    OSSafeReleaseNULL(this->messageRingMemory);
     OSSafeReleaseNULL(this->dataQueueMemory);
     OSSafeReleaseNULL(this->dataQueue);
     return false;
@@ -78,6 +109,7 @@ CleanupAndFail:
 
 void PrjFSProviderUserClient::free()
 {
+    OSSafeReleaseNULL(this->messageRingMemory);
     OSSafeReleaseNULL(this->dataQueueMemory);
     OSSafeReleaseNULL(this->dataQueue);
     if (Mutex_IsValid(this->dataQueueWriterMutex))
@@ -123,6 +155,17 @@ IOReturn PrjFSProviderUserClient::clientMemoryForType(
             }
         }
         break;
+    case ProviderMemoryType_MessageRing:
+        {
+            IOMemoryDescriptor* ringMemory = this->messageRingMemory;
+            if (ringMemory != nullptr)
+            {
+                ringMemory->retain(); // Matched internally in IOUserClient
+                *memory = ringMemory;
+                return kIOReturnSuccess;
+            }
+        }
+        break;
     }
     
     return kIOReturnError;
@@ -186,6 +229,34 @@ IOReturn PrjFSProviderUserClient::kernelMessageResponse(uint64_t messageId, Mess
     return kIOReturnSuccess;
 }
 
+IOReturn PrjFSProviderUserClient::kernelMessageResponses(
+    OSObject* target,
+    void* reference,
+    IOExternalMethodArguments* arguments)
+{
+    // We don't support batches large enough to warrant a memory descriptor
+    uint32_t size = arguments->structureInputSize;
+    if (nullptr == arguments->structureInput ||
+        0 == size ||
+        0 != size % sizeof(uint64_t) ||
+        size / sizeof(uint64_t) > PrjFSMaxKernelMessageResponseBatch ||
+        !OutstandingMessages_IsValidResponseBatch(static_cast<const uint64_t*>(arguments->structureInput), size / sizeof(uint64_t)))
+    {
+        return kIOReturnBadArgument;
+    }
+    
+    return static_cast<PrjFSProviderUserClient*>(target)->kernelMessageResponses(
+        static_cast<const uint64_t*>(arguments->structureInput),
+        size / sizeof(uint64_t),
+        static_cast<MessageType>(arguments->scalarInput[0]));
+}
+
+IOReturn PrjFSProviderUserClient::kernelMessageResponses(const uint64_t* messageIds, uint32_t messageIdCount, MessageType responseType)
+{
+    KauthHandler_HandleKernelMessageResponses(messageIds, messageIdCount, responseType);
+    return kIOReturnSuccess;
+}
+
 IOReturn PrjFSProviderUserClient::registerVirtualizationRoot(
     OSObject* target,
     void* reference,
@@ -233,16 +304,58 @@ IOReturn PrjFSProviderUserClient::registerVirtualizationRoot(const char* rootPat
     return kIOReturnSuccess;
 }
 
-void PrjFSProviderUserClient::sendMessage(const void* message, uint32_t size)
+bool PrjFSProviderUserClient::sendMessage(const Message& message)
 {
-    Mutex_Acquire(this->dataQueueWriterMutex);
+    // Any number of kauth threads send messages at once, and only contend with each other when they reserve the
+    // same space in the ring. The message is written straight into it, and the provider reads it from there.
+    uint32_t pathSize = message.messageHeader->pathSizeBytes;
+    uint32_t messageSize = sizeof(*message.messageHeader) + pathSize;
+    if (MessageRing_GetRecordSize(messageSize) > ProviderMessageRingCapacityBytes / 2)
     {
-        // IOSharedDataQueue::enqueue() only reads (memcpy source), but doesn't take a const pointer for some reason
-        bool ok = this->dataQueue->enqueue(const_cast<void*>(message), size);
-        assert(ok);
-
-        // TODO: block here and try again when space has cleared if enqueueing fails
+        return false;
+    }
+    
+    uint64_t deadline;
+    clock_interval_to_deadline(ProviderMessageTimeoutSeconds, NSEC_PER_SEC, &deadline);
+    
+    uint64_t position;
+    uint8_t* messageMemory;
+    while (nullptr == (messageMemory = static_cast<uint8_t*>(MessageRing_Reserve(this->messageRing, &this->messageRingProducer, messageSize, &position))))
+    {
+        // The provider is behind; wait for it to release space rather than drop the message, unless it has stopped
+        // reading messages altogether
+        if (this->isInactive())
+        {
+            return false;
+        }
+        
+        if (mach_absolute_time() >= deadline)
+        {
+            KextLog_Error("PrjFSProviderUserClient::sendMessage: timed out waiting for space in the message ring of provider pid %d", this->pid);
+            return false;
+        }
+        
+        IOSleep(1);
     }
-    Mutex_Release(this->dataQueueWriterMutex);
+    
+    memcpy(messageMemory, message.messageHeader, sizeof(*message.messageHeader));
+    if (pathSize > 0)
+    {
+        memcpy(messageMemory + sizeof(*message.messageHeader), message.path, pathSize);
+    }
+    
+    if (MessageRing_Commit(this->messageRing, &this->messageRingProducer, position, messageSize))
+    {
+        // The provider is waiting on the data queue's notification port. Enqueueing only fails if the queue is
+        // full of wakeups the provider has not dequeued yet, in which case it is going to wake up anyway.
+        uint32_t wakeup = 0;
+        Mutex_Acquire(this->dataQueueWriterMutex);
+        {
+            this->dataQueue->enqueue(&wakeup, sizeof(wakeup));
+        }
+        Mutex_Release(this->dataQueueWriterMutex);
+    }
+    
+    return true;
 }
 
@@ -3,10 +3,12 @@
 #include "PrjFSClasses.hpp"
 #include "Locks.hpp"
 #include "Message.h"
+#include "../public/MessageRing.h"
 #include <IOKit/IOUserClient.h>
 
 struct MessageHeader;
 struct VirtualizationRoot;
+class IOBufferMemoryDescriptor;
 class IOSharedDataQueue;
 class PrjFSProviderUserClient : public IOUserClient
 {
@@ -16,6 +18,12 @@ private:
     IOSharedDataQueue* dataQueue;
     IOMemoryDescriptor* dataQueueMemory;
     Mutex dataQueueWriterMutex;
+    IOBufferMemoryDescriptor* messageRingMemory;
+    MessageRingHeader* messageRing;
+    
+    // The provider can write to the message ring's memory, so where kauth threads write messages is only worked
+    // out from this
+    MessageRingProducer messageRingProducer;
 public:
     pid_t pid;
     // The root for which this is the provider; -1 prior to registration
@@ -47,7 +55,8 @@ public:
     virtual void free() override;
 
 
-    void sendMessage(const void* message, uint32_t size);
+    // Returns false if the message could not be sent, because it is too large or the provider has gone away
+    bool sendMessage(const Message& message);
 
     // External methods:
     static IOReturn registerVirtualizationRoot(
@@ -61,4 +70,10 @@ public:
         void* reference,
         IOExternalMethodArguments* arguments);
     IOReturn kernelMessageResponse(uint64_t messageId, MessageType responseType);
+
+    static IOReturn kernelMessageResponses(
+        OSObject* target,
+        void* reference,
+        IOExternalMethodArguments* arguments);
+    IOReturn kernelMessageResponses(const uint64_t* messageIds, uint32_t messageIdCount, MessageType responseType);
 };
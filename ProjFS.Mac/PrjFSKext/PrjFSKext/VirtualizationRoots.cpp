@@ -326,17 +326,9 @@ errno_t ActiveProvider_SendMessage(int32_t rootIndex, const Message message)
     
     if (nullptr != userClient)
     {
-        uint32_t messageSize = sizeof(*message.messageHeader) + message.messageHeader->pathSizeBytes;
-        uint8_t messageMemory[messageSize];
-        memcpy(messageMemory, message.messageHeader, sizeof(*message.messageHeader));
-        if (message.messageHeader->pathSizeBytes > 0)
-        {
-            memcpy(messageMemory + sizeof(*message.messageHeader), message.path, message.messageHeader->pathSizeBytes);
-        }
-        
-        userClient->sendMessage(messageMemory, messageSize);
+        bool sent = userClient->sendMessage(message);
         userClient->release();
-        return 0;
+        return sent ? 0 : EIO;
     }
     else
     {
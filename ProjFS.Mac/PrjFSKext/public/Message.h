@@ -56,4 +56,7 @@ void Message_Init(
     const char* procname,
     const char* path);
 
+// Decomposes a message received from the kernel; aborts if the message is malformed. User mode only.
+Message ParseMessageMemory(const void* messageMemory, uint32_t size);
+
 #endif /* Message_h */
@@ -0,0 +1,231 @@
+#pragma once
+
+// A ring of variable sized messages in memory shared by the kext, which writes them from any number of kauth threads
+// at once, and the provider, which reads them.
+// A producer reserves space for a record by advancing reservedPosition with compare and swap, so producers never
+// wait for each other: a failed swap means another producer's reservation succeeded. reservedPosition and the
+// capacity that producers use are kept in a MessageRingProducer outside the shared memory, so that the consumer
+// can't change where the producers write. A producer then writes the record in
+// place and commits it by storing its size. The consumer handles committed records in place, in the order their
+// space was reserved, stopping at the first one that has not been committed yet. Once it has handled a batch it
+// zeroes their space, so that any offset can hold an uncommitted record header on the next pass, and releases it
+// to producers by advancing consumedPosition.
+// Positions count bytes from the start of the ring's first pass and are 64 bit, so they never wrap. Records are 8
+// byte aligned and never wrap either: one that does not fit before the end of the ring is preceded by a padding
+// record that fills the rest of it.
+// Only uses compiler atomic builtins, so the same code runs in the kext and in user space; see
+// PrjFSKext/Benchmarks/MessageRingBenchmark.cpp.
+
+#include <stdint.h>
+#include <string.h>
+
+struct MessageRingHeader
+{
+    // Written by the consumer, and by the producer that takes a notification
+    uint64_t consumedPosition;
+    uint32_t isConsumerWaiting;
+
+    // Power of two number of bytes of records, which follow the header. Only read by the consumer.
+    uint32_t capacity;
+    uint8_t  _padding[48];
+};
+
+// The producers' state, in memory that only they can write
+struct MessageRingProducer
+{
+    uint64_t reservedPosition;
+    uint32_t capacity;
+};
+
+struct MessageRingRecordHeader
+{
+    // Zero until the record is committed, then the size of the whole record including this header
+    uint32_t recordSize;
+
+    // Size of the data that follows, or MessageRingPaddingDataSize if the record only fills the end of the ring
+    uint32_t dataSize;
+};
+
+#define MessageRingPaddingDataSize UINT32_MAX
+
+inline size_t MessageRing_GetMemorySize(uint32_t capacity)
+{
+    return sizeof(MessageRingHeader) + capacity;
+}
+
+inline uint8_t* MessageRing_GetRecords(MessageRingHeader* ring)
+{
+    return reinterpret_cast<uint8_t*>(ring + 1);
+}
+
+inline uint32_t MessageRing_GetRecordSize(uint32_t dataSize)
+{
+    return sizeof(MessageRingRecordHeader) + ((dataSize + 7) & ~7U);
+}
+
+inline MessageRingRecordHeader* MessageRing_GetRecordHeader(MessageRingHeader* ring, uint32_t capacity, uint64_t position)
+{
+    return reinterpret_cast<MessageRingRecordHeader*>(MessageRing_GetRecords(ring) + (position & (capacity - 1)));
+}
+
+// Sets up a ring in memory of MessageRing_GetMemorySize(capacity) bytes, aligned to 8 bytes. capacity must be a
+// power of two. The ring starts out as if the consumer were waiting, so the first message notifies it.
+inline MessageRingHeader* MessageRing_Init(void* memory, uint32_t capacity)
+{
+    memset(memory, 0, MessageRing_GetMemorySize(capacity));
+    MessageRingHeader* ring = static_cast<MessageRingHeader*>(memory);
+    ring->capacity = capacity;
+    ring->isConsumerWaiting = 1;
+    return ring;
+}
+
+// Sets up the producers' state for a ring that MessageRing_Init set up with the same capacity
+inline void MessageRing_InitProducer(MessageRingProducer* producer, uint32_t capacity)
+{
+    producer->reservedPosition = 0;
+    producer->capacity = capacity;
+}
+
+// Reserves a record with dataSize bytes of data, which can be up to half the ring's capacity, and returns where to
+// write the data, or null if the ring is too full. The record must then be committed with
+// MessageRing_Commit(ring, producer, *outPosition, dataSize), without blocking in between, as the consumer cannot get
+// past it until it is.
+inline void* MessageRing_Reserve(MessageRingHeader* ring, MessageRingProducer* producer, uint32_t dataSize, uint64_t* outPosition)
+{
+    uint32_t capacity = producer->capacity;
+    uint32_t recordSize = MessageRing_GetRecordSize(dataSize);
+    if (recordSize > capacity / 2)
+    {
+        return nullptr;
+    }
+
+    uint64_t position = __atomic_load_n(&producer->reservedPosition, __ATOMIC_RELAXED);
+    uint32_t paddingSize;
+    while (true)
+    {
+        uint32_t offset = static_cast<uint32_t>(position & (capacity - 1));
+        paddingSize = capacity - offset < recordSize ? capacity - offset : 0;
+
+        // Acquire, so that the consumer has finished zeroing the space before it is written again. position may
+        // be older than consumedPosition, in which case the swap below fails.
+        uint64_t consumedPosition = __atomic_load_n(&ring->consumedPosition, __ATOMIC_ACQUIRE);
+
+        // The consumer can store anything in consumedPosition, but only a position between a ring's length behind
+        // position and position itself is taken into account
+        if (consumedPosition > position)
+        {
+            consumedPosition = position;
+        }
+        else if (position - consumedPosition > capacity)
+        {
+            consumedPosition = position - capacity;
+        }
+
+        if (position + paddingSize + recordSize > consumedPosition + capacity)
+        {
+            return nullptr;
+        }
+
+        if (__atomic_compare_exchange_n(
+                &producer->reservedPosition,
+                &position,
+                position + paddingSize + recordSize,
+                true, // weak
+                __ATOMIC_RELAXED,
+                __ATOMIC_RELAXED))
+        {
+            break;
+        }
+    }
+
+    if (0 != paddingSize)
+    {
+        MessageRingRecordHeader* padding = MessageRing_GetRecordHeader(ring, capacity, position);
+        padding->dataSize = MessageRingPaddingDataSize;
+        __atomic_store_n(&padding->recordSize, paddingSize, __ATOMIC_RELEASE);
+        position += paddingSize;
+    }
+
+    MessageRingRecordHeader* record = MessageRing_GetRecordHeader(ring, capacity, position);
+    record->dataSize = dataSize;
+    *outPosition = position;
+    return record + 1;
+}
+
+// Makes the record visible to the consumer. Returns true if the consumer is waiting and has to be notified; only
+// one of the producers that commit while it waits gets true.
+inline bool MessageRing_Commit(MessageRingHeader* ring, const MessageRingProducer* producer, uint64_t position, uint32_t dataSize)
+{
+    // dataSize is passed in rather than read back, as the consumer could have changed it in the meantime
+    MessageRingRecordHeader* record = MessageRing_GetRecordHeader(ring, producer->capacity, position);
+    __atomic_store_n(&record->recordSize, MessageRing_GetRecordSize(dataSize), __ATOMIC_RELEASE);
+
+    // Pairs with the fence in MessageRing_PrepareToWait: either the consumer sees this record before it waits, or
+    // this sees that it is waiting
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return
+        0 != __atomic_load_n(&ring->isConsumerWaiting, __ATOMIC_RELAXED) &&
+        0 != __atomic_exchange_n(&ring->isConsumerWaiting, 0, __ATOMIC_RELAXED);
+}
+
+// Calls handler(data, dataSize) for up to maxRecordCount committed records, from the oldest, with each record's data
+// still in the ring, then releases their space. Only one thread may consume at a time. Returns the number of records
+// handled, which can be zero even if padding was consumed.
+template <typename THandler>
+uint32_t MessageRing_Drain(MessageRingHeader* ring, uint32_t maxRecordCount, THandler handler)
+{
+    uint32_t capacity = ring->capacity;
+    uint64_t startPosition = __atomic_load_n(&ring->consumedPosition, __ATOMIC_RELAXED);
+    uint64_t position = startPosition;
+    uint32_t recordCount = 0;
+
+    // A full ring's records fill all of it, and the first of them is only zeroed once the batch is done
+    while (recordCount < maxRecordCount && position - startPosition < capacity)
+    {
+        MessageRingRecordHeader* record = MessageRing_GetRecordHeader(ring, capacity, position);
+        uint32_t recordSize = __atomic_load_n(&record->recordSize, __ATOMIC_ACQUIRE);
+        if (0 == recordSize)
+        {
+            break;
+        }
+
+        if (MessageRingPaddingDataSize != record->dataSize)
+        {
+            handler(static_cast<const void*>(record + 1), record->dataSize);
+            ++recordCount;
+        }
+
+        position += recordSize;
+    }
+
+    if (position != startPosition)
+    {
+        // Records never wrap, but a batch can
+        uint32_t startOffset = static_cast<uint32_t>(startPosition & (capacity - 1));
+        uint64_t size = position - startPosition;
+        if (startOffset + size > capacity)
+        {
+            memset(MessageRing_GetRecords(ring) + startOffset, 0, capacity - startOffset);
+            memset(MessageRing_GetRecords(ring), 0, startOffset + size - capacity);
+        }
+        else
+        {
+            memset(MessageRing_GetRecords(ring) + startOffset, 0, size);
+        }
+
+        __atomic_store_n(&ring->consumedPosition, position, __ATOMIC_RELEASE);
+    }
+
+    return recordCount;
+}
+
+// Called by the consumer when a drain found nothing to handle. Returns true if it can wait to be notified, or false
+// if a record was committed in the meantime and it has to drain again.
+inline bool MessageRing_PrepareToWait(MessageRingHeader* ring)
+{
+    __atomic_store_n(&ring->isConsumerWaiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    uint64_t position = __atomic_load_n(&ring->consumedPosition, __ATOMIC_RELAXED);
+    return 0 == __atomic_load_n(&MessageRing_GetRecordHeader(ring, ring->capacity, position)->recordSize, __ATOMIC_RELAXED);
+}
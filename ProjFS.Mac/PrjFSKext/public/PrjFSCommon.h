@@ -11,7 +11,7 @@
 #define PrjFSServiceClass       "io_gvfs_PrjFS"
 
 // TODO: move this to an autogenerated header.
-#define PrjFSKextVersion "0.1"
+#define PrjFSKextVersion "0.2"
 // Name of property on the main PrjFS IOService indicating the kext version, to be checked by user space
 #define PrjFSKextVersionKey "io.gvfs.PrjFSKext.Version"
 
@@ -7,13 +7,22 @@ enum PrjFSProviderUserClientSelector
     
     ProviderSelector_RegisterVirtualizationRootPath,
     ProviderSelector_KernelMessageResponse,
+    ProviderSelector_KernelMessageResponses,
 };
 
+// Most message IDs that can be passed to ProviderSelector_KernelMessageResponses at once. Larger batches
+// would not fit in the inline structure input and need a memory descriptor.
+#define PrjFSMaxKernelMessageResponseBatch (4096 / sizeof(uint64_t))
+
 enum PrjFSProviderUserClientMemoryType
 {
     ProviderMemoryType_Invalid = 0,
     
+    // Only wakes the provider when it is waiting for messages; see ProviderMemoryType_MessageRing
     ProviderMemoryType_MessageQueue,
+    
+    // A MessageRing holding the kernel -> provider messages themselves
+    ProviderMemoryType_MessageRing,
 };
 
 enum PrjFSProviderUserClientPortType
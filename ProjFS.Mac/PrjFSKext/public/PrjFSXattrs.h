@@ -11,6 +11,10 @@
 static const int32_t PlaceholderMagicNumber = 0x12345678;
 static const int32_t PlaceholderFormatVersion = 1;
 
+// File xattrs written as PrjFSFileXAttrData use PlaceholderFormatVersion. Version 2 is a header followed by
+// variable length IDs, see PrjFSLib/PlaceholderXAttr.hpp.
+static const int32_t PlaceholderFileFormatVersion2 = 2;
+
 struct PrjFSXattrHeader
 {
     int32_t magicNumber;
@@ -22,6 +26,7 @@ struct PrjFSVirtualizationRootXAttrData
     PrjFSXattrHeader header;
 };
 
+// The fixed size version 1 file xattr, also used in memory for IDs read from either version
 struct PrjFSFileXAttrData
 {
     PrjFSXattrHeader header;
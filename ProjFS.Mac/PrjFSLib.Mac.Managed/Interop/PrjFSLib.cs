@@ -32,10 +32,39 @@ namespace PrjFSLib.Mac.Interop
             ulong fileSize,
             ushort fileMode);
 
+        [DllImport(PrjFSLibPath, EntryPoint = "PrjFS_UpdatePlaceholderFileIfNeeded")]
+        public static extern Result UpdatePlaceholderFileIfNeeded(
+            string relativePath,
+            [MarshalAs(UnmanagedType.LPArray, SizeConst = PlaceholderIdLength)]
+            byte[] providerId,
+            [MarshalAs(UnmanagedType.LPArray, SizeConst = PlaceholderIdLength)]
+            byte[] contentId,
+            ulong fileSize,
+            UpdateType updateFlags,
+            ref UpdateFailureCause failureCause);
+
+        [DllImport(PrjFSLibPath, EntryPoint = "PrjFS_DeleteFile")]
+        public static extern Result DeleteFile(
+            string relativePath,
+            UpdateType updateFlags,
+            ref UpdateFailureCause failureCause);
+
         [DllImport(PrjFSLibPath, EntryPoint = "PrjFS_WriteFileContents")]
         public static extern Result WriteFileContents(
             IntPtr fileHandle,
             IntPtr bytes,
             uint byteCount);
+
+        [DllImport(PrjFSLibPath, EntryPoint = "PrjFS_WriteFileContentsFromFile")]
+        public static extern Result WriteFileContentsFromFile(
+            IntPtr fileHandle,
+            int sourceFileDescriptor,
+            ulong sourceOffset,
+            ulong byteCount);
+
+        [DllImport(PrjFSLibPath, EntryPoint = "PrjFS_CompleteCommand")]
+        public static extern Result CompleteCommand(
+            ulong commandId,
+            Result result);
     }
 }
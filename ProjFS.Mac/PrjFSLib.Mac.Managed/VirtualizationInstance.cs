@@ -62,12 +62,26 @@ namespace PrjFSLib.Mac
             }
         }
 
+        public virtual Result WriteFileContentsFromFile(
+            IntPtr fileHandle,
+            int sourceFileDescriptor,
+            ulong sourceOffset,
+            ulong byteCount)
+        {
+            return Interop.PrjFSLib.WriteFileContentsFromFile(
+                fileHandle,
+                sourceFileDescriptor,
+                sourceOffset,
+                byteCount);
+        }
+
         public virtual Result DeleteFile(
             string relativePath,
             UpdateType updateFlags,
             out UpdateFailureCause failureCause)
         {
-            throw new NotImplementedException();
+            failureCause = UpdateFailureCause.NoFailure;
+            return Interop.PrjFSLib.DeleteFile(relativePath, updateFlags, ref failureCause);
         }
 
         public virtual Result WritePlaceholderDirectory(
@@ -105,14 +119,27 @@ namespace PrjFSLib.Mac
             UpdateType updateFlags,
             out UpdateFailureCause failureCause)
         {
-            throw new NotImplementedException();
+            if (providerId.Length != Interop.PrjFSLib.PlaceholderIdLength ||
+                contentId.Length != Interop.PrjFSLib.PlaceholderIdLength)
+            {
+                throw new ArgumentException();
+            }
+
+            failureCause = UpdateFailureCause.NoFailure;
+            return Interop.PrjFSLib.UpdatePlaceholderFileIfNeeded(
+                relativePath,
+                providerId,
+                contentId,
+                fileSize,
+                updateFlags,
+                ref failureCause);
         }
 
         public virtual Result CompleteCommand(
             ulong commandId,
             Result result)
         {
-            throw new NotImplementedException();
+            return Interop.PrjFSLib.CompleteCommand(commandId, result);
         }
 
         public virtual Result ConvertDirectoryToPlaceholder(
@@ -0,0 +1,334 @@
+// Finds the on disk state of every file in a tree of 1M files, spread over 1000 directories three levels deep, the
+// way a status check or placeholder list rebuild does. Most files are placeholders, some hydrated, and a few full;
+// every tenth directory also has a placeholder subdirectory that has not been enumerated.
+// The tree is walked by full path, calling FileStateScanner_GetFileState once per path as one
+// PrjFS_GetOnDiskFileState call per file would, and scanned with FileStateScanner_Scan on different numbers of
+// threads. Pass a different file count as the first argument.
+// Only uses portable code, so it also runs on Linux, where PlaceholderWriter keeps file flags in an xattr; see
+// Scripts/RunBenchmarks.sh.
+
+#include "../FileStateScanner.hpp"
+#include "../PlaceholderWriter.hpp"
+#include "../PlaceholderXAttr.hpp"
+#include "../StagedDirectory.hpp"
+#include "PrjFSKext/public/PrjFSCommon.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+static const unsigned DirectoriesPerLevel = 10;
+static const unsigned LeafDirectoryCount = DirectoriesPerLevel * DirectoriesPerLevel * DirectoriesPerLevel;
+static const unsigned FullInterval = 20;
+static const unsigned HydratedPerFullInterval = 3;
+static const unsigned UnenumeratedDirectoryInterval = 10;
+
+#ifdef __APPLE__
+static const char* const FileXAttrName = PrjFSFileXAttrName;
+#else
+static const char* const FileXAttrName = "user." PrjFSFileXAttrName;
+#endif
+
+static void Fail(const char* operation, const std::string& path, int error)
+{
+    fprintf(stderr, "%s failed for %s: %s\n", operation, path.c_str(), strerror(error));
+    exit(1);
+}
+
+static void SetFileFlags(int fd, const std::string& path, uint32_t fileFlags)
+{
+#ifdef __APPLE__
+    if (fchflags(fd, fileFlags))
+#else
+    if (fsetxattr(fd, PlaceholderWriter_FileFlagsXAttrName, &fileFlags, sizeof(fileFlags), 0))
+#endif
+    {
+        Fail("setting file flags", path, errno);
+    }
+}
+
+static void SetFileXAttr(int fd, const std::string& path, unsigned index)
+{
+    unsigned char providerId[PrjFS_PlaceholderIdLength] = { 1 };
+    unsigned char contentId[PrjFS_PlaceholderIdLength] = {};
+    char sha[41];
+    snprintf(sha, sizeof(sha), "%040X", index);
+    for (int i = 0; i < 40; ++i)
+    {
+        contentId[2 * i] = sha[i];
+    }
+
+    unsigned char xattr[PlaceholderXAttrMaxSize];
+    size_t xattrSize = PlaceholderXAttr_Encode(providerId, contentId, xattr);
+#ifdef __APPLE__
+    if (fsetxattr(fd, FileXAttrName, xattr, xattrSize, 0, 0))
+#else
+    if (fsetxattr(fd, FileXAttrName, xattr, xattrSize, 0))
+#endif
+    {
+        Fail("fsetxattr", path, errno);
+    }
+}
+
+static void MakeDirectory(const std::string& path, uint32_t fileFlags)
+{
+    if (mkdir(path.c_str(), 0777))
+    {
+        Fail("mkdir", path, errno);
+    }
+
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+    {
+        Fail("open", path, errno);
+    }
+
+    SetFileFlags(fd, path, fileFlags);
+    close(fd);
+}
+
+// Returns the counts the scan should find
+static PrjFS_FileStateCounts CreateTree(const std::string& root, unsigned fileCount)
+{
+    PrjFS_FileStateCounts expected = {};
+    unsigned filesPerDirectory = (fileCount + LeafDirectoryCount - 1) / LeafDirectoryCount;
+    unsigned fileIndex = 0;
+    for (unsigned i = 0; i < LeafDirectoryCount && fileIndex < fileCount; ++i)
+    {
+        std::string parent = root;
+        for (unsigned level = DirectoriesPerLevel * DirectoriesPerLevel; level > 0; level /= DirectoriesPerLevel)
+        {
+            parent += "/directory" + std::to_string(i / level % DirectoriesPerLevel);
+            if (0 == i % level)
+            {
+                MakeDirectory(parent, FileFlags_IsInVirtualizationRoot);
+                ++expected.hydratedPlaceholderDirectoryCount;
+            }
+        }
+
+        if (0 == i % UnenumeratedDirectoryInterval)
+        {
+            MakeDirectory(parent + "/unenumerated", FileFlags_IsInVirtualizationRoot | FileFlags_IsEmpty);
+            ++expected.placeholderDirectoryCount;
+        }
+
+        for (unsigned j = 0; j < filesPerDirectory && fileIndex < fileCount; ++j, ++fileIndex)
+        {
+            std::string path = parent + "/file" + std::to_string(fileIndex) + ".cpp";
+            int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+            if (fd < 0)
+            {
+                Fail("open", path, errno);
+            }
+
+            unsigned kind = fileIndex % FullInterval;
+            if (0 == kind)
+            {
+                ++expected.fullFileCount;
+            }
+            else if (kind <= HydratedPerFullInterval)
+            {
+                SetFileFlags(fd, path, FileFlags_IsInVirtualizationRoot);
+                SetFileXAttr(fd, path, fileIndex);
+                ++expected.hydratedPlaceholderFileCount;
+            }
+            else
+            {
+                SetFileFlags(fd, path, FileFlags_IsInVirtualizationRoot | FileFlags_IsEmpty);
+                SetFileXAttr(fd, path, fileIndex);
+                ++expected.placeholderFileCount;
+            }
+
+            close(fd);
+        }
+    }
+
+    // Left behind by an interrupted directory expansion or placeholder update, and not part of the tree
+    MakeDirectory(root + "/" + StagedDirectory_NamePrefix + "directory0", FileFlags_IsInVirtualizationRoot);
+    std::string updatePath = root + "/directory0/" + PlaceholderWriter_UpdateNamePrefix + "file0.cpp";
+    int fd = open(updatePath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+    {
+        Fail("open", updatePath, errno);
+    }
+
+    close(fd);
+
+    // Only those exact prefixes are skipped
+    std::string otherPath = root + "/.prjfs-other";
+    fd = open(otherPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+    {
+        Fail("open", otherPath, errno);
+    }
+
+    close(fd);
+    ++expected.fullFileCount;
+
+    return expected;
+}
+
+static bool IsLeftBehindByPrjFSLib(const char* name)
+{
+    return
+        0 == strncmp(name, StagedDirectory_NamePrefix, strlen(StagedDirectory_NamePrefix)) ||
+        0 == strncmp(name, PlaceholderWriter_UpdateNamePrefix, strlen(PlaceholderWriter_UpdateNamePrefix));
+}
+
+static void AddFileState(PrjFS_FileStateCounts& counts, bool isDirectory, PrjFS_FileState fileState)
+{
+    switch (fileState)
+    {
+        case PrjFS_FileState_Placeholder:
+            ++(isDirectory ? counts.placeholderDirectoryCount : counts.placeholderFileCount);
+            break;
+        case PrjFS_FileState_HydratedPlaceholder:
+            ++(isDirectory ? counts.hydratedPlaceholderDirectoryCount : counts.hydratedPlaceholderFileCount);
+            break;
+        default:
+            ++(isDirectory ? counts.fullDirectoryCount : counts.fullFileCount);
+            break;
+    }
+}
+
+static void WalkByPath(const std::string& directoryPath, PrjFS_FileStateCounts& counts)
+{
+    DIR* directory = opendir(directoryPath.c_str());
+    if (nullptr == directory)
+    {
+        Fail("opendir", directoryPath, errno);
+    }
+
+    while (dirent* entry = readdir(directory))
+    {
+        if (0 == strcmp(entry->d_name, ".") || 0 == strcmp(entry->d_name, "..") || IsLeftBehindByPrjFSLib(entry->d_name))
+        {
+            continue;
+        }
+
+        std::string path = directoryPath + "/" + entry->d_name;
+        PrjFS_FileState fileState;
+        int error = FileStateScanner_GetFileState(AT_FDCWD, path.c_str(), &fileState);
+        if (0 != error)
+        {
+            Fail("FileStateScanner_GetFileState", path, error);
+        }
+
+        bool isDirectory = DT_DIR == entry->d_type;
+        AddFileState(counts, isDirectory, fileState);
+        if (isDirectory && PrjFS_FileState_Placeholder != fileState)
+        {
+            WalkByPath(path, counts);
+        }
+    }
+
+    closedir(directory);
+}
+
+static void CountReported(void* context, const char* /* relativePath */, bool /* isDirectory */, PrjFS_FileState /* fileState */)
+{
+    ++*static_cast<unsigned long long*>(context);
+}
+
+static void RunBenchmark(const std::string& root, const PrjFS_FileStateCounts& expected, unsigned threadCount)
+{
+    PrjFS_FileStateCounts counts = {};
+    unsigned long long reportedCount = 0;
+
+    Clock::time_point start = Clock::now();
+    if (0 == threadCount)
+    {
+        WalkByPath(root, counts);
+    }
+    else
+    {
+        int error = FileStateScanner_Scan(root.c_str(), "", threadCount, &counts, CountReported, &reportedCount);
+        if (0 != error)
+        {
+            Fail("FileStateScanner_Scan", root, error);
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    unsigned long long expectedReportedCount =
+        expected.hydratedPlaceholderFileCount +
+        expected.fullFileCount +
+        expected.hydratedPlaceholderDirectoryCount +
+        expected.fullDirectoryCount;
+    if (0 != memcmp(&expected, &counts, sizeof(counts)) || (0 != threadCount && expectedReportedCount != reportedCount))
+    {
+        fprintf(
+            stderr,
+            "Wrong counts: files %llu/%llu/%llu, directories %llu/%llu/%llu, %llu reported\n",
+            counts.placeholderFileCount,
+            counts.hydratedPlaceholderFileCount,
+            counts.fullFileCount,
+            counts.placeholderDirectoryCount,
+            counts.hydratedPlaceholderDirectoryCount,
+            counts.fullDirectoryCount,
+            reportedCount);
+        exit(1);
+    }
+
+    char description[32];
+    if (0 == threadCount)
+    {
+        snprintf(description, sizeof(description), "by path");
+    }
+    else
+    {
+        snprintf(description, sizeof(description), "scan, %u thread%s", threadCount, threadCount > 1 ? "s" : "");
+    }
+
+    unsigned long long fileCount = counts.placeholderFileCount + counts.hydratedPlaceholderFileCount + counts.fullFileCount;
+    printf(
+        "%-17s %8llu files in %8.1f ms  %6.2f us per file\n",
+        description,
+        fileCount,
+        seconds * 1000,
+        seconds * 1000000 / fileCount);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned fileCount = argc > 1 ? static_cast<unsigned>(strtoul(argv[1], nullptr, 10)) : 1000000;
+
+    const char* tempDirectory = getenv("TMPDIR");
+    std::string root = std::string(nullptr != tempDirectory ? tempDirectory : "/tmp") + "/FileStateScanBenchmarkXXXXXX";
+    if (nullptr == mkdtemp(&root[0]))
+    {
+        Fail("mkdtemp", root, errno);
+    }
+
+    Clock::time_point start = Clock::now();
+    PrjFS_FileStateCounts expected = CreateTree(root, fileCount);
+    printf(
+        "created %u files and %llu directories in %.1f s\n",
+        fileCount,
+        expected.placeholderDirectoryCount + expected.hydratedPlaceholderDirectoryCount,
+        std::chrono::duration<double>(Clock::now() - start).count());
+
+    const unsigned threadCounts[] = { 0, 1, 2, 4, 8 };
+    for (unsigned threadCount : threadCounts)
+    {
+        RunBenchmark(root, expected, threadCount);
+    }
+
+    int error = StagedDirectory_Remove(root.c_str());
+    if (0 != error)
+    {
+        Fail("StagedDirectory_Remove", root, error);
+    }
+
+    return 0;
+}
@@ -0,0 +1,287 @@
+// Measures hydration throughput for small, medium and large files. Each file starts as an empty placeholder of
+// its final size, like the ones PrjFS_WritePlaceholderFile creates, and is filled in the way a provider does:
+//  - stdio: fopen/fwrite in 4 KB chunks, which PrjFSLib used before
+//  - fd: preallocate, then positional writes in 4 KB chunks (PrjFS_WriteFileContents)
+//  - copy: preallocate, then copy a byte range of a source file (PrjFS_WriteFileContentsFromFile)
+// Only uses portable code, so it also runs on Linux; see Scripts/RunBenchmarks.sh.
+
+#include "../HydrationFile.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+// The chunk size GVFS and MirrorProvider use to copy blobs into PrjFS_WriteFileContents
+static const size_t ProviderChunkSize = 4096;
+
+// Offset of each file's contents in the source file, so that copies do not start on a page boundary
+static const off_t SourceOffset = 100;
+
+enum HydrationMode
+{
+    HydrationMode_Stdio,
+    HydrationMode_Fd,
+    HydrationMode_Copy,
+};
+
+static const char* const HydrationModeNames[] = { "stdio", "fd", "copy" };
+
+static void Fail(const char* operation, const std::string& path)
+{
+    fprintf(stderr, "%s failed for %s: %s\n", operation, path.c_str(), strerror(errno));
+    exit(1);
+}
+
+static void CreatePlaceholder(const std::string& path, off_t size)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size) || close(fd))
+    {
+        Fail("creating placeholder", path);
+    }
+}
+
+static void HydrateWithStdio(const std::string& path, const std::vector<char>& contents)
+{
+    FILE* file = fopen(path.c_str(), "rb+");
+    if (nullptr == file || fseek(file, 0, 0))
+    {
+        Fail("fopen", path);
+    }
+
+    for (size_t offset = 0; offset < contents.size(); offset += ProviderChunkSize)
+    {
+        size_t chunkSize = std::min(ProviderChunkSize, contents.size() - offset);
+        if (chunkSize != fwrite(contents.data() + offset, 1, chunkSize, file))
+        {
+            Fail("fwrite", path);
+        }
+    }
+
+    if (fclose(file))
+    {
+        Fail("fclose", path);
+    }
+}
+
+static void HydrateWithFd(const std::string& path, const std::vector<char>& contents, int sourceFd, HydrationMode mode)
+{
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    struct stat fileAttributes;
+    if (fd < 0 || fstat(fd, &fileAttributes))
+    {
+        Fail("open", path);
+    }
+
+    HydrationFile_Preallocate(fd, fileAttributes.st_size);
+
+    if (HydrationMode_Copy == mode)
+    {
+        errno = HydrationFile_CopyFrom(fd, 0, sourceFd, SourceOffset, contents.size());
+        if (0 != errno)
+        {
+            Fail("HydrationFile_CopyFrom", path);
+        }
+    }
+    else
+    {
+        for (size_t offset = 0; offset < contents.size(); offset += ProviderChunkSize)
+        {
+            size_t chunkSize = std::min(ProviderChunkSize, contents.size() - offset);
+            errno = HydrationFile_Write(fd, contents.data() + offset, chunkSize, offset);
+            if (0 != errno)
+            {
+                Fail("HydrationFile_Write", path);
+            }
+        }
+    }
+
+    if (close(fd))
+    {
+        Fail("close", path);
+    }
+}
+
+static void VerifyContents(const std::string& path, const std::vector<char>& contents)
+{
+    std::vector<char> actual(contents.size() + 1);
+    FILE* file = fopen(path.c_str(), "rb");
+    if (nullptr == file)
+    {
+        Fail("verifying", path);
+    }
+
+    size_t bytesRead = fread(actual.data(), 1, actual.size(), file);
+    fclose(file);
+    if (bytesRead != contents.size() || 0 != memcmp(actual.data(), contents.data(), contents.size()))
+    {
+        fprintf(stderr, "%s has the wrong contents after hydration\n", path.c_str());
+        exit(1);
+    }
+}
+
+// Providers may stream contents from a pipe, which can't be mapped or read with pread, and a source that is shorter
+// than the requested range must fail the copy rather than crash the provider
+static void CheckCopyFromUnusualSources(const std::string& directory)
+{
+    std::vector<char> contents(3 * 1024 * 1024 + 123);
+    for (size_t i = 0; i < contents.size(); ++i)
+    {
+        contents[i] = static_cast<char>(i * 7 + i / 1000);
+    }
+
+    std::string path = directory + "/unusual";
+    CreatePlaceholder(path, contents.size());
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    int pipeFds[2];
+    if (fd < 0 || pipe(pipeFds))
+    {
+        Fail("opening", path);
+    }
+
+    std::thread writer(
+        [&contents, &pipeFds]()
+        {
+            size_t offset = 0;
+            while (offset < contents.size())
+            {
+                ssize_t written = write(pipeFds[1], contents.data() + offset, contents.size() - offset);
+                if (written < 0 && EINTR != errno)
+                {
+                    break;
+                }
+
+                offset += written > 0 ? written : 0;
+            }
+
+            close(pipeFds[1]);
+        });
+
+    errno = HydrationFile_CopyFrom(fd, 0, pipeFds[0], 0, contents.size());
+    writer.join();
+    if (0 != errno)
+    {
+        Fail("HydrationFile_CopyFrom from a pipe", path);
+    }
+
+    VerifyContents(path, contents);
+
+    // The pipe is now empty and closed, so it ends before the requested range
+    if (EIO != HydrationFile_CopyFrom(fd, 0, pipeFds[0], 0, 1) ||
+        ESPIPE != HydrationFile_CopyFrom(fd, 0, pipeFds[0], 1, 1))
+    {
+        fprintf(stderr, "HydrationFile_CopyFrom did not fail for a pipe that ends early or an offset in a pipe\n");
+        exit(1);
+    }
+
+    close(pipeFds[0]);
+
+    std::string sourcePath = directory + "/short-source";
+    int sourceFd = open(sourcePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (sourceFd < 0 || 0 != HydrationFile_Write(sourceFd, contents.data(), 100, 0))
+    {
+        Fail("writing source", sourcePath);
+    }
+
+    if (EIO != HydrationFile_CopyFrom(fd, 0, sourceFd, 0, 2 * 1024 * 1024) ||
+        EIO != HydrationFile_CopyFrom(fd, 0, sourceFd, 50, 51))
+    {
+        fprintf(stderr, "HydrationFile_CopyFrom did not fail for a source shorter than the range\n");
+        exit(1);
+    }
+
+    close(sourceFd);
+    close(fd);
+    unlink(sourcePath.c_str());
+    unlink(path.c_str());
+
+    printf("HydrationFile_CopyFrom checks passed\n");
+}
+
+static void RunBenchmark(const std::string& directory, size_t fileSize, unsigned fileCount)
+{
+    std::vector<char> contents(fileSize);
+    for (size_t i = 0; i < fileSize; ++i)
+    {
+        contents[i] = static_cast<char>(i * 31 + i / 4096);
+    }
+
+    std::string sourcePath = directory + "/source";
+    int sourceFd = open(sourcePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (sourceFd < 0 ||
+        0 != HydrationFile_Write(sourceFd, contents.data(), contents.size(), SourceOffset))
+    {
+        Fail("writing source", sourcePath);
+    }
+
+    for (HydrationMode mode : { HydrationMode_Stdio, HydrationMode_Fd, HydrationMode_Copy })
+    {
+        std::vector<std::string> paths;
+        for (unsigned i = 0; i < fileCount; ++i)
+        {
+            paths.push_back(directory + "/file" + std::to_string(i));
+            CreatePlaceholder(paths.back(), fileSize);
+        }
+
+        Clock::time_point start = Clock::now();
+        for (const std::string& path : paths)
+        {
+            if (HydrationMode_Stdio == mode)
+            {
+                HydrateWithStdio(path, contents);
+            }
+            else
+            {
+                HydrateWithFd(path, contents, sourceFd, mode);
+            }
+        }
+
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        for (const std::string& path : paths)
+        {
+            VerifyContents(path, contents);
+            unlink(path.c_str());
+        }
+
+        printf(
+            "%9zu byte files x %5u  %-6s %8.1f MB/s  %9.1f us per file\n",
+            fileSize,
+            fileCount,
+            HydrationModeNames[mode],
+            fileSize * static_cast<double>(fileCount) / seconds / (1024 * 1024),
+            seconds * 1000000 / fileCount);
+    }
+
+    close(sourceFd);
+    unlink(sourcePath.c_str());
+}
+
+int main()
+{
+    const char* tempDirectory = getenv("TMPDIR");
+    std::string directoryTemplate = std::string(nullptr != tempDirectory ? tempDirectory : "/tmp") + "/HydrationWriteBenchmarkXXXXXX";
+    if (nullptr == mkdtemp(&directoryTemplate[0]))
+    {
+        Fail("mkdtemp", directoryTemplate);
+    }
+
+    CheckCopyFromUnusualSources(directoryTemplate);
+
+    RunBenchmark(directoryTemplate, 4 * 1024, 5000);
+    RunBenchmark(directoryTemplate, 1024 * 1024, 200);
+    RunBenchmark(directoryTemplate, 100 * 1024 * 1024, 3);
+
+    rmdir(directoryTemplate.c_str());
+    return 0;
+}
@@ -0,0 +1,209 @@
+// Replays synthetic kernel messages through the steps PrjFSLib takes for each one: copying it out of the kernel
+// queue into a message buffer, parsing it, coalescing it with pending requests for the same path, handing it to
+// a request handling thread, and releasing the buffer once the request is complete. Compares buffers from a
+// MessageBufferPool with malloc/free, which PrjFSLib used before.
+// Only uses portable code, so it also runs on Linux; see Scripts/RunBenchmarks.sh.
+
+#include "../MessageBufferPool.hpp"
+#include "../PendingRequestMap.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static const size_t MessageCount = 1000000;
+static const size_t PathCount = 4096;
+static const unsigned HandlerThreadCount = 8;
+
+// Requests that can be queued for or running on the handler threads at once, like the kernel threads that
+// block until their request is responded to
+static const size_t MaxRequestsInFlight = 1024;
+
+struct QueuedRequest
+{
+    Message message;
+    void* messageMemory;
+};
+
+// Bounded FIFO from the dispatch thread to the handler threads that does not allocate
+class RequestQueue
+{
+public:
+    void Push(const QueuedRequest& request)
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->notFull.wait(lock, [this] { return this->count < MaxRequestsInFlight; });
+        this->requests[(this->first + this->count) % MaxRequestsInFlight] = request;
+        ++this->count;
+        this->notEmpty.notify_one();
+    }
+
+    bool Pop(QueuedRequest* request)
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->notEmpty.wait(lock, [this] { return this->count > 0 || this->closed; });
+        if (0 == this->count)
+        {
+            return false;
+        }
+
+        *request = this->requests[this->first];
+        this->first = (this->first + 1) % MaxRequestsInFlight;
+        --this->count;
+        this->notFull.notify_one();
+        return true;
+    }
+
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->closed = true;
+        this->notEmpty.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    QueuedRequest requests[MaxRequestsInFlight];
+    size_t first = 0;
+    size_t count = 0;
+    bool closed = false;
+};
+
+class HeapMessageBuffers
+{
+public:
+    void* Allocate(uint32_t size) { return malloc(size); }
+    void Free(void* buffer) { free(buffer); }
+};
+
+static std::vector<std::vector<char>> s_serializedMessages;
+
+static void CreateMessages()
+{
+    for (size_t i = 0; i < PathCount; ++i)
+    {
+        char path[PrjFSMaxPath];
+        int pathLength = snprintf(path, sizeof(path), "src/component%zu/subdirectory%zu/file%zu.cpp", i % 97, i % 13, i);
+
+        MessageHeader header = {};
+        header.messageId = i;
+        header.messageType = (i % 4 == 0) ? MessageType_KtoU_EnumerateDirectory : MessageType_KtoU_HydrateFile;
+        header.pid = 1000;
+        strncpy(header.procname, "benchmark", sizeof(header.procname) - 1);
+        header.pathSizeBytes = pathLength + 1;
+
+        std::vector<char> serialized(sizeof(header) + header.pathSizeBytes);
+        memcpy(serialized.data(), &header, sizeof(header));
+        memcpy(serialized.data() + sizeof(header), path, header.pathSizeBytes);
+        s_serializedMessages.push_back(serialized);
+    }
+}
+
+template <typename TBuffers>
+static void RunBenchmark(const char* name, TBuffers& buffers)
+{
+    PendingRequestMap pendingRequests;
+    RequestQueue queue;
+    std::vector<std::thread> handlerThreads;
+    std::vector<uint64_t> responseCounts(HandlerThreadCount);
+    uint64_t coalescedCount = 0;
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    for (unsigned i = 0; i < HandlerThreadCount; ++i)
+    {
+        handlerThreads.emplace_back(
+            [&, i]()
+            {
+                MessageIdList messageIds;
+                QueuedRequest request;
+                while (queue.Pop(&request))
+                {
+                    if (!pendingRequests.TryRemove(request.message.path, &messageIds))
+                    {
+                        abort();
+                    }
+
+                    responseCounts[i] += messageIds.Count();
+                    buffers.Free(request.messageMemory);
+                }
+            });
+    }
+
+    uint64_t random = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < MessageCount; ++i)
+    {
+        // Skewed towards a few paths, as when many threads read the same files
+        random ^= random << 13;
+        random ^= random >> 7;
+        random ^= random << 17;
+        size_t pathIndex = (random % 8 == 0) ? (random >> 8) % 16 : (random >> 8) % PathCount;
+        const std::vector<char>& serialized = s_serializedMessages[pathIndex];
+
+        // Dequeue
+        uint32_t messageSize = static_cast<uint32_t>(serialized.size());
+        void* messageMemory = buffers.Allocate(messageSize);
+        memcpy(messageMemory, serialized.data(), messageSize);
+        static_cast<MessageHeader*>(messageMemory)->messageId = i;
+
+        // Parse and dispatch
+        Message message = ParseMessageMemory(messageMemory, messageSize);
+        if (!pendingRequests.TryInsert(message.path, message.messageHeader->messageId))
+        {
+            ++coalescedCount;
+            buffers.Free(messageMemory);
+            continue;
+        }
+
+        queue.Push(QueuedRequest { message, messageMemory });
+    }
+
+    queue.Close();
+    for (std::thread& thread : handlerThreads)
+    {
+        thread.join();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    uint64_t responseCount = 0;
+    for (uint64_t count : responseCounts)
+    {
+        responseCount += count;
+    }
+
+    // Every message must be responded to exactly once
+    if (responseCount != MessageCount)
+    {
+        fprintf(stderr, "%s: %zu messages but %llu responses\n", name, MessageCount, (unsigned long long)responseCount);
+        exit(1);
+    }
+
+    printf(
+        "%-18s %zu messages  %7.1f ns/message  %5.1f%% coalesced",
+        name,
+        MessageCount,
+        seconds * 1e9 / MessageCount,
+        100.0 * coalescedCount / MessageCount);
+}
+
+int main()
+{
+    CreateMessages();
+
+    HeapMessageBuffers heapBuffers;
+    RunBenchmark("malloc/free", heapBuffers);
+    printf("\n");
+
+    MessageBufferPool pool(MaxRequestsInFlight);
+    RunBenchmark("MessageBufferPool", pool);
+    printf("  %llu pool hits, %llu misses\n", (unsigned long long)pool.HitCount(), (unsigned long long)pool.MissCount());
+
+    return 0;
+}
@@ -0,0 +1,198 @@
+// Compares PendingRequestMap with the global mutex + unordered_map<string, set<uint64_t>> that PrjFSLib used
+// before, with 1 to 64 threads inserting, coalescing and completing requests for a shared set of paths.
+// Only uses portable code, so it also runs on Linux; see Scripts/RunBenchmarks.sh.
+
+#include "../PendingRequestMap.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using std::string;
+
+class LegacyPendingRequestMap
+{
+public:
+    bool TryInsert(const char* path, uint64_t messageId)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto found = this->messageIds.find(path);
+        if (found == this->messageIds.end())
+        {
+            this->messageIds.insert(std::make_pair(string(path), std::set<uint64_t>{ messageId }));
+            return true;
+        }
+
+        found->second.insert(messageId);
+        return false;
+    }
+
+    bool TryRemove(const char* path, std::set<uint64_t>* outMessageIds)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto found = this->messageIds.find(path);
+        if (found == this->messageIds.end())
+        {
+            return false;
+        }
+
+        *outMessageIds = std::move(found->second);
+        this->messageIds.erase(found);
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::unordered_map<string, std::set<uint64_t>> messageIds;
+};
+
+static const size_t PathCount = 16384;
+static const size_t OperationsPerThread = 200000;
+
+// Number of paths each thread has a handler "running" for before it completes the oldest one
+static const size_t HandlersPerThread = 8;
+
+static std::vector<string> s_paths;
+static PendingRequestMap s_pendingRequestMap;
+static LegacyPendingRequestMap s_legacyMap;
+
+struct ThreadResult
+{
+    uint64_t inserted;
+    uint64_t coalesced;
+    uint64_t responded;
+};
+
+template <typename TMap, typename TMessageIds>
+static void RunThread(TMap& map, unsigned threadIndex, std::atomic<bool>* start, ThreadResult* result)
+{
+    TMessageIds messageIds;
+    const char* handling[HandlersPerThread];
+    size_t handlingCount = 0;
+    size_t nextToComplete = 0;
+    uint64_t random = 0x9E3779B97F4A7C15ULL * (threadIndex + 1);
+    *result = ThreadResult();
+
+    while (!start->load())
+    {
+    }
+
+    for (size_t i = 0; i < OperationsPerThread; ++i)
+    {
+        // xorshift64
+        random ^= random << 13;
+        random ^= random >> 7;
+        random ^= random << 17;
+
+        const char* path = s_paths[random % PathCount].c_str();
+        uint64_t messageId = (static_cast<uint64_t>(threadIndex) << 40) | i;
+        if (!map.TryInsert(path, messageId))
+        {
+            ++result->coalesced;
+            continue;
+        }
+
+        ++result->inserted;
+        if (handlingCount < HandlersPerThread)
+        {
+            handling[handlingCount] = path;
+            ++handlingCount;
+            continue;
+        }
+
+        if (!map.TryRemove(handling[nextToComplete], &messageIds))
+        {
+            abort();
+        }
+
+        result->responded += messageIds.size();
+        handling[nextToComplete] = path;
+        nextToComplete = (nextToComplete + 1) % HandlersPerThread;
+    }
+
+    for (size_t i = 0; i < handlingCount; ++i)
+    {
+        if (!map.TryRemove(handling[i], &messageIds))
+        {
+            abort();
+        }
+
+        result->responded += messageIds.size();
+    }
+}
+
+// Adapts MessageIdList to the size() used for the legacy std::set
+struct MessageIdListWithSize : MessageIdList
+{
+    size_t size() const { return this->Count(); }
+};
+
+template <typename TMap, typename TMessageIds>
+static void RunBenchmark(const char* name, TMap& map, unsigned threadCount)
+{
+    std::vector<std::thread> threads;
+    std::vector<ThreadResult> results(threadCount);
+    std::atomic<bool> start(false);
+    for (unsigned i = 0; i < threadCount; ++i)
+    {
+        threads.emplace_back(RunThread<TMap, TMessageIds>, std::ref(map), i, &start, &results[i]);
+    }
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    start = true;
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    ThreadResult total = ThreadResult();
+    for (const ThreadResult& result : results)
+    {
+        total.inserted += result.inserted;
+        total.coalesced += result.coalesced;
+        total.responded += result.responded;
+    }
+
+    // Every request must be responded to exactly once
+    if (total.responded != total.inserted + total.coalesced)
+    {
+        fprintf(stderr, "%s: %llu requests but %llu responses\n", name, (unsigned long long)(total.inserted + total.coalesced), (unsigned long long)total.responded);
+        exit(1);
+    }
+
+    double operations = static_cast<double>(OperationsPerThread) * threadCount;
+    printf(
+        "%-20s %3u threads  %8.2f Mops/s  %7.1f ns/op  %5.1f%% coalesced\n",
+        name,
+        threadCount,
+        operations / seconds / 1e6,
+        seconds * 1e9 / OperationsPerThread,
+        100.0 * total.coalesced / operations);
+}
+
+int main()
+{
+    for (size_t i = 0; i < PathCount; ++i)
+    {
+        char path[PrjFSMaxPath];
+        snprintf(path, sizeof(path), "src/component%zu/subdirectory%zu/file%zu.cpp", i % 97, i % 13, i);
+        s_paths.push_back(path);
+    }
+
+    const unsigned threadCounts[] = { 1, 2, 4, 8, 16, 32, 64 };
+    for (unsigned threadCount : threadCounts)
+    {
+        RunBenchmark<LegacyPendingRequestMap, std::set<uint64_t>>("unordered_map+set", s_legacyMap, threadCount);
+        RunBenchmark<PendingRequestMap, MessageIdListWithSize>("PendingRequestMap", s_pendingRequestMap, threadCount);
+    }
+
+    return 0;
+}
@@ -0,0 +1,241 @@
+// Expands a directory of 5000 file placeholders, the way PrjFS_WritePlaceholderFile used to (every step resolving
+// the placeholder's full path) and the way PrjFS_WritePlaceholdersBatch does (creating each placeholder relative
+// to the open parent directory, then using its file descriptor), with different numbers of threads.
+// Only uses portable code, so it also runs on Linux, where PlaceholderWriter keeps file flags in an xattr; see
+// Scripts/RunBenchmarks.sh.
+
+#include "../PlaceholderWriter.hpp"
+#include "PrjFSKext/public/PrjFSCommon.h"
+#include "PrjFSKext/public/PrjFSXattrs.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static const unsigned PlaceholderCount = 5000;
+
+// Creating files is dominated by the file system's own work, which varies a lot from run to run, so each way of
+// writing placeholders reports its fastest run
+static const unsigned RunCount = 5;
+static const off_t PlaceholderSize = 12345;
+static const mode_t PlaceholderMode = 0644;
+static const char* const FileXAttrName = "user." PrjFSFileXAttrName;
+
+struct Placeholder
+{
+    std::string name;
+    PrjFSFileXAttrData xattrData;
+};
+
+struct Batch
+{
+    int directoryFd;
+    const std::vector<Placeholder>* placeholders;
+};
+
+static void Fail(const char* operation, const std::string& path, int error)
+{
+    fprintf(stderr, "%s failed for %s: %s\n", operation, path.c_str(), strerror(error));
+    exit(1);
+}
+
+// The steps PrjFS_WritePlaceholderFile took before it used PlaceholderWriter, with chflags emulated by reading and
+// writing the flags xattr
+static void SetBitInFileFlags(const std::string& path, uint32_t bit)
+{
+    uint32_t flags = 0;
+    if (getxattr(path.c_str(), PlaceholderWriter_FileFlagsXAttrName, &flags, sizeof(flags)) < 0 && ENODATA != errno)
+    {
+        Fail("getxattr", path, errno);
+    }
+
+    flags |= bit;
+    if (setxattr(path.c_str(), PlaceholderWriter_FileFlagsXAttrName, &flags, sizeof(flags), 0))
+    {
+        Fail("setxattr", path, errno);
+    }
+}
+
+static void WritePlaceholderWithPaths(const std::string& directory, const Placeholder& placeholder)
+{
+    std::string path = directory + "/" + placeholder.name;
+    FILE* file = fopen(path.c_str(), "wbx");
+    if (nullptr == file || ftruncate(fileno(file), PlaceholderSize))
+    {
+        Fail("fopen", path, errno);
+    }
+
+    fclose(file);
+
+    SetBitInFileFlags(path, FileFlags_IsInVirtualizationRoot);
+    SetBitInFileFlags(path, FileFlags_IsEmpty);
+
+    if (setxattr(path.c_str(), FileXAttrName, &placeholder.xattrData, sizeof(placeholder.xattrData), 0) ||
+        chmod(path.c_str(), PlaceholderMode))
+    {
+        Fail("setxattr", path, errno);
+    }
+}
+
+static void WriteBatchedPlaceholder(void* context, size_t index)
+{
+    const Batch* batch = static_cast<const Batch*>(context);
+    const Placeholder& placeholder = (*batch->placeholders)[index];
+    int error = PlaceholderWriter_CreateFile(
+        batch->directoryFd,
+        placeholder.name.c_str(),
+        FileFlags_IsInVirtualizationRoot | FileFlags_IsEmpty,
+        PrjFSFileXAttrName,
+        &placeholder.xattrData,
+        sizeof(placeholder.xattrData),
+        PlaceholderSize,
+        PlaceholderMode);
+    if (0 != error)
+    {
+        Fail("PlaceholderWriter_CreateFile", placeholder.name, error);
+    }
+}
+
+static void VerifyAndRemovePlaceholders(const std::string& directory, const std::vector<Placeholder>& placeholders)
+{
+    for (const Placeholder& placeholder : placeholders)
+    {
+        std::string path = directory + "/" + placeholder.name;
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat fileAttributes;
+        uint32_t flags;
+        PrjFSFileXAttrData xattrData;
+        if (fd < 0 ||
+            fstat(fd, &fileAttributes) ||
+            0 != PlaceholderWriter_GetFileFlags(fd, &flags) ||
+            sizeof(xattrData) != fgetxattr(fd, FileXAttrName, &xattrData, sizeof(xattrData)))
+        {
+            Fail("verifying", path, errno);
+        }
+
+        close(fd);
+        if (fileAttributes.st_size != PlaceholderSize ||
+            (fileAttributes.st_mode & 07777) != PlaceholderMode ||
+            flags != (FileFlags_IsInVirtualizationRoot | FileFlags_IsEmpty) ||
+            0 != memcmp(&xattrData, &placeholder.xattrData, sizeof(xattrData)))
+        {
+            fprintf(stderr, "%s is not a complete placeholder\n", path.c_str());
+            exit(1);
+        }
+
+        unlink(path.c_str());
+    }
+}
+
+static double WritePlaceholders(const std::string& directory, const std::vector<Placeholder>& placeholders, unsigned threadCount)
+{
+    Clock::time_point start = Clock::now();
+    if (0 == threadCount)
+    {
+        for (const Placeholder& placeholder : placeholders)
+        {
+            WritePlaceholderWithPaths(directory, placeholder);
+        }
+    }
+    else
+    {
+        int directoryFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (directoryFd < 0)
+        {
+            Fail("open", directory, errno);
+        }
+
+        Batch batch = { directoryFd, &placeholders };
+        PlaceholderWriter_ForEach(placeholders.size(), threadCount, WriteBatchedPlaceholder, &batch);
+        close(directoryFd);
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    VerifyAndRemovePlaceholders(directory, placeholders);
+    return seconds;
+}
+
+static void RunBenchmark(const std::string& directory, const std::vector<Placeholder>& placeholders, unsigned threadCount)
+{
+    double seconds = WritePlaceholders(directory, placeholders, threadCount);
+    for (unsigned run = 1; run < RunCount; ++run)
+    {
+        seconds = std::min(seconds, WritePlaceholders(directory, placeholders, threadCount));
+    }
+
+    char description[32];
+    if (0 == threadCount)
+    {
+        snprintf(description, sizeof(description), "full paths");
+    }
+    else
+    {
+        snprintf(description, sizeof(description), "batch, %u thread%s", threadCount, threadCount > 1 ? "s" : "");
+    }
+
+    printf(
+        "%-18s %5u placeholders in %7.1f ms  %6.2f us per placeholder\n",
+        description,
+        PlaceholderCount,
+        seconds * 1000,
+        seconds * 1000000 / PlaceholderCount);
+}
+
+int main()
+{
+    // Placeholders go a few directories deep, as they usually are in a repo, so that resolving full paths costs
+    // what it would in practice
+    const char* tempDirectory = getenv("TMPDIR");
+    std::string directory = std::string(nullptr != tempDirectory ? tempDirectory : "/tmp") + "/PlaceholderBatchBenchmarkXXXXXX";
+    if (nullptr == mkdtemp(&directory[0]))
+    {
+        Fail("mkdtemp", directory, errno);
+    }
+
+    std::string root = directory;
+    const char* const subdirectories[] = { "src", "components", "widgets", "generated" };
+    for (const char* subdirectory : subdirectories)
+    {
+        directory += "/";
+        directory += subdirectory;
+        if (mkdir(directory.c_str(), 0777))
+        {
+            Fail("mkdir", directory, errno);
+        }
+    }
+
+    std::vector<Placeholder> placeholders(PlaceholderCount);
+    for (unsigned i = 0; i < PlaceholderCount; ++i)
+    {
+        placeholders[i].name = "placeholder_file_" + std::to_string(i) + ".cpp";
+        memset(&placeholders[i].xattrData, 0, sizeof(placeholders[i].xattrData));
+        placeholders[i].xattrData.header.magicNumber = PlaceholderMagicNumber;
+        placeholders[i].xattrData.header.formatVersion = PlaceholderFormatVersion;
+        snprintf(reinterpret_cast<char*>(placeholders[i].xattrData.contentId), PrjFS_PlaceholderIdLength, "%040x", i);
+    }
+
+    const unsigned threadCounts[] = { 0, 1, 4, 8 };
+    for (unsigned threadCount : threadCounts)
+    {
+        RunBenchmark(directory, placeholders, threadCount);
+    }
+
+    while (directory != root)
+    {
+        rmdir(directory.c_str());
+        directory.resize(directory.rfind('/'));
+    }
+
+    rmdir(root.c_str());
+    return 0;
+}
@@ -0,0 +1,308 @@
+// Simulates a checkout that changes the content ID and size of 100k placeholders, spread over 100 directories and
+// listed in no particular order, as GitIndexProjection.UpdatePlaceholders does. One in ten placeholders has been
+// hydrated, and one in a hundred modified since, so is left alone and reported as a full file.
+// The placeholders are updated one at a time by full path, as PrjFS_UpdatePlaceholderFileIfNeeded does, and
+// grouped by parent directory with different numbers of threads, as PrjFS_UpdatePlaceholdersBatch does.
+// Only uses portable code, so it also runs on Linux, where PlaceholderWriter keeps file flags in an xattr; see
+// Scripts/RunBenchmarks.sh.
+
+#include "../PlaceholderWriter.hpp"
+#include "../PlaceholderXAttr.hpp"
+#include "../StagedDirectory.hpp"
+#include "PrjFSKext/public/PrjFSCommon.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+// Placeholders go a few directories deep, as they usually are in a repo, so that resolving full paths costs what it
+// would in practice
+static const char* const ParentPath = "src/components/widgets/generated";
+static const unsigned DirectoryCount = 100;
+static const unsigned PlaceholdersPerDirectory = 1000;
+static const unsigned HydratedInterval = 10;
+static const unsigned ModifiedInterval = 100;
+static const off_t OldFileSize = 100;
+static const off_t NewFileSize = 200;
+static const uint32_t PlaceholderFlags = FileFlags_IsInVirtualizationRoot | FileFlags_IsEmpty;
+static const char* const FileXAttrName = "user." PrjFSFileXAttrName;
+
+struct Placeholder
+{
+    std::string relativePath;
+    bool isHydrated;
+    bool isModified;
+
+    unsigned char newXAttr[PlaceholderXAttrMaxSize];
+    size_t newXAttrSize;
+
+    int error;
+    uint32_t conflicts;
+};
+
+static void Fail(const char* operation, const std::string& path, int error)
+{
+    fprintf(stderr, "%s failed for %s: %s\n", operation, path.c_str(), strerror(error));
+    exit(1);
+}
+
+static size_t EncodeXAttr(unsigned index, unsigned version, unsigned char (&xattr)[PlaceholderXAttrMaxSize])
+{
+    unsigned char providerId[PrjFS_PlaceholderIdLength] = { 1 };
+    unsigned char contentId[PrjFS_PlaceholderIdLength] = {};
+
+    // A SHA-1 in UTF-16, as GVFS uses for content IDs
+    char sha[41];
+    snprintf(sha, sizeof(sha), "%08X%08X%024X", version, index, index * 2654435761U);
+    for (int i = 0; i < 40; ++i)
+    {
+        contentId[2 * i] = sha[i];
+    }
+
+    return PlaceholderXAttr_Encode(providerId, contentId, xattr);
+}
+
+static void SetFileFlags(int fd, const std::string& path, uint32_t fileFlags)
+{
+    if (fsetxattr(fd, PlaceholderWriter_FileFlagsXAttrName, &fileFlags, sizeof(fileFlags), 0))
+    {
+        Fail("fsetxattr", path, errno);
+    }
+}
+
+static void CreatePlaceholders(const std::string& root, const std::vector<Placeholder>& placeholders)
+{
+    for (unsigned i = 0; i < DirectoryCount; ++i)
+    {
+        std::string directory = root + "/" + ParentPath + "/directory" + std::to_string(i);
+        if (mkdir(directory.c_str(), 0777))
+        {
+            Fail("mkdir", directory, errno);
+        }
+    }
+
+    for (unsigned i = 0; i < placeholders.size(); ++i)
+    {
+        std::string path = root + "/" + placeholders[i].relativePath;
+        unsigned char xattr[PlaceholderXAttrMaxSize];
+        size_t xattrSize = EncodeXAttr(i, 1, xattr);
+        int error = PlaceholderWriter_CreateFile(AT_FDCWD, path.c_str(), PlaceholderFlags, PrjFSFileXAttrName, xattr, xattrSize, OldFileSize, 0644);
+        if (0 != error)
+        {
+            Fail("PlaceholderWriter_CreateFile", path, error);
+        }
+
+        if (!placeholders[i].isHydrated)
+        {
+            continue;
+        }
+
+        // What hydrating the placeholder, and then modifying it, leaves on disk
+        int fd = open(path.c_str(), O_WRONLY);
+        char contents[OldFileSize] = {};
+        if (fd < 0 || OldFileSize != pwrite(fd, contents, sizeof(contents), 0))
+        {
+            Fail("hydrating", path, errno);
+        }
+
+        SetFileFlags(fd, path, FileFlags_IsInVirtualizationRoot);
+        if (placeholders[i].isModified && fremovexattr(fd, FileXAttrName))
+        {
+            Fail("fremovexattr", path, errno);
+        }
+
+        close(fd);
+    }
+}
+
+static void UpdatePlaceholder(Placeholder& placeholder, int directoryFd, const char* path)
+{
+    placeholder.error = PlaceholderWriter_UpdateFile(
+        directoryFd,
+        path,
+        PlaceholderFlags,
+        PrjFSFileXAttrName,
+        placeholder.newXAttr,
+        placeholder.newXAttrSize,
+        NewFileSize,
+        PlaceholderConflict_None,
+        &placeholder.conflicts);
+}
+
+static void UpdateBatchedPlaceholder(void* context, size_t index, int directoryFd, const char* name, int directoryError)
+{
+    Placeholder& placeholder = (*static_cast<std::vector<Placeholder>*>(context))[index];
+    if (0 != directoryError)
+    {
+        Fail("opening parent directory", placeholder.relativePath, directoryError);
+    }
+
+    UpdatePlaceholder(placeholder, directoryFd, name);
+}
+
+static void VerifyPlaceholders(const std::string& root, const std::vector<Placeholder>& placeholders)
+{
+    for (const Placeholder& placeholder : placeholders)
+    {
+        std::string path = root + "/" + placeholder.relativePath;
+        if (0 != placeholder.error)
+        {
+            Fail("PlaceholderWriter_UpdateFile", path, placeholder.error);
+        }
+
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat fileAttributes;
+        uint32_t flags;
+        if (fd < 0 || fstat(fd, &fileAttributes) || 0 != PlaceholderWriter_GetFileFlags(fd, &flags))
+        {
+            Fail("verifying", path, errno);
+        }
+
+        unsigned char xattr[PlaceholderXAttrMaxSize];
+        ssize_t xattrSize = fgetxattr(fd, FileXAttrName, xattr, sizeof(xattr));
+        close(fd);
+
+        bool isCorrect;
+        if (placeholder.isModified)
+        {
+            isCorrect =
+                PlaceholderConflict_FullFile == placeholder.conflicts &&
+                xattrSize < 0 &&
+                OldFileSize == fileAttributes.st_size;
+        }
+        else
+        {
+            isCorrect =
+                PlaceholderConflict_None == placeholder.conflicts &&
+                placeholder.newXAttrSize == static_cast<size_t>(xattrSize) &&
+                0 == memcmp(placeholder.newXAttr, xattr, xattrSize) &&
+                NewFileSize == fileAttributes.st_size &&
+                PlaceholderFlags == flags &&
+                0644 == (fileAttributes.st_mode & 07777);
+        }
+
+        if (!isCorrect)
+        {
+            fprintf(stderr, "%s was not updated correctly\n", path.c_str());
+            exit(1);
+        }
+    }
+}
+
+static void RunBenchmark(const std::string& root, std::vector<Placeholder>& placeholders, unsigned threadCount)
+{
+    CreatePlaceholders(root, placeholders);
+
+    Clock::time_point start = Clock::now();
+    if (0 == threadCount)
+    {
+        for (Placeholder& placeholder : placeholders)
+        {
+            std::string path = root + "/" + placeholder.relativePath;
+            UpdatePlaceholder(placeholder, AT_FDCWD, path.c_str());
+        }
+    }
+    else
+    {
+        std::vector<const char*> relativePaths;
+        for (const Placeholder& placeholder : placeholders)
+        {
+            relativePaths.push_back(placeholder.relativePath.c_str());
+        }
+
+        PlaceholderWriter_ForEachInDirectories(
+            root.c_str(),
+            relativePaths.data(),
+            relativePaths.size(),
+            threadCount,
+            UpdateBatchedPlaceholder,
+            &placeholders);
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    VerifyPlaceholders(root, placeholders);
+
+    for (unsigned i = 0; i < DirectoryCount; ++i)
+    {
+        std::string directory = root + "/" + ParentPath + "/directory" + std::to_string(i);
+        int error = StagedDirectory_Remove(directory.c_str());
+        if (0 != error)
+        {
+            Fail("StagedDirectory_Remove", directory, error);
+        }
+    }
+
+    char description[32];
+    if (0 == threadCount)
+    {
+        snprintf(description, sizeof(description), "one at a time");
+    }
+    else
+    {
+        snprintf(description, sizeof(description), "batch, %u thread%s", threadCount, threadCount > 1 ? "s" : "");
+    }
+
+    printf(
+        "%-18s %6zu placeholders in %8.1f ms  %6.2f us per placeholder\n",
+        description,
+        placeholders.size(),
+        seconds * 1000,
+        seconds * 1000000 / placeholders.size());
+}
+
+int main()
+{
+    const char* tempDirectory = getenv("TMPDIR");
+    std::string root = std::string(nullptr != tempDirectory ? tempDirectory : "/tmp") + "/PlaceholderUpdateBenchmarkXXXXXX";
+    if (nullptr == mkdtemp(&root[0]))
+    {
+        Fail("mkdtemp", root, errno);
+    }
+
+    std::string parentPath = std::string(ParentPath) + "/";
+    for (size_t end = parentPath.find('/'); std::string::npos != end; end = parentPath.find('/', end + 1))
+    {
+        std::string directory = root + "/" + parentPath.substr(0, end);
+        if (mkdir(directory.c_str(), 0777))
+        {
+            Fail("mkdir", directory, errno);
+        }
+    }
+
+    std::vector<Placeholder> placeholders(DirectoryCount * PlaceholdersPerDirectory);
+    for (unsigned i = 0; i < placeholders.size(); ++i)
+    {
+        Placeholder& placeholder = placeholders[i];
+        placeholder.relativePath = std::string(ParentPath) + "/directory" + std::to_string(i % DirectoryCount) + "/file" + std::to_string(i) + ".cpp";
+        placeholder.isHydrated = 0 == i % HydratedInterval;
+        placeholder.isModified = 0 == i % ModifiedInterval;
+        placeholder.newXAttrSize = EncodeXAttr(i, 2, placeholder.newXAttr);
+    }
+
+    std::shuffle(placeholders.begin(), placeholders.end(), std::mt19937(42));
+
+    const unsigned threadCounts[] = { 0, 1, 4, 8 };
+    for (unsigned threadCount : threadCounts)
+    {
+        RunBenchmark(root, placeholders, threadCount);
+    }
+
+    int error = StagedDirectory_Remove(root.c_str());
+    if (0 != error)
+    {
+        Fail("StagedDirectory_Remove", root, error);
+    }
+
+    return 0;
+}
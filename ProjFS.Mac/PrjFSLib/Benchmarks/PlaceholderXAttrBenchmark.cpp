@@ -0,0 +1,244 @@
+// Compares the version 1 file xattr (PrjFSFileXAttrData, 264 bytes) with the compact version 2 xattr written by
+// PlaceholderXAttr, using GVFS style IDs: a one byte placeholder version and a SHA-1 in UTF-16. For each format it
+// measures the time to write and to read and decode the xattrs of every placeholder, how much the file system's
+// free space drops to hold them, and the time to migrate version 1 xattrs to version 2.
+// Defaults to 100k placeholders, as version 1 xattrs can take a 4 KB block each (they do on ext4); pass a different
+// count, such as 1000000, as the first argument.
+// Only uses portable code, so it also runs on Linux; see Scripts/RunBenchmarks.sh.
+
+#include "../PlaceholderXAttr.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static const unsigned PlaceholdersPerDirectory = 1000;
+
+#ifdef __APPLE__
+static const char* const FileXAttrName = PrjFSFileXAttrName;
+#define getxattr(path, name, value, size) getxattr(path, name, value, size, 0, 0)
+#define setxattr(path, name, value, size, options) setxattr(path, name, value, size, 0, options)
+#define removexattr(path, name) removexattr(path, name, 0)
+#else
+static const char* const FileXAttrName = "user." PrjFSFileXAttrName;
+#endif
+
+static void Fail(const char* operation, const std::string& path, int error)
+{
+    fprintf(stderr, "%s failed for %s: %s\n", operation, path.c_str(), strerror(error));
+    exit(1);
+}
+
+static void GetIds(unsigned index, unsigned char (&providerId)[PrjFS_PlaceholderIdLength], unsigned char (&contentId)[PrjFS_PlaceholderIdLength])
+{
+    memset(providerId, 0, PrjFS_PlaceholderIdLength);
+    memset(contentId, 0, PrjFS_PlaceholderIdLength);
+    providerId[0] = 1;
+
+    // What FileSystemVirtualizer.ConvertShaToContentId produces: 40 uppercase hex digits in UTF-16LE
+    char sha[41];
+    snprintf(sha, sizeof(sha), "%08X%08X%08X%08X%08X", index, index * 2654435761U, ~index, index ^ 0x5A5A5A5AU, index * 40503U);
+    for (int i = 0; i < 40; ++i)
+    {
+        contentId[2 * i] = sha[i];
+    }
+}
+
+static unsigned long long GetUsedBytes(const std::string& path)
+{
+    struct statvfs fileSystem;
+    if (statvfs(path.c_str(), &fileSystem))
+    {
+        Fail("statvfs", path, errno);
+    }
+
+    return static_cast<unsigned long long>(fileSystem.f_blocks - fileSystem.f_bfree) * fileSystem.f_frsize;
+}
+
+static double SecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void WriteXAttrs(const std::vector<std::string>& paths, int32_t formatVersion)
+{
+    for (unsigned i = 0; i < paths.size(); ++i)
+    {
+        PrjFSFileXAttrData data = {};
+        GetIds(i, data.providerId, data.contentId);
+
+        unsigned char buffer[PlaceholderXAttrMaxSize];
+        const void* xattr = buffer;
+        size_t xattrSize;
+        if (PlaceholderFormatVersion == formatVersion)
+        {
+            data.header.magicNumber = PlaceholderMagicNumber;
+            data.header.formatVersion = PlaceholderFormatVersion;
+            xattr = &data;
+            xattrSize = sizeof(data);
+        }
+        else
+        {
+            xattrSize = PlaceholderXAttr_Encode(data.providerId, data.contentId, buffer);
+        }
+
+        if (setxattr(paths[i].c_str(), FileXAttrName, xattr, xattrSize, 0))
+        {
+            Fail("setxattr", paths[i], errno);
+        }
+    }
+}
+
+// Reads every xattr the way PrjFSLib does, and checks it decodes to the IDs that were written. When migrate is set,
+// version 1 xattrs are rewritten as version 2 like PrjFSLib does the first time it reads one.
+static void ReadXAttrs(const std::vector<std::string>& paths, int32_t expectedFormatVersion, bool migrate)
+{
+    for (unsigned i = 0; i < paths.size(); ++i)
+    {
+        unsigned char xattr[PlaceholderXAttrMaxSize];
+        ssize_t xattrSize = getxattr(paths[i].c_str(), FileXAttrName, xattr, sizeof(xattr));
+        PrjFSFileXAttrData data;
+        if (xattrSize < 0 || !PlaceholderXAttr_Decode(xattr, xattrSize, &data))
+        {
+            Fail("reading xattr", paths[i], errno);
+        }
+
+        unsigned char providerId[PrjFS_PlaceholderIdLength];
+        unsigned char contentId[PrjFS_PlaceholderIdLength];
+        GetIds(i, providerId, contentId);
+        if (expectedFormatVersion != data.header.formatVersion ||
+            0 != memcmp(providerId, data.providerId, sizeof(providerId)) ||
+            0 != memcmp(contentId, data.contentId, sizeof(contentId)))
+        {
+            fprintf(stderr, "%s has the wrong xattr\n", paths[i].c_str());
+            exit(1);
+        }
+
+        if (migrate)
+        {
+            xattrSize = PlaceholderXAttr_Encode(data.providerId, data.contentId, xattr);
+            if (setxattr(paths[i].c_str(), FileXAttrName, xattr, xattrSize, XATTR_REPLACE))
+            {
+                Fail("setxattr", paths[i], errno);
+            }
+        }
+    }
+}
+
+static void RemoveXAttrs(const std::vector<std::string>& paths)
+{
+    for (const std::string& path : paths)
+    {
+        if (removexattr(path.c_str(), FileXAttrName))
+        {
+            Fail("removexattr", path, errno);
+        }
+    }
+}
+
+static void PrintResult(const char* description, size_t count, double seconds)
+{
+    printf("%-28s %8.2f s  %6.2f us per placeholder\n", description, seconds, seconds * 1000000 / count);
+}
+
+static void PrintUsage(const char* description, size_t count, long long usedBytes, size_t xattrSize)
+{
+    printf(
+        "%-28s %8.1f MB used on disk (%lld bytes per placeholder), %zu bytes of xattr data each\n",
+        description,
+        usedBytes / (1024.0 * 1024.0),
+        usedBytes / static_cast<long long>(count),
+        xattrSize);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned placeholderCount = argc > 1 ? static_cast<unsigned>(strtoul(argv[1], nullptr, 10)) : 100000;
+
+    const char* tempDirectory = getenv("TMPDIR");
+    std::string root = std::string(nullptr != tempDirectory ? tempDirectory : "/tmp") + "/PlaceholderXAttrBenchmarkXXXXXX";
+    if (nullptr == mkdtemp(&root[0]))
+    {
+        Fail("mkdtemp", root, errno);
+    }
+
+    std::vector<std::string> directories;
+    std::vector<std::string> paths;
+    for (unsigned i = 0; i < placeholderCount; ++i)
+    {
+        if (0 == i % PlaceholdersPerDirectory)
+        {
+            directories.push_back(root + "/" + std::to_string(i / PlaceholdersPerDirectory));
+            if (mkdir(directories.back().c_str(), 0777))
+            {
+                Fail("mkdir", directories.back(), errno);
+            }
+        }
+
+        paths.push_back(directories.back() + "/placeholder" + std::to_string(i));
+        int fd = open(paths.back().c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd < 0)
+        {
+            Fail("open", paths.back(), errno);
+        }
+
+        close(fd);
+    }
+
+    unsigned char sampleProviderId[PrjFS_PlaceholderIdLength];
+    unsigned char sampleContentId[PrjFS_PlaceholderIdLength];
+    unsigned char sampleXAttr[PlaceholderXAttrMaxSize];
+    GetIds(0, sampleProviderId, sampleContentId);
+    size_t compactSize = PlaceholderXAttr_Encode(sampleProviderId, sampleContentId, sampleXAttr);
+
+    printf("%u placeholders\n", placeholderCount);
+    long long usedBefore = GetUsedBytes(root);
+
+    Clock::time_point start = Clock::now();
+    WriteXAttrs(paths, PlaceholderFormatVersion);
+    PrintResult("write version 1", paths.size(), SecondsSince(start));
+    PrintUsage("version 1", paths.size(), GetUsedBytes(root) - usedBefore, sizeof(PrjFSFileXAttrData));
+
+    start = Clock::now();
+    ReadXAttrs(paths, PlaceholderFormatVersion, false);
+    PrintResult("read version 1", paths.size(), SecondsSince(start));
+
+    start = Clock::now();
+    ReadXAttrs(paths, PlaceholderFormatVersion, true);
+    PrintResult("migrate to version 2", paths.size(), SecondsSince(start));
+    PrintUsage("migrated to version 2", paths.size(), GetUsedBytes(root) - usedBefore, compactSize);
+
+    RemoveXAttrs(paths);
+
+    start = Clock::now();
+    WriteXAttrs(paths, PlaceholderFileFormatVersion2);
+    PrintResult("write version 2", paths.size(), SecondsSince(start));
+    PrintUsage("version 2", paths.size(), GetUsedBytes(root) - usedBefore, compactSize);
+
+    start = Clock::now();
+    ReadXAttrs(paths, PlaceholderFileFormatVersion2, false);
+    PrintResult("read version 2", paths.size(), SecondsSince(start));
+
+    for (const std::string& path : paths)
+    {
+        unlink(path.c_str());
+    }
+
+    for (const std::string& directory : directories)
+    {
+        rmdir(directory.c_str());
+    }
+
+    rmdir(root.c_str());
+    return 0;
+}
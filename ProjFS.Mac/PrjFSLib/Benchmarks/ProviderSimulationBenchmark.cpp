@@ -0,0 +1,326 @@
+// Load test for the whole provider path: KernelSimulator plays the kext, and PrjFSLib handles its messages through
+// SharedMemoryTransport and calls a minimal provider, which writes placeholders when a directory is enumerated and
+// 4 KB of contents when a file is hydrated.
+// Each phase simulates a number of processes accessing their own directories at once, from 1 to 2048 threads each
+// blocked on one access like a kauth thread: every directory is enumerated, every file is hydrated by two accesses
+// at the same time, so that PrjFSLib coalesces them when it can, and every file is then modified. Reports messages
+// per second and the latency each access saw, and checks the provider was called and the files on disk are in the
+// expected state. Pass a different file count per phase as the first argument.
+// Only uses portable code, so it also runs on Linux, where PlaceholderWriter keeps file flags in an xattr; see
+// Scripts/RunBenchmarks.sh.
+
+#include <stdint.h>
+#include "../PrjFSLib.h"
+#include "../KernelTransport.hpp"
+#include "../SharedMemoryTransport.hpp"
+#include "../StagedDirectory.hpp"
+#include "../KernelSimulator/KernelSimulator.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static const unsigned ThreadCounts[] = { 1, 16, 256, 2048 };
+static const unsigned FilesPerDirectory = 64;
+static const unsigned FileSize = 4096;
+static const uint32_t RingCapacity = 1 << 20;
+
+static unsigned s_directoriesPerPhase;
+static std::atomic<unsigned long long> s_enumerateCount(0);
+static std::atomic<unsigned long long> s_getFileStreamCount(0);
+static std::atomic<unsigned long long> s_notifyCount(0);
+
+static void Fail(const char* operation, const std::string& path, int error)
+{
+    fprintf(stderr, "%s failed for %s: %s\n", operation, path.c_str(), strerror(error));
+    exit(1);
+}
+
+static void Fail(const char* operation, const std::string& path, PrjFS_Result result)
+{
+    fprintf(stderr, "%s failed for %s: 0x%08x\n", operation, path.c_str(), result);
+    exit(1);
+}
+
+static std::string GetDirectoryPath(unsigned threadCount, unsigned index)
+{
+    return "phase" + std::to_string(threadCount) + "_directory" + std::to_string(index);
+}
+
+static std::string GetFilePath(unsigned threadCount, unsigned directoryIndex, unsigned index)
+{
+    return GetDirectoryPath(threadCount, directoryIndex) + "/file" + std::to_string(index) + ".cpp";
+}
+
+// The root holds every phase's directories, and each of those FilesPerDirectory files
+static PrjFS_Result EnumerateDirectory(
+    unsigned long /* commandId */,
+    const char* relativePath,
+    int /* triggeringProcessId */,
+    const char* /* triggeringProcessName */)
+{
+    ++s_enumerateCount;
+
+    bool isRoot = '\0' == relativePath[0];
+    std::vector<std::string> names;
+    if (isRoot)
+    {
+        for (unsigned threadCount : ThreadCounts)
+        {
+            for (unsigned i = 0; i < s_directoriesPerPhase; ++i)
+            {
+                names.push_back(GetDirectoryPath(threadCount, i));
+            }
+        }
+    }
+    else
+    {
+        for (unsigned i = 0; i < FilesPerDirectory; ++i)
+        {
+            names.push_back("file" + std::to_string(i) + ".cpp");
+        }
+    }
+
+    std::vector<PrjFS_PlaceholderInfo> placeholders(names.size());
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        PrjFS_PlaceholderInfo& placeholder = placeholders[i];
+        memset(&placeholder, 0, sizeof(placeholder));
+        placeholder.name = names[i].c_str();
+        placeholder.isDirectory = isRoot;
+        placeholder.providerId[0] = 1;
+        snprintf(reinterpret_cast<char*>(placeholder.contentId), sizeof(placeholder.contentId), "%040zX", i);
+        placeholder.fileSize = FileSize;
+        placeholder.fileMode = 0644;
+    }
+
+    return PrjFS_WritePlaceholdersBatch(relativePath, placeholders.data(), static_cast<unsigned>(placeholders.size()), 1);
+}
+
+static PrjFS_Result GetFileStream(
+    unsigned long /* commandId */,
+    const char* /* relativePath */,
+    unsigned char /* providerId */[PrjFS_PlaceholderIdLength],
+    unsigned char /* contentId */[PrjFS_PlaceholderIdLength],
+    int /* triggeringProcessId */,
+    const char* /* triggeringProcessName */,
+    const PrjFS_FileHandle* fileHandle)
+{
+    ++s_getFileStreamCount;
+
+    static const std::vector<char> contents(FileSize, 'x');
+    return PrjFS_WriteFileContents(fileHandle, contents.data(), FileSize);
+}
+
+static PrjFS_Result NotifyOperation(
+    unsigned long /* commandId */,
+    const char* /* relativePath */,
+    unsigned char /* providerId */[PrjFS_PlaceholderIdLength],
+    unsigned char /* contentId */[PrjFS_PlaceholderIdLength],
+    int /* triggeringProcessId */,
+    const char* /* triggeringProcessName */,
+    bool /* isDirectory */,
+    PrjFS_NotificationType /* notificationType */,
+    const char* /* destinationRelativePath */)
+{
+    ++s_notifyCount;
+    return PrjFS_Result_Success;
+}
+
+// Sends a message for each path from threadCount threads at once, and reports the throughput and latency
+static void SendRequests(
+    KernelSimulator& simulator,
+    const char* description,
+    MessageType messageType,
+    const std::vector<std::string>& paths,
+    unsigned threadCount)
+{
+    std::atomic<size_t> nextPath(0);
+    std::vector<std::vector<double>> latencies(threadCount);
+    std::vector<std::thread> threads;
+
+    Clock::time_point start = Clock::now();
+    for (unsigned t = 0; t < threadCount; ++t)
+    {
+        threads.emplace_back(
+            [&, t]()
+            {
+                int32_t pid = getpid();
+                for (size_t i = nextPath++; i < paths.size(); i = nextPath++)
+                {
+                    Clock::time_point sendTime = Clock::now();
+                    MessageType response = simulator.SendRequest(messageType, paths[i].c_str(), pid, "benchmark");
+                    latencies[t].push_back(std::chrono::duration<double, std::micro>(Clock::now() - sendTime).count());
+
+                    if (MessageType_Response_Success != response)
+                    {
+                        fprintf(stderr, "%s of %s failed\n", description, paths[i].c_str());
+                        exit(1);
+                    }
+                }
+            });
+    }
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<double> allLatencies;
+    for (const std::vector<double>& threadLatencies : latencies)
+    {
+        allLatencies.insert(allLatencies.end(), threadLatencies.begin(), threadLatencies.end());
+    }
+
+    std::sort(allLatencies.begin(), allLatencies.end());
+    double totalLatency = 0;
+    for (double latency : allLatencies)
+    {
+        totalLatency += latency;
+    }
+
+    printf(
+        "%-12s %4u threads %7zu messages %9.0f messages/s  mean %8.1f us  p99 %8.1f us\n",
+        description,
+        threadCount,
+        paths.size(),
+        paths.size() / seconds,
+        totalLatency / allLatencies.size(),
+        allLatencies[allLatencies.size() * 99 / 100]);
+}
+
+static void CheckCount(const char* callback, unsigned long long count, unsigned long long expectedMin, unsigned long long expectedMax)
+{
+    if (count < expectedMin || count > expectedMax)
+    {
+        fprintf(stderr, "%s was called %llu times, expected %llu to %llu\n", callback, count, expectedMin, expectedMax);
+        exit(1);
+    }
+}
+
+static void CheckFileStates(const std::string& root, const std::vector<std::string>& files, PrjFS_FileState expectedState)
+{
+    for (const std::string& file : files)
+    {
+        std::string fullPath = root + "/" + file;
+        unsigned int fileState;
+        PrjFS_Result result = PrjFS_GetOnDiskFileState(fullPath.c_str(), &fileState);
+        if (PrjFS_Result_Success != result)
+        {
+            Fail("PrjFS_GetOnDiskFileState", fullPath, result);
+        }
+
+        if (expectedState != fileState)
+        {
+            fprintf(stderr, "%s is in state %u, expected %u\n", fullPath.c_str(), fileState, expectedState);
+            exit(1);
+        }
+    }
+}
+
+static void RunPhase(KernelSimulator& simulator, const std::string& root, unsigned threadCount)
+{
+    std::vector<std::string> directories;
+    std::vector<std::string> files;
+    std::vector<std::string> hydrations;
+    for (unsigned i = 0; i < s_directoriesPerPhase; ++i)
+    {
+        directories.push_back(GetDirectoryPath(threadCount, i));
+        for (unsigned j = 0; j < FilesPerDirectory; ++j)
+        {
+            files.push_back(GetFilePath(threadCount, i, j));
+
+            // Next to each other, so that both accesses tend to be in flight at once
+            hydrations.push_back(files.back());
+            hydrations.push_back(files.back());
+        }
+    }
+
+    unsigned long long enumerateCount = s_enumerateCount;
+    SendRequests(simulator, "enumerate", MessageType_KtoU_EnumerateDirectory, directories, threadCount);
+    CheckCount("EnumerateDirectory", s_enumerateCount - enumerateCount, directories.size(), directories.size());
+    CheckFileStates(root, files, PrjFS_FileState_Placeholder);
+
+    // Accesses that arrive while the file is being hydrated are answered with the first one, and the rest
+    // hydrate it again
+    unsigned long long getFileStreamCount = s_getFileStreamCount;
+    SendRequests(simulator, "hydrate", MessageType_KtoU_HydrateFile, hydrations, threadCount);
+    CheckCount("GetFileStream", s_getFileStreamCount - getFileStreamCount, files.size(), hydrations.size());
+    CheckFileStates(root, files, PrjFS_FileState_HydratedPlaceholder);
+
+    unsigned long long notifyCount = s_notifyCount;
+    SendRequests(simulator, "modify", MessageType_KtoU_NotifyFileModified, files, threadCount);
+    CheckCount("NotifyOperation", s_notifyCount - notifyCount, files.size(), files.size());
+    CheckFileStates(root, files, PrjFS_FileState_Full);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned fileCount = argc > 1 ? static_cast<unsigned>(strtoul(argv[1], nullptr, 10)) : 16384;
+    s_directoriesPerPhase = std::max(1U, fileCount / FilesPerDirectory);
+
+    const char* tempDirectory = getenv("TMPDIR");
+    std::string root = std::string(nullptr != tempDirectory ? tempDirectory : "/tmp") + "/ProviderSimulationBenchmarkXXXXXX";
+    if (nullptr == mkdtemp(&root[0]))
+    {
+        Fail("mkdtemp", root, errno);
+    }
+
+    PrjFS_Result result = PrjFS_ConvertDirectoryToVirtualizationRoot(root.c_str());
+    if (PrjFS_Result_Success != result)
+    {
+        Fail("PrjFS_ConvertDirectoryToVirtualizationRoot", root, result);
+    }
+
+    KernelSimulator simulator;
+    int error = simulator.Start(RingCapacity);
+    if (0 != error)
+    {
+        Fail("KernelSimulator::Start", root, error);
+    }
+
+    PrjFS_Callbacks callbacks = { EnumerateDirectory, GetFileStream, NotifyOperation };
+    result = PrjFS_StartVirtualizationInstanceWithTransport(root.c_str(), callbacks, 0, new SharedMemoryTransport(simulator.GetChannel()));
+    if (PrjFS_Result_Success != result)
+    {
+        Fail("PrjFS_StartVirtualizationInstanceWithTransport", root, result);
+    }
+
+    if (simulator.GetVirtualizationRootPath() != root)
+    {
+        fprintf(stderr, "Registered %s, expected %s\n", simulator.GetVirtualizationRootPath().c_str(), root.c_str());
+        exit(1);
+    }
+
+    if (MessageType_Response_Success != simulator.SendRequest(MessageType_KtoU_EnumerateDirectory, "", getpid(), "benchmark"))
+    {
+        fprintf(stderr, "Enumerating the virtualization root failed\n");
+        exit(1);
+    }
+
+    for (unsigned threadCount : ThreadCounts)
+    {
+        RunPhase(simulator, root, threadCount);
+    }
+
+    // The instance cannot be stopped yet, so the process exits with it still running
+    error = StagedDirectory_Remove(root.c_str());
+    if (0 != error)
+    {
+        Fail("StagedDirectory_Remove", root, error);
+    }
+
+    fflush(stdout);
+    _exit(0);
+}
@@ -0,0 +1,111 @@
+// Load test for RequestScheduler: a flood of notifications arrives together with a steady stream of hydrations,
+// and the time the hydrations wait for a worker is compared with the time they wait when every request shares
+// one FIFO queue, as all requests did before the scheduler had lanes.
+// Only uses portable code, so it also runs on Linux; see Scripts/RunBenchmarks.sh.
+
+#include "../RequestScheduler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static const unsigned NotificationCount = 4000;
+static const unsigned HydrationCount = 200;
+
+// Handlers sleep rather than spin, like handlers waiting on disk or network, so that the results do not depend
+// on how many cores the machine has
+static const std::chrono::microseconds NotificationWork(500);
+static const std::chrono::microseconds HydrationWork(1000);
+static const std::chrono::microseconds HydrationInterval(2000);
+
+struct SyntheticRequest
+{
+    Clock::time_point enqueueTime;
+    std::chrono::microseconds work;
+    double waitMicroseconds;
+};
+
+static void RunSyntheticRequest(void* context)
+{
+    SyntheticRequest* request = static_cast<SyntheticRequest*>(context);
+    request->waitMicroseconds = std::chrono::duration<double, std::micro>(Clock::now() - request->enqueueTime).count();
+    std::this_thread::sleep_for(request->work);
+}
+
+static double Percentile(std::vector<double> values, double percentile)
+{
+    std::sort(values.begin(), values.end());
+    size_t rank = static_cast<size_t>(percentile / 100.0 * (values.size() - 1) + 0.5);
+    return values[rank];
+}
+
+static void RunLoadTest(unsigned threadCount, bool useLanes)
+{
+    std::vector<SyntheticRequest> notifications(NotificationCount);
+    std::vector<SyntheticRequest> hydrations(HydrationCount);
+
+    RequestScheduler scheduler;
+    scheduler.Start(threadCount);
+
+    RequestLane hydrationLane = useLanes ? RequestLane_Hydration : RequestLane_Notification;
+    Clock::time_point start = Clock::now();
+
+    // Something touches a lot of files at once...
+    for (SyntheticRequest& notification : notifications)
+    {
+        notification = SyntheticRequest { Clock::now(), NotificationWork, 0 };
+        scheduler.Enqueue(RequestLane_Notification, RunSyntheticRequest, &notification);
+    }
+
+    // ... while other processes keep reading files that have not been hydrated
+    for (SyntheticRequest& hydration : hydrations)
+    {
+        hydration = SyntheticRequest { Clock::now(), HydrationWork, 0 };
+        scheduler.Enqueue(hydrationLane, RunSyntheticRequest, &hydration);
+        std::this_thread::sleep_for(HydrationInterval);
+    }
+
+    scheduler.Stop();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    RequestLaneStats hydrationStats = scheduler.GetLaneStats(hydrationLane);
+    RequestLaneStats notificationStats = scheduler.GetLaneStats(RequestLane_Notification);
+    uint64_t startedCount = hydrationStats.startedCount + (useLanes ? notificationStats.startedCount : 0);
+    if (startedCount != NotificationCount + HydrationCount)
+    {
+        fprintf(stderr, "%llu of %u requests ran\n", (unsigned long long)startedCount, NotificationCount + HydrationCount);
+        exit(1);
+    }
+
+    std::vector<double> hydrationWaits;
+    for (const SyntheticRequest& hydration : hydrations)
+    {
+        hydrationWaits.push_back(hydration.waitMicroseconds);
+    }
+
+    printf(
+        "%2u threads  %-10s hydration wait p50 %9.0f us  p99 %9.0f us  max %9.0f us  notification max depth %4u  total %.2f s\n",
+        threadCount,
+        useLanes ? "lanes" : "one queue",
+        Percentile(hydrationWaits, 50),
+        Percentile(hydrationWaits, 99),
+        Percentile(hydrationWaits, 100),
+        notificationStats.maxQueueDepth,
+        seconds);
+}
+
+int main()
+{
+    const unsigned threadCounts[] = { 2, 8, 32 };
+    for (unsigned threadCount : threadCounts)
+    {
+        RunLoadTest(threadCount, false);
+        RunLoadTest(threadCount, true);
+    }
+
+    return 0;
+}
@@ -0,0 +1,201 @@
+// Expands directories of 10 to 100k placeholders three ways, and measures how long readers would have to be held
+// off so that they never see the directory partially expanded:
+//  - in place: placeholders are written straight into the directory, so for the whole expansion
+//  - staged: placeholders are written into a staging directory and moved in by StagedDirectory_MoveChildren, so
+//    only while they are renamed into place (what PrjFS_SetStagedDirectoryExpansion does)
+//  - exchange: the staging directory is swapped with the directory in one rename, for comparison. PrjFSLib does
+//    not do this, as the process whose access triggered the enumeration already has the old, empty directory open.
+// Only uses portable code, so it also runs on Linux; see Scripts/RunBenchmarks.sh.
+
+#include "../PlaceholderWriter.hpp"
+#include "../StagedDirectory.hpp"
+#include "PrjFSKext/public/PrjFSCommon.h"
+#include "PrjFSKext/public/PrjFSXattrs.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+enum ExpansionMode
+{
+    ExpansionMode_InPlace,
+    ExpansionMode_Staged,
+    ExpansionMode_Exchange,
+};
+
+static const char* const ExpansionModeNames[] = { "in place", "staged", "exchange" };
+
+static void Fail(const char* operation, const std::string& path, int error)
+{
+    fprintf(stderr, "%s failed for %s: %s\n", operation, path.c_str(), strerror(error));
+    exit(1);
+}
+
+static double MillisecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void WritePlaceholders(const std::string& directory, unsigned entryCount)
+{
+    int directoryFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directoryFd < 0)
+    {
+        Fail("open", directory, errno);
+    }
+
+    PrjFSFileXAttrData xattrData = {};
+    xattrData.header.magicNumber = PlaceholderMagicNumber;
+    xattrData.header.formatVersion = PlaceholderFormatVersion;
+
+    for (unsigned i = 0; i < entryCount; ++i)
+    {
+        std::string name = "entry" + std::to_string(i);
+        int error = PlaceholderWriter_CreateFile(
+            directoryFd,
+            name.c_str(),
+            FileFlags_IsInVirtualizationRoot | FileFlags_IsEmpty,
+            PrjFSFileXAttrName,
+            &xattrData,
+            sizeof(xattrData),
+            4096,
+            0644);
+        if (0 != error)
+        {
+            Fail("PlaceholderWriter_CreateFile", name, error);
+        }
+    }
+
+    close(directoryFd);
+}
+
+static int ExchangeDirectories(const std::string& first, const std::string& second)
+{
+#ifdef __APPLE__
+    return renamex_np(first.c_str(), second.c_str(), RENAME_SWAP) ? errno : 0;
+#else
+    return renameat2(AT_FDCWD, first.c_str(), AT_FDCWD, second.c_str(), RENAME_EXCHANGE) ? errno : 0;
+#endif
+}
+
+static unsigned CountChildren(const std::string& directory)
+{
+    DIR* handle = opendir(directory.c_str());
+    if (nullptr == handle)
+    {
+        Fail("opendir", directory, errno);
+    }
+
+    unsigned count = 0;
+    while (dirent* entry = readdir(handle))
+    {
+        if (0 != strcmp(entry->d_name, ".") && 0 != strcmp(entry->d_name, ".."))
+        {
+            ++count;
+        }
+    }
+
+    closedir(handle);
+    return count;
+}
+
+static void RunBenchmark(const std::string& parent, unsigned entryCount, ExpansionMode mode)
+{
+    std::string directory = parent + "/directory";
+    std::string stagingPath = parent + "/.prjfs-staging.directory";
+    if (mkdir(directory.c_str(), 0777))
+    {
+        Fail("mkdir", directory, errno);
+    }
+
+    double blockedMilliseconds;
+    Clock::time_point start = Clock::now();
+    if (ExpansionMode_InPlace == mode)
+    {
+        WritePlaceholders(directory, entryCount);
+        blockedMilliseconds = MillisecondsSince(start);
+    }
+    else
+    {
+        int error = StagedDirectory_Create(stagingPath.c_str());
+        if (0 != error)
+        {
+            Fail("StagedDirectory_Create", stagingPath, error);
+        }
+
+        WritePlaceholders(stagingPath, entryCount);
+
+        Clock::time_point blockStart = Clock::now();
+        if (ExpansionMode_Staged == mode)
+        {
+            error = StagedDirectory_MoveChildren(stagingPath.c_str(), directory.c_str());
+            blockedMilliseconds = MillisecondsSince(blockStart);
+        }
+        else
+        {
+            error = ExchangeDirectories(stagingPath, directory);
+            blockedMilliseconds = MillisecondsSince(blockStart);
+            if (0 == error)
+            {
+                error = StagedDirectory_Remove(stagingPath.c_str());
+            }
+        }
+
+        if (0 != error)
+        {
+            Fail(ExpansionModeNames[mode], directory, error);
+        }
+    }
+
+    double totalMilliseconds = MillisecondsSince(start);
+
+    struct stat stagingAttributes;
+    if (entryCount != CountChildren(directory) || 0 == stat(stagingPath.c_str(), &stagingAttributes))
+    {
+        fprintf(stderr, "%s expansion of %u entries left the wrong directories behind\n", ExpansionModeNames[mode], entryCount);
+        exit(1);
+    }
+
+    int error = StagedDirectory_Remove(directory.c_str());
+    if (0 != error)
+    {
+        Fail("StagedDirectory_Remove", directory, error);
+    }
+
+    printf(
+        "%6u entries  %-8s  readers blocked %10.3f ms  expansion %9.1f ms\n",
+        entryCount,
+        ExpansionModeNames[mode],
+        blockedMilliseconds,
+        totalMilliseconds);
+}
+
+int main()
+{
+    const char* tempDirectory = getenv("TMPDIR");
+    std::string parent = std::string(nullptr != tempDirectory ? tempDirectory : "/tmp") + "/StagedExpansionBenchmarkXXXXXX";
+    if (nullptr == mkdtemp(&parent[0]))
+    {
+        Fail("mkdtemp", parent, errno);
+    }
+
+    const unsigned entryCounts[] = { 10, 100, 1000, 10000, 100000 };
+    for (unsigned entryCount : entryCounts)
+    {
+        for (ExpansionMode mode : { ExpansionMode_InPlace, ExpansionMode_Staged, ExpansionMode_Exchange })
+        {
+            RunBenchmark(parent, entryCount, mode);
+        }
+    }
+
+    rmdir(parent.c_str());
+    return 0;
+}
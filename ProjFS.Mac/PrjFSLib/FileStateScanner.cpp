@@ -0,0 +1,552 @@
+#include "FileStateScanner.hpp"
+#include "PlaceholderWriter.hpp"
+#include "StagedDirectory.hpp"
+#include "PrjFSKext/public/PrjFSCommon.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#ifndef ENOATTR
+#define ENOATTR ENODATA
+#endif
+
+#ifdef __APPLE__
+static const char* const FileXAttrName = PrjFSFileXAttrName;
+#else
+// Linux only lets unprivileged processes use xattrs in the user namespace
+static const char* const FileXAttrName = "user." PrjFSFileXAttrName;
+#endif
+
+// Closed once the directory and every child directory queued from it have been scanned
+struct OpenDirectory
+{
+    explicit OpenDirectory(int fd) : fd(fd) {}
+    ~OpenDirectory() { close(this->fd); }
+    OpenDirectory(const OpenDirectory&) = delete;
+    OpenDirectory& operator=(const OpenDirectory&) = delete;
+
+    int fd;
+};
+
+struct DirectoryTask
+{
+    // Null for the directory the scan starts at, which is opened by its full path
+    std::shared_ptr<OpenDirectory> parent;
+    std::string relativePath;
+    size_t nameOffset;
+};
+
+struct ScanWorker
+{
+    // The worker takes directories from the back of its own queue, so it goes depth first and few directories
+    // are open at a time. Other workers steal from the front, which has the directories nearest the top of the
+    // tree and so likely the most under them.
+    std::mutex mutex;
+    std::deque<DirectoryTask> tasks;
+
+    PrjFS_FileStateCounts counts;
+};
+
+struct Scan
+{
+    std::string rootPath;
+    std::vector<ScanWorker> workers;
+
+    // Directories that are queued or being scanned. Child directories are queued before their parent is done,
+    // so this only drops to zero once the whole tree has been scanned.
+    std::atomic<size_t> pendingTaskCount;
+    std::atomic<int> firstError;
+
+    // Workers that run out of directories wait for taskGeneration to change, which it does when directories are
+    // queued while any worker is idle, or for pendingTaskCount to reach zero
+    std::mutex idleMutex;
+    std::condition_variable idleChanged;
+    std::atomic<size_t> idleWorkerCount;
+    uint64_t taskGeneration;
+
+    PrjFS_FileStateCallback* callback;
+    void* callbackContext;
+    std::mutex callbackMutex;
+};
+
+static int GetFileStateFromFlags(int fd, bool isDirectory, uint32_t fileFlags, PrjFS_FileState* fileState);
+static int GetChildFileState(int directoryFd, const char* name, unsigned char type, PrjFS_FileState* fileState);
+static void RunWorker(Scan* scan, size_t workerIndex);
+static bool TakeTask(Scan* scan, size_t workerIndex, DirectoryTask* task);
+static bool WaitForTask(Scan* scan, size_t workerIndex, DirectoryTask* task);
+static void NotifyIdleWorkers(Scan* scan);
+static bool IsLeftBehindByPrjFSLib(const char* name);
+static void ScanDirectory(Scan* scan, size_t workerIndex, const DirectoryTask& task);
+static void AddFileState(Scan* scan, size_t workerIndex, const std::string& relativePath, bool isDirectory, PrjFS_FileState fileState);
+static std::string CombineRelativePaths(const std::string& parent, const char* name);
+static void RecordError(Scan* scan, int error);
+
+int FileStateScanner_GetFileState(int directoryFd, const char* path, PrjFS_FileState* fileState)
+{
+    // Not blocking, in case path is a FIFO
+    int fd = openat(directoryFd, path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (ELOOP == errno)
+        {
+            // A symlink
+            *fileState = PrjFS_FileState_Full;
+            return 0;
+        }
+
+        return errno;
+    }
+
+    struct stat fileAttributes;
+    uint32_t fileFlags = 0;
+    int error = fstat(fd, &fileAttributes) ? errno : 0;
+    if (0 == error && (S_ISREG(fileAttributes.st_mode) || S_ISDIR(fileAttributes.st_mode)))
+    {
+        error = PlaceholderWriter_GetFileFlags(fd, &fileFlags);
+    }
+
+    if (0 == error)
+    {
+        error = GetFileStateFromFlags(fd, S_ISDIR(fileAttributes.st_mode), fileFlags, fileState);
+    }
+
+    close(fd);
+    return error;
+}
+
+int FileStateScanner_Scan(
+    const char* rootPath,
+    const char* relativeDirectoryPath,
+    unsigned int threadCount,
+    PrjFS_FileStateCounts* counts,
+    PrjFS_FileStateCallback* callback,
+    void* callbackContext)
+{
+    threadCount = std::max(threadCount, 1U);
+
+    Scan scan;
+    scan.rootPath = rootPath;
+    scan.workers = std::vector<ScanWorker>(threadCount);
+    scan.pendingTaskCount = 1;
+    scan.firstError = 0;
+    scan.idleWorkerCount = 0;
+    scan.taskGeneration = 0;
+    scan.callback = callback;
+    scan.callbackContext = callbackContext;
+
+    for (ScanWorker& worker : scan.workers)
+    {
+        memset(&worker.counts, 0, sizeof(worker.counts));
+    }
+
+    scan.workers[0].tasks.push_back(DirectoryTask { nullptr, relativeDirectoryPath, 0 });
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; ++i)
+    {
+        threads.emplace_back(RunWorker, &scan, i);
+    }
+
+    RunWorker(&scan, 0);
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    memset(counts, 0, sizeof(*counts));
+    for (const ScanWorker& worker : scan.workers)
+    {
+        counts->placeholderFileCount += worker.counts.placeholderFileCount;
+        counts->hydratedPlaceholderFileCount += worker.counts.hydratedPlaceholderFileCount;
+        counts->fullFileCount += worker.counts.fullFileCount;
+        counts->placeholderDirectoryCount += worker.counts.placeholderDirectoryCount;
+        counts->hydratedPlaceholderDirectoryCount += worker.counts.hydratedPlaceholderDirectoryCount;
+        counts->fullDirectoryCount += worker.counts.fullDirectoryCount;
+    }
+
+    return scan.firstError;
+}
+
+static int GetFileStateFromFlags(int fd, bool isDirectory, uint32_t fileFlags, PrjFS_FileState* fileState)
+{
+    if (0 == (fileFlags & FileFlags_IsInVirtualizationRoot))
+    {
+        *fileState = PrjFS_FileState_Full;
+    }
+    else if (fileFlags & FileFlags_IsEmpty)
+    {
+        *fileState = PrjFS_FileState_Placeholder;
+    }
+    else if (isDirectory)
+    {
+        *fileState = PrjFS_FileState_HydratedPlaceholder;
+    }
+    else
+    {
+        // A hydrated placeholder loses its xattr once it is modified
+#ifdef __APPLE__
+        ssize_t xattrSize = fgetxattr(fd, FileXAttrName, nullptr, 0, 0, 0);
+#else
+        ssize_t xattrSize = fgetxattr(fd, FileXAttrName, nullptr, 0);
+#endif
+        if (xattrSize < 0 && ENOATTR != errno)
+        {
+            return errno;
+        }
+
+        *fileState = xattrSize < 0 ? PrjFS_FileState_Full : PrjFS_FileState_HydratedPlaceholder;
+    }
+
+    return 0;
+}
+
+// type is the DT_ value readdir gave for the entry
+static int GetChildFileState(int directoryFd, const char* name, unsigned char type, PrjFS_FileState* fileState)
+{
+    if (DT_REG != type)
+    {
+        *fileState = PrjFS_FileState_Full;
+        return 0;
+    }
+
+#ifdef __APPLE__
+    // The flags come with the file's attributes, so only files that may be either hydrated placeholders or full
+    // files have to be opened
+    struct stat fileAttributes;
+    if (fstatat(directoryFd, name, &fileAttributes, AT_SYMLINK_NOFOLLOW))
+    {
+        return errno;
+    }
+
+    uint32_t fileFlags = S_ISREG(fileAttributes.st_mode) ? fileAttributes.st_flags : 0;
+    if (FileFlags_IsInVirtualizationRoot != (fileFlags & (FileFlags_IsInVirtualizationRoot | FileFlags_IsEmpty)))
+    {
+        return GetFileStateFromFlags(-1, false, fileFlags, fileState);
+    }
+
+    return FileStateScanner_GetFileState(directoryFd, name, fileState);
+#else
+    // The flags are in an xattr, which has to be read through an fd, but the file is already known to be a
+    // regular file so doesn't need an fstat
+    int fd = openat(directoryFd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    uint32_t fileFlags;
+    int error = PlaceholderWriter_GetFileFlags(fd, &fileFlags);
+    if (0 == error)
+    {
+        error = GetFileStateFromFlags(fd, false, fileFlags, fileState);
+    }
+
+    close(fd);
+    return error;
+#endif
+}
+
+static void RunWorker(Scan* scan, size_t workerIndex)
+{
+    DirectoryTask task;
+    while (true)
+    {
+        if (!TakeTask(scan, workerIndex, &task) && !WaitForTask(scan, workerIndex, &task))
+        {
+            if (0 == scan->pendingTaskCount)
+            {
+                return;
+            }
+
+            continue;
+        }
+
+        ScanDirectory(scan, workerIndex, task);
+
+        // Lets go of the parent directory before the task is counted as done
+        task = DirectoryTask();
+        if (0 == --scan->pendingTaskCount)
+        {
+            // Lets the idle workers return too
+            NotifyIdleWorkers(scan);
+            return;
+        }
+    }
+}
+
+// Returns true if a directory was taken, and false once another worker has queued directories or the scan has
+// finished
+static bool WaitForTask(Scan* scan, size_t workerIndex, DirectoryTask* task)
+{
+    // Counted as idle before looking again, so that a worker that queues directories after that look sees it
+    // and changes the generation this worker waits on
+    ++scan->idleWorkerCount;
+    uint64_t taskGeneration;
+    {
+        std::lock_guard<std::mutex> lock(scan->idleMutex);
+        taskGeneration = scan->taskGeneration;
+    }
+
+    bool tookTask = TakeTask(scan, workerIndex, task);
+    if (!tookTask)
+    {
+        std::unique_lock<std::mutex> lock(scan->idleMutex);
+        scan->idleChanged.wait(
+            lock,
+            [scan, taskGeneration] { return taskGeneration != scan->taskGeneration || 0 == scan->pendingTaskCount; });
+    }
+
+    --scan->idleWorkerCount;
+    return tookTask;
+}
+
+static bool TakeTask(Scan* scan, size_t workerIndex, DirectoryTask* task)
+{
+    {
+        ScanWorker& worker = scan->workers[workerIndex];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.tasks.empty())
+        {
+            *task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < scan->workers.size(); ++i)
+    {
+        ScanWorker& victim = scan->workers[(workerIndex + i) % scan->workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            *task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void NotifyIdleWorkers(Scan* scan)
+{
+    {
+        std::lock_guard<std::mutex> lock(scan->idleMutex);
+        ++scan->taskGeneration;
+    }
+
+    scan->idleChanged.notify_all();
+}
+
+// Half written placeholders, and staging directories from versions of PrjFSLib that kept them in the
+// virtualization root, are not part of the tree
+static bool IsLeftBehindByPrjFSLib(const char* name)
+{
+    return
+        0 == strncmp(name, PlaceholderWriter_UpdateNamePrefix, sizeof(PlaceholderWriter_UpdateNamePrefix) - 1) ||
+        0 == strncmp(name, StagedDirectory_NamePrefix, sizeof(StagedDirectory_NamePrefix) - 1);
+}
+
+static void ScanDirectory(Scan* scan, size_t workerIndex, const DirectoryTask& task)
+{
+    int fd;
+    if (nullptr == task.parent)
+    {
+        std::string fullPath = task.relativePath.empty() ? scan->rootPath : scan->rootPath + "/" + task.relativePath;
+        fd = open(fullPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    else
+    {
+        fd = openat(task.parent->fd, task.relativePath.c_str() + task.nameOffset, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+
+    if (fd < 0)
+    {
+        if (nullptr == task.parent)
+        {
+            // Unlike entries under it, the directory the scan starts at going missing is an error
+            scan->firstError = errno;
+        }
+        else
+        {
+            RecordError(scan, errno);
+        }
+
+        return;
+    }
+
+    std::shared_ptr<OpenDirectory> directory = std::make_shared<OpenDirectory>(fd);
+    if (nullptr != task.parent)
+    {
+        uint32_t fileFlags;
+        PrjFS_FileState fileState;
+        int error = PlaceholderWriter_GetFileFlags(fd, &fileFlags);
+        if (0 == error)
+        {
+            error = GetFileStateFromFlags(fd, true, fileFlags, &fileState);
+        }
+
+        if (0 != error)
+        {
+            RecordError(scan, error);
+            return;
+        }
+
+        AddFileState(scan, workerIndex, task.relativePath, true, fileState);
+        if (PrjFS_FileState_Placeholder == fileState)
+        {
+            // Not enumerated yet, so it has no children
+            return;
+        }
+    }
+
+    // fdopendir takes ownership of the fd it is given
+    int readFd = dup(fd);
+    DIR* handle = readFd < 0 ? nullptr : fdopendir(readFd);
+    if (nullptr == handle)
+    {
+        RecordError(scan, errno);
+        if (readFd >= 0)
+        {
+            close(readFd);
+        }
+
+        return;
+    }
+
+    std::vector<DirectoryTask> childDirectories;
+    while (true)
+    {
+        // readdir only sets errno when it fails
+        errno = 0;
+        dirent* entry = readdir(handle);
+        if (nullptr == entry)
+        {
+            if (0 != errno)
+            {
+                RecordError(scan, errno);
+            }
+
+            break;
+        }
+
+        const char* name = entry->d_name;
+        if (0 == strcmp(name, ".") || 0 == strcmp(name, "..") || IsLeftBehindByPrjFSLib(name))
+        {
+            continue;
+        }
+
+        unsigned char type = entry->d_type;
+        if (DT_UNKNOWN == type)
+        {
+            struct stat fileAttributes;
+            if (fstatat(fd, name, &fileAttributes, AT_SYMLINK_NOFOLLOW))
+            {
+                RecordError(scan, errno);
+                continue;
+            }
+
+            type = IFTODT(fileAttributes.st_mode);
+        }
+
+        if (DT_DIR == type)
+        {
+            std::string childPath = CombineRelativePaths(task.relativePath, name);
+            size_t nameOffset = childPath.size() - strlen(name);
+            childDirectories.push_back(DirectoryTask { directory, std::move(childPath), nameOffset });
+            continue;
+        }
+
+        PrjFS_FileState fileState;
+        int error = GetChildFileState(fd, name, type, &fileState);
+        if (0 != error)
+        {
+            RecordError(scan, error);
+            continue;
+        }
+
+        // The path is only built for files that are reported
+        AddFileState(
+            scan,
+            workerIndex,
+            PrjFS_FileState_Placeholder == fileState || nullptr == scan->callback ? std::string() : CombineRelativePaths(task.relativePath, name),
+            false,
+            fileState);
+    }
+
+    closedir(handle);
+
+    if (!childDirectories.empty())
+    {
+        scan->pendingTaskCount += childDirectories.size();
+
+        {
+            ScanWorker& worker = scan->workers[workerIndex];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            for (DirectoryTask& childDirectory : childDirectories)
+            {
+                worker.tasks.push_back(std::move(childDirectory));
+            }
+        }
+
+        if (0 != scan->idleWorkerCount)
+        {
+            NotifyIdleWorkers(scan);
+        }
+    }
+}
+
+static void AddFileState(Scan* scan, size_t workerIndex, const std::string& relativePath, bool isDirectory, PrjFS_FileState fileState)
+{
+    PrjFS_FileStateCounts& counts = scan->workers[workerIndex].counts;
+    switch (fileState)
+    {
+        case PrjFS_FileState_Placeholder:
+            ++(isDirectory ? counts.placeholderDirectoryCount : counts.placeholderFileCount);
+            return;
+
+        case PrjFS_FileState_HydratedPlaceholder:
+            ++(isDirectory ? counts.hydratedPlaceholderDirectoryCount : counts.hydratedPlaceholderFileCount);
+            break;
+
+        default:
+            ++(isDirectory ? counts.fullDirectoryCount : counts.fullFileCount);
+            break;
+    }
+
+    if (nullptr != scan->callback)
+    {
+        std::lock_guard<std::mutex> lock(scan->callbackMutex);
+        scan->callback(scan->callbackContext, relativePath.c_str(), isDirectory, fileState);
+    }
+}
+
+static std::string CombineRelativePaths(const std::string& parent, const char* name)
+{
+    return parent.empty() ? std::string(name) : parent + "/" + name;
+}
+
+static void RecordError(Scan* scan, int error)
+{
+    // Entries may be removed while the scan runs
+    if (ENOENT == error)
+    {
+        return;
+    }
+
+    int noError = 0;
+    scan->firstError.compare_exchange_strong(noError, error);
+}
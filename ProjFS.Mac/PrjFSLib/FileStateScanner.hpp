@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include "PrjFSLib.h"
+
+// Finds the on disk state of files and directories in a virtualization root from their file flags and xattrs.
+// Functions return 0 on success or an errno value.
+
+// Gets the state of the file or directory at path, which is relative to directoryFd and may be AT_FDCWD.
+// Anything that is not a file or directory, such as a symlink, is full.
+int FileStateScanner_GetFileState(int directoryFd, const char* path, PrjFS_FileState* fileState);
+
+// Counts the states of everything under rootPath/relativeDirectoryPath, not including the directory itself,
+// and calls callback, if there is one, for each hydrated placeholder and full file or directory with its path
+// relative to rootPath. Placeholder directories that have not been enumerated have no children to scan.
+// Directories are spread across up to threadCount threads, each of which works through its own queue and takes
+// directories from the others' queues once it runs out. Each directory is opened once, and its children are
+// looked up relative to it. Calls to callback are made from the scanning threads, one at a time.
+// Entries removed while the scan runs are skipped. Other errors don't stop the scan, and the first one is
+// returned once it has finished.
+int FileStateScanner_Scan(
+    const char* rootPath,
+    const char* relativeDirectoryPath,
+    unsigned int threadCount,
+    PrjFS_FileStateCounts* counts,
+    PrjFS_FileStateCallback* callback,
+    void* callbackContext);
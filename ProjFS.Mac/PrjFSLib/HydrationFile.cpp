@@ -0,0 +1,214 @@
+#include "HydrationFile.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <memory>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int CopyFromWithMap(int fd, off_t offset, int sourceFd, off_t sourceOffset, size_t byteCount);
+static int CopyFromWithBuffer(int fd, off_t offset, int sourceFd, off_t sourceOffset, size_t byteCount);
+
+int HydrationFile_Preallocate(int fd, off_t size)
+{
+    if (size <= 0)
+    {
+        return 0;
+    }
+
+#ifdef __APPLE__
+    // Placeholders are sparse, so allocate from the physical end of the file. Try for a contiguous
+    // allocation first, then accept a fragmented one.
+    fstore_t store = { F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, size, 0 };
+    if (-1 == fcntl(fd, F_PREALLOCATE, &store))
+    {
+        store.fst_flags = F_ALLOCATEALL;
+        if (-1 == fcntl(fd, F_PREALLOCATE, &store))
+        {
+            return errno;
+        }
+    }
+
+    return 0;
+#else
+    return posix_fallocate(fd, 0, size);
+#endif
+}
+
+int HydrationFile_Write(int fd, const void* bytes, size_t byteCount, off_t offset)
+{
+    const char* remaining = static_cast<const char*>(bytes);
+    while (byteCount > 0)
+    {
+        ssize_t written = pwrite(fd, remaining, byteCount, offset);
+        if (written < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+
+            return errno;
+        }
+
+        remaining += written;
+        byteCount -= written;
+        offset += written;
+    }
+
+    return 0;
+}
+
+int HydrationFile_CopyFrom(int fd, off_t offset, int sourceFd, off_t sourceOffset, size_t byteCount)
+{
+#ifdef __linux__
+    // copy_file_range copies within the kernel, and may share extents on file systems that support it
+    while (byteCount > 0)
+    {
+        loff_t sourcePosition = sourceOffset;
+        loff_t position = offset;
+        ssize_t copied = copy_file_range(sourceFd, &sourcePosition, fd, &position, byteCount, 0);
+        if (copied < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+
+            if (EXDEV == errno || ENOSYS == errno || EINVAL == errno || EOPNOTSUPP == errno)
+            {
+                // Not supported between these files, copy what is left another way
+                break;
+            }
+
+            return errno;
+        }
+
+        if (0 == copied)
+        {
+            // The source is shorter than the requested range
+            return EIO;
+        }
+
+        sourceOffset += copied;
+        offset += copied;
+        byteCount -= copied;
+    }
+
+    if (0 == byteCount)
+    {
+        return 0;
+    }
+#endif
+
+    int result = CopyFromWithMap(fd, offset, sourceFd, sourceOffset, byteCount);
+    if (ENODEV == result || EACCES == result || EINVAL == result)
+    {
+        // The source can't be mapped, for example because it is a pipe
+        result = CopyFromWithBuffer(fd, offset, sourceFd, sourceOffset, byteCount);
+    }
+
+    return result;
+}
+
+static int CopyFromWithMap(int fd, off_t offset, int sourceFd, off_t sourceOffset, size_t byteCount)
+{
+    // Writing straight from a mapping of the source saves copying the bytes into a buffer first
+    static const size_t MaxMapSize = 64 * 1024 * 1024;
+    const off_t pageSize = sysconf(_SC_PAGESIZE);
+
+    struct stat sourceAttributes;
+    if (0 != fstat(sourceFd, &sourceAttributes))
+    {
+        return errno;
+    }
+
+    if (!S_ISREG(sourceAttributes.st_mode))
+    {
+        return ENODEV;
+    }
+
+    // Touching a mapped page past the end of the source raises SIGBUS rather than failing
+    if (sourceOffset < 0 || static_cast<uint64_t>(sourceAttributes.st_size) < static_cast<uint64_t>(sourceOffset) + byteCount)
+    {
+        return EIO;
+    }
+
+    while (byteCount > 0)
+    {
+        off_t mapOffset = sourceOffset - (sourceOffset % pageSize);
+        size_t leadingBytes = static_cast<size_t>(sourceOffset - mapOffset);
+        size_t chunkSize = byteCount < MaxMapSize ? byteCount : MaxMapSize;
+
+        void* map = mmap(nullptr, leadingBytes + chunkSize, PROT_READ, MAP_SHARED, sourceFd, mapOffset);
+        if (MAP_FAILED == map)
+        {
+            return errno;
+        }
+
+        madvise(map, leadingBytes + chunkSize, MADV_SEQUENTIAL);
+        int result = HydrationFile_Write(fd, static_cast<const char*>(map) + leadingBytes, chunkSize, offset);
+        munmap(map, leadingBytes + chunkSize);
+        if (0 != result)
+        {
+            return result;
+        }
+
+        sourceOffset += chunkSize;
+        offset += chunkSize;
+        byteCount -= chunkSize;
+    }
+
+    return 0;
+}
+
+static int CopyFromWithBuffer(int fd, off_t offset, int sourceFd, off_t sourceOffset, size_t byteCount)
+{
+    static const size_t BufferSize = 1024 * 1024;
+    std::unique_ptr<char[]> buffer(new char[BufferSize]);
+    bool seekable = true;
+
+    while (byteCount > 0)
+    {
+        size_t readSize = byteCount < BufferSize ? byteCount : BufferSize;
+        ssize_t bytesRead =
+            seekable
+            ? pread(sourceFd, buffer.get(), readSize, sourceOffset)
+            : read(sourceFd, buffer.get(), readSize);
+        if (bytesRead < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+
+            if (ESPIPE == errno && seekable && 0 == sourceOffset)
+            {
+                // A pipe or socket, which is read from wherever it is up to
+                seekable = false;
+                continue;
+            }
+
+            return errno;
+        }
+
+        if (0 == bytesRead)
+        {
+            // The source is shorter than the requested range
+            return EIO;
+        }
+
+        int result = HydrationFile_Write(fd, buffer.get(), bytesRead, offset);
+        if (0 != result)
+        {
+            return result;
+        }
+
+        sourceOffset += bytesRead;
+        offset += bytesRead;
+        byteCount -= bytesRead;
+    }
+
+    return 0;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// File operations used to write the contents of files being hydrated. They only use POSIX calls, plus
+// platform specific fast paths where available, so that they can be benchmarked on Linux.
+// Functions return 0 on success or an errno value.
+
+// Reserves space for the first size bytes of the file without changing its size, so that the provider's
+// writes do not extend the file's allocation piece by piece. Preallocation is only a hint; failing to
+// preallocate does not prevent writing the file.
+int HydrationFile_Preallocate(int fd, off_t size);
+
+// Writes all of bytes at offset, retrying short and interrupted writes
+int HydrationFile_Write(int fd, const void* bytes, size_t byteCount, off_t offset);
+
+// Copies byteCount bytes starting at sourceOffset in sourceFd to offset in fd, without passing them through
+// a user space buffer where the platform allows it. Sources that can't seek, such as pipes, are read from
+// their current position and sourceOffset must be 0. Returns EIO if the source ends before byteCount bytes.
+int HydrationFile_CopyFrom(int fd, off_t offset, int sourceFd, off_t sourceOffset, size_t byteCount);
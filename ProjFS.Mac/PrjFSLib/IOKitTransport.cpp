@@ -0,0 +1,131 @@
+#include "IOKitTransport.hpp"
+#include "../PrjFSKext/public/MessageRing.h"
+#include <IOKit/IOKitLib.h>
+#include <IOKit/IODataQueueClient.h>
+#include <errno.h>
+#include <iostream>
+#include <mach/mach_port.h>
+#include <string.h>
+#include <type_traits>
+
+static void ClearMachNotification(mach_port_t port);
+
+IOKitTransport::IOKitTransport() :
+    connection(IO_OBJECT_NULL),
+    dispatchQueue(nullptr),
+    messageRing(nullptr)
+{
+    memset(&this->dataQueue, 0, sizeof(this->dataQueue));
+}
+
+PrjFS_Result IOKitTransport::Connect()
+{
+    this->connection = PrjFSService_ConnectToDriver(UserClientType_Provider);
+    if (IO_OBJECT_NULL == this->connection)
+    {
+        return PrjFS_Result_EDriverNotLoaded;
+    }
+
+    this->dispatchQueue = dispatch_queue_create("PrjFS Kernel Message Handling", DISPATCH_QUEUE_SERIAL);
+    if (!PrjFSService_DataQueueInit(&this->dataQueue, this->connection, ProviderPortType_MessageQueue, ProviderMemoryType_MessageQueue, this->dispatchQueue))
+    {
+        std::cerr << "Failed to set up shared data queue.\n";
+        return PrjFS_Result_EInvalidOperation;
+    }
+
+    mach_vm_address_t messageRingAddress = 0;
+    mach_vm_size_t messageRingSize = 0;
+    IOReturn result = IOConnectMapMemory64(
+        this->connection,
+        ProviderMemoryType_MessageRing,
+        mach_task_self(),
+        &messageRingAddress,
+        &messageRingSize,
+        kIOMapAnywhere);
+    MessageRingHeader* messageRing = reinterpret_cast<MessageRingHeader*>(messageRingAddress);
+    if (kIOReturnSuccess != result ||
+        0 == messageRingAddress ||
+        messageRingSize < sizeof(MessageRingHeader) ||
+        messageRingSize < MessageRing_GetMemorySize(messageRing->capacity))
+    {
+        std::cerr << "Failed to map message ring: 0x" << std::hex << result << std::endl;
+        return PrjFS_Result_EInvalidOperation;
+    }
+
+    this->messageRing = messageRing;
+
+    return PrjFS_Result_Success;
+}
+
+bool IOKitTransport::Start(MessageHandler handler)
+{
+    DataQueueResources dataQueue = this->dataQueue;
+    MessageRingHeader* messageRing = this->messageRing;
+    dispatch_source_set_event_handler(dataQueue.dispatchSource, ^{
+        ClearMachNotification(dataQueue.notificationPort);
+
+        // The data queue only holds wakeups
+        while (nullptr != IODataQueuePeek(dataQueue.queueMemory))
+        {
+            IODataQueueDequeue(dataQueue.queueMemory, nullptr, nullptr);
+        }
+
+        // Messages are handled in place in the ring, a batch at a time so that the kext can reuse their space
+        // while the rest are handled. Once there are none left, the next one the kext commits wakes us up again.
+        while (0 != MessageRing_Drain(messageRing, KernelTransportMessageBatchSize, handler) ||
+               !MessageRing_PrepareToWait(messageRing))
+        {
+        }
+    });
+    dispatch_resume(dataQueue.dispatchSource);
+
+    return true;
+}
+
+int IOKitTransport::RegisterVirtualizationRootPath(const char* path)
+{
+    uint64_t error = EBADMSG;
+    uint32_t output_count = 1;
+    size_t pathSize = strlen(path) + 1;
+    IOReturn callResult = IOConnectCallMethod(
+        this->connection,
+        ProviderSelector_RegisterVirtualizationRootPath,
+        nullptr, 0, // no scalar inputs
+        path, pathSize, // struct input
+        &error, &output_count, // scalar output
+        nullptr, nullptr); // no struct output
+    return callResult == kIOReturnSuccess ? static_cast<int>(error) : EBADMSG;
+}
+
+int IOKitTransport::SendResponse(uint64_t messageId, MessageType responseType)
+{
+    const uint64_t inputs[] = { messageId, responseType };
+    IOReturn callResult = IOConnectCallScalarMethod(
+        this->connection,
+        ProviderSelector_KernelMessageResponse,
+        inputs, std::extent<decltype(inputs)>::value, // scalar inputs
+        nullptr, nullptr);                            // no outputs
+    return callResult == kIOReturnSuccess ? 0 : EBADMSG;
+}
+
+int IOKitTransport::SendResponseBatch(const uint64_t* messageIds, uint32_t messageIdCount, MessageType responseType)
+{
+    const uint64_t inputs[] = { responseType };
+    IOReturn callResult = IOConnectCallMethod(
+        this->connection,
+        ProviderSelector_KernelMessageResponses,
+        inputs, std::extent<decltype(inputs)>::value,  // scalar inputs
+        messageIds, messageIdCount * sizeof(uint64_t), // struct input
+        nullptr, nullptr,                              // no scalar outputs
+        nullptr, nullptr);                             // no struct output
+    return callResult == kIOReturnSuccess ? 0 : EBADMSG;
+}
+
+static void ClearMachNotification(mach_port_t port)
+{
+    struct {
+        mach_msg_header_t	msgHdr;
+        mach_msg_trailer_t	trailer;
+    } msg;
+    mach_msg(&msg.msgHdr, MACH_RCV_MSG | MACH_RCV_TIMEOUT, 0, sizeof(msg), port, 0, MACH_PORT_NULL);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "KernelTransport.hpp"
+#include "PrjFSLib.h"
+#include "PrjFSUser.hpp"
+
+struct MessageRingHeader;
+
+// The kext's provider user client: messages arrive in a MessageRing, and an IOSharedDataQueue, whose notifications
+// are handled on a serial dispatch queue, wakes the provider when it has run out of them. Responses are external
+// method calls.
+class IOKitTransport : public KernelTransport
+{
+public:
+    IOKitTransport();
+
+    // Opens the connection to the kext and maps its message ring. Messages the kext sends from then on wait in
+    // the ring until Start is called.
+    PrjFS_Result Connect();
+
+    virtual bool Start(MessageHandler handler) override;
+    virtual int RegisterVirtualizationRootPath(const char* path) override;
+    virtual int SendResponse(uint64_t messageId, MessageType responseType) override;
+    virtual int SendResponseBatch(const uint64_t* messageIds, uint32_t messageIdCount, MessageType responseType) override;
+
+private:
+    io_connect_t connection;
+    dispatch_queue_t dispatchQueue;
+    DataQueueResources dataQueue;
+    MessageRingHeader* messageRing;
+};
@@ -0,0 +1,146 @@
+#include "KernelSimulator.hpp"
+#include "../../PrjFSKext/public/PrjFSProviderClientShared.h"
+#include <condition_variable>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A thread blocked in SendRequest, like a kauth thread sleeping on its OutstandingMessage
+struct WaitingRequest : OutstandingMessage
+{
+    std::condition_variable responseReceived;
+};
+
+KernelSimulator::KernelSimulator() :
+    nextMessageId(1),
+    isStopping(false)
+{
+    memset(&this->channel, 0, sizeof(this->channel));
+    LIST_INIT(&this->outstandingMessages);
+}
+
+KernelSimulator::~KernelSimulator()
+{
+    if (this->responseThread.joinable())
+    {
+        this->isStopping = true;
+        SharedMemoryNotification_Signal(this->channel.responsesAvailable);
+        this->responseThread.join();
+        SharedMemoryChannel_Destroy(&this->channel);
+    }
+}
+
+int KernelSimulator::Start(uint32_t ringCapacity)
+{
+    int error = SharedMemoryChannel_Create(ringCapacity, &this->channel);
+    if (0 != error)
+    {
+        return error;
+    }
+
+    MessageRing_InitProducer(&this->messageRingProducer, ringCapacity);
+    this->responseThread = std::thread(&KernelSimulator::ReadResponses, this);
+    return 0;
+}
+
+const SharedMemoryChannel& KernelSimulator::GetChannel() const
+{
+    return this->channel;
+}
+
+std::string KernelSimulator::GetVirtualizationRootPath() const
+{
+    const SharedMemoryChannelHeader* header = SharedMemoryChannel_GetHeader(this->channel);
+    if (0 == header->isVirtualizationRootRegistered.load(std::memory_order_acquire))
+    {
+        return std::string();
+    }
+
+    return header->virtualizationRootPath;
+}
+
+MessageType KernelSimulator::SendRequest(MessageType messageType, const char* relativePath, int32_t pid, const char* procname)
+{
+    size_t pathSize = strlen(relativePath) + 1;
+    if (pathSize > PrjFSMaxPath)
+    {
+        return MessageType_Response_Fail;
+    }
+
+    WaitingRequest request;
+    request.request = MessageHeader();
+    request.request.messageId = this->nextMessageId++;
+    request.request.messageType = messageType;
+    request.request.pid = pid;
+    snprintf(request.request.procname, sizeof(request.request.procname), "%s", procname);
+    request.request.pathSizeBytes = static_cast<uint16_t>(pathSize);
+    request.response = MessageType_Invalid;
+    request.receivedResponse = false;
+
+    // The response can come as soon as the message is in the ring, so the request has to be waiting for it first
+    std::unique_lock<std::mutex> outstandingMessagesLock(this->outstandingMessagesMutex);
+    LIST_INSERT_HEAD(&this->outstandingMessages, &request, _list_privates);
+    outstandingMessagesLock.unlock();
+
+    // As the kext does in PrjFSProviderUserClient::sendMessage, the header and path are written into the ring in
+    // place as one message
+    MessageRingHeader* ring = SharedMemoryChannel_GetMessageRing(this->channel);
+    uint32_t messageSize = sizeof(MessageHeader) + request.request.pathSizeBytes;
+    uint64_t position;
+    uint8_t* messageMemory;
+    while (nullptr == (messageMemory = static_cast<uint8_t*>(
+               MessageRing_Reserve(ring, &this->messageRingProducer, messageSize, &position))))
+    {
+        // As the kext does, wait for the provider to make room
+        std::this_thread::yield();
+    }
+
+    memcpy(messageMemory, &request.request, sizeof(MessageHeader));
+    memcpy(messageMemory + sizeof(MessageHeader), relativePath, request.request.pathSizeBytes);
+    if (MessageRing_Commit(ring, &this->messageRingProducer, position, messageSize))
+    {
+        SharedMemoryNotification_Signal(this->channel.messagesAvailable);
+    }
+
+    outstandingMessagesLock.lock();
+    request.responseReceived.wait(outstandingMessagesLock, [&request] { return request.receivedResponse; });
+    LIST_REMOVE(&request, _list_privates);
+    return request.response;
+}
+
+void KernelSimulator::ReadResponses()
+{
+    MessageRingHeader* ring = SharedMemoryChannel_GetResponseRing(this->channel);
+    auto deliverResponse =
+        [this](const void* record, uint32_t recordSize)
+        {
+            SharedMemoryResponse response;
+            memcpy(&response, record, sizeof(response));
+            // Records are 8 byte aligned, so the message IDs can be read where they are
+            const uint64_t* messageIds = reinterpret_cast<const uint64_t*>(static_cast<const uint8_t*>(record) + sizeof(response));
+            if (recordSize != sizeof(response) + response.messageIdCount * sizeof(uint64_t) ||
+                response.messageIdCount > PrjFSMaxKernelMessageResponseBatch ||
+                !OutstandingMessages_IsValidResponseBatch(messageIds, response.messageIdCount))
+            {
+                fprintf(stderr, "KernelSimulator: bad response of %u bytes\n", recordSize);
+                abort();
+            }
+
+            std::lock_guard<std::mutex> lock(this->outstandingMessagesMutex);
+            OutstandingMessages_DeliverResponses(
+                &this->outstandingMessages,
+                messageIds,
+                response.messageIdCount,
+                static_cast<MessageType>(response.responseType),
+                [](OutstandingMessage* message) { static_cast<WaitingRequest*>(message)->responseReceived.notify_one(); });
+        };
+
+    while (!this->isStopping)
+    {
+        if (0 == MessageRing_Drain(ring, KernelTransportMessageBatchSize, deliverResponse) &&
+            MessageRing_PrepareToWait(ring))
+        {
+            SharedMemoryNotification_Wait(this->channel.responsesAvailable);
+        }
+    }
+}
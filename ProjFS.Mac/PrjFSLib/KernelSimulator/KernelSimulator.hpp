@@ -0,0 +1,49 @@
+#pragma once
+
+// Builds with PrjFSKext/public on the include path, as the kext's OutstandingMessages.hpp expects
+#include "../SharedMemoryTransport.hpp"
+#include "../../PrjFSKext/PrjFSKext/OutstandingMessages.hpp"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Plays the kext's part for a provider connected through SharedMemoryTransport, so that PrjFSLib's message handling
+// can be run and load tested where there is no kext. Threads that call SendRequest stand in for the kauth threads
+// of processes accessing files: each sends a message, then blocks until the provider responds. Responses are
+// matched to the waiting threads with the kext's own OutstandingMessages_DeliverResponses.
+class KernelSimulator
+{
+public:
+    KernelSimulator();
+
+    // Stops reading responses and destroys the channel
+    ~KernelSimulator();
+
+    // Creates the channel, with rings of ringCapacity bytes, and starts reading responses. Returns 0 or an errno
+    // value.
+    int Start(uint32_t ringCapacity);
+
+    // The channel to create the provider's SharedMemoryTransport with
+    const SharedMemoryChannel& GetChannel() const;
+
+    // The path the provider registered, or an empty string if it has not registered one yet
+    std::string GetVirtualizationRootPath() const;
+
+    // Sends a message about relativePath as if the process pid had accessed it, and returns the provider's
+    // response once it has arrived. Safe to call from any number of threads at once.
+    MessageType SendRequest(MessageType messageType, const char* relativePath, int32_t pid, const char* procname);
+
+private:
+    void ReadResponses();
+
+    SharedMemoryChannel channel;
+    MessageRingProducer messageRingProducer;
+    std::atomic<uint64_t> nextMessageId;
+
+    std::mutex outstandingMessagesMutex;
+    OutstandingMessage_Head outstandingMessages;
+
+    std::thread responseThread;
+    std::atomic<bool> isStopping;
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include "../PrjFSKext/public/Message.h"
+#include "PrjFSLib.h"
+
+// Most messages a transport handles before releasing their space in its message ring to the kernel
+static const uint32_t KernelTransportMessageBatchSize = 64;
+
+// How PrjFSLib receives messages from the kernel and answers them. IOKitTransport talks to the kext;
+// SharedMemoryTransport does the same over shared memory, so that PrjFSLib can be run against KernelSimulator
+// where there is no kext. Functions that can fail return 0 or an errno value.
+class KernelTransport
+{
+public:
+    // Called with each message from the kernel, which is only valid until the handler returns
+    typedef void (*MessageHandler)(const void* messageMemory, uint32_t messageSize);
+
+    virtual ~KernelTransport() {}
+
+    // Starts calling handler, one message at a time and in the order they were sent, on a thread the transport
+    // owns
+    virtual bool Start(MessageHandler handler) = 0;
+
+    virtual int RegisterVirtualizationRootPath(const char* path) = 0;
+
+    // Responses may be sent from any thread
+    virtual int SendResponse(uint64_t messageId, MessageType responseType) = 0;
+
+    // Sends the same response to up to PrjFSMaxKernelMessageResponseBatch messages at once
+    virtual int SendResponseBatch(const uint64_t* messageIds, uint32_t messageIdCount, MessageType responseType) = 0;
+};
+
+// Like PrjFS_StartVirtualizationInstance, but over the given transport, which has not been started yet. Takes
+// ownership of the transport, whether or not the instance starts.
+PrjFS_Result PrjFS_StartVirtualizationInstanceWithTransport(
+    _In_    const char*                             virtualizationRootFullPath,
+    _In_    PrjFS_Callbacks                         callbacks,
+    _In_    unsigned int                            poolThreadCount,
+    _In_    KernelTransport*                        transport);
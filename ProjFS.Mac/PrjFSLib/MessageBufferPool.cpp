@@ -0,0 +1,82 @@
+#include "MessageBufferPool.hpp"
+#include <cstdlib>
+#include <stdint.h>
+
+MessageBufferPool::MessageBufferPool(uint32_t capacity) :
+    capacity(capacity),
+    buffers(static_cast<char*>(malloc(static_cast<size_t>(capacity) * BufferSize))),
+    nextFree(new std::atomic<uint32_t>[capacity]),
+    freeListHead(0),
+    hitCount(0),
+    missCount(0)
+{
+    if (nullptr == this->buffers)
+    {
+        abort();
+    }
+
+    // Initially every buffer is free, in index order
+    for (uint32_t i = 0; i < capacity; ++i)
+    {
+        this->nextFree[i].store(i + 1 < capacity ? i + 2 : 0, std::memory_order_relaxed);
+    }
+
+    this->freeListHead.store(capacity > 0 ? 1 : 0);
+}
+
+MessageBufferPool::~MessageBufferPool()
+{
+    free(this->buffers);
+    delete[] this->nextFree;
+}
+
+void* MessageBufferPool::Allocate(uint32_t size)
+{
+    if (size <= BufferSize)
+    {
+        uint64_t head = this->freeListHead.load(std::memory_order_acquire);
+        while (0 != static_cast<uint32_t>(head))
+        {
+            uint32_t index = static_cast<uint32_t>(head) - 1;
+            uint32_t next = this->nextFree[index].load(std::memory_order_relaxed);
+            if (this->freeListHead.compare_exchange_weak(head, MakeHead(head, next), std::memory_order_acquire, std::memory_order_acquire))
+            {
+                this->hitCount.fetch_add(1, std::memory_order_relaxed);
+                return this->buffers + static_cast<size_t>(index) * BufferSize;
+            }
+        }
+    }
+
+    this->missCount.fetch_add(1, std::memory_order_relaxed);
+    void* buffer = malloc(size);
+    if (nullptr == buffer)
+    {
+        abort();
+    }
+
+    return buffer;
+}
+
+void MessageBufferPool::Free(void* buffer)
+{
+    uintptr_t offset = reinterpret_cast<uintptr_t>(buffer) - reinterpret_cast<uintptr_t>(this->buffers);
+    if (offset >= static_cast<uintptr_t>(this->capacity) * BufferSize)
+    {
+        free(buffer);
+        return;
+    }
+
+    uint32_t index = static_cast<uint32_t>(offset / BufferSize);
+    uint64_t head = this->freeListHead.load(std::memory_order_relaxed);
+    do
+    {
+        this->nextFree[index].store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+    }
+    while (!this->freeListHead.compare_exchange_weak(head, MakeHead(head, index + 1), std::memory_order_release, std::memory_order_relaxed));
+}
+
+uint64_t MessageBufferPool::MakeHead(uint64_t previousHead, uint32_t indexPlusOne)
+{
+    uint64_t counter = (previousHead >> 32) + 1;
+    return (counter << 32) | indexPlusOne;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "../PrjFSKext/public/PrjFSCommon.h"
+#include "../PrjFSKext/public/Message.h"
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed number of buffers for kernel messages, each large enough for a header plus the longest path. Messages
+// are dequeued on the dispatch thread and released on whichever request handling thread ran their handler, so
+// free buffers are kept on a lock-free stack. Messages that are too large, or that arrive while every buffer is
+// in use, fall back to the heap.
+class MessageBufferPool
+{
+public:
+    static const uint32_t BufferSize = sizeof(MessageHeader) + PrjFSMaxPath;
+
+    explicit MessageBufferPool(uint32_t capacity);
+    ~MessageBufferPool();
+    MessageBufferPool(const MessageBufferPool&) = delete;
+    MessageBufferPool& operator=(const MessageBufferPool&) = delete;
+
+    // Never returns nullptr
+    void* Allocate(uint32_t size);
+
+    // buffer must have been returned by Allocate
+    void Free(void* buffer);
+
+    uint32_t Capacity() const { return this->capacity; }
+
+    // Number of Allocate calls that were satisfied from the pool, and that had to fall back to the heap
+    uint64_t HitCount() const { return this->hitCount.load(std::memory_order_relaxed); }
+    uint64_t MissCount() const { return this->missCount.load(std::memory_order_relaxed); }
+
+private:
+    // The low 32 bits of freeListHead are the index + 1 of the first free buffer (0 if there is none), the high
+    // 32 bits a counter that changes on every push and pop, so that a pop that raced with a pop and push of the
+    // same buffer fails its compare-and-swap rather than corrupting the list.
+    static uint64_t MakeHead(uint64_t previousHead, uint32_t indexPlusOne);
+
+    uint32_t capacity;
+    char* buffers;
+    std::atomic<uint32_t>* nextFree;
+    std::atomic<uint64_t> freeListHead;
+
+    std::atomic<uint64_t> hitCount;
+    std::atomic<uint64_t> missCount;
+};
@@ -0,0 +1,27 @@
+#include "../PrjFSKext/public/Message.h"
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+Message ParseMessageMemory(const void* messageMemory, uint32_t size)
+{
+    const MessageHeader* header = static_cast<const MessageHeader*>(messageMemory);
+    if (header->pathSizeBytes + sizeof(*header) != size)
+    {
+        fprintf(stderr, "ParseMessageMemory: invariant failed, bad message? PathSizeBytes = %u, message size = %u, expecting %zu\n",
+            header->pathSizeBytes, size, header->pathSizeBytes + sizeof(*header));
+        abort();
+    }
+
+    const char* path = nullptr;
+    if (header->pathSizeBytes > 0)
+    {
+        path = static_cast<const char*>(messageMemory) + sizeof(*header);
+        
+        // Path string should fit exactly in reserved memory, with nul terminator in end position
+        // (pathSizeBytes is a uint16_t, which would otherwise be promoted to a signed int)
+        assert(strnlen(path, header->pathSizeBytes) == static_cast<size_t>(header->pathSizeBytes) - 1);
+    }
+    return Message { header, path };
+}
@@ -0,0 +1,199 @@
+#include "PendingRequestMap.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+typedef std::lock_guard<std::mutex> mutex_lock;
+
+MessageIdList::MessageIdList() :
+    items(this->inlineItems),
+    count(0),
+    capacity(InlineCapacity)
+{
+}
+
+MessageIdList::~MessageIdList()
+{
+    if (this->items != this->inlineItems)
+    {
+        free(this->items);
+    }
+}
+
+void MessageIdList::Add(uint64_t messageId)
+{
+    if (this->count == this->capacity)
+    {
+        size_t newCapacity = this->capacity * 2;
+        uint64_t* newItems = static_cast<uint64_t*>(malloc(newCapacity * sizeof(uint64_t)));
+        if (nullptr == newItems)
+        {
+            abort();
+        }
+
+        memcpy(newItems, this->items, this->count * sizeof(uint64_t));
+        if (this->items != this->inlineItems)
+        {
+            free(this->items);
+        }
+
+        this->items = newItems;
+        this->capacity = newCapacity;
+    }
+
+    this->items[this->count] = messageId;
+    ++this->count;
+}
+
+void MessageIdList::Clear()
+{
+    this->count = 0;
+}
+
+void MessageIdList::SortAndRemoveDuplicates()
+{
+    std::sort(this->items, this->items + this->count);
+    this->count = std::unique(this->items, this->items + this->count) - this->items;
+}
+
+void MessageIdList::MoveTo(MessageIdList* destination)
+{
+    destination->Clear();
+    for (uint64_t messageId : *this)
+    {
+        destination->Add(messageId);
+    }
+
+    this->Clear();
+}
+
+PendingRequestMap::PendingRequestMap()
+{
+    for (Shard& shard : this->shards)
+    {
+        memset(shard.buckets, 0, sizeof(shard.buckets));
+        shard.freeEntries = nullptr;
+    }
+}
+
+PendingRequestMap::~PendingRequestMap()
+{
+    for (Shard& shard : this->shards)
+    {
+        for (Entry* bucket : shard.buckets)
+        {
+            while (nullptr != bucket)
+            {
+                Entry* next = bucket->next;
+                delete bucket;
+                bucket = next;
+            }
+        }
+
+        while (nullptr != shard.freeEntries)
+        {
+            Entry* next = shard.freeEntries->next;
+            delete shard.freeEntries;
+            shard.freeEntries = next;
+        }
+    }
+}
+
+bool PendingRequestMap::TryInsert(const char* path, uint64_t messageId)
+{
+    size_t pathLength;
+    uint64_t hash = HashPath(path, &pathLength);
+
+    // Paths in kernel messages are at most PrjFSMaxPath bytes including the terminator
+    assert(pathLength < PrjFSMaxPath);
+
+    Shard& shard = this->GetShard(hash);
+    mutex_lock lock(shard.mutex);
+
+    Entry** found = FindEntry(shard, hash, path, pathLength);
+    if (nullptr != *found)
+    {
+        // Already a handler running for this path
+        (*found)->messageIds.Add(messageId);
+        return false;
+    }
+
+    Entry* entry = shard.freeEntries;
+    if (nullptr != entry)
+    {
+        shard.freeEntries = entry->next;
+    }
+    else
+    {
+        entry = new Entry();
+    }
+
+    entry->next = nullptr;
+    entry->hash = hash;
+    entry->pathLength = pathLength;
+    memcpy(entry->path, path, pathLength + 1);
+    entry->messageIds.Add(messageId);
+
+    // found points at the link at the end of the bucket's chain
+    *found = entry;
+    return true;
+}
+
+bool PendingRequestMap::TryRemove(const char* path, MessageIdList* messageIds)
+{
+    size_t pathLength;
+    uint64_t hash = HashPath(path, &pathLength);
+
+    Shard& shard = this->GetShard(hash);
+    mutex_lock lock(shard.mutex);
+
+    Entry** found = FindEntry(shard, hash, path, pathLength);
+    Entry* entry = *found;
+    if (nullptr == entry)
+    {
+        return false;
+    }
+
+    *found = entry->next;
+    entry->messageIds.MoveTo(messageIds);
+    entry->next = shard.freeEntries;
+    shard.freeEntries = entry;
+    return true;
+}
+
+uint64_t PendingRequestMap::HashPath(const char* path, size_t* outPathLength)
+{
+    // 64-bit FNV-1a, computing the length in the same pass
+    uint64_t hash = 14695981039346656037ULL;
+    const char* end = path;
+    for (; *end != '\0'; ++end)
+    {
+        hash ^= static_cast<unsigned char>(*end);
+        hash *= 1099511628211ULL;
+    }
+
+    *outPathLength = end - path;
+    return hash;
+}
+
+PendingRequestMap::Entry** PendingRequestMap::FindEntry(Shard& shard, uint64_t hash, const char* path, size_t pathLength)
+{
+    // The shard is chosen by the high bits of the hash, the bucket by the low bits
+    Entry** link = &shard.buckets[hash % BucketsPerShard];
+    for (; nullptr != *link; link = &(*link)->next)
+    {
+        Entry* entry = *link;
+        if (entry->hash == hash && entry->pathLength == pathLength && 0 == memcmp(entry->path, path, pathLength))
+        {
+            break;
+        }
+    }
+
+    return link;
+}
+
+PendingRequestMap::Shard& PendingRequestMap::GetShard(uint64_t hash)
+{
+    return this->shards[(hash >> 58) % ShardCount];
+}
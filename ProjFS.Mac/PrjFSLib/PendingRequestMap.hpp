@@ -0,0 +1,90 @@
+#pragma once
+
+#include "../PrjFSKext/public/PrjFSCommon.h"
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+
+// Message IDs of the requests for one path. Almost every path has a single request, so the first few IDs are
+// stored inline and the list only allocates when more requests than that are coalesced. Clear() keeps any
+// allocated storage so that a recycled list does not allocate again.
+class MessageIdList
+{
+public:
+    static const size_t InlineCapacity = 4;
+
+    MessageIdList();
+    ~MessageIdList();
+    MessageIdList(const MessageIdList&) = delete;
+    MessageIdList& operator=(const MessageIdList&) = delete;
+
+    void Add(uint64_t messageId);
+    void Clear();
+
+    // Puts the IDs in ascending order and removes any repeats, as the kext requires of response batches
+    void SortAndRemoveDuplicates();
+
+    // Replaces the contents of destination with the IDs in this list, and clears this list
+    void MoveTo(MessageIdList* destination);
+
+    size_t Count() const { return this->count; }
+    const uint64_t* begin() const { return this->items; }
+    const uint64_t* end() const { return this->items + this->count; }
+
+private:
+    uint64_t* items;
+    size_t count;
+    size_t capacity;
+    uint64_t inlineItems[InlineCapacity];
+};
+
+// Map of relative path -> message IDs of the requests for that path that have not been responded to yet,
+// which ensures there is only one request handler running for a path at a time.
+//
+// Paths are spread over shards that each have their own mutex, so the dispatch thread inserting new requests
+// and the handler threads completing them rarely contend. Lookups hash the caller's path in place rather than
+// building a string, and removed entries go on their shard's free list for reuse, so once the map has warmed
+// up inserting and removing paths does not allocate.
+class PendingRequestMap
+{
+public:
+    PendingRequestMap();
+    ~PendingRequestMap();
+    PendingRequestMap(const PendingRequestMap&) = delete;
+    PendingRequestMap& operator=(const PendingRequestMap&) = delete;
+
+    // Adds messageId to the requests for path. Returns true if path had no pending requests, in which case the
+    // caller must handle the request and then call TryRemove for path, and false if the request was coalesced
+    // with one that is already being handled.
+    bool TryInsert(const char* path, uint64_t messageId);
+
+    // Removes path from the map, moving the IDs of its pending requests into messageIds. Returns false if path
+    // has no pending requests.
+    bool TryRemove(const char* path, MessageIdList* messageIds);
+
+private:
+    static const size_t ShardCount = 64;
+    static const size_t BucketsPerShard = 256;
+
+    struct Entry
+    {
+        Entry* next;
+        uint64_t hash;
+        size_t pathLength;
+        MessageIdList messageIds;
+        char path[PrjFSMaxPath];
+    };
+
+    struct alignas(64) Shard
+    {
+        std::mutex mutex;
+        Entry* buckets[BucketsPerShard];
+        Entry* freeEntries;
+    };
+
+    static uint64_t HashPath(const char* path, size_t* outPathLength);
+    static Entry** FindEntry(Shard& shard, uint64_t hash, const char* path, size_t pathLength);
+    Shard& GetShard(uint64_t hash);
+
+    Shard shards[ShardCount];
+};
@@ -0,0 +1,537 @@
+#include "PlaceholderWriter.hpp"
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#ifndef ENOATTR
+#define ENOATTR ENODATA
+#endif
+
+struct DirectoryGroups
+{
+    const char* rootPath;
+    const char* const* relativePaths;
+
+    // Indices of relativePaths, sorted so that paths with the same parent directory are next to each other
+    std::vector<size_t> order;
+
+    // Where each group starts in order, followed by order.size()
+    std::vector<size_t> groupStarts;
+
+    int rootFd;
+    int rootError;
+    void (*work)(void* context, size_t index, int directoryFd, const char* name, int directoryError);
+    void* context;
+};
+
+static int SetXAttr(int fd, const char* name, const void* value, size_t size);
+static ssize_t GetXAttr(int fd, const char* name, void* value, size_t size);
+static uint32_t GetConflicts(const struct stat& fileAttributes, bool hasXAttr);
+static int ReplaceFile(
+    int directoryFd,
+    const char* path,
+    uint32_t fileFlags,
+    const char* xattrName,
+    const void* xattrData,
+    size_t xattrSize,
+    off_t fileSize,
+    mode_t fileMode);
+static size_t GetParentLength(const char* path);
+static void HandleDirectoryGroup(void* context, size_t groupIndex);
+static int CloseAfterError(int fd, int error);
+
+int PlaceholderWriter_CreateDirectory(int directoryFd, const char* path, uint32_t fileFlags)
+{
+    if (mkdirat(directoryFd, path, 0777))
+    {
+        return errno;
+    }
+
+    int fd = openat(directoryFd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    int error = PlaceholderWriter_SetFileFlags(fd, fileFlags);
+    if (0 != error)
+    {
+        return CloseAfterError(fd, error);
+    }
+
+    return close(fd) ? errno : 0;
+}
+
+int PlaceholderWriter_CreateFile(
+    int directoryFd,
+    const char* path,
+    uint32_t fileFlags,
+    const char* xattrName,
+    const void* xattrData,
+    size_t xattrSize,
+    off_t fileSize,
+    mode_t fileMode)
+{
+    // Created owner writable, in case fileMode is not, and given its real mode once the placeholder is complete
+    int fd = openat(directoryFd, path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    int error = 0;
+    if (ftruncate(fd, fileSize))
+    {
+        error = errno;
+    }
+    else
+    {
+        error = PlaceholderWriter_SetFileFlags(fd, fileFlags);
+    }
+
+    if (0 == error)
+    {
+        error = SetXAttr(fd, xattrName, xattrData, xattrSize);
+    }
+
+    if (0 == error && fchmod(fd, fileMode))
+    {
+        error = errno;
+    }
+
+    if (0 != error)
+    {
+        // Don't leave a placeholder without its metadata behind
+        unlinkat(directoryFd, path, 0);
+        return CloseAfterError(fd, error);
+    }
+
+    return close(fd) ? errno : 0;
+}
+
+int PlaceholderWriter_UpdateFile(
+    int directoryFd,
+    const char* path,
+    uint32_t fileFlags,
+    const char* xattrName,
+    const void* xattrData,
+    size_t xattrSize,
+    off_t fileSize,
+    uint32_t allowedConflicts,
+    uint32_t* conflicts)
+{
+    *conflicts = PlaceholderConflict_None;
+
+    // Read only files can only be opened for reading. They are never updated in place, so that is all they need.
+    int fd = openat(directoryFd, path, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0 && EACCES == errno)
+    {
+        fd = openat(directoryFd, path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    }
+
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    struct stat fileAttributes;
+    if (fstat(fd, &fileAttributes))
+    {
+        return CloseAfterError(fd, errno);
+    }
+
+    if (!S_ISREG(fileAttributes.st_mode))
+    {
+        return CloseAfterError(fd, EISDIR);
+    }
+
+    // One byte larger than the new xattr, so that a longer xattr is not mistaken for a match
+    unsigned char currentXAttr[512];
+    ssize_t currentXAttrSize = GetXAttr(fd, xattrName, currentXAttr, std::min(xattrSize + 1, sizeof(currentXAttr)));
+    if (currentXAttrSize < 0 && ENOATTR != errno && ERANGE != errno)
+    {
+        return CloseAfterError(fd, errno);
+    }
+
+    bool hasXAttr = currentXAttrSize >= 0 || ERANGE == errno;
+
+    if (fileSize == fileAttributes.st_size &&
+        xattrSize == static_cast<size_t>(currentXAttrSize) &&
+        0 == memcmp(currentXAttr, xattrData, xattrSize))
+    {
+        return close(fd) ? errno : 0;
+    }
+
+    *conflicts = GetConflicts(fileAttributes, hasXAttr) & ~allowedConflicts;
+    if (PlaceholderConflict_None != *conflicts)
+    {
+        return close(fd) ? errno : 0;
+    }
+
+    uint32_t currentFlags = 0;
+    bool isEmptyPlaceholder =
+        hasXAttr &&
+        0 == PlaceholderWriter_GetFileFlags(fd, &currentFlags) &&
+        fileFlags == (currentFlags & fileFlags) &&
+        (fcntl(fd, F_GETFL) & O_ACCMODE) == O_RDWR;
+    if (isEmptyPlaceholder)
+    {
+        // Only the metadata of a placeholder that has not been hydrated changes, so there is no data to replace
+        int error = SetXAttr(fd, xattrName, xattrData, xattrSize);
+        if (0 == error && ftruncate(fd, fileSize))
+        {
+            error = errno;
+        }
+
+        close(fd);
+        return error;
+    }
+
+    close(fd);
+    return ReplaceFile(directoryFd, path, fileFlags, xattrName, xattrData, xattrSize, fileSize, fileAttributes.st_mode & 07777);
+}
+
+int PlaceholderWriter_DeleteFile(
+    int directoryFd,
+    const char* path,
+    const char* xattrName,
+    uint32_t allowedConflicts,
+    uint32_t* conflicts)
+{
+    *conflicts = PlaceholderConflict_None;
+
+    struct stat fileAttributes;
+    if (fstatat(directoryFd, path, &fileAttributes, AT_SYMLINK_NOFOLLOW))
+    {
+        return errno;
+    }
+
+    if (S_ISDIR(fileAttributes.st_mode))
+    {
+        return unlinkat(directoryFd, path, AT_REMOVEDIR) ? errno : 0;
+    }
+
+    if (S_ISREG(fileAttributes.st_mode))
+    {
+        int fd = openat(directoryFd, path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return errno;
+        }
+
+        ssize_t xattrSize = GetXAttr(fd, xattrName, nullptr, 0);
+        int error = errno;
+        close(fd);
+        if (xattrSize < 0 && ENOATTR != error)
+        {
+            return error;
+        }
+
+        *conflicts = GetConflicts(fileAttributes, xattrSize >= 0);
+    }
+    else
+    {
+        // Placeholders are only ever files or directories
+        *conflicts = PlaceholderConflict_FullFile;
+    }
+
+    *conflicts &= ~allowedConflicts;
+    if (PlaceholderConflict_None != *conflicts)
+    {
+        return 0;
+    }
+
+    return unlinkat(directoryFd, path, 0) ? errno : 0;
+}
+
+int PlaceholderWriter_SetFileFlags(int fd, uint32_t fileFlags)
+{
+#ifdef __APPLE__
+    struct stat fileAttributes;
+    if (fstat(fd, &fileAttributes))
+    {
+        return errno;
+    }
+
+    if (fchflags(fd, fileAttributes.st_flags | fileFlags))
+    {
+        return errno;
+    }
+
+    return 0;
+#else
+    uint32_t currentFlags;
+    int error = PlaceholderWriter_GetFileFlags(fd, &currentFlags);
+    if (0 != error)
+    {
+        return error;
+    }
+
+    currentFlags |= fileFlags;
+    if (fsetxattr(fd, PlaceholderWriter_FileFlagsXAttrName, &currentFlags, sizeof(currentFlags), 0))
+    {
+        return errno;
+    }
+
+    return 0;
+#endif
+}
+
+int PlaceholderWriter_GetFileFlags(int fd, uint32_t* fileFlags)
+{
+#ifdef __APPLE__
+    struct stat fileAttributes;
+    if (fstat(fd, &fileAttributes))
+    {
+        return errno;
+    }
+
+    *fileFlags = fileAttributes.st_flags;
+    return 0;
+#else
+    ssize_t size = fgetxattr(fd, PlaceholderWriter_FileFlagsXAttrName, fileFlags, sizeof(*fileFlags));
+    if (size < 0)
+    {
+        if (ENODATA != errno)
+        {
+            return errno;
+        }
+
+        size = 0;
+    }
+
+    if (sizeof(*fileFlags) != size)
+    {
+        *fileFlags = 0;
+    }
+
+    return 0;
+#endif
+}
+
+void PlaceholderWriter_ForEach(size_t count, unsigned int threadCount, void (*work)(void* context, size_t index), void* context)
+{
+    // Each thread takes the next unclaimed index, so threads that get slow entries don't hold up the rest
+    std::atomic<size_t> nextIndex(0);
+    auto runWork =
+        [&nextIndex, count, work, context]()
+        {
+            for (size_t i = nextIndex++; i < count; i = nextIndex++)
+            {
+                work(context, i);
+            }
+        };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < threadCount && i < count; ++i)
+    {
+        threads.emplace_back(runWork);
+    }
+
+    runWork();
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void PlaceholderWriter_ForEachInDirectories(
+    const char* rootPath,
+    const char* const* relativePaths,
+    size_t count,
+    unsigned int threadCount,
+    void (*work)(void* context, size_t index, int directoryFd, const char* name, int directoryError),
+    void* context)
+{
+    DirectoryGroups groups = { rootPath, relativePaths, std::vector<size_t>(count), std::vector<size_t>(), -1, 0, work, context };
+    std::vector<size_t> parentLengths(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        groups.order[i] = i;
+        parentLengths[i] = GetParentLength(relativePaths[i]);
+    }
+
+    // Any order that keeps equal parents together will do, and comparing lengths first is cheap
+    std::sort(
+        groups.order.begin(),
+        groups.order.end(),
+        [relativePaths, &parentLengths](size_t first, size_t second)
+        {
+            if (parentLengths[first] != parentLengths[second])
+            {
+                return parentLengths[first] < parentLengths[second];
+            }
+
+            return memcmp(relativePaths[first], relativePaths[second], parentLengths[first]) < 0;
+        });
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t index = groups.order[i];
+        size_t previousIndex = 0 == i ? 0 : groups.order[i - 1];
+        if (0 == i ||
+            parentLengths[index] != parentLengths[previousIndex] ||
+            0 != memcmp(relativePaths[index], relativePaths[previousIndex], parentLengths[index]))
+        {
+            groups.groupStarts.push_back(i);
+        }
+    }
+
+    groups.groupStarts.push_back(count);
+
+    groups.rootFd = open(rootPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    groups.rootError = groups.rootFd < 0 ? errno : 0;
+    PlaceholderWriter_ForEach(groups.groupStarts.size() - 1, threadCount, HandleDirectoryGroup, &groups);
+    if (groups.rootFd >= 0)
+    {
+        close(groups.rootFd);
+    }
+}
+
+static int SetXAttr(int fd, const char* name, const void* value, size_t size)
+{
+#ifdef __APPLE__
+    if (fsetxattr(fd, name, value, size, 0, 0))
+    {
+        return errno;
+    }
+#else
+    // Linux only lets unprivileged processes set xattrs in the user namespace
+    char userName[256];
+    snprintf(userName, sizeof(userName), "user.%s", name);
+    if (fsetxattr(fd, userName, value, size, 0))
+    {
+        return errno;
+    }
+#endif
+
+    return 0;
+}
+
+static ssize_t GetXAttr(int fd, const char* name, void* value, size_t size)
+{
+#ifdef __APPLE__
+    return fgetxattr(fd, name, value, size, 0, 0);
+#else
+    char userName[256];
+    snprintf(userName, sizeof(userName), "user.%s", name);
+    return fgetxattr(fd, userName, value, size);
+#endif
+}
+
+static uint32_t GetConflicts(const struct stat& fileAttributes, bool hasXAttr)
+{
+    uint32_t conflicts = PlaceholderConflict_None;
+    if (!hasXAttr)
+    {
+        conflicts |= PlaceholderConflict_FullFile;
+    }
+
+    if (0 == (fileAttributes.st_mode & S_IWUSR))
+    {
+        conflicts |= PlaceholderConflict_ReadOnly;
+    }
+
+    return conflicts;
+}
+
+static int ReplaceFile(
+    int directoryFd,
+    const char* path,
+    uint32_t fileFlags,
+    const char* xattrName,
+    const void* xattrData,
+    size_t xattrSize,
+    off_t fileSize,
+    mode_t fileMode)
+{
+    // Written in the same directory, so that it can be renamed over the file
+    size_t parentLength = GetParentLength(path);
+    std::string temporaryPath(path, parentLength);
+    if (0 != parentLength)
+    {
+        temporaryPath += '/';
+    }
+
+    temporaryPath += PlaceholderWriter_UpdateNamePrefix;
+    temporaryPath += path + parentLength + (0 == parentLength ? 0 : 1);
+
+    // Left behind if an earlier update did not finish
+    unlinkat(directoryFd, temporaryPath.c_str(), 0);
+
+    int error = PlaceholderWriter_CreateFile(
+        directoryFd,
+        temporaryPath.c_str(),
+        fileFlags,
+        xattrName,
+        xattrData,
+        xattrSize,
+        fileSize,
+        fileMode);
+    if (0 != error)
+    {
+        return error;
+    }
+
+    if (renameat(directoryFd, temporaryPath.c_str(), directoryFd, path))
+    {
+        error = errno;
+        unlinkat(directoryFd, temporaryPath.c_str(), 0);
+        return error;
+    }
+
+    return 0;
+}
+
+static size_t GetParentLength(const char* path)
+{
+    const char* lastSeparator = strrchr(path, '/');
+    return nullptr == lastSeparator ? 0 : lastSeparator - path;
+}
+
+static void HandleDirectoryGroup(void* context, size_t groupIndex)
+{
+    const DirectoryGroups* groups = static_cast<const DirectoryGroups*>(context);
+    size_t groupStart = groups->groupStarts[groupIndex];
+    size_t groupEnd = groups->groupStarts[groupIndex + 1];
+
+    const char* firstPath = groups->relativePaths[groups->order[groupStart]];
+    size_t parentLength = GetParentLength(firstPath);
+
+    int directoryFd = groups->rootFd;
+    int directoryError = groups->rootError;
+    if (0 == directoryError && parentLength > 0)
+    {
+        std::string parentPath(firstPath, parentLength);
+        directoryFd = openat(groups->rootFd, parentPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        directoryError = directoryFd < 0 ? errno : 0;
+    }
+
+    for (size_t i = groupStart; i < groupEnd; ++i)
+    {
+        size_t index = groups->order[i];
+        const char* path = groups->relativePaths[index];
+        const char* name = path + parentLength + (0 == parentLength ? 0 : 1);
+        groups->work(groups->context, index, 0 == directoryError ? directoryFd : -1, name, directoryError);
+    }
+
+    if (directoryFd >= 0 && directoryFd != groups->rootFd)
+    {
+        close(directoryFd);
+    }
+}
+
+static int CloseAfterError(int fd, int error)
+{
+    close(fd);
+    return error;
+}
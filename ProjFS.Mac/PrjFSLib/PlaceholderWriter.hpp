@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Creates placeholders with calls on file descriptors, so that each placeholder's path is resolved once rather
+// than once per step. Paths are relative to directoryFd, which may be AT_FDCWD.
+// Functions return 0 on success or an errno value.
+
+#ifndef __APPLE__
+// Platforms without BSD file flags keep them in an xattr instead, so that the benchmarks run on Linux
+#define PlaceholderWriter_FileFlagsXAttrName "user.io.gvfs.fileflags"
+#endif
+
+// Creates a directory and sets fileFlags on it
+int PlaceholderWriter_CreateDirectory(int directoryFd, const char* path, uint32_t fileFlags);
+
+// Creates a file of fileSize bytes with no contents, sets fileFlags and the xattr on it, then sets its mode.
+// Fails if something already exists at path, and removes the file again if a later step fails.
+int PlaceholderWriter_CreateFile(
+    int directoryFd,
+    const char* path,
+    uint32_t fileFlags,
+    const char* xattrName,
+    const void* xattrData,
+    size_t xattrSize,
+    off_t fileSize,
+    mode_t fileMode);
+
+// What stops PlaceholderWriter_UpdateFile or PlaceholderWriter_DeleteFile from changing a file, unless the caller
+// allows it
+enum PlaceholderConflict
+{
+    PlaceholderConflict_None                = 0x00000000,
+
+    // The file has no placeholder xattr: it was never a placeholder, or it was modified after being hydrated
+    PlaceholderConflict_FullFile            = 0x00000001,
+
+    // The file's owner does not have write permission
+    PlaceholderConflict_ReadOnly            = 0x00000002,
+};
+
+// Makes the file at path a placeholder with the given xattr and size, unless its xattr and size already match.
+// A placeholder that has not been hydrated yet, so still has all of fileFlags, is updated in place. Any other
+// file is replaced by a new placeholder, with the same mode, that is written next to it and renamed over it, so
+// readers see either the old file or the new placeholder, and whose name is the file's with
+// PlaceholderWriter_UpdateNamePrefix in front.
+// If the file has conflicts that allowedConflicts does not include, it is left as it is, those conflicts are
+// set in *conflicts and 0 is returned.
+static const char PlaceholderWriter_UpdateNamePrefix[] = ".prjfs-update.";
+
+int PlaceholderWriter_UpdateFile(
+    int directoryFd,
+    const char* path,
+    uint32_t fileFlags,
+    const char* xattrName,
+    const void* xattrData,
+    size_t xattrSize,
+    off_t fileSize,
+    uint32_t allowedConflicts,
+    uint32_t* conflicts);
+
+// Removes the file or empty directory at path, with the same checks on files as PlaceholderWriter_UpdateFile
+int PlaceholderWriter_DeleteFile(
+    int directoryFd,
+    const char* path,
+    const char* xattrName,
+    uint32_t allowedConflicts,
+    uint32_t* conflicts);
+
+// Adds fileFlags to the flags already set on fd
+int PlaceholderWriter_SetFileFlags(int fd, uint32_t fileFlags);
+int PlaceholderWriter_GetFileFlags(int fd, uint32_t* fileFlags);
+
+// Calls work(context, i) for each i below count, spread across up to threadCount threads including the calling
+// one. Returns once every call has finished.
+void PlaceholderWriter_ForEach(size_t count, unsigned int threadCount, void (*work)(void* context, size_t index), void* context);
+
+// Calls work(context, i, directoryFd, name, 0) for each i below count, where directoryFd is the parent directory
+// of relativePaths[i], which is relative to rootPath, and name is its last component. Paths are grouped by parent
+// directory so that each directory is opened once, and the groups are spread across up to threadCount threads.
+// If a directory can't be opened, work is called for each of its paths with directoryFd set to -1 and the error
+// as its last argument.
+void PlaceholderWriter_ForEachInDirectories(
+    const char* rootPath,
+    const char* const* relativePaths,
+    size_t count,
+    unsigned int threadCount,
+    void (*work)(void* context, size_t index, int directoryFd, const char* name, int directoryError),
+    void* context);
@@ -0,0 +1,205 @@
+#include "PlaceholderXAttr.hpp"
+#include <string.h>
+
+static const uint8_t ValidEncodingBits = PlaceholderIdEncoding_Hex | PlaceholderIdEncoding_UppercaseHex | PlaceholderIdEncoding_Utf16Hex;
+
+static size_t GetUnpaddedLength(const unsigned char* id);
+static uint8_t GetHexEncoding(const unsigned char* id, size_t length);
+static int GetHexDigitValue(unsigned char digit, uint8_t encoding);
+static unsigned char* EncodeId(const unsigned char* id, unsigned char* buffer);
+static bool DecodeId(const unsigned char** cursor, const unsigned char* end, unsigned char (&id)[PrjFS_PlaceholderIdLength]);
+
+size_t PlaceholderXAttr_Encode(
+    const unsigned char* providerId,
+    const unsigned char* contentId,
+    unsigned char (&buffer)[PlaceholderXAttrMaxSize])
+{
+    PrjFSXattrHeader header = { PlaceholderMagicNumber, PlaceholderFileFormatVersion2 };
+    memcpy(buffer, &header, sizeof(header));
+    
+    unsigned char* end = EncodeId(providerId, buffer + sizeof(header));
+    end = EncodeId(contentId, end);
+    return end - buffer;
+}
+
+bool PlaceholderXAttr_Decode(const void* xattr, size_t size, PrjFSFileXAttrData* data)
+{
+    if (size < sizeof(PrjFSXattrHeader))
+    {
+        return false;
+    }
+    
+    memcpy(&data->header, xattr, sizeof(PrjFSXattrHeader));
+    if (PlaceholderMagicNumber != data->header.magicNumber)
+    {
+        return false;
+    }
+    
+    if (PlaceholderFormatVersion == data->header.formatVersion)
+    {
+        if (sizeof(PrjFSFileXAttrData) != size)
+        {
+            return false;
+        }
+        
+        memcpy(data, xattr, sizeof(PrjFSFileXAttrData));
+        return true;
+    }
+    
+    if (PlaceholderFileFormatVersion2 == data->header.formatVersion)
+    {
+        const unsigned char* cursor = static_cast<const unsigned char*>(xattr) + sizeof(PrjFSXattrHeader);
+        const unsigned char* end = static_cast<const unsigned char*>(xattr) + size;
+        return
+            DecodeId(&cursor, end, data->providerId) &&
+            DecodeId(&cursor, end, data->contentId) &&
+            cursor == end;
+    }
+    
+    return false;
+}
+
+static size_t GetUnpaddedLength(const unsigned char* id)
+{
+    size_t length = PrjFS_PlaceholderIdLength;
+    while (length > 0 && 0 == id[length - 1])
+    {
+        --length;
+    }
+    
+    return length;
+}
+
+// Returns the hex encoding the ID can be stored with, or PlaceholderIdEncoding_Raw if it is not a string of an
+// even number of hex digits that are all the same case
+static uint8_t GetHexEncoding(const unsigned char* id, size_t length)
+{
+    uint8_t encoding = PlaceholderIdEncoding_Hex;
+    size_t digitCount = length;
+    if (length > 1 && 0 == id[1])
+    {
+        // UTF-16LE: the zero high byte of the last digit was removed as padding
+        encoding |= PlaceholderIdEncoding_Utf16Hex;
+        digitCount = (length + 1) / 2;
+    }
+    
+    if (0 == digitCount || 0 != digitCount % 2)
+    {
+        return PlaceholderIdEncoding_Raw;
+    }
+    
+    bool hasLowercase = false;
+    for (size_t i = 0; i < length; ++i)
+    {
+        unsigned char c = id[i];
+        if ((encoding & PlaceholderIdEncoding_Utf16Hex) && 1 == i % 2)
+        {
+            if (0 != c)
+            {
+                return PlaceholderIdEncoding_Raw;
+            }
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            encoding |= PlaceholderIdEncoding_UppercaseHex;
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            hasLowercase = true;
+        }
+        else if (c < '0' || c > '9')
+        {
+            return PlaceholderIdEncoding_Raw;
+        }
+    }
+    
+    if (hasLowercase && (encoding & PlaceholderIdEncoding_UppercaseHex))
+    {
+        return PlaceholderIdEncoding_Raw;
+    }
+    
+    return encoding;
+}
+
+static unsigned char* EncodeId(const unsigned char* id, unsigned char* buffer)
+{
+    size_t length = GetUnpaddedLength(id);
+    uint8_t encoding = GetHexEncoding(id, length);
+    
+    buffer[0] = encoding;
+    if (PlaceholderIdEncoding_Raw == encoding)
+    {
+        buffer[1] = static_cast<uint8_t>(length);
+        memcpy(buffer + 2, id, length);
+        return buffer + 2 + length;
+    }
+    
+    size_t digitStride = (encoding & PlaceholderIdEncoding_Utf16Hex) ? 2 : 1;
+    size_t byteCount = (length + digitStride - 1) / digitStride / 2;
+    buffer[1] = static_cast<uint8_t>(byteCount);
+    for (size_t i = 0; i < byteCount; ++i)
+    {
+        int high = GetHexDigitValue(id[(2 * i) * digitStride], encoding);
+        int low = GetHexDigitValue(id[(2 * i + 1) * digitStride], encoding);
+        buffer[2 + i] = static_cast<unsigned char>(high << 4 | low);
+    }
+    
+    return buffer + 2 + byteCount;
+}
+
+static int GetHexDigitValue(unsigned char digit, uint8_t encoding)
+{
+    if (digit <= '9')
+    {
+        return digit - '0';
+    }
+    
+    return digit - ((encoding & PlaceholderIdEncoding_UppercaseHex) ? 'A' : 'a') + 10;
+}
+
+static bool DecodeId(const unsigned char** cursor, const unsigned char* end, unsigned char (&id)[PrjFS_PlaceholderIdLength])
+{
+    if (end - *cursor < 2)
+    {
+        return false;
+    }
+    
+    uint8_t encoding = (*cursor)[0];
+    size_t length = (*cursor)[1];
+    const unsigned char* bytes = *cursor + 2;
+    if (0 != (encoding & ~ValidEncodingBits) ||
+        (PlaceholderIdEncoding_Raw != encoding && !(encoding & PlaceholderIdEncoding_Hex)) ||
+        static_cast<size_t>(end - bytes) < length)
+    {
+        return false;
+    }
+    
+    memset(id, 0, PrjFS_PlaceholderIdLength);
+    if (PlaceholderIdEncoding_Raw == encoding)
+    {
+        if (length > PrjFS_PlaceholderIdLength)
+        {
+            return false;
+        }
+        
+        memcpy(id, bytes, length);
+    }
+    else
+    {
+        size_t digitStride = (encoding & PlaceholderIdEncoding_Utf16Hex) ? 2 : 1;
+        if (length * 2 * digitStride > PrjFS_PlaceholderIdLength)
+        {
+            return false;
+        }
+        
+        const char* digits = (encoding & PlaceholderIdEncoding_UppercaseHex) ? "0123456789ABCDEF" : "0123456789abcdef";
+        for (size_t i = 0; i < length; ++i)
+        {
+            id[(2 * i) * digitStride] = digits[bytes[i] >> 4];
+            id[(2 * i + 1) * digitStride] = digits[bytes[i] & 0xF];
+        }
+    }
+    
+    *cursor = bytes + length;
+    return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "PrjFSKext/public/PrjFSXattrs.h"
+
+// Encoding of the version 2 file xattr (PlaceholderFileFormatVersion2):
+//
+//   PrjFSXattrHeader header
+//   provider ID: uint8_t encoding, uint8_t length, then length bytes
+//   content ID:  uint8_t encoding, uint8_t length, then length bytes
+//
+// IDs are passed around as PrjFS_PlaceholderIdLength byte arrays padded with zeros, and are stored without the
+// padding. An ID that is a string of hex digits, like the SHA-1 GVFS uses as a content ID, is stored as the
+// bytes those digits encode: a 20 byte SHA-1 rather than 40 ASCII or 80 UTF-16 characters.
+enum PlaceholderIdEncoding
+{
+    PlaceholderIdEncoding_Raw               = 0x00,
+
+    PlaceholderIdEncoding_Hex               = 0x01,
+
+    // Only used together with PlaceholderIdEncoding_Hex
+    PlaceholderIdEncoding_UppercaseHex      = 0x02,
+    PlaceholderIdEncoding_Utf16Hex          = 0x04,
+};
+
+static const size_t PlaceholderXAttrMaxSize = sizeof(PrjFSXattrHeader) + 2 * (2 + PrjFS_PlaceholderIdLength);
+
+// Writes a version 2 xattr for the IDs, which are PrjFS_PlaceholderIdLength bytes each, to buffer and returns its size
+size_t PlaceholderXAttr_Encode(
+    const unsigned char* providerId,
+    const unsigned char* contentId,
+    unsigned char (&buffer)[PlaceholderXAttrMaxSize]);
+
+// Reads a version 1 or version 2 file xattr of the given size. Returns false if the magic number, the format
+// version or the layout of the data is not valid. On success data holds the padded IDs, and its header the
+// version that was read.
+bool PlaceholderXAttr_Decode(const void* xattr, size_t size, PrjFSFileXAttrData* data);
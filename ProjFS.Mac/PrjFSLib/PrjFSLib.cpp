@@ -1,18 +1,18 @@
 #include <iostream>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <errno.h>
+#include <fcntl.h>
 #include <stddef.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
-#include <sys/sys_domain.h>
 #include <sys/xattr.h>
 #include <thread>
 #include <unistd.h>
 #include <unordered_map>
-#include <set>
-#include <IOKit/IOKitLib.h>
-#include <IOKit/IODataQueueClient.h>
-#include <mach/mach_port.h>
-#include <CoreFoundation/CFNumber.h>
+#include <vector>
 
 #include "stdlib.h"
 
@@ -20,53 +20,143 @@
 #include "PrjFSKext/public/PrjFSCommon.h"
 #include "PrjFSKext/public/PrjFSXattrs.h"
 #include "PrjFSKext/public/Message.h"
-#include "PrjFSUser.hpp"
+#include "PrjFSKext/public/PrjFSProviderClientShared.h"
+#include "KernelTransport.hpp"
+#include "PendingRequestMap.hpp"
+#include "MessageBufferPool.hpp"
+#include "RequestScheduler.hpp"
+#include "HydrationFile.hpp"
+#include "PlaceholderWriter.hpp"
+#include "StagedDirectory.hpp"
+#include "PlaceholderXAttr.hpp"
+#include "FileStateScanner.hpp"
+#ifdef __APPLE__
+#include "IOKitTransport.hpp"
+#endif
+
+#ifndef ENOATTR
+#define ENOATTR ENODATA
+#endif
 
 using std::endl; using std::cerr;
-using std::unordered_map; using std::set; using std::string;
+using std::unordered_map; using std::string;
 using std::mutex;
 typedef std::lock_guard<mutex> mutex_lock;
 
 // Structs
 struct _PrjFS_FileHandle
 {
-    FILE* file;
+    int fd;
+    
+    // Providers write file contents in order, so each write goes to the end of what has been written so far
+    mutable off_t nextWriteOffset;
+};
+
+// A request whose callback has not finished yet, either because it is still running or because it returned
+// PrjFS_Result_Pending and the provider has not called PrjFS_CompleteCommand yet
+struct PendingCommand
+{
+    MessageType messageType;
+    string relativePath;
+    
+    // Only set for hydration requests, closed when the command completes
+    PrjFS_FileHandle* fileHandle;
+    
+    bool callbackReturnedPending;
+    
+    // Set if PrjFS_CompleteCommand was called before the callback returned PrjFS_Result_Pending
+    bool hasCompletionResult;
+    PrjFS_Result completionResult;
+};
+
+struct PlaceholderBatch
+{
+    int directoryFd;
+    PrjFS_PlaceholderInfo* placeholders;
+};
+
+struct PlaceholderUpdateBatch
+{
+    PrjFS_PlaceholderUpdateInfo* updates;
+    PrjFS_UpdateType updateFlags;
 };
 
 // Function prototypes
 static bool SetBitInFileFlags(const char* path, uint32_t bit, bool value);
 static bool IsBitSetInFileFlags(const char* path, uint32_t bit);
+static bool GetFileFlags(const char* path, uint32_t* fileFlags);
 
 static bool InitializeEmptyPlaceholder(const char* fullPath);
 template<typename TPlaceholder> static bool InitializeEmptyPlaceholder(const char* fullPath, TPlaceholder* data, const char* xattrName);
+static int WritePlaceholderFile(int directoryFd, const char* path, const unsigned char* providerId, const unsigned char* contentId, unsigned long fileSize, uint16_t fileMode);
+static void WriteBatchedPlaceholder(void* context, size_t index);
+static PrjFS_Result UpdatePlaceholderFile(
+    int directoryFd,
+    const char* path,
+    const unsigned char* providerId,
+    const unsigned char* contentId,
+    unsigned long fileSize,
+    PrjFS_UpdateType updateFlags,
+    _Out_ PrjFS_UpdateFailureCause* failureCause);
+static void UpdateBatchedPlaceholder(void* context, size_t index, int directoryFd, const char* name, int directoryError);
+static uint32_t GetAllowedConflicts(PrjFS_UpdateType updateFlags);
+static PrjFS_Result GetUpdateResult(int error, uint32_t conflicts, _Out_ PrjFS_UpdateFailureCause* failureCause);
 static bool AddXAttr(const char* path, const char* name, const void* value, size_t size);
 static bool GetXAttr(const char* path, const char* name, size_t size, _Out_ void* value);
+static bool GetFileXAttr(const char* path, _Out_ PrjFSFileXAttrData* data);
+static ssize_t ReadXAttr(const char* path, const char* name, void* value, size_t size);
+static int WriteXAttr(const char* path, const char* name, const void* value, size_t size, int options);
+static int DeleteXAttr(const char* path, const char* name);
 
 static bool IsVirtualizationRoot(const char* path);
 static void CombinePaths(const char* root, const char* relative, char (&combined)[PrjFSMaxPath]);
+static void CombinePlaceholderDirectoryPath(const char* relativeDirectoryPath, char (&combined)[PrjFSMaxPath]);
+static void CombinePlaceholderPath(const char* relativePath, char (&combined)[PrjFSMaxPath]);
+static void InitializeStagingRoot(const char* virtualizationRootFullPath);
+static void GetStagingDirectoryPath(uint64_t commandId, char (&stagingPath)[PrjFSMaxPath]);
 
-static errno_t SendKernelMessageResponse(uint64_t messageId, MessageType responseType);
-static errno_t RegisterVirtualizationRootPath(const char* path);
+static PrjFS_Result CheckStartArguments(const char* virtualizationRootFullPath, const PrjFS_Callbacks& callbacks);
+static void HandleKernelMessage(const void* messageMemory, uint32_t messageSize);
+static RequestLane GetRequestLane(MessageType messageType);
+static void HandleKernelRequest(void* messageMemory);
+static PrjFS_Result HandleEnumerateDirectoryRequest(uint64_t commandId, const MessageHeader* request, const char* path);
+static PrjFS_Result HandleHydrateFileRequest(uint64_t commandId, const MessageHeader* request, const char* path);
+static PrjFS_Result HandleFileModifiedNotification(uint64_t commandId, const MessageHeader* request, const char* path);
 
-static void HandleKernelRequest(Message requestSpec, void* messageMemory);
-static PrjFS_Result HandleEnumerateDirectoryRequest(const MessageHeader* request, const char* path);
-static PrjFS_Result HandleHydrateFileRequest(const MessageHeader* request, const char* path);
-static PrjFS_Result HandleFileModifiedNotification(const MessageHeader* request, const char* path);
-
-static Message ParseMessageMemory(const void* messageMemory, uint32_t size);
-
-static void ClearMachNotification(mach_port_t port);
+static void RegisterPendingCommand(uint64_t commandId, MessageType messageType, const char* path, PrjFS_FileHandle* fileHandle);
+static PrjFS_Result HandleCallbackResult(uint64_t commandId, PrjFS_Result callbackResult);
+static PrjFS_Result FinishCommand(const PendingCommand& command, PrjFS_Result result);
+static void SendKernelMessageResponses(const char* path, PrjFS_Result result);
 
 // State
-static io_connect_t s_kernelServiceConnection = IO_OBJECT_NULL;
+static KernelTransport* s_transport = nullptr;
 static std::string s_virtualizationRootFullPath;
 static PrjFS_Callbacks s_callbacks;
-static dispatch_queue_t s_messageQueueDispatchQueue;
-static dispatch_queue_t s_kernelRequestHandlingConcurrentQueue;
 
-// Map of relative path -> set of pending message IDs for that path, plus mutex to protect it.
-static unordered_map<string, set<uint64_t>> s_PendingRequestMessageIDs;
-static std::mutex s_PendingRequestMessageMutex;
+// Runs request handlers on poolThreadCount threads. Never destroyed, as handlers may still be running when the
+// process exits.
+static RequestScheduler* s_requestScheduler = nullptr;
+
+// Map of relative path -> pending message IDs for that path
+static PendingRequestMap s_PendingRequestMessageIDs;
+
+// Buffers for messages dequeued from the kernel, released once their request has been handled. Every message
+// blocks a thread in the kernel until it is responded to, so this only runs out when more than this many
+// threads are waiting on the provider at once.
+static MessageBufferPool s_messageBufferPool(1024);
+
+// Map of command ID -> request that has not been completed yet, plus mutex to protect it. The message IDs
+// that the command will respond to are the ones in s_PendingRequestMessageIDs for its path.
+static unordered_map<uint64_t, PendingCommand> s_PendingCommands;
+static std::mutex s_PendingCommandsMutex;
+static std::atomic<uint64_t> s_nextCommandId(1);
+
+// When set, enumerations write their placeholders into a staging directory under s_stagingRootFullPath.
+// Map of relative path of a directory being expanded -> full path of its staging directory, plus mutex to protect it.
+static std::atomic<bool> s_stageDirectoryExpansion(false);
+static std::string s_stagingRootFullPath;
+static unordered_map<string, string> s_stagingDirectories;
+static std::mutex s_stagingDirectoriesMutex;
 
 
 // The full API is defined in the header, but only the minimal set of functions needed
@@ -90,113 +180,61 @@ PrjFS_Result PrjFS_StartVirtualizationInstance(
         << poolThreadCount << ")" << std::endl;
 #endif
     
-    if (nullptr == virtualizationRootFullPath ||
-        nullptr == callbacks.EnumerateDirectory ||
-        nullptr == callbacks.GetFileStream ||
-        nullptr == callbacks.NotifyOperation)
-    {
-        return PrjFS_Result_EInvalidArgs;
-    }
-    
-    if (!s_virtualizationRootFullPath.empty())
-    {
-        return PrjFS_Result_EInvalidOperation;
-    }
-    
-    if (!IsVirtualizationRoot(virtualizationRootFullPath))
+    PrjFS_Result result = CheckStartArguments(virtualizationRootFullPath, callbacks);
+    if (PrjFS_Result_Success != result)
     {
-        return PrjFS_Result_ENotAVirtualizationRoot;
+        return result;
     }
     
-    s_kernelServiceConnection = PrjFSService_ConnectToDriver(UserClientType_Provider);
-    if (IO_OBJECT_NULL == s_kernelServiceConnection)
+#ifdef __APPLE__
+    IOKitTransport* transport = new IOKitTransport();
+    result = transport->Connect();
+    if (PrjFS_Result_Success != result)
     {
-        return PrjFS_Result_EDriverNotLoaded;
+        delete transport;
+        return result;
     }
     
-    DataQueueResources dataQueue;
-    s_messageQueueDispatchQueue = dispatch_queue_create("PrjFS Kernel Message Handling", DISPATCH_QUEUE_SERIAL);
-    if (!PrjFSService_DataQueueInit(&dataQueue, s_kernelServiceConnection, ProviderPortType_MessageQueue, ProviderMemoryType_MessageQueue, s_messageQueueDispatchQueue))
+    return PrjFS_StartVirtualizationInstanceWithTransport(virtualizationRootFullPath, callbacks, poolThreadCount, transport);
+#else
+    // There is no kext to connect to; see KernelSimulator
+    (void)poolThreadCount;
+    return PrjFS_Result_EDriverNotLoaded;
+#endif
+}
+
+PrjFS_Result PrjFS_StartVirtualizationInstanceWithTransport(
+    _In_    const char*                             virtualizationRootFullPath,
+    _In_    PrjFS_Callbacks                         callbacks,
+    _In_    unsigned int                            poolThreadCount,
+    _In_    KernelTransport*                        transport)
+{
+    PrjFS_Result result = CheckStartArguments(virtualizationRootFullPath, callbacks);
+    if (PrjFS_Result_Success != result)
     {
-        cerr << "Failed to set up shared data queue.\n";
-        return PrjFS_Result_EInvalidOperation;
+        delete transport;
+        return result;
     }
     
+    s_transport = transport;
     s_virtualizationRootFullPath = virtualizationRootFullPath;
     s_callbacks = callbacks;
+    InitializeStagingRoot(virtualizationRootFullPath);
     
-    errno_t error = RegisterVirtualizationRootPath(virtualizationRootFullPath);
+    int error = s_transport->RegisterVirtualizationRootPath(virtualizationRootFullPath);
     if (error != 0)
     {
         cerr << "Registering virtualization root failed: " << error << ", " << strerror(error) << endl;
         return PrjFS_Result_EInvalidOperation;
     }
     
-    s_kernelRequestHandlingConcurrentQueue = dispatch_queue_create("PrjFS Kernel Request Handling", DISPATCH_QUEUE_CONCURRENT);
+    s_requestScheduler = new RequestScheduler();
+    s_requestScheduler->Start(0 != poolThreadCount ? poolThreadCount : std::max(1U, std::thread::hardware_concurrency()));
     
-    dispatch_source_set_event_handler(dataQueue.dispatchSource, ^{
-        ClearMachNotification(dataQueue.notificationPort);
-        
-        while (1)
-        {
-            IODataQueueEntry* entry = IODataQueuePeek(dataQueue.queueMemory);
-            if (nullptr == entry)
-            {
-                // No more items in queue
-                break;
-            }
-            
-            uint32_t messageSize = entry->size;
-            if (messageSize < sizeof(Message))
-            {
-                cerr << "Bad message size: got " << messageSize << " bytes, expected minimum of " << sizeof(Message) << ", skipping. Kernel/user version mismatch?\n";
-                IODataQueueDequeue(dataQueue.queueMemory, nullptr, nullptr);
-                continue;
-            }
-            
-            void* messageMemory = malloc(messageSize);
-            uint32_t dequeuedSize = messageSize;
-            IOReturn result = IODataQueueDequeue(dataQueue.queueMemory, messageMemory, &dequeuedSize);
-            if (kIOReturnSuccess != result || dequeuedSize != messageSize)
-            {
-                cerr << "Unexpected result dequeueing message - result 0x" << std::hex << result << " dequeued " << dequeuedSize << "/" << messageSize << " bytes\n";
-                abort();
-            }
-            
-            Message message = ParseMessageMemory(messageMemory, messageSize);
-            
-            // At the moment, we expect all messages to include a path
-            assert(message.path != nullptr);
-
-            // Ensure we don't run more than one request handler at once for the same file
-            {
-                mutex_lock lock(s_PendingRequestMessageMutex);
-                typedef unordered_map<string, set<uint64_t>>::iterator PendingMessageIterator;
-                    PendingMessageIterator file_messages_found = s_PendingRequestMessageIDs.find(message.path);
-                if (file_messages_found == s_PendingRequestMessageIDs.end())
-                {
-                    // Not handling this file/dir yet
-                    std::pair<PendingMessageIterator, bool> inserted =
-                        s_PendingRequestMessageIDs.insert(std::make_pair(string(message.path), set<uint64_t>{ message.messageHeader->messageId }));
-                    assert(inserted.second);
-                }
-                else
-                {
-                    // Already a handler running for this path, don't handle it again.
-                    file_messages_found->second.insert(message.messageHeader->messageId);
-                    continue;
-                }
-            }
-            
-
-            dispatch_async(
-                s_kernelRequestHandlingConcurrentQueue,
-                ^{
-                    HandleKernelRequest(message, messageMemory);
-                });
-        }
-    });
-    dispatch_resume(dataQueue.dispatchSource);
+    if (!s_transport->Start(HandleKernelMessage))
+    {
+        return PrjFS_Result_EInvalidOperation;
+    }
 	
     return PrjFS_Result_Success;
 }
@@ -247,23 +285,15 @@ PrjFS_Result PrjFS_WritePlaceholderDirectory(
     }
     
     char fullPath[PrjFSMaxPath];
-    CombinePaths(s_virtualizationRootFullPath.c_str(), relativePath, fullPath);
+    CombinePlaceholderPath(relativePath, fullPath);
 
-    if (mkdir(fullPath, 0777))
-    {
-        goto CleanupAndFail;
-    }
-    
-    if (!InitializeEmptyPlaceholder(fullPath))
+    if (PlaceholderWriter_CreateDirectory(AT_FDCWD, fullPath, FileFlags_IsInVirtualizationRoot | FileFlags_IsEmpty))
     {
-        goto CleanupAndFail;
+        // TODO: cleanup the directory on disk if needed
+        return PrjFS_Result_EIOError;
     }
     
     return PrjFS_Result_Success;
-    
-CleanupAndFail:
-    // TODO: cleanup the directory on disk if needed
-    return PrjFS_Result_EIOError;
 }
 
 PrjFS_Result PrjFS_WritePlaceholderFile(
@@ -287,295 +317,765 @@ PrjFS_Result PrjFS_WritePlaceholderFile(
         return PrjFS_Result_EInvalidArgs;
     }
     
-    PrjFSFileXAttrData fileXattrData = {};
-    
     char fullPath[PrjFSMaxPath];
-    CombinePaths(s_virtualizationRootFullPath.c_str(), relativePath, fullPath);
+    CombinePlaceholderPath(relativePath, fullPath);
     
-    // Mode "wbx" means
-    //  - Create an empty file if none exists
-    //  - Fail if a file already exists at this path
-    FILE* file = fopen(fullPath, "wbx");
-    if (nullptr == file)
+    if (WritePlaceholderFile(AT_FDCWD, fullPath, providerId, contentId, fileSize, fileMode))
     {
-        goto CleanupAndFail;
+        return PrjFS_Result_EIOError;
     }
+
+    return PrjFS_Result_Success;
+}
+
+PrjFS_Result PrjFS_WritePlaceholdersBatch(
+    _In_    const char*                             relativeDirectoryPath,
+    _Inout_ PrjFS_PlaceholderInfo*                  placeholders,
+    _In_    unsigned int                            placeholderCount,
+    _In_    unsigned int                            threadCount)
+{
+#ifdef DEBUG
+    std::cout
+        << "PrjFS_WritePlaceholdersBatch("
+        << relativeDirectoryPath << ", "
+        << placeholderCount << ", "
+        << threadCount << ")" << std::endl;
+#endif
     
-    // Expand the file to the desired size
-    if (ftruncate(fileno(file), fileSize))
+    if (nullptr == relativeDirectoryPath ||
+        (nullptr == placeholders && placeholderCount > 0))
     {
-        goto CleanupAndFail;
+        return PrjFS_Result_EInvalidArgs;
     }
     
-    fclose(file);
-    file = nullptr;
-    
-    memcpy(fileXattrData.providerId, providerId, PrjFS_PlaceholderIdLength);
-    memcpy(fileXattrData.contentId, contentId, PrjFS_PlaceholderIdLength);
-    
-    if (!InitializeEmptyPlaceholder(
-            fullPath,
-            &fileXattrData,
-            PrjFSFileXAttrName))
+    for (unsigned int i = 0; i < placeholderCount; ++i)
     {
-        goto CleanupAndFail;
+        if (nullptr == placeholders[i].name)
+        {
+            return PrjFS_Result_EInvalidArgs;
+        }
     }
     
-    if (chmod(fullPath, fileMode))
+    char fullPath[PrjFSMaxPath];
+    CombinePlaceholderDirectoryPath(relativeDirectoryPath, fullPath);
+    
+    // Each placeholder is created relative to the open directory, so the directory's path is only resolved here
+    // rather than several times for every placeholder
+    int directoryFd = open(fullPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directoryFd < 0)
     {
-        goto CleanupAndFail;
+        return PrjFS_Result_EIOError;
     }
-
-    return PrjFS_Result_Success;
     
-CleanupAndFail:
-    if (nullptr != file)
+    PlaceholderBatch batch = { directoryFd, placeholders };
+    PlaceholderWriter_ForEach(placeholderCount, std::max(threadCount, 1U), WriteBatchedPlaceholder, &batch);
+    close(directoryFd);
+    
+    for (unsigned int i = 0; i < placeholderCount; ++i)
     {
-        // TODO: we now have a partially created placeholder file. Should we delete it?
-        // A better pattern would likely be to create the file in a tmp location, fully initialize its state, then move it into the requested path
-        
-        fclose(file);
-        file = nullptr;
+        if (PrjFS_Result_Success != placeholders[i].result)
+        {
+            return PrjFS_Result_EIOError;
+        }
     }
     
-    return PrjFS_Result_EIOError;
+    return PrjFS_Result_Success;
 }
 
-PrjFS_Result PrjFS_WriteFileContents(
-    _In_    const PrjFS_FileHandle*                 fileHandle,
-    _In_    const void*                             bytes,
-    _In_    unsigned int                            byteCount)
+PrjFS_Result PrjFS_UpdatePlaceholderFileIfNeeded(
+    _In_    const char*                             relativePath,
+    _In_    unsigned char                           providerId[PrjFS_PlaceholderIdLength],
+    _In_    unsigned char                           contentId[PrjFS_PlaceholderIdLength],
+    _In_    unsigned long                           fileSize,
+    _In_    PrjFS_UpdateType                        updateFlags,
+    _Out_   PrjFS_UpdateFailureCause*               failureCause)
 {
 #ifdef DEBUG
     std::cout
-        << "PrjFS_WriteFile("
-        << fileHandle->file << ", "
-        << (int)((char*)bytes)[0] << ", "
-        << (int)((char*)bytes)[1] << ", "
-        << (int)((char*)bytes)[2] << ", "
-        << byteCount << ")" << std::endl;
+        << "PrjFS_UpdatePlaceholderFileIfNeeded("
+        << relativePath << ", "
+        << (int)providerId[0] << ", "
+        << (int)contentId[0] << ", "
+        << fileSize << ", "
+        << updateFlags << ")" << std::endl;
 #endif
     
-    if (nullptr == fileHandle->file ||
-        nullptr == bytes)
+    if (nullptr == relativePath || nullptr == failureCause)
     {
         return PrjFS_Result_EInvalidArgs;
     }
     
-    if (byteCount != fwrite(bytes, 1, byteCount, fileHandle->file))
-    {
-        return PrjFS_Result_EIOError;
-    }
+    char fullPath[PrjFSMaxPath];
+    CombinePaths(s_virtualizationRootFullPath.c_str(), relativePath, fullPath);
     
-    return PrjFS_Result_Success;
+    return UpdatePlaceholderFile(AT_FDCWD, fullPath, providerId, contentId, fileSize, updateFlags, failureCause);
 }
 
-// Private functions
-
-
-static Message ParseMessageMemory(const void* messageMemory, uint32_t size)
+PrjFS_Result PrjFS_DeleteFile(
+    _In_    const char*                             relativePath,
+    _In_    PrjFS_UpdateType                        updateFlags,
+    _Out_   PrjFS_UpdateFailureCause*               failureCause)
 {
-    const MessageHeader* header = static_cast<const MessageHeader*>(messageMemory);
-    if (header->pathSizeBytes + sizeof(*header) != size)
-    {
-        fprintf(stderr, "ParseMessageMemory: invariant failed, bad message? PathSizeBytes = %u, message size = %u, expecting %zu\n",
-            header->pathSizeBytes, size, header->pathSizeBytes + sizeof(*header));
-        abort();
-    }
-            
-    const char* path = nullptr;
-    if (header->pathSizeBytes > 0)
+#ifdef DEBUG
+    std::cout << "PrjFS_DeleteFile(" << relativePath << ", " << updateFlags << ")" << std::endl;
+#endif
+    
+    if (nullptr == relativePath || nullptr == failureCause)
     {
-        path = static_cast<const char*>(messageMemory) + sizeof(*header);
-        
-        // Path string should fit exactly in reserved memory, with nul terminator in end position
-        assert(strnlen(path, header->pathSizeBytes) == header->pathSizeBytes - 1);
+        return PrjFS_Result_EInvalidArgs;
     }
-    return Message { header, path };
+    
+    char fullPath[PrjFSMaxPath];
+    CombinePaths(s_virtualizationRootFullPath.c_str(), relativePath, fullPath);
+    
+    uint32_t conflicts;
+    int error = PlaceholderWriter_DeleteFile(AT_FDCWD, fullPath, PrjFSFileXAttrName, GetAllowedConflicts(updateFlags), &conflicts);
+    return GetUpdateResult(error, conflicts, failureCause);
 }
 
-static void HandleKernelRequest(Message request, void* messageMemory)
+PrjFS_Result PrjFS_UpdatePlaceholdersBatch(
+    _Inout_ PrjFS_PlaceholderUpdateInfo*            updates,
+    _In_    unsigned int                            updateCount,
+    _In_    PrjFS_UpdateType                        updateFlags,
+    _In_    unsigned int                            threadCount)
 {
-    PrjFS_Result result = PrjFS_Result_EIOError;
+#ifdef DEBUG
+    std::cout
+        << "PrjFS_UpdatePlaceholdersBatch("
+        << updateCount << ", "
+        << updateFlags << ", "
+        << threadCount << ")" << std::endl;
+#endif
     
-    const MessageHeader* requestHeader = request.messageHeader;
-    switch (requestHeader->messageType)
+    if (nullptr == updates && updateCount > 0)
     {
-        case MessageType_KtoU_EnumerateDirectory:
-        {
-            result = HandleEnumerateDirectoryRequest(requestHeader, request.path);
-            break;
-        }
-            
-        case MessageType_KtoU_HydrateFile:
-        {
-            result = HandleHydrateFileRequest(requestHeader, request.path);
-            break;
-        }
-            
-        case MessageType_KtoU_NotifyFileModified:
+        return PrjFS_Result_EInvalidArgs;
+    }
+    
+    std::vector<const char*> relativePaths(updateCount);
+    for (unsigned int i = 0; i < updateCount; ++i)
+    {
+        if (nullptr == updates[i].relativePath)
         {
-            result = HandleFileModifiedNotification(requestHeader, request.path);
-            break;
+            return PrjFS_Result_EInvalidArgs;
         }
+        
+        relativePaths[i] = updates[i].relativePath;
     }
     
-    // async callbacks are not yet implemented
-    assert(PrjFS_Result_Pending != result);
+    PlaceholderUpdateBatch batch = { updates, updateFlags };
+    PlaceholderWriter_ForEachInDirectories(
+        s_virtualizationRootFullPath.c_str(),
+        relativePaths.data(),
+        updateCount,
+        std::max(threadCount, 1U),
+        UpdateBatchedPlaceholder,
+        &batch);
     
-    if (PrjFS_Result_Pending != result)
+    for (unsigned int i = 0; i < updateCount; ++i)
     {
-        MessageType responseType =
-            PrjFS_Result_Success == result
-            ? MessageType_Response_Success
-            : MessageType_Response_Fail;
-
-        std::set<uint64_t> messageIDs;
-
-        {
-            mutex_lock lock(s_PendingRequestMessageMutex);
-            unordered_map<string, set<uint64_t>>::iterator fileMessageIDsFound = s_PendingRequestMessageIDs.find(request.path);
-            assert(fileMessageIDsFound != s_PendingRequestMessageIDs.end());
-            messageIDs = std::move(fileMessageIDsFound->second);
-            s_PendingRequestMessageIDs.erase(fileMessageIDsFound);
-        }
-
-        for (uint64_t messageID : messageIDs)
+        if (PrjFS_Result_Success != updates[i].result)
         {
-            SendKernelMessageResponse(messageID, responseType);
+            return PrjFS_Result_EIOError;
         }
     }
     
-    free(messageMemory);
+    return PrjFS_Result_Success;
 }
 
-static PrjFS_Result HandleEnumerateDirectoryRequest(const MessageHeader* request, const char* path)
+PrjFS_Result PrjFS_GetOnDiskFileState(
+    _In_    const char*                             fullPath,
+    _Out_   unsigned int*                           fileState)
 {
 #ifdef DEBUG
-    std::cout << "PrjFSLib.HandleEnumerateDirectoryRequest: " << path << std::endl;
+    std::cout << "PrjFS_GetOnDiskFileState(" << fullPath << ")" << std::endl;
 #endif
     
-    PrjFS_Result callbackResult = s_callbacks.EnumerateDirectory(
-        0 /* commandId */,
-        path,
-        request->pid,
-        request->procname);
+    if (nullptr == fullPath || nullptr == fileState)
+    {
+        return PrjFS_Result_EInvalidArgs;
+    }
     
-    if (PrjFS_Result_Success == callbackResult)
+    PrjFS_FileState state;
+    int error = FileStateScanner_GetFileState(AT_FDCWD, fullPath, &state);
+    if (0 != error)
     {
-        char fullPath[PrjFSMaxPath];
-        CombinePaths(s_virtualizationRootFullPath.c_str(), path, fullPath);
-        
-        if (!SetBitInFileFlags(fullPath, FileFlags_IsEmpty, false))
-        {
-            // TODO: how should we handle this scenario where the provider thinks it succeeded, but we were unable to
-            // update placeholder metadata?
-            return PrjFS_Result_EIOError;
-        }
+        return ENOENT == error || ENOTDIR == error ? PrjFS_Result_EFileNotFound : PrjFS_Result_EIOError;
     }
     
-    return callbackResult;
+    *fileState = state;
+    return PrjFS_Result_Success;
 }
 
-static PrjFS_Result HandleHydrateFileRequest(const MessageHeader* request, const char* path)
+PrjFS_Result PrjFS_ScanOnDiskFileStates(
+    _In_    const char*                             relativeDirectoryPath,
+    _In_    unsigned int                            threadCount,
+    _Out_   PrjFS_FileStateCounts*                  counts,
+    _In_    PrjFS_FileStateCallback*                callback,
+    _In_    void*                                   callbackContext)
 {
 #ifdef DEBUG
-    std::cout << "PrjFSLib.HandleHydrateFileRequest: " << path << std::endl;
+    std::cout
+        << "PrjFS_ScanOnDiskFileStates("
+        << relativeDirectoryPath << ", "
+        << threadCount << ", "
+        << (nullptr != callback) << ")" << std::endl;
 #endif
     
-    char fullPath[PrjFSMaxPath];
-    CombinePaths(s_virtualizationRootFullPath.c_str(), path, fullPath);
+    if (nullptr == relativeDirectoryPath || nullptr == counts)
+    {
+        return PrjFS_Result_EInvalidArgs;
+    }
     
-    PrjFSFileXAttrData xattrData = {};
-    if (!GetXAttr(fullPath, PrjFSFileXAttrName, sizeof(PrjFSFileXAttrData), &xattrData))
+    int error = FileStateScanner_Scan(
+        s_virtualizationRootFullPath.c_str(),
+        relativeDirectoryPath,
+        std::max(threadCount, 1U),
+        counts,
+        callback,
+        callbackContext);
+    if (ENOENT == error || ENOTDIR == error)
     {
-        return PrjFS_Result_EIOError;
+        return PrjFS_Result_EPathNotFound;
     }
     
-    PrjFS_FileHandle fileHandle;
+    return 0 == error ? PrjFS_Result_Success : PrjFS_Result_EIOError;
+}
+
+PrjFS_Result PrjFS_WriteFileContents(
+    _In_    const PrjFS_FileHandle*                 fileHandle,
+    _In_    const void*                             bytes,
+    _In_    unsigned int                            byteCount)
+{
+#ifdef DEBUG
+    std::cout
+        << "PrjFS_WriteFile("
+        << fileHandle->fd << ", "
+        << (int)((char*)bytes)[0] << ", "
+        << (int)((char*)bytes)[1] << ", "
+        << (int)((char*)bytes)[2] << ", "
+        << byteCount << ")" << std::endl;
+#endif
     
-    // Mode "rb+" means:
-    //  - The file must already exist
-    //  - The handle is opened for reading and writing
-    //  - We are allowed to seek to somewhere other than end of stream for writing
-    fileHandle.file = fopen(fullPath, "rb+");
-    if (nullptr == fileHandle.file)
+    if (nullptr == fileHandle ||
+        fileHandle->fd < 0 ||
+        nullptr == bytes)
     {
-        return PrjFS_Result_EIOError;
+        return PrjFS_Result_EInvalidArgs;
     }
     
-    // Seek back to the beginning so the provider can overwrite the empty contents
-    if (fseek(fileHandle.file, 0, 0))
+    if (0 != HydrationFile_Write(fileHandle->fd, bytes, byteCount, fileHandle->nextWriteOffset))
     {
-        fclose(fileHandle.file);
         return PrjFS_Result_EIOError;
     }
     
-    PrjFS_Result callbackResult = s_callbacks.GetFileStream(
-        0 /* comandId */,
-        path,
-        xattrData.providerId,
-        xattrData.contentId,
-        request->pid,
-        request->procname,
-        &fileHandle);
-    
-    // TODO: once we support async callbacks, we'll need to save off the fileHandle if the result is Pending
+    fileHandle->nextWriteOffset += byteCount;
+    return PrjFS_Result_Success;
+}
+
+PrjFS_Result PrjFS_WriteFileContentsFromFile(
+    _In_    const PrjFS_FileHandle*                 fileHandle,
+    _In_    int                                     sourceFileDescriptor,
+    _In_    unsigned long long                      sourceOffset,
+    _In_    unsigned long long                      byteCount)
+{
+#ifdef DEBUG
+    std::cout
+        << "PrjFS_WriteFileContentsFromFile("
+        << fileHandle->fd << ", "
+        << sourceFileDescriptor << ", "
+        << sourceOffset << ", "
+        << byteCount << ")" << std::endl;
+#endif
     
-    if (fclose(fileHandle.file))
+    if (nullptr == fileHandle ||
+        fileHandle->fd < 0 ||
+        sourceFileDescriptor < 0)
     {
-        // TODO: under what conditions can fclose fail? How do we recover?
-        return PrjFS_Result_EIOError;
+        return PrjFS_Result_EInvalidArgs;
     }
     
-    if (PrjFS_Result_Success == callbackResult)
+    if (0 != HydrationFile_CopyFrom(fileHandle->fd, fileHandle->nextWriteOffset, sourceFileDescriptor, sourceOffset, byteCount))
     {
-        // TODO: validate that the total bytes written match the size that was reported on the placeholder in the first place
-        // Potential bugs if we don't:
-        //  * The provider writes fewer bytes than expected. The hydrated is left with extra padding up to the original reported size.
-        //  * The provider writes more bytes than expected. The write succeeds, but whatever tool originally opened the file may have already
-        //    allocated the originally reported size, and now the contents appear truncated.
-        
-        if (!SetBitInFileFlags(fullPath, FileFlags_IsEmpty, false))
-        {
-            // TODO: how should we handle this scenario where the provider thinks it succeeded, but we were unable to
-            // update placeholder metadata?
-            return PrjFS_Result_EIOError;
-        }
+        return PrjFS_Result_EIOError;
     }
     
-    return callbackResult;
+    fileHandle->nextWriteOffset += byteCount;
+    return PrjFS_Result_Success;
 }
 
-static PrjFS_Result HandleFileModifiedNotification(const MessageHeader* request, const char* path)
+PrjFS_Result PrjFS_CompleteCommand(
+    _In_    unsigned long                           commandId,
+    _In_    PrjFS_Result                            result)
 {
 #ifdef DEBUG
-    std::cout << "PrjFSLib.HandleFileModifiedNotification: " << path << std::endl;
+    std::cout << "PrjFS_CompleteCommand(" << commandId << ", " << result << ")" << std::endl;
 #endif
     
-    char fullPath[PrjFSMaxPath];
-    CombinePaths(s_virtualizationRootFullPath.c_str(), path, fullPath);
-    
-    PrjFSFileXAttrData xattrData = {};
-    if (!GetXAttr(fullPath, PrjFSFileXAttrName, sizeof(PrjFSFileXAttrData), &xattrData))
+    if (PrjFS_Result_Pending == result)
     {
-        return PrjFS_Result_EIOError;
+        return PrjFS_Result_EInvalidArgs;
     }
     
-    s_callbacks.NotifyOperation(
-        0 /* commandId */,
-        path,
-        xattrData.providerId,
-        xattrData.contentId,
-        request->pid,
-        request->procname,
-        false /* isDirectory */,
+    PendingCommand command;
+    {
+        mutex_lock lock(s_PendingCommandsMutex);
+        unordered_map<uint64_t, PendingCommand>::iterator commandFound = s_PendingCommands.find(commandId);
+        if (commandFound == s_PendingCommands.end())
+        {
+            // Never issued, or already completed
+            return PrjFS_Result_EInvalidArgs;
+        }
+        
+        if (!commandFound->second.callbackReturnedPending)
+        {
+            // The provider completed the command from another thread while its callback is still running,
+            // the callback's thread will finish the command once the callback returns PrjFS_Result_Pending
+            if (commandFound->second.hasCompletionResult)
+            {
+                return PrjFS_Result_EInvalidOperation;
+            }
+            
+            commandFound->second.hasCompletionResult = true;
+            commandFound->second.completionResult = result;
+            return PrjFS_Result_Success;
+        }
+        
+        command = std::move(commandFound->second);
+        s_PendingCommands.erase(commandFound);
+    }
+    
+    result = FinishCommand(command, result);
+    SendKernelMessageResponses(command.relativePath.c_str(), result);
+    
+    return PrjFS_Result_Success;
+}
+
+PrjFS_Result PrjFS_SetStagedDirectoryExpansion(
+    _In_    bool                                    enabled)
+{
+#ifdef DEBUG
+    std::cout << "PrjFS_SetStagedDirectoryExpansion(" << enabled << ")" << std::endl;
+#endif
+    
+    s_stageDirectoryExpansion = enabled;
+    return PrjFS_Result_Success;
+}
+
+PrjFS_Result PrjFS_GetMessageBufferPoolStats(
+    _Out_   PrjFS_MessageBufferPoolStats*           stats)
+{
+    if (nullptr == stats)
+    {
+        return PrjFS_Result_EInvalidArgs;
+    }
+    
+    stats->capacity = s_messageBufferPool.Capacity();
+    stats->hits = s_messageBufferPool.HitCount();
+    stats->misses = s_messageBufferPool.MissCount();
+    return PrjFS_Result_Success;
+}
+
+PrjFS_Result PrjFS_GetRequestQueueStats(
+    _In_    PrjFS_RequestQueue                      queue,
+    _Out_   PrjFS_RequestQueueStats*                stats)
+{
+    RequestLane lane;
+    switch (queue)
+    {
+        case PrjFS_RequestQueue_Enumeration:
+            lane = RequestLane_Enumeration;
+            break;
+        case PrjFS_RequestQueue_Hydration:
+            lane = RequestLane_Hydration;
+            break;
+        case PrjFS_RequestQueue_Notification:
+            lane = RequestLane_Notification;
+            break;
+        default:
+            return PrjFS_Result_EInvalidArgs;
+    }
+    
+    if (nullptr == stats)
+    {
+        return PrjFS_Result_EInvalidArgs;
+    }
+    
+    if (nullptr == s_requestScheduler)
+    {
+        return PrjFS_Result_EInvalidOperation;
+    }
+    
+    RequestLaneStats laneStats = s_requestScheduler->GetLaneStats(lane);
+    stats->enqueued = laneStats.enqueuedCount;
+    stats->started = laneStats.startedCount;
+    stats->queueDepth = laneStats.queueDepth;
+    stats->maxQueueDepth = laneStats.maxQueueDepth;
+    stats->totalWaitMicroseconds = laneStats.totalWaitMicroseconds;
+    stats->maxWaitMicroseconds = laneStats.maxWaitMicroseconds;
+    return PrjFS_Result_Success;
+}
+
+// Private functions
+
+
+static PrjFS_Result CheckStartArguments(const char* virtualizationRootFullPath, const PrjFS_Callbacks& callbacks)
+{
+    if (nullptr == virtualizationRootFullPath ||
+        nullptr == callbacks.EnumerateDirectory ||
+        nullptr == callbacks.GetFileStream ||
+        nullptr == callbacks.NotifyOperation)
+    {
+        return PrjFS_Result_EInvalidArgs;
+    }
+    
+    if (!s_virtualizationRootFullPath.empty())
+    {
+        return PrjFS_Result_EInvalidOperation;
+    }
+    
+    if (!IsVirtualizationRoot(virtualizationRootFullPath))
+    {
+        return PrjFS_Result_ENotAVirtualizationRoot;
+    }
+    
+    return PrjFS_Result_Success;
+}
+
+static void HandleKernelMessage(const void* messageMemory, uint32_t messageSize)
+{
+    if (messageSize < sizeof(Message))
+    {
+        cerr << "Bad message size: got " << messageSize << " bytes, expected minimum of " << sizeof(Message) << ", skipping. Kernel/user version mismatch?\n";
+        return;
+    }
+    
+    // Parsed where the transport has it, so that messages for paths that already have a handler running are never
+    // copied
+    Message message = ParseMessageMemory(messageMemory, messageSize);
+    
+    // At the moment, we expect all messages to include a path
+    assert(message.path != nullptr);
+    
+    // Ensure we don't run more than one request handler at once for the same file
+    if (!s_PendingRequestMessageIDs.TryInsert(message.path, message.messageHeader->messageId))
+    {
+        // Already a handler running for this path, don't handle it again.
+        return;
+    }
+    
+    // The transport's copy of the message is only valid until this returns
+    void* messageCopy = s_messageBufferPool.Allocate(messageSize);
+    memcpy(messageCopy, messageMemory, messageSize);
+    
+    s_requestScheduler->Enqueue(
+        GetRequestLane(static_cast<MessageType>(message.messageHeader->messageType)),
+        HandleKernelRequest,
+        messageCopy);
+}
+
+static RequestLane GetRequestLane(MessageType messageType)
+{
+    switch (messageType)
+    {
+        case MessageType_KtoU_EnumerateDirectory:
+            return RequestLane_Enumeration;
+            
+        case MessageType_KtoU_HydrateFile:
+            return RequestLane_Hydration;
+            
+        default:
+            return RequestLane_Notification;
+    }
+}
+
+static void HandleKernelRequest(void* messageMemory)
+{
+    uint16_t pathSizeBytes = static_cast<const MessageHeader*>(messageMemory)->pathSizeBytes;
+    Message request = ParseMessageMemory(messageMemory, sizeof(MessageHeader) + pathSizeBytes);
+    
+    PrjFS_Result result = PrjFS_Result_EIOError;
+    uint64_t commandId = s_nextCommandId++;
+    
+    const MessageHeader* requestHeader = request.messageHeader;
+    switch (requestHeader->messageType)
+    {
+        case MessageType_KtoU_EnumerateDirectory:
+        {
+            result = HandleEnumerateDirectoryRequest(commandId, requestHeader, request.path);
+            break;
+        }
+            
+        case MessageType_KtoU_HydrateFile:
+        {
+            result = HandleHydrateFileRequest(commandId, requestHeader, request.path);
+            break;
+        }
+            
+        case MessageType_KtoU_NotifyFileModified:
+        {
+            result = HandleFileModifiedNotification(commandId, requestHeader, request.path);
+            break;
+        }
+    }
+    
+    // Pending requests are answered by PrjFS_CompleteCommand
+    if (PrjFS_Result_Pending != result)
+    {
+        SendKernelMessageResponses(request.path, result);
+    }
+    
+    s_messageBufferPool.Free(messageMemory);
+}
+
+static PrjFS_Result HandleEnumerateDirectoryRequest(uint64_t commandId, const MessageHeader* request, const char* path)
+{
+#ifdef DEBUG
+    std::cout << "PrjFSLib.HandleEnumerateDirectoryRequest: " << path << std::endl;
+#endif
+    
+    // The virtualization root is never staged, as the kext identifies the root by its vnode
+    if (s_stageDirectoryExpansion && '\0' != path[0] && !s_stagingRootFullPath.empty())
+    {
+        char stagingPath[PrjFSMaxPath];
+        GetStagingDirectoryPath(commandId, stagingPath);
+        if ((mkdir(s_stagingRootFullPath.c_str(), 0700) && EEXIST != errno) ||
+            StagedDirectory_Create(stagingPath))
+        {
+            return PrjFS_Result_EIOError;
+        }
+        
+        mutex_lock lock(s_stagingDirectoriesMutex);
+        s_stagingDirectories[path] = stagingPath;
+    }
+    
+    RegisterPendingCommand(commandId, MessageType_KtoU_EnumerateDirectory, path, nullptr /* fileHandle */);
+    
+    PrjFS_Result callbackResult = s_callbacks.EnumerateDirectory(
+        commandId,
+        path,
+        request->pid,
+        request->procname);
+    
+    return HandleCallbackResult(commandId, callbackResult);
+}
+
+static PrjFS_Result HandleHydrateFileRequest(uint64_t commandId, const MessageHeader* request, const char* path)
+{
+#ifdef DEBUG
+    std::cout << "PrjFSLib.HandleHydrateFileRequest: " << path << std::endl;
+#endif
+    
+    char fullPath[PrjFSMaxPath];
+    CombinePaths(s_virtualizationRootFullPath.c_str(), path, fullPath);
+    
+    PrjFSFileXAttrData xattrData = {};
+    if (!GetFileXAttr(fullPath, &xattrData))
+    {
+        return PrjFS_Result_EIOError;
+    }
+    
+    // The handle outlives this function if the provider completes the hydration asynchronously, it is
+    // closed and freed by FinishCommand
+    // The file must already exist, and the provider overwrites its empty contents from the beginning
+    int fd = open(fullPath, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return PrjFS_Result_EIOError;
+    }
+    
+    struct stat fileAttributes;
+    if (fstat(fd, &fileAttributes))
+    {
+        close(fd);
+        return PrjFS_Result_EIOError;
+    }
+    
+    // The placeholder already has the file's final size, reserve its blocks up front rather than growing the
+    // allocation with each write. If this fails the writes will still allocate what they need.
+    HydrationFile_Preallocate(fd, fileAttributes.st_size);
+    
+    PrjFS_FileHandle* fileHandle = new PrjFS_FileHandle { fd, 0 };
+    
+    RegisterPendingCommand(commandId, MessageType_KtoU_HydrateFile, path, fileHandle);
+    
+    PrjFS_Result callbackResult = s_callbacks.GetFileStream(
+        commandId,
+        path,
+        xattrData.providerId,
+        xattrData.contentId,
+        request->pid,
+        request->procname,
+        fileHandle);
+    
+    return HandleCallbackResult(commandId, callbackResult);
+}
+
+static PrjFS_Result HandleFileModifiedNotification(uint64_t commandId, const MessageHeader* request, const char* path)
+{
+#ifdef DEBUG
+    std::cout << "PrjFSLib.HandleFileModifiedNotification: " << path << std::endl;
+#endif
+    
+    char fullPath[PrjFSMaxPath];
+    CombinePaths(s_virtualizationRootFullPath.c_str(), path, fullPath);
+    
+    // A file that was already modified has no IDs, and is reported with zeros for them
+    PrjFSFileXAttrData xattrData = {};
+    bool isPlaceholder = GetFileXAttr(fullPath, &xattrData);
+    if (!isPlaceholder && ENOATTR != errno)
+    {
+        return PrjFS_Result_EIOError;
+    }
+    
+    s_callbacks.NotifyOperation(
+        commandId,
+        path,
+        xattrData.providerId,
+        xattrData.contentId,
+        request->pid,
+        request->procname,
+        false /* isDirectory */,
         PrjFS_NotificationType_FileModified,
         nullptr /* destinationRelativePath */);
     
+    if (isPlaceholder)
+    {
+        // The file's contents no longer match its content ID, so it becomes a full file, which
+        // PrjFS_UpdatePlaceholderFileIfNeeded and PrjFS_DeleteFile only change when allowed to
+        DeleteXAttr(fullPath, PrjFSFileXAttrName);
+    }
+    
     return PrjFS_Result_Success;
 }
 
+static void RegisterPendingCommand(uint64_t commandId, MessageType messageType, const char* path, PrjFS_FileHandle* fileHandle)
+{
+    // Registered before the callback runs, as the provider may complete the command from another thread
+    // before the callback returns
+    mutex_lock lock(s_PendingCommandsMutex);
+    std::pair<unordered_map<uint64_t, PendingCommand>::iterator, bool> inserted =
+        s_PendingCommands.insert(std::make_pair(commandId, PendingCommand { messageType, path, fileHandle, false, false, PrjFS_Result_Invalid }));
+    assert(inserted.second);
+}
+
+static PrjFS_Result HandleCallbackResult(uint64_t commandId, PrjFS_Result callbackResult)
+{
+    PendingCommand command;
+    {
+        mutex_lock lock(s_PendingCommandsMutex);
+        unordered_map<uint64_t, PendingCommand>::iterator commandFound = s_PendingCommands.find(commandId);
+        assert(commandFound != s_PendingCommands.end());
+        
+        if (PrjFS_Result_Pending == callbackResult)
+        {
+            if (!commandFound->second.hasCompletionResult)
+            {
+                commandFound->second.callbackReturnedPending = true;
+                return PrjFS_Result_Pending;
+            }
+            
+            callbackResult = commandFound->second.completionResult;
+        }
+        
+        command = std::move(commandFound->second);
+        s_PendingCommands.erase(commandFound);
+    }
+    
+    return FinishCommand(command, callbackResult);
+}
+
+static PrjFS_Result FinishCommand(const PendingCommand& command, PrjFS_Result result)
+{
+    char fullPath[PrjFSMaxPath];
+    CombinePaths(s_virtualizationRootFullPath.c_str(), command.relativePath.c_str(), fullPath);
+    
+    if (nullptr != command.fileHandle)
+    {
+        int closeResult = close(command.fileHandle->fd);
+        delete command.fileHandle;
+        
+        if (closeResult)
+        {
+            // TODO: under what conditions can close fail? How do we recover?
+            return PrjFS_Result_EIOError;
+        }
+    }
+    
+    if (MessageType_KtoU_EnumerateDirectory == command.messageType)
+    {
+        string stagingPath;
+        {
+            mutex_lock lock(s_stagingDirectoriesMutex);
+            unordered_map<string, string>::iterator stagingFound = s_stagingDirectories.find(command.relativePath);
+            if (stagingFound != s_stagingDirectories.end())
+            {
+                stagingPath = std::move(stagingFound->second);
+                s_stagingDirectories.erase(stagingFound);
+            }
+        }
+        
+        if (!stagingPath.empty())
+        {
+            if (PrjFS_Result_Success != result)
+            {
+                StagedDirectory_Remove(stagingPath.c_str());
+            }
+            else if (StagedDirectory_MoveChildren(stagingPath.c_str(), fullPath))
+            {
+                // The directory is still marked empty, so the next enumeration stages its children again and
+                // replaces the ones that were already moved
+                return PrjFS_Result_EIOError;
+            }
+        }
+    }
+    
+    if (PrjFS_Result_Success == result)
+    {
+        // TODO: for hydration, validate that the total bytes written match the size that was reported on the placeholder in the first place
+        // Potential bugs if we don't:
+        //  * The provider writes fewer bytes than expected. The hydrated is left with extra padding up to the original reported size.
+        //  * The provider writes more bytes than expected. The write succeeds, but whatever tool originally opened the file may have already
+        //    allocated the originally reported size, and now the contents appear truncated.
+        
+        if (!SetBitInFileFlags(fullPath, FileFlags_IsEmpty, false))
+        {
+            // TODO: how should we handle this scenario where the provider thinks it succeeded, but we were unable to
+            // update placeholder metadata?
+            return PrjFS_Result_EIOError;
+        }
+    }
+    
+    return result;
+}
+
+static void SendKernelMessageResponses(const char* path, PrjFS_Result result)
+{
+    MessageType responseType =
+        PrjFS_Result_Success == result
+        ? MessageType_Response_Success
+        : MessageType_Response_Fail;
+
+    MessageIdList messageIDs;
+    bool removed = s_PendingRequestMessageIDs.TryRemove(path, &messageIDs);
+    assert(removed);
+    (void)removed;
+
+    if (1 == messageIDs.Count())
+    {
+        s_transport->SendResponse(*messageIDs.begin(), responseType);
+        return;
+    }
+
+    // Coalesced requests are answered with one call per batch rather than one per request
+    messageIDs.SortAndRemoveDuplicates();
+    for (size_t first = 0; first < messageIDs.Count(); first += PrjFSMaxKernelMessageResponseBatch)
+    {
+        size_t batchSize = std::min(messageIDs.Count() - first, static_cast<size_t>(PrjFSMaxKernelMessageResponseBatch));
+        s_transport->SendResponseBatch(messageIDs.begin() + first, static_cast<uint32_t>(batchSize), responseType);
+    }
+}
+
 static bool InitializeEmptyPlaceholder(const char* fullPath)
 {
     return
@@ -601,6 +1101,160 @@ static bool InitializeEmptyPlaceholder(const char* fullPath, TPlaceholder* data,
     return false;
 }
 
+static int WritePlaceholderFile(int directoryFd, const char* path, const unsigned char* providerId, const unsigned char* contentId, unsigned long fileSize, uint16_t fileMode)
+{
+    unsigned char xattr[PlaceholderXAttrMaxSize];
+    size_t xattrSize = PlaceholderXAttr_Encode(providerId, contentId, xattr);
+    
+    return PlaceholderWriter_CreateFile(
+        directoryFd,
+        path,
+        FileFlags_IsInVirtualizationRoot | FileFlags_IsEmpty,
+        PrjFSFileXAttrName,
+        xattr,
+        xattrSize,
+        fileSize,
+        fileMode);
+}
+
+static void WriteBatchedPlaceholder(void* context, size_t index)
+{
+    const PlaceholderBatch* batch = static_cast<const PlaceholderBatch*>(context);
+    PrjFS_PlaceholderInfo& placeholder = batch->placeholders[index];
+    
+    int error;
+    if (placeholder.isDirectory)
+    {
+        error = PlaceholderWriter_CreateDirectory(batch->directoryFd, placeholder.name, FileFlags_IsInVirtualizationRoot | FileFlags_IsEmpty);
+    }
+    else
+    {
+        error = WritePlaceholderFile(
+            batch->directoryFd,
+            placeholder.name,
+            placeholder.providerId,
+            placeholder.contentId,
+            placeholder.fileSize,
+            placeholder.fileMode);
+    }
+    
+    placeholder.result = 0 == error ? PrjFS_Result_Success : PrjFS_Result_EIOError;
+}
+
+static PrjFS_Result UpdatePlaceholderFile(
+    int directoryFd,
+    const char* path,
+    const unsigned char* providerId,
+    const unsigned char* contentId,
+    unsigned long fileSize,
+    PrjFS_UpdateType updateFlags,
+    _Out_ PrjFS_UpdateFailureCause* failureCause)
+{
+    unsigned char xattr[PlaceholderXAttrMaxSize];
+    size_t xattrSize = PlaceholderXAttr_Encode(providerId, contentId, xattr);
+    
+    uint32_t conflicts;
+    int error = PlaceholderWriter_UpdateFile(
+        directoryFd,
+        path,
+        FileFlags_IsInVirtualizationRoot | FileFlags_IsEmpty,
+        PrjFSFileXAttrName,
+        xattr,
+        xattrSize,
+        fileSize,
+        GetAllowedConflicts(updateFlags),
+        &conflicts);
+    return GetUpdateResult(error, conflicts, failureCause);
+}
+
+static void UpdateBatchedPlaceholder(void* context, size_t index, int directoryFd, const char* name, int directoryError)
+{
+    const PlaceholderUpdateBatch* batch = static_cast<const PlaceholderUpdateBatch*>(context);
+    PrjFS_PlaceholderUpdateInfo& update = batch->updates[index];
+    
+    if (0 != directoryError)
+    {
+        update.result = GetUpdateResult(directoryError, PlaceholderConflict_None, &update.failureCause);
+        if (PrjFS_Result_EFileNotFound == update.result)
+        {
+            // It's the file's parent directory that is missing
+            update.result = PrjFS_Result_EPathNotFound;
+        }
+        
+        return;
+    }
+    
+    update.result = UpdatePlaceholderFile(
+        directoryFd,
+        name,
+        update.providerId,
+        update.contentId,
+        update.fileSize,
+        batch->updateFlags,
+        &update.failureCause);
+}
+
+static uint32_t GetAllowedConflicts(PrjFS_UpdateType updateFlags)
+{
+    uint32_t allowedConflicts = PlaceholderConflict_None;
+    if (updateFlags & PrjFS_UpdateType_AllowDirtyData)
+    {
+        allowedConflicts |= PlaceholderConflict_FullFile;
+    }
+    
+    if (updateFlags & PrjFS_UpdateType_AllowReadOnly)
+    {
+        allowedConflicts |= PlaceholderConflict_ReadOnly;
+    }
+    
+    return allowedConflicts;
+}
+
+static PrjFS_Result GetUpdateResult(int error, uint32_t conflicts, _Out_ PrjFS_UpdateFailureCause* failureCause)
+{
+    *failureCause = PrjFS_UpdateFailureCause_Invalid;
+    switch (error)
+    {
+        case 0:
+            break;
+            
+        case ENOENT:
+            return PrjFS_Result_EFileNotFound;
+            
+        case ENOTDIR:
+            return PrjFS_Result_EPathNotFound;
+            
+        case ENOTEMPTY:
+            return PrjFS_Result_EDirectoryNotEmpty;
+            
+        case EACCES:
+        case EPERM:
+            return PrjFS_Result_EAccessDenied;
+            
+        default:
+            return PrjFS_Result_EIOError;
+    }
+    
+    if (PlaceholderConflict_None == conflicts)
+    {
+        return PrjFS_Result_Success;
+    }
+    
+    uint32_t cause = PrjFS_UpdateFailureCause_Invalid;
+    if (conflicts & PlaceholderConflict_FullFile)
+    {
+        cause |= PrjFS_UpdateFailureCause_FullFile;
+    }
+    
+    if (conflicts & PlaceholderConflict_ReadOnly)
+    {
+        cause |= PrjFS_UpdateFailureCause_ReadOnly;
+    }
+    
+    *failureCause = static_cast<PrjFS_UpdateFailureCause>(cause);
+    return PrjFS_Result_EVirtualizationInvalidOperation;
+}
+
 static bool IsVirtualizationRoot(const char* path)
 {
     PrjFSVirtualizationRootXAttrData data = {};
@@ -617,10 +1271,88 @@ static void CombinePaths(const char* root, const char* relative, char (&combined
     snprintf(combined, PrjFSMaxPath, "%s/%s", root, relative);
 }
 
+static void CombinePlaceholderDirectoryPath(const char* relativeDirectoryPath, char (&combined)[PrjFSMaxPath])
+{
+    {
+        mutex_lock lock(s_stagingDirectoriesMutex);
+        unordered_map<string, string>::const_iterator stagingFound = s_stagingDirectories.find(relativeDirectoryPath);
+        if (stagingFound != s_stagingDirectories.end())
+        {
+            snprintf(combined, PrjFSMaxPath, "%s", stagingFound->second.c_str());
+            return;
+        }
+    }
+    
+    CombinePaths(s_virtualizationRootFullPath.c_str(), relativeDirectoryPath, combined);
+}
+
+static void CombinePlaceholderPath(const char* relativePath, char (&combined)[PrjFSMaxPath])
+{
+    // Placeholders written while their parent directory is being expanded go into its staging directory
+    const char* name = strrchr(relativePath, '/');
+    if (nullptr != name)
+    {
+        mutex_lock lock(s_stagingDirectoriesMutex);
+        unordered_map<string, string>::const_iterator stagingFound = s_stagingDirectories.find(string(relativePath, name - relativePath));
+        if (stagingFound != s_stagingDirectories.end())
+        {
+            snprintf(combined, PrjFSMaxPath, "%s%s", stagingFound->second.c_str(), name);
+            return;
+        }
+    }
+    
+    CombinePaths(s_virtualizationRootFullPath.c_str(), relativePath, combined);
+}
+
+static void InitializeStagingRoot(const char* virtualizationRootFullPath)
+{
+    // Staging directories live beside the virtualization root rather than in it, so that git and the kext never
+    // see them, and on the same volume, so that staged children can still be renamed into place
+    s_stagingRootFullPath.clear();
+    
+    string rootPath = virtualizationRootFullPath;
+    while (rootPath.size() > 1 && '/' == rootPath.back())
+    {
+        rootPath.pop_back();
+    }
+    
+    size_t nameOffset = rootPath.rfind('/');
+    if (string::npos == nameOffset || nameOffset + 1 == rootPath.size())
+    {
+        return;
+    }
+    
+    string parentPath = 0 == nameOffset ? string("/") : rootPath.substr(0, nameOffset);
+    struct stat rootAttributes;
+    struct stat parentAttributes;
+    if (stat(rootPath.c_str(), &rootAttributes) ||
+        stat(parentPath.c_str(), &parentAttributes) ||
+        rootAttributes.st_dev != parentAttributes.st_dev)
+    {
+        cerr << "Staged directory expansion is unavailable, as " << parentPath << " is not on the same volume as the virtualization root" << endl;
+        return;
+    }
+    
+    s_stagingRootFullPath = (0 == nameOffset ? string() : parentPath) + "/" + StagedDirectory_NamePrefix + rootPath.substr(nameOffset + 1);
+    
+    // Sweep up the staging directories of expansions that were still running when an earlier instance exited
+    int error = StagedDirectory_Remove(s_stagingRootFullPath.c_str());
+    if (0 != error && ENOENT != error)
+    {
+        cerr << "Removing staging directory " << s_stagingRootFullPath << " failed: " << error << ", " << strerror(error) << endl;
+    }
+}
+
+static void GetStagingDirectoryPath(uint64_t commandId, char (&stagingPath)[PrjFSMaxPath])
+{
+    // Only one enumeration of a directory runs at a time, and each has its own command ID
+    snprintf(stagingPath, PrjFSMaxPath, "%s/%llu", s_stagingRootFullPath.c_str(), static_cast<unsigned long long>(commandId));
+}
+
 static bool SetBitInFileFlags(const char* path, uint32_t bit, bool value)
 {
-    struct stat fileAttributes;
-    if (stat(path, &fileAttributes))
+    uint32_t fileFlags;
+    if (!GetFileFlags(path, &fileFlags))
     {
         return false;
     }
@@ -628,14 +1360,18 @@ static bool SetBitInFileFlags(const char* path, uint32_t bit, bool value)
     uint32_t newValue;
     if (value)
     {
-        newValue = fileAttributes.st_flags | bit;
+        newValue = fileFlags | bit;
     }
     else
     {
-        newValue = fileAttributes.st_flags & ~bit;
+        newValue = fileFlags & ~bit;
     }
     
+#ifdef __APPLE__
     if (chflags(path, newValue))
+#else
+    if (setxattr(path, PlaceholderWriter_FileFlagsXAttrName, &newValue, sizeof(newValue), 0))
+#endif
     {
         return false;
     }
@@ -645,18 +1381,46 @@ static bool SetBitInFileFlags(const char* path, uint32_t bit, bool value)
 
 static bool IsBitSetInFileFlags(const char* path, uint32_t bit)
 {
+    uint32_t fileFlags;
+    if (!GetFileFlags(path, &fileFlags))
+    {
+        return false;
+    }
+
+    return fileFlags & bit;
+}
+
+static bool GetFileFlags(const char* path, uint32_t* fileFlags)
+{
+#ifdef __APPLE__
     struct stat fileAttributes;
     if (stat(path, &fileAttributes))
     {
         return false;
     }
-
-    return fileAttributes.st_flags & bit;
+    
+    *fileFlags = fileAttributes.st_flags;
+#else
+    // Kept where PlaceholderWriter keeps them on platforms without BSD file flags. A file without the xattr has
+    // none set.
+    ssize_t size = getxattr(path, PlaceholderWriter_FileFlagsXAttrName, fileFlags, sizeof(*fileFlags));
+    if (size < 0 && ENODATA != errno)
+    {
+        return false;
+    }
+    
+    if (sizeof(*fileFlags) != size)
+    {
+        *fileFlags = 0;
+    }
+#endif
+    
+    return true;
 }
 
 static bool AddXAttr(const char* path, const char* name, const void* value, size_t size)
 {
-    if (setxattr(path, name, value, size, 0, 0))
+    if (WriteXAttr(path, name, value, size, 0))
     {
         return false;
     }
@@ -666,49 +1430,77 @@ static bool AddXAttr(const char* path, const char* name, const void* value, size
 
 static bool GetXAttr(const char* path, const char* name, size_t size, _Out_ void* value)
 {
-    if (getxattr(path, name, value, size, 0, 0) == size)
+    if (ReadXAttr(path, name, value, size) == static_cast<ssize_t>(size))
     {
-        // TODO: also validate the magic number and format version.
-        // It's easy to check their expected values, but we will need to decide what to do if they are incorrect.
-
-        return true;
+        // Every xattr struct starts with a header. Data written by a different format version is treated the
+        // same as a missing xattr.
+        const PrjFSXattrHeader* header = static_cast<const PrjFSXattrHeader*>(value);
+        return
+            PlaceholderMagicNumber == header->magicNumber &&
+            PlaceholderFormatVersion == header->formatVersion;
     }
     
     return false;
 }
 
-static errno_t SendKernelMessageResponse(uint64_t messageId, MessageType responseType)
+static bool GetFileXAttr(const char* path, _Out_ PrjFSFileXAttrData* data)
 {
-    const uint64_t inputs[] = { messageId, responseType };
-    IOReturn callResult = IOConnectCallScalarMethod(
-        s_kernelServiceConnection,
-        ProviderSelector_KernelMessageResponse,
-        inputs, std::extent<decltype(inputs)>::value, // scalar inputs
-        nullptr, nullptr);                            // no outputs
-    return callResult == kIOReturnSuccess ? 0 : EBADMSG;
+    static_assert(sizeof(PrjFSFileXAttrData) <= PlaceholderXAttrMaxSize, "Buffer must fit either version");
+    
+    unsigned char xattr[PlaceholderXAttrMaxSize];
+    ssize_t xattrSize = ReadXAttr(path, PrjFSFileXAttrName, xattr, sizeof(xattr));
+    if (xattrSize < 0)
+    {
+        return false;
+    }
+    
+    if (!PlaceholderXAttr_Decode(xattr, xattrSize, data))
+    {
+        errno = EINVAL;
+        return false;
+    }
+    
+    if (PlaceholderFormatVersion == data->header.formatVersion)
+    {
+        // Placeholders written before the compact format are rewritten the first time they are read. If this
+        // fails the old version still works, so it is tried again next time.
+        xattrSize = PlaceholderXAttr_Encode(data->providerId, data->contentId, xattr);
+        WriteXAttr(path, PrjFSFileXAttrName, xattr, xattrSize, XATTR_REPLACE);
+    }
+    
+    return true;
 }
 
-static errno_t RegisterVirtualizationRootPath(const char* path)
+static ssize_t ReadXAttr(const char* path, const char* name, void* value, size_t size)
 {
-    uint64_t error = EBADMSG;
-    uint32_t output_count = 1;
-    size_t pathSize = strlen(path) + 1;
-    IOReturn callResult = IOConnectCallMethod(
-        s_kernelServiceConnection,
-        ProviderSelector_RegisterVirtualizationRootPath,
-        nullptr, 0, // no scalar inputs
-        path, pathSize, // struct input
-        &error, &output_count, // scalar output
-        nullptr, nullptr); // no struct output
-    assert(callResult == kIOReturnSuccess);
-    return static_cast<errno_t>(error);
+#ifdef __APPLE__
+    return getxattr(path, name, value, size, 0, 0);
+#else
+    // Linux only lets unprivileged processes use xattrs in the user namespace
+    char userName[256];
+    snprintf(userName, sizeof(userName), "user.%s", name);
+    return getxattr(path, userName, value, size);
+#endif
+}
+
+static int WriteXAttr(const char* path, const char* name, const void* value, size_t size, int options)
+{
+#ifdef __APPLE__
+    return setxattr(path, name, value, size, 0, options);
+#else
+    char userName[256];
+    snprintf(userName, sizeof(userName), "user.%s", name);
+    return setxattr(path, userName, value, size, options);
+#endif
 }
 
-static void ClearMachNotification(mach_port_t port)
+static int DeleteXAttr(const char* path, const char* name)
 {
-    struct {
-        mach_msg_header_t	msgHdr;
-        mach_msg_trailer_t	trailer;
-    } msg;
-    mach_msg(&msg.msgHdr, MACH_RCV_MSG | MACH_RCV_TIMEOUT, 0, sizeof(msg), port, 0, MACH_PORT_NULL);
+#ifdef __APPLE__
+    return removexattr(path, name, 0);
+#else
+    char userName[256];
+    snprintf(userName, sizeof(userName), "user.%s", name);
+    return removexattr(path, userName);
+#endif
 }
@@ -6,6 +6,7 @@
 
 #define _In_
 #define _Out_
+#define _Inout_
 
 typedef struct _PrjFS_FileHandle PrjFS_FileHandle;
 
@@ -33,6 +34,8 @@ typedef enum
     PrjFS_Result_EIOError                           = 0x20000040,
     PrjFS_Result_ENotAVirtualizationRoot            = 0x20000080,
     PrjFS_Result_EVirtualizationRootAlreadyExists   = 0x20000100,
+    PrjFS_Result_EDirectoryNotEmpty                 = 0x20000200,
+    PrjFS_Result_EVirtualizationInvalidOperation    = 0x20000400,
     
     PrjFS_Result_ENotYetImplemented                 = 0xFFFFFFFF,
     
@@ -84,10 +87,36 @@ extern "C" PrjFS_Result PrjFS_WritePlaceholderFile(
     _In_    unsigned long                           fileSize,
     _In_    uint16_t                                fileMode);
 
+typedef struct
+{
+    // Relative to the directory passed to PrjFS_WritePlaceholdersBatch
+    _In_    const char*                             name;
+    _In_    bool                                    isDirectory;
+    
+    // Only used for files
+    _In_    unsigned char                           providerId[PrjFS_PlaceholderIdLength];
+    _In_    unsigned char                           contentId[PrjFS_PlaceholderIdLength];
+    _In_    unsigned long                           fileSize;
+    _In_    uint16_t                                fileMode;
+    
+    _Out_   PrjFS_Result                            result;
+    
+} PrjFS_PlaceholderInfo;
+
+// Writes the placeholders for several children of one directory. The directory is opened once and each
+// placeholder is created relative to it, using up to threadCount threads. Returns PrjFS_Result_Success if every
+// placeholder was written, otherwise the result of each one is set in placeholders.
+extern "C" PrjFS_Result PrjFS_WritePlaceholdersBatch(
+    _In_    const char*                             relativeDirectoryPath,
+    _Inout_ PrjFS_PlaceholderInfo*                  placeholders,
+    _In_    unsigned int                            placeholderCount,
+    _In_    unsigned int                            threadCount);
+
 typedef enum
 {
     PrjFS_UpdateType_Invalid                        = 0x00000000,
     
+    PrjFS_UpdateType_AllowDirtyData                 = 0x00000002,
     PrjFS_UpdateType_AllowReadOnly                  = 0x00000020,
     
 } PrjFS_UpdateType;
@@ -101,7 +130,13 @@ typedef enum
     
 } PrjFS_UpdateFailureCause;
 
-PrjFS_Result PrjFS_UpdatePlaceholderFileIfNeeded(
+// Makes the file a placeholder with the new IDs and size, unless it already is one. A placeholder that has been
+// hydrated, or a full file if PrjFS_UpdateType_AllowDirtyData is set, is replaced with a new placeholder, so its
+// contents are hydrated again when next read.
+// A full file, that was modified or is not a placeholder, and a file without write permission are left as they
+// are unless updateFlags allows it: PrjFS_Result_EVirtualizationInvalidOperation is returned and failureCause
+// says why.
+extern "C" PrjFS_Result PrjFS_UpdatePlaceholderFileIfNeeded(
     _In_    const char*                             relativePath,
     _In_    unsigned char                           providerId[PrjFS_PlaceholderIdLength],
     _In_    unsigned char                           contentId[PrjFS_PlaceholderIdLength],
@@ -109,16 +144,50 @@ PrjFS_Result PrjFS_UpdatePlaceholderFileIfNeeded(
     _In_    PrjFS_UpdateType                        updateFlags,
     _Out_   PrjFS_UpdateFailureCause*               failureCause);
 
-PrjFS_Result PrjFS_DeleteFile(
+// Deletes a file, with the same checks as PrjFS_UpdatePlaceholderFileIfNeeded, or an empty directory
+extern "C" PrjFS_Result PrjFS_DeleteFile(
     _In_    const char*                             relativePath,
     _In_    PrjFS_UpdateType                        updateFlags,
     _Out_   PrjFS_UpdateFailureCause*               failureCause);
 
+typedef struct
+{
+    // Relative to the virtualization root
+    _In_    const char*                             relativePath;
+    
+    _In_    unsigned char                           providerId[PrjFS_PlaceholderIdLength];
+    _In_    unsigned char                           contentId[PrjFS_PlaceholderIdLength];
+    _In_    unsigned long                           fileSize;
+    
+    _Out_   PrjFS_Result                            result;
+    _Out_   PrjFS_UpdateFailureCause                failureCause;
+    
+} PrjFS_PlaceholderUpdateInfo;
+
+// Does what PrjFS_UpdatePlaceholderFileIfNeeded does for each update, such as every placeholder changed by a
+// checkout. Updates are grouped by parent directory, each directory is opened once and the groups are spread
+// across up to threadCount threads. Returns PrjFS_Result_Success if every file was updated or already up to date,
+// otherwise the result and failure cause of each one is set in updates.
+extern "C" PrjFS_Result PrjFS_UpdatePlaceholdersBatch(
+    _Inout_ PrjFS_PlaceholderUpdateInfo*            updates,
+    _In_    unsigned int                            updateCount,
+    _In_    PrjFS_UpdateType                        updateFlags,
+    _In_    unsigned int                            threadCount);
+
 extern "C" PrjFS_Result PrjFS_WriteFileContents(
     _In_    const PrjFS_FileHandle*                 fileHandle,
     _In_    const void*                             bytes,
     _In_    unsigned int                            byteCount);
 
+// Writes byteCount bytes of sourceFileDescriptor, starting at sourceOffset, after the contents written so far.
+// The library copies the bytes itself, without the provider reading them into memory first. A source that can't
+// seek, such as a pipe, is read from its current position, and sourceOffset must be 0.
+extern "C" PrjFS_Result PrjFS_WriteFileContentsFromFile(
+    _In_    const PrjFS_FileHandle*                 fileHandle,
+    _In_    int                                     sourceFileDescriptor,
+    _In_    unsigned long long                      sourceOffset,
+    _In_    unsigned long long                      byteCount);
+
 typedef enum
 {
     PrjFS_FileState_Invalid                         = 0x00000000,
@@ -129,10 +198,42 @@ typedef enum
     
 } PrjFS_FileState;
 
-PrjFS_Result PrjFS_GetOnDiskFileState(
+// Gets whether the file at fullPath is a placeholder that has not been hydrated, a hydrated placeholder, or a
+// full file, which was modified or not written by the provider at all. Directories are placeholders until they
+// have been enumerated, and hydrated placeholders after.
+extern "C" PrjFS_Result PrjFS_GetOnDiskFileState(
     _In_    const char*                             fullPath,
     _Out_   unsigned int*                           fileState);
 
+typedef struct
+{
+    _Out_   unsigned long long                      placeholderFileCount;
+    _Out_   unsigned long long                      hydratedPlaceholderFileCount;
+    _Out_   unsigned long long                      fullFileCount;
+    
+    _Out_   unsigned long long                      placeholderDirectoryCount;
+    _Out_   unsigned long long                      hydratedPlaceholderDirectoryCount;
+    _Out_   unsigned long long                      fullDirectoryCount;
+    
+} PrjFS_FileStateCounts;
+
+typedef void (PrjFS_FileStateCallback)(
+    _In_    void*                                   context,
+    _In_    const char*                             relativePath,
+    _In_    bool                                    isDirectory,
+    _In_    PrjFS_FileState                         fileState);
+
+// Counts the on disk state, as PrjFS_GetOnDiskFileState reports it, of every file and directory under
+// relativeDirectoryPath, using up to threadCount threads. If callback is not null it is called, one call at a
+// time, with the path of each hydrated placeholder and full file or directory, relative to the virtualization
+// root. Placeholder directories that have not been enumerated are not enumerated by the scan.
+extern "C" PrjFS_Result PrjFS_ScanOnDiskFileStates(
+    _In_    const char*                             relativeDirectoryPath,
+    _In_    unsigned int                            threadCount,
+    _Out_   PrjFS_FileStateCounts*                  counts,
+    _In_    PrjFS_FileStateCallback*                callback,
+    _In_    void*                                   callbackContext);
+
 typedef PrjFS_Result (PrjFS_EnumerateDirectoryCallback)(
     _In_    unsigned long                           commandId,
     _In_    const char*                             relativePath,
@@ -169,8 +270,61 @@ typedef struct _PrjFS_Callbacks
     
 } PrjFS_Callbacks;
 
-PrjFS_Result PrjFS_CompleteCommand(
+// Finishes a request whose callback returned PrjFS_Result_Pending, and may be called from any thread. For
+// GetFileStream the file handle passed to the callback stays valid until the command is completed.
+extern "C" PrjFS_Result PrjFS_CompleteCommand(
     _In_    unsigned long                           commandId,
     _In_    PrjFS_Result                            result);
 
+// When enabled, placeholders written while a directory is being enumerated go into a staging directory, and are
+// moved into the directory only once the EnumerateDirectory command succeeds. A provider that fails or exits part
+// way through an enumeration then leaves the directory empty, ready to be enumerated again. Staging directories
+// are kept in .prjfs-staging.<root name>, beside the virtualization root, which PrjFS_StartVirtualizationInstance
+// empties; directories are not staged if the root's parent directory is on another volume. Off by default.
+extern "C" PrjFS_Result PrjFS_SetStagedDirectoryExpansion(
+    _In_    bool                                    enabled);
+
+typedef struct
+{
+    _Out_   unsigned int                            capacity;
+    
+    // Kernel messages that were received into a pooled buffer, and that needed a heap allocation because
+    // the message was too large or every pooled buffer was in use
+    _Out_   unsigned long long                      hits;
+    _Out_   unsigned long long                      misses;
+    
+} PrjFS_MessageBufferPoolStats;
+
+extern "C" PrjFS_Result PrjFS_GetMessageBufferPoolStats(
+    _Out_   PrjFS_MessageBufferPoolStats*           stats);
+
+// Requests are handled by poolThreadCount threads, which take enumerations first, then hydrations, and only
+// then notifications
+typedef enum
+{
+    PrjFS_RequestQueue_Invalid                      = 0x00000000,
+    
+    PrjFS_RequestQueue_Enumeration                  = 0x00000001,
+    PrjFS_RequestQueue_Hydration                    = 0x00000002,
+    PrjFS_RequestQueue_Notification                 = 0x00000003,
+    
+} PrjFS_RequestQueue;
+
+typedef struct
+{
+    _Out_   unsigned long long                      enqueued;
+    _Out_   unsigned long long                      started;
+    _Out_   unsigned int                            queueDepth;
+    _Out_   unsigned int                            maxQueueDepth;
+    
+    // Time requests spent queued before a thread started handling them
+    _Out_   unsigned long long                      totalWaitMicroseconds;
+    _Out_   unsigned long long                      maxWaitMicroseconds;
+    
+} PrjFS_RequestQueueStats;
+
+extern "C" PrjFS_Result PrjFS_GetRequestQueueStats(
+    _In_    PrjFS_RequestQueue                      queue,
+    _Out_   PrjFS_RequestQueueStats*                stats);
+
 #endif /* PrjFSLib_h */
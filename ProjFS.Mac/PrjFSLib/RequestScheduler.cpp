@@ -0,0 +1,115 @@
+#include "RequestScheduler.hpp"
+#include <cassert>
+
+typedef std::lock_guard<std::mutex> mutex_lock;
+
+RequestScheduler::RequestScheduler() :
+    lanes(),
+    stopping(false)
+{
+}
+
+RequestScheduler::~RequestScheduler()
+{
+    this->Stop();
+}
+
+void RequestScheduler::Start(unsigned int threadCount)
+{
+    assert(this->threads.empty());
+    assert(threadCount > 0);
+
+    this->stopping = false;
+    for (unsigned int i = 0; i < threadCount; ++i)
+    {
+        this->threads.emplace_back(&RequestScheduler::RunWorker, this);
+    }
+}
+
+void RequestScheduler::Stop()
+{
+    {
+        mutex_lock lock(this->mutex);
+        this->stopping = true;
+    }
+
+    this->requestsAvailable.notify_all();
+    for (std::thread& thread : this->threads)
+    {
+        thread.join();
+    }
+
+    this->threads.clear();
+}
+
+void RequestScheduler::Enqueue(RequestLane lane, WorkFunction work, void* context)
+{
+    assert(lane < RequestLane_Count);
+
+    {
+        mutex_lock lock(this->mutex);
+        Lane& queue = this->lanes[lane];
+        queue.requests.push_back(QueuedRequest { work, context, Clock::now() });
+
+        ++queue.stats.enqueuedCount;
+        ++queue.stats.queueDepth;
+        if (queue.stats.queueDepth > queue.stats.maxQueueDepth)
+        {
+            queue.stats.maxQueueDepth = queue.stats.queueDepth;
+        }
+    }
+
+    this->requestsAvailable.notify_one();
+}
+
+RequestLaneStats RequestScheduler::GetLaneStats(RequestLane lane)
+{
+    assert(lane < RequestLane_Count);
+
+    mutex_lock lock(this->mutex);
+    return this->lanes[lane].stats;
+}
+
+void RequestScheduler::RunWorker()
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true)
+    {
+        Lane* lane = nullptr;
+        for (Lane& candidate : this->lanes)
+        {
+            if (!candidate.requests.empty())
+            {
+                lane = &candidate;
+                break;
+            }
+        }
+
+        if (nullptr == lane)
+        {
+            if (this->stopping)
+            {
+                return;
+            }
+
+            this->requestsAvailable.wait(lock);
+            continue;
+        }
+
+        QueuedRequest request = lane->requests.front();
+        lane->requests.pop_front();
+
+        uint64_t waitMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - request.enqueueTime).count();
+        ++lane->stats.startedCount;
+        --lane->stats.queueDepth;
+        lane->stats.totalWaitMicroseconds += waitMicroseconds;
+        if (waitMicroseconds > lane->stats.maxWaitMicroseconds)
+        {
+            lane->stats.maxWaitMicroseconds = waitMicroseconds;
+        }
+
+        lock.unlock();
+        request.work(request.context);
+        lock.lock();
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+// Lanes in priority order: a worker always takes the oldest request from the first lane that has one
+enum RequestLane
+{
+    RequestLane_Enumeration,
+    RequestLane_Hydration,
+    RequestLane_Notification,
+
+    RequestLane_Count,
+};
+
+struct RequestLaneStats
+{
+    uint64_t enqueuedCount;
+    uint64_t startedCount;
+    uint32_t queueDepth;
+    uint32_t maxQueueDepth;
+
+    // Time requests spent queued before a worker started them
+    uint64_t totalWaitMicroseconds;
+    uint64_t maxWaitMicroseconds;
+};
+
+// Fixed size pool of worker threads that runs requests from separate lanes, so that requests which block user
+// processes (enumerations and hydrations) are never queued behind notifications.
+class RequestScheduler
+{
+public:
+    typedef void (*WorkFunction)(void* context);
+
+    RequestScheduler();
+    ~RequestScheduler();
+    RequestScheduler(const RequestScheduler&) = delete;
+    RequestScheduler& operator=(const RequestScheduler&) = delete;
+
+    void Start(unsigned int threadCount);
+
+    // Runs the requests that are already queued, then stops and joins the worker threads
+    void Stop();
+
+    void Enqueue(RequestLane lane, WorkFunction work, void* context);
+
+    RequestLaneStats GetLaneStats(RequestLane lane);
+    unsigned int ThreadCount() const { return static_cast<unsigned int>(this->threads.size()); }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct QueuedRequest
+    {
+        WorkFunction work;
+        void* context;
+        Clock::time_point enqueueTime;
+    };
+
+    struct Lane
+    {
+        std::deque<QueuedRequest> requests;
+        RequestLaneStats stats;
+    };
+
+    void RunWorker();
+
+    std::mutex mutex;
+    std::condition_variable requestsAvailable;
+    Lane lanes[RequestLane_Count];
+    bool stopping;
+    std::vector<std::thread> threads;
+};
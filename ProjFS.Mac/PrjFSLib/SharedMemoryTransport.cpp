@@ -0,0 +1,270 @@
+#include "SharedMemoryTransport.hpp"
+#include "../PrjFSKext/public/PrjFSProviderClientShared.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+static size_t GetMessageRingOffset();
+static size_t GetResponseRingOffset(uint32_t ringCapacity);
+static int CreateNotification(SharedMemoryNotification* notification);
+static void CloseNotification(const SharedMemoryNotification& notification);
+static int SendResponseRecord(
+    SharedMemoryChannel& channel,
+    MessageRingProducer* responseRingProducer,
+    const uint64_t* messageIds,
+    uint32_t messageIdCount,
+    MessageType responseType);
+
+void SharedMemoryNotification_Signal(const SharedMemoryNotification& notification)
+{
+    // Fails only if the notification is already pending, which is as good
+#ifdef __linux__
+    uint64_t count = 1;
+    (void)write(notification.writeFd, &count, sizeof(count));
+#else
+    char signal = 0;
+    (void)write(notification.writeFd, &signal, sizeof(signal));
+#endif
+}
+
+void SharedMemoryNotification_Wait(const SharedMemoryNotification& notification)
+{
+    // Reading the eventfd resets it; the pipe is drained as far as one read goes
+#ifdef __linux__
+    uint64_t count;
+#else
+    char count[64];
+#endif
+    while (read(notification.readFd, &count, sizeof(count)) < 0 && EINTR == errno)
+    {
+    }
+}
+
+int SharedMemoryChannel_Create(uint32_t ringCapacity, SharedMemoryChannel* channel)
+{
+    memset(channel, 0, sizeof(*channel));
+    channel->messagesAvailable = { -1, -1 };
+    channel->responsesAvailable = { -1, -1 };
+
+    uint32_t largestRecordSize = MessageRing_GetRecordSize(static_cast<uint32_t>(std::max(
+        sizeof(MessageHeader) + PrjFSMaxPath,
+        sizeof(SharedMemoryResponse) + PrjFSMaxKernelMessageResponseBatch * sizeof(uint64_t))));
+    if (0 != (ringCapacity & (ringCapacity - 1)) || largestRecordSize > ringCapacity / 2)
+    {
+        return EINVAL;
+    }
+
+    channel->memorySize = GetResponseRingOffset(ringCapacity) + MessageRing_GetMemorySize(ringCapacity);
+    channel->memory = mmap(nullptr, channel->memorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+    if (MAP_FAILED == channel->memory)
+    {
+        int error = errno;
+        channel->memory = nullptr;
+        return error;
+    }
+
+    SharedMemoryChannelHeader* header = new (channel->memory) SharedMemoryChannelHeader();
+    header->isVirtualizationRootRegistered = 0;
+    MessageRing_Init(static_cast<uint8_t*>(channel->memory) + GetMessageRingOffset(), ringCapacity);
+    MessageRing_Init(static_cast<uint8_t*>(channel->memory) + GetResponseRingOffset(ringCapacity), ringCapacity);
+
+    int error = CreateNotification(&channel->messagesAvailable);
+    if (0 == error)
+    {
+        error = CreateNotification(&channel->responsesAvailable);
+    }
+
+    if (0 != error)
+    {
+        SharedMemoryChannel_Destroy(channel);
+    }
+
+    return error;
+}
+
+void SharedMemoryChannel_Destroy(SharedMemoryChannel* channel)
+{
+    if (nullptr != channel->memory)
+    {
+        munmap(channel->memory, channel->memorySize);
+    }
+
+    CloseNotification(channel->messagesAvailable);
+    CloseNotification(channel->responsesAvailable);
+    memset(channel, 0, sizeof(*channel));
+}
+
+SharedMemoryChannelHeader* SharedMemoryChannel_GetHeader(const SharedMemoryChannel& channel)
+{
+    return static_cast<SharedMemoryChannelHeader*>(channel.memory);
+}
+
+MessageRingHeader* SharedMemoryChannel_GetMessageRing(const SharedMemoryChannel& channel)
+{
+    return reinterpret_cast<MessageRingHeader*>(static_cast<uint8_t*>(channel.memory) + GetMessageRingOffset());
+}
+
+MessageRingHeader* SharedMemoryChannel_GetResponseRing(const SharedMemoryChannel& channel)
+{
+    // Both rings have the same capacity
+    uint32_t ringCapacity = SharedMemoryChannel_GetMessageRing(channel)->capacity;
+    return reinterpret_cast<MessageRingHeader*>(static_cast<uint8_t*>(channel.memory) + GetResponseRingOffset(ringCapacity));
+}
+
+SharedMemoryTransport::SharedMemoryTransport(const SharedMemoryChannel& channel) :
+    channel(channel),
+    isStopping(false)
+{
+    MessageRing_InitProducer(&this->responseRingProducer, SharedMemoryChannel_GetResponseRing(channel)->capacity);
+}
+
+SharedMemoryTransport::~SharedMemoryTransport()
+{
+    if (this->messageThread.joinable())
+    {
+        this->isStopping = true;
+        SharedMemoryNotification_Signal(this->channel.messagesAvailable);
+        this->messageThread.join();
+    }
+}
+
+bool SharedMemoryTransport::Start(MessageHandler handler)
+{
+    this->messageThread = std::thread(&SharedMemoryTransport::HandleMessages, this, handler);
+    return true;
+}
+
+int SharedMemoryTransport::RegisterVirtualizationRootPath(const char* path)
+{
+    SharedMemoryChannelHeader* header = SharedMemoryChannel_GetHeader(this->channel);
+    if (strlen(path) >= sizeof(header->virtualizationRootPath))
+    {
+        return ENAMETOOLONG;
+    }
+
+    // Like the kext, only one root can be registered per connection
+    if (header->isVirtualizationRootRegistered)
+    {
+        return EBUSY;
+    }
+
+    snprintf(header->virtualizationRootPath, sizeof(header->virtualizationRootPath), "%s", path);
+    header->isVirtualizationRootRegistered.store(1, std::memory_order_release);
+    return 0;
+}
+
+int SharedMemoryTransport::SendResponse(uint64_t messageId, MessageType responseType)
+{
+    return SendResponseRecord(this->channel, &this->responseRingProducer, &messageId, 1, responseType);
+}
+
+int SharedMemoryTransport::SendResponseBatch(const uint64_t* messageIds, uint32_t messageIdCount, MessageType responseType)
+{
+    if (messageIdCount > PrjFSMaxKernelMessageResponseBatch)
+    {
+        return EINVAL;
+    }
+
+    return SendResponseRecord(this->channel, &this->responseRingProducer, messageIds, messageIdCount, responseType);
+}
+
+void SharedMemoryTransport::HandleMessages(MessageHandler handler)
+{
+    MessageRingHeader* ring = SharedMemoryChannel_GetMessageRing(this->channel);
+    while (!this->isStopping)
+    {
+        // As IOKitTransport does, messages are handled in place a batch at a time
+        if (0 == MessageRing_Drain(ring, KernelTransportMessageBatchSize, handler) &&
+            MessageRing_PrepareToWait(ring))
+        {
+            SharedMemoryNotification_Wait(this->channel.messagesAvailable);
+        }
+    }
+}
+
+// Rings are 64 byte aligned, so that their headers keep the producers' and the consumer's positions in separate
+// cache lines
+static size_t GetMessageRingOffset()
+{
+    return (sizeof(SharedMemoryChannelHeader) + 63) & ~static_cast<size_t>(63);
+}
+
+static size_t GetResponseRingOffset(uint32_t ringCapacity)
+{
+    return (GetMessageRingOffset() + MessageRing_GetMemorySize(ringCapacity) + 63) & ~static_cast<size_t>(63);
+}
+
+static int CreateNotification(SharedMemoryNotification* notification)
+{
+#ifdef __linux__
+    int fd = eventfd(0, EFD_CLOEXEC);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    *notification = { fd, fd };
+#else
+    int fds[2];
+    if (pipe(fds))
+    {
+        return errno;
+    }
+
+    // A full pipe already wakes the reader, so signalling must not block on it
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    *notification = { fds[0], fds[1] };
+#endif
+
+    return 0;
+}
+
+static void CloseNotification(const SharedMemoryNotification& notification)
+{
+    if (notification.readFd >= 0)
+    {
+        close(notification.readFd);
+    }
+
+    if (notification.writeFd >= 0 && notification.writeFd != notification.readFd)
+    {
+        close(notification.writeFd);
+    }
+}
+
+static int SendResponseRecord(
+    SharedMemoryChannel& channel,
+    MessageRingProducer* responseRingProducer,
+    const uint64_t* messageIds,
+    uint32_t messageIdCount,
+    MessageType responseType)
+{
+    SharedMemoryResponse response = { static_cast<uint32_t>(responseType), messageIdCount };
+    uint32_t recordSize = static_cast<uint32_t>(sizeof(response) + messageIdCount * sizeof(uint64_t));
+
+    MessageRingHeader* ring = SharedMemoryChannel_GetResponseRing(channel);
+    uint64_t position;
+    uint8_t* record;
+    while (nullptr == (record = static_cast<uint8_t*>(MessageRing_Reserve(ring, responseRingProducer, recordSize, &position))))
+    {
+        // The kernel is behind on responses, and will catch up without any more being sent
+        std::this_thread::yield();
+    }
+
+    memcpy(record, &response, sizeof(response));
+    memcpy(record + sizeof(response), messageIds, messageIdCount * sizeof(uint64_t));
+    if (MessageRing_Commit(ring, responseRingProducer, position, recordSize))
+    {
+        SharedMemoryNotification_Signal(channel.responsesAvailable);
+    }
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "KernelTransport.hpp"
+#include "../PrjFSKext/public/MessageRing.h"
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <thread>
+
+// Wakes the other side when a ring it is waiting on is written to. An eventfd on Linux and a pipe elsewhere.
+struct SharedMemoryNotification
+{
+    int readFd;
+    int writeFd;
+};
+
+void SharedMemoryNotification_Signal(const SharedMemoryNotification& notification);
+
+// Blocks until the notification has been signalled at least once since the last wait
+void SharedMemoryNotification_Wait(const SharedMemoryNotification& notification);
+
+// A response in the response ring, followed by messageIdCount message IDs
+struct SharedMemoryResponse
+{
+    uint32_t responseType;
+    uint32_t messageIdCount;
+};
+
+// Both ends of the connection between PrjFSLib and the kernel, or KernelSimulator standing in for it: a message
+// ring, a response ring and the registered virtualization root. Either ring can be written by any number of threads
+// at once, as the kext's message ring is. The memory is mapped shared and the fds are
+// inherited by child processes, so the two ends can also be in different processes.
+struct SharedMemoryChannel
+{
+    void* memory;
+    size_t memorySize;
+
+    SharedMemoryNotification messagesAvailable;
+    SharedMemoryNotification responsesAvailable;
+};
+
+struct SharedMemoryChannelHeader
+{
+    std::atomic<uint32_t> isVirtualizationRootRegistered;
+    char virtualizationRootPath[PrjFSMaxPath];
+
+    // Followed by the message ring, then the response ring, each 64 byte aligned
+};
+
+// Creates a channel whose rings have ringCapacity bytes each, which must be a power of two and at least twice a
+// message with the longest path or a full batch of responses. Returns 0 or an errno value.
+int SharedMemoryChannel_Create(uint32_t ringCapacity, SharedMemoryChannel* channel);
+void SharedMemoryChannel_Destroy(SharedMemoryChannel* channel);
+
+SharedMemoryChannelHeader* SharedMemoryChannel_GetHeader(const SharedMemoryChannel& channel);
+MessageRingHeader* SharedMemoryChannel_GetMessageRing(const SharedMemoryChannel& channel);
+MessageRingHeader* SharedMemoryChannel_GetResponseRing(const SharedMemoryChannel& channel);
+
+// PrjFSLib's end of a SharedMemoryChannel
+class SharedMemoryTransport : public KernelTransport
+{
+public:
+    explicit SharedMemoryTransport(const SharedMemoryChannel& channel);
+
+    // Stops handling messages; the channel is not destroyed
+    virtual ~SharedMemoryTransport() override;
+
+    virtual bool Start(MessageHandler handler) override;
+    virtual int RegisterVirtualizationRootPath(const char* path) override;
+    virtual int SendResponse(uint64_t messageId, MessageType responseType) override;
+    virtual int SendResponseBatch(const uint64_t* messageIds, uint32_t messageIdCount, MessageType responseType) override;
+
+private:
+    void HandleMessages(MessageHandler handler);
+
+    SharedMemoryChannel channel;
+    MessageRingProducer responseRingProducer;
+    std::thread messageThread;
+    std::atomic<bool> isStopping;
+};
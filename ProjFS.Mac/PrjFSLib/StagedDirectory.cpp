@@ -0,0 +1,165 @@
+#include "StagedDirectory.hpp"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+static int ReadChildNames(int directoryFd, std::vector<std::string>* names);
+static int RemoveChildren(int directoryFd);
+static int RemoveChild(int directoryFd, const char* name);
+
+int StagedDirectory_Create(const char* stagingPath)
+{
+    int error = StagedDirectory_Remove(stagingPath);
+    if (0 != error && ENOENT != error)
+    {
+        return error;
+    }
+
+    if (mkdir(stagingPath, 0777))
+    {
+        return errno;
+    }
+
+    return 0;
+}
+
+int StagedDirectory_MoveChildren(const char* stagingPath, const char* directoryPath)
+{
+    int stagingFd = open(stagingPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (stagingFd < 0)
+    {
+        return errno;
+    }
+
+    int directoryFd = open(directoryPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directoryFd < 0)
+    {
+        int error = errno;
+        close(stagingFd);
+        return error;
+    }
+
+    // The names are read up front, as it is unspecified which entries readdir returns once some have been
+    // renamed away
+    std::vector<std::string> names;
+    int error = ReadChildNames(stagingFd, &names);
+    for (size_t i = 0; 0 == error && i < names.size(); ++i)
+    {
+        const char* name = names[i].c_str();
+        if (renameat(stagingFd, name, directoryFd, name))
+        {
+            error = errno;
+            if (ENOTEMPTY == error || EEXIST == error)
+            {
+                // The existing directory has already been expanded, keep it
+                error = RemoveChild(stagingFd, name);
+            }
+        }
+    }
+
+    close(directoryFd);
+    close(stagingFd);
+
+    if (0 == error && rmdir(stagingPath))
+    {
+        error = errno;
+    }
+
+    return error;
+}
+
+int StagedDirectory_Remove(const char* stagingPath)
+{
+    int stagingFd = open(stagingPath, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (stagingFd < 0)
+    {
+        return errno;
+    }
+
+    int error = RemoveChildren(stagingFd);
+    close(stagingFd);
+
+    if (0 == error && rmdir(stagingPath))
+    {
+        error = errno;
+    }
+
+    return error;
+}
+
+static int ReadChildNames(int directoryFd, std::vector<std::string>* names)
+{
+    // fdopendir takes ownership of the fd it is given
+    int readFd = dup(directoryFd);
+    if (readFd < 0)
+    {
+        return errno;
+    }
+
+    DIR* directory = fdopendir(readFd);
+    if (nullptr == directory)
+    {
+        int error = errno;
+        close(readFd);
+        return error;
+    }
+
+    errno = 0;
+    while (dirent* entry = readdir(directory))
+    {
+        if (0 != strcmp(entry->d_name, ".") && 0 != strcmp(entry->d_name, ".."))
+        {
+            names->push_back(entry->d_name);
+        }
+    }
+
+    int error = errno;
+    closedir(directory);
+    return error;
+}
+
+static int RemoveChildren(int directoryFd)
+{
+    std::vector<std::string> names;
+    int error = ReadChildNames(directoryFd, &names);
+    for (size_t i = 0; 0 == error && i < names.size(); ++i)
+    {
+        error = RemoveChild(directoryFd, names[i].c_str());
+    }
+
+    return error;
+}
+
+static int RemoveChild(int directoryFd, const char* name)
+{
+    struct stat childAttributes;
+    if (fstatat(directoryFd, name, &childAttributes, AT_SYMLINK_NOFOLLOW))
+    {
+        return errno;
+    }
+
+    if (S_ISDIR(childAttributes.st_mode))
+    {
+        int childFd = openat(directoryFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (childFd < 0)
+        {
+            return errno;
+        }
+
+        int error = RemoveChildren(childFd);
+        close(childFd);
+        if (0 != error)
+        {
+            return error;
+        }
+
+        return unlinkat(directoryFd, name, AT_REMOVEDIR) ? errno : 0;
+    }
+
+    return unlinkat(directoryFd, name, 0) ? errno : 0;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// A staging directory holds the placeholders for the children of a directory being expanded, so that a provider
+// that fails or crashes part way through an enumeration never leaves some of them in the directory itself.
+// Functions return 0 on success or an errno value.
+
+// Prefix of the directory that PrjFSLib keeps its staging directories in, which is named after the virtualization root
+static const char StagedDirectory_NamePrefix[] = ".prjfs-staging.";
+
+// Creates an empty staging directory, first removing any left behind by an earlier expansion that did not finish
+int StagedDirectory_Create(const char* stagingPath);
+
+// Moves every child of the staging directory into directoryPath, then removes the staging directory. A child
+// replaces an existing file or empty directory of the same name, so a move that was interrupted can be redone
+// by staging the same children again; a directory that is no longer empty is kept as it is.
+int StagedDirectory_MoveChildren(const char* stagingPath, const char* directoryPath);
+
+// Removes the staging directory and everything in it
+int StagedDirectory_Remove(const char* stagingPath);
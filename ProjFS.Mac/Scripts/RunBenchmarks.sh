@@ -0,0 +1,54 @@
+#!/bin/bash
+
+# Builds and runs the PrjFSLib and PrjFSKext benchmarks. They only use portable code, so they also build and
+# run on Linux.
+
+SCRIPTDIR=$(dirname ${BASH_SOURCE[0]})
+SRCDIR=$SCRIPTDIR/../..
+ROOTDIR=$SRCDIR/..
+
+PRJFSLIB=$SRCDIR/ProjFS.Mac/PrjFSLib
+PRJFSKEXT=$SRCDIR/ProjFS.Mac/PrjFSKext
+OUTDIR=$ROOTDIR/BuildOutput/ProjFS.Mac/Benchmarks
+
+CXX=${CXX:-c++}
+# MAXCOMLEN comes from the BSD sys/param.h, which Linux does not have
+CXXFLAGS="-std=c++14 -O2 -pthread -I$SRCDIR/ProjFS.Mac -DMAXCOMLEN=16"
+
+mkdir -p $OUTDIR || exit 1
+
+$CXX $CXXFLAGS -o $OUTDIR/PendingRequestMapBenchmark $PRJFSLIB/Benchmarks/PendingRequestMapBenchmark.cpp $PRJFSLIB/PendingRequestMap.cpp || exit 1
+$OUTDIR/PendingRequestMapBenchmark || exit 1
+
+$CXX $CXXFLAGS -o $OUTDIR/MessageDispatchBenchmark $PRJFSLIB/Benchmarks/MessageDispatchBenchmark.cpp $PRJFSLIB/MessageBufferPool.cpp $PRJFSLIB/Message_User.cpp $PRJFSLIB/PendingRequestMap.cpp || exit 1
+$OUTDIR/MessageDispatchBenchmark || exit 1
+
+$CXX $CXXFLAGS -I$PRJFSKEXT/public -o $OUTDIR/OutstandingMessagesBenchmark $PRJFSKEXT/Benchmarks/OutstandingMessagesBenchmark.cpp || exit 1
+$OUTDIR/OutstandingMessagesBenchmark || exit 1
+
+$CXX $CXXFLAGS -I$PRJFSKEXT/public -o $OUTDIR/MessageRingBenchmark $PRJFSKEXT/Benchmarks/MessageRingBenchmark.cpp || exit 1
+$OUTDIR/MessageRingBenchmark || exit 1
+
+$CXX $CXXFLAGS -o $OUTDIR/RequestSchedulerBenchmark $PRJFSLIB/Benchmarks/RequestSchedulerBenchmark.cpp $PRJFSLIB/RequestScheduler.cpp || exit 1
+$OUTDIR/RequestSchedulerBenchmark || exit 1
+
+$CXX $CXXFLAGS -o $OUTDIR/HydrationWriteBenchmark $PRJFSLIB/Benchmarks/HydrationWriteBenchmark.cpp $PRJFSLIB/HydrationFile.cpp || exit 1
+$OUTDIR/HydrationWriteBenchmark || exit 1
+
+$CXX $CXXFLAGS -o $OUTDIR/PlaceholderBatchBenchmark $PRJFSLIB/Benchmarks/PlaceholderBatchBenchmark.cpp $PRJFSLIB/PlaceholderWriter.cpp || exit 1
+$OUTDIR/PlaceholderBatchBenchmark || exit 1
+
+$CXX $CXXFLAGS -o $OUTDIR/StagedExpansionBenchmark $PRJFSLIB/Benchmarks/StagedExpansionBenchmark.cpp $PRJFSLIB/PlaceholderWriter.cpp $PRJFSLIB/StagedDirectory.cpp || exit 1
+$OUTDIR/StagedExpansionBenchmark || exit 1
+
+$CXX $CXXFLAGS -o $OUTDIR/PlaceholderXAttrBenchmark $PRJFSLIB/Benchmarks/PlaceholderXAttrBenchmark.cpp $PRJFSLIB/PlaceholderXAttr.cpp || exit 1
+$OUTDIR/PlaceholderXAttrBenchmark || exit 1
+
+$CXX $CXXFLAGS -o $OUTDIR/PlaceholderUpdateBenchmark $PRJFSLIB/Benchmarks/PlaceholderUpdateBenchmark.cpp $PRJFSLIB/PlaceholderWriter.cpp $PRJFSLIB/PlaceholderXAttr.cpp $PRJFSLIB/StagedDirectory.cpp || exit 1
+$OUTDIR/PlaceholderUpdateBenchmark || exit 1
+
+$CXX $CXXFLAGS -o $OUTDIR/FileStateScanBenchmark $PRJFSLIB/Benchmarks/FileStateScanBenchmark.cpp $PRJFSLIB/FileStateScanner.cpp $PRJFSLIB/PlaceholderWriter.cpp $PRJFSLIB/PlaceholderXAttr.cpp $PRJFSLIB/StagedDirectory.cpp || exit 1
+$OUTDIR/FileStateScanBenchmark || exit 1
+
+$CXX $CXXFLAGS -I$PRJFSKEXT/public -o $OUTDIR/ProviderSimulationBenchmark $PRJFSLIB/Benchmarks/ProviderSimulationBenchmark.cpp $PRJFSLIB/KernelSimulator/KernelSimulator.cpp $PRJFSLIB/SharedMemoryTransport.cpp $PRJFSLIB/PrjFSLib.cpp $PRJFSLIB/Message_User.cpp $PRJFSLIB/PendingRequestMap.cpp $PRJFSLIB/MessageBufferPool.cpp $PRJFSLIB/RequestScheduler.cpp $PRJFSLIB/HydrationFile.cpp $PRJFSLIB/PlaceholderWriter.cpp $PRJFSLIB/StagedDirectory.cpp $PRJFSLIB/PlaceholderXAttr.cpp $PRJFSLIB/FileStateScanner.cpp || exit 1
+$OUTDIR/ProviderSimulationBenchmark || exit 1
@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# Builds and runs the benchmarks for the native hooks. They only use portable code, so they also build and run
+# on Linux.
+
+SCRIPTDIR=$(dirname ${BASH_SOURCE[0]})
+SRCDIR=$SCRIPTDIR/../..
+ROOTDIR=$SRCDIR/..
+
+HOOKSCOMMON=$SRCDIR/GVFS/GVFS.NativeHooks.Common
+READOBJECTHOOK=$SRCDIR/GVFS/GVFS.ReadObjectHook
+OUTDIR=$ROOTDIR/BuildOutput/GVFS.NativeHooks/Benchmarks
+
+CXX=${CXX:-c++}
+CXXFLAGS="-std=c++14 -O2 -pthread -I$HOOKSCOMMON"
+
+mkdir -p $OUTDIR || exit 1
+
+$CXX $CXXFLAGS -o $OUTDIR/LocalObjectsBenchmark $READOBJECTHOOK/Benchmarks/LocalObjectsBenchmark.cpp $READOBJECTHOOK/localobjects.cpp || exit 1
+$OUTDIR/LocalObjectsBenchmark || exit 1
+
+# packet.cpp expects the hook that includes it to provide stdafx.h
+$CXX $CXXFLAGS -I$READOBJECTHOOK -o $OUTDIR/PacketBenchmark $HOOKSCOMMON/Benchmarks/PacketBenchmark.cpp $HOOKSCOMMON/packet.cpp || exit 1
+$OUTDIR/PacketBenchmark || exit 1
+
+$CXX $CXXFLAGS -I$READOBJECTHOOK -o $OUTDIR/EnlistmentRootBenchmark $HOOKSCOMMON/Benchmarks/EnlistmentRootBenchmark.cpp $HOOKSCOMMON/common.mac.cpp || exit 1
+$OUTDIR/EnlistmentRootBenchmark || exit 1
+
+$CXX $CXXFLAGS -I$READOBJECTHOOK -o $OUTDIR/read-object $READOBJECTHOOK/main.cpp $READOBJECTHOOK/localobjects.cpp $HOOKSCOMMON/common.mac.cpp $HOOKSCOMMON/multiplexedpipe.cpp $HOOKSCOMMON/packet.cpp || exit 1
+$CXX $CXXFLAGS -o $OUTDIR/MultiplexedDownloadBenchmark $READOBJECTHOOK/Benchmarks/MultiplexedDownloadBenchmark.cpp || exit 1
+$OUTDIR/MultiplexedDownloadBenchmark $OUTDIR/read-object || exit 1